@@ -369,6 +369,7 @@ int fi_rma_initiate_allowed(uint64_t caps);
 int fi_rma_target_allowed(uint64_t caps);
 
 uint64_t fi_gettime_ms(void);
+uint64_t fi_gettime_us(void);
 int fi_fd_nonblock(int fd);
 
 #define RDMA_CONF_DIR  SYSCONFDIR "/" RDMADIR
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2015 Intel Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#if !defined(FI_EPOLL_H)
+#define FI_EPOLL_H
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <rdma/fi_errno.h>
+
+/*
+ * Persistent readiness set.  Uses epoll where available and falls back
+ * to a poll() array elsewhere.  The fallback is always level-triggered;
+ * callers that register with FI_EPOLL_ET must therefore tolerate being
+ * told about an fd more than once.
+ */
+
+#if HAVE_EPOLL
+
+#include <sys/epoll.h>
+
+#define FI_EPOLL_IN	EPOLLIN
+#define FI_EPOLL_OUT	EPOLLOUT
+#define FI_EPOLL_ET	EPOLLET
+
+typedef int fi_epoll_t;
+
+static inline int fi_epoll_create(fi_epoll_t *ep)
+{
+	*ep = epoll_create(4);
+	return (*ep < 0) ? -errno : 0;
+}
+
+static inline int fi_epoll_add(fi_epoll_t ep, int fd, uint32_t events,
+			       void *context)
+{
+	struct epoll_event event;
+
+	event.data.ptr = context;
+	event.events = events;
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &event) && errno != EEXIST)
+		return -errno;
+	return 0;
+}
+
+static inline int fi_epoll_del(fi_epoll_t ep, int fd)
+{
+	return epoll_ctl(ep, EPOLL_CTL_DEL, fd, NULL) ? -errno : 0;
+}
+
+static inline int fi_epoll_wait(fi_epoll_t ep, void **contexts, int max,
+				int timeout)
+{
+	struct epoll_event events[max];
+	int i, ret;
+
+	ret = epoll_wait(ep, events, max, timeout);
+	if (ret < 0)
+		return (errno == EINTR) ? 0 : -errno;
+
+	for (i = 0; i < ret; i++)
+		contexts[i] = events[i].data.ptr;
+	return ret;
+}
+
+static inline void fi_epoll_close(fi_epoll_t ep)
+{
+	close(ep);
+}
+
+#else
+
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+
+#define FI_EPOLL_IN	POLLIN
+#define FI_EPOLL_OUT	POLLOUT
+#define FI_EPOLL_ET	0
+
+struct fi_epoll {
+	int		size;
+	int		nfds;
+	int		index;
+	struct pollfd	*fds;
+	void		**context;
+	pthread_mutex_t	lock;
+};
+
+typedef struct fi_epoll *fi_epoll_t;
+
+static inline int fi_epoll_create(fi_epoll_t *ep)
+{
+	*ep = calloc(1, sizeof(struct fi_epoll));
+	if (!*ep)
+		return -FI_ENOMEM;
+
+	pthread_mutex_init(&(*ep)->lock, NULL);
+	return 0;
+}
+
+static inline int fi_epoll_add(fi_epoll_t ep, int fd, uint32_t events,
+			       void *context)
+{
+	struct pollfd *fds;
+	void **ctxs;
+	int size, ret = 0;
+
+	pthread_mutex_lock(&ep->lock);
+	if (ep->nfds == ep->size) {
+		size = ep->size ? ep->size * 2 : 64;
+		fds = realloc(ep->fds, size * sizeof(*ep->fds));
+		if (!fds) {
+			ret = -FI_ENOMEM;
+			goto out;
+		}
+		ep->fds = fds;
+
+		ctxs = realloc(ep->context, size * sizeof(*ep->context));
+		if (!ctxs) {
+			ret = -FI_ENOMEM;
+			goto out;
+		}
+		ep->context = ctxs;
+		ep->size = size;
+	}
+
+	ep->fds[ep->nfds].fd = fd;
+	ep->fds[ep->nfds].events = (short) events;
+	ep->fds[ep->nfds].revents = 0;
+	ep->context[ep->nfds++] = context;
+out:
+	pthread_mutex_unlock(&ep->lock);
+	return ret;
+}
+
+static inline int fi_epoll_del(fi_epoll_t ep, int fd)
+{
+	int i, ret = -FI_EINVAL;
+
+	pthread_mutex_lock(&ep->lock);
+	for (i = 0; i < ep->nfds; i++) {
+		if (ep->fds[i].fd == fd) {
+			ep->nfds--;
+			ep->fds[i] = ep->fds[ep->nfds];
+			ep->context[i] = ep->context[ep->nfds];
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ep->lock);
+	return ret;
+}
+
+/*
+ * The set is snapshotted so that fds may be added or removed by other
+ * threads while a caller is blocked in poll().
+ */
+static inline int fi_epoll_wait(fi_epoll_t ep, void **contexts, int max,
+				int timeout)
+{
+	struct pollfd *fds;
+	void **ctxs;
+	int i, nfds, found = 0, ret;
+
+	pthread_mutex_lock(&ep->lock);
+	nfds = ep->nfds;
+	fds = malloc(nfds * (sizeof(*fds) + sizeof(*ctxs)) + 1);
+	if (!fds) {
+		pthread_mutex_unlock(&ep->lock);
+		return -FI_ENOMEM;
+	}
+	ctxs = (void **) (fds + nfds);
+	memcpy(fds, ep->fds, nfds * sizeof(*fds));
+	memcpy(ctxs, ep->context, nfds * sizeof(*ctxs));
+	pthread_mutex_unlock(&ep->lock);
+
+	ret = poll(fds, nfds, timeout);
+	if (ret <= 0) {
+		ret = (ret < 0 && errno != EINTR) ? -errno : 0;
+		goto out;
+	}
+
+	/* rotate the starting point so that no fd is starved */
+	for (i = 0; i < nfds && found < max; i++) {
+		if (ep->index >= nfds)
+			ep->index = 0;
+		if (fds[ep->index].revents)
+			contexts[found++] = ctxs[ep->index];
+		ep->index++;
+	}
+	ret = found;
+out:
+	free(fds);
+	return ret;
+}
+
+static inline void fi_epoll_close(fi_epoll_t ep)
+{
+	pthread_mutex_destroy(&ep->lock);
+	free(ep->fds);
+	free(ep->context);
+	free(ep);
+}
+
+#endif /* HAVE_EPOLL */
+
+#endif /* FI_EPOLL_H */
@@ -32,6 +32,12 @@ AC_DEFUN([FI_SOCKETS_CONFIGURE],[
 				[],
 				[sockets_shm_happy=1],
 				[sockets_shm_happy=0])])
+
+	       # cross-memory attach for same-host RMA
+	       AC_CHECK_FUNCS([process_vm_writev])
+
+	       # batched datagram I/O
+	       AC_CHECK_FUNCS([sendmmsg recvmmsg])
 	      ])
 
 	AS_IF([test $sockets_h_happy -eq 1 && \
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2015 Intel Corporation, Inc.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _FI_EXT_SOCKETS_H_
+#define _FI_EXT_SOCKETS_H_
+
+/*
+ * See the fi_sockets.7 man page for information about the sockets
+ * provider extensions provided in this header.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <rdma/fabric.h>
+
+/* fi_control() commands and fi_getopt() options of the sockets provider */
+#define FI_SOCKETS_OPS_BASE (FI_PROV_SPECIFIC | (0x50c << 16))
+
+/*
+ * fi_getopt(FI_OPT_ENDPOINT) on an endpoint or rx context: fetch
+ * struct fi_sockets_buffered_recv_stats
+ */
+#define FI_SOCKETS_OPT_BUFFERED_RECV_STATS (FI_SOCKETS_OPS_BASE + 0)
+
+struct fi_sockets_buffered_recv_stats {
+	size_t limit;
+	size_t used;
+	size_t entries;
+	size_t pooled;
+	size_t cached;
+};
+
+/* fi_control() on a domain: fetch struct fi_sockets_mr_cache_stats */
+#define FI_SOCKETS_DOM_MR_CACHE_STATS (FI_SOCKETS_OPS_BASE + 1)
+
+struct fi_sockets_mr_cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	size_t cached;
+	size_t idle;
+};
+
+/*
+ * fi_control() on an AV: connect to every address in it and fetch
+ * struct fi_sockets_av_conn_status.  Returns -FI_EAGAIN while any connect
+ * is still pending, so it can be polled until the AV is fully wired up.
+ * Connections closed by the connection cache count as closed; they are
+ * reopened by the next transfer to that peer.
+ */
+#define FI_SOCKETS_AV_CONN_STATUS (FI_SOCKETS_OPS_BASE + 2)
+
+struct fi_sockets_av_conn_status {
+	size_t connected;
+	size_t pending;
+	size_t failed;
+	size_t closed;
+};
+
+/* how an FI_PROGRESS_AUTO progress thread waits for work */
+enum {
+	FI_SOCKETS_PE_PROFILE_LATENCY,
+	FI_SOCKETS_PE_PROFILE_CPU,
+};
+
+/* fi_control() on a domain: get or set the progress profile (int) */
+#define FI_SOCKETS_DOM_GET_PE_PROFILE (FI_SOCKETS_OPS_BASE + 3)
+#define FI_SOCKETS_DOM_SET_PE_PROFILE (FI_SOCKETS_OPS_BASE + 4)
+
+/*
+ * fi_control() on a domain: fetch struct fi_sockets_pe_stats summed over
+ * its progress threads
+ */
+#define FI_SOCKETS_DOM_PE_STATS (FI_SOCKETS_OPS_BASE + 5)
+
+/* microseconds spent by a progress thread in each state */
+struct fi_sockets_pe_stats {
+	uint64_t busy;
+	uint64_t spin;
+	uint64_t backoff;
+	uint64_t blocked;
+	uint64_t num_blocks;
+};
+
+#endif /* _FI_EXT_SOCKETS_H_ */
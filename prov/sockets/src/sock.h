@@ -53,7 +53,11 @@
 #include <fi_enosys.h>
 #include <fi_indexer.h>
 #include <fi_rbuf.h>
+#include <fi_epoll.h>
 #include <fi_list.h>
+#include <fi_signal.h>
+
+#include "fi_ext_sockets.h"
 
 #ifndef _SOCK_H_
 #define _SOCK_H_
@@ -61,6 +65,13 @@
 #define SOCK_EP_MAX_MSG_SZ (1<<23)
 #define SOCK_EP_MAX_INJECT_SZ ((1<<8) - 1)
 #define SOCK_EP_MAX_BUFF_RECV (1<<26)
+#define SOCK_MR_INDEX_BITS (24)
+#define SOCK_MR_CHUNK_BITS (12)
+#define SOCK_MR_MAX_INDEX ((1 << SOCK_MR_INDEX_BITS) - 1)
+#define SOCK_MR_SCALABLE_KEY_SIZE ((SOCK_MR_INDEX_BITS + 7) / 8)
+#define SOCK_MR_CHUNK_SZ (1 << SOCK_MR_CHUNK_BITS)
+#define SOCK_MR_NUM_CHUNKS (1 << (SOCK_MR_INDEX_BITS - SOCK_MR_CHUNK_BITS))
+#define SOCK_MR_GEN_MASK ((1ULL << (64 - SOCK_MR_INDEX_BITS)) - 1)
 #define SOCK_EP_MAX_ORDER_RAW_SZ SOCK_EP_MAX_MSG_SZ
 #define SOCK_EP_MAX_ORDER_WAR_SZ SOCK_EP_MAX_MSG_SZ
 #define SOCK_EP_MAX_ORDER_WAW_SZ SOCK_EP_MAX_MSG_SZ
@@ -72,17 +83,32 @@
 #define SOCK_EP_MAX_IOV_LIMIT (8)
 #define SOCK_EP_TX_SZ (256)
 #define SOCK_EP_RX_SZ (256)
+#define SOCK_RX_HASH_MIN_SZ (64)
+#define SOCK_RX_HASH_MAX_SZ (1 << 14)
+#define SOCK_RX_BUF_MIN_SHIFT (6)
+#define SOCK_RX_BUF_CLASSES (11)
+#define SOCK_RX_BUF_SLAB_SZ (1 << 18)
 #define SOCK_EP_TX_ENTRY_SZ (256)
+#define SOCK_TX_SLOT_SZ (64)
 #define SOCK_EP_RX_ENTRY_SZ (256)
 #define SOCK_EP_MIN_MULTI_RECV (64)
 #define SOCK_EP_MAX_ATOMIC_SZ (256)
+#define SOCK_EP_MAX_ATOMIC_MSG_SZ (1 << 20)
 #define SOCK_EP_MAX_CTX_BITS (16)
 #define SOCK_EP_MSG_PREFIX_SZ (0)
 
 #define SOCK_PE_POLL_TIMEOUT (100000)
-#define SOCK_PE_MAX_ENTRIES (128)
+#define SOCK_PE_SLAB_ENTRIES (128)
+#define SOCK_PE_DEF_MAX_ENTRIES (1024)
+#define SOCK_PE_MAX_ENTRIES (1 << 16)
 #define SOCK_PE_MIN_ENTRIES (1)
 #define SOCK_PE_WAITTIME (10)
+#define SOCK_PE_CPU_SPIN_BUDGET (50)
+#define SOCK_PE_LATENCY_BACKOFF_MAX (64)
+#define SOCK_PE_CPU_BACKOFF_MAX (1000)
+#define SOCK_PE_THREADS (1)
+#define SOCK_PE_MAX_THREADS (64)
+#define SOCK_EPOLL_WAIT_SZ (64)
 
 #define SOCK_EQ_DEF_SZ (1<<8)
 #define SOCK_CQ_DEF_SZ (1<<8)
@@ -91,6 +117,9 @@
 
 #define SOCK_CQ_DATA_SIZE (sizeof(uint64_t))
 #define SOCK_TAG_SIZE (sizeof(uint64_t))
+#define SOCK_CNTR_TRIGGER_HEAP_SZ (64)
+#define SOCK_CNTR_TRIGGER_BLOCKED (16)
+#define SOCK_WAIT_PROGRESS_MS (1)
 
 #define SOCK_PEP_LISTENER_TIMEOUT (10000)
 #define SOCK_CM_COMM_TIMEOUT (2000)
@@ -98,6 +127,8 @@
 #define SOCK_EP_MAX_CM_DATA_SZ (256)
 #define SOCK_CM_DEF_BACKLOG (128)
 #define SOCK_CM_DEF_RETRY (5)
+#define SOCK_CM_DEF_INFLIGHT (64)
+#define SOCK_CM_EVICT_INTERVAL (100)
 
 #define SOCK_EP_RDM_PRI_CAP (FI_MSG | FI_RMA | FI_TAGGED | FI_ATOMICS |	\
 			 FI_NAMED_RX_CTX | \
@@ -143,9 +174,26 @@
 #define SOCK_MODE (0)
 #define SOCK_NO_COMPLETION (1ULL << 60)
 #define SOCK_USE_OP_FLAGS (1ULL << 61)
+#define SOCK_RNDV (1ULL << 62)
+#define SOCK_CMA (1ULL << 63)
 
 #define SOCK_COMM_BUF_SZ (1<<20)
+#define SOCK_COMM_BUF_MIN_SZ (1<<16)
+#define SOCK_COMM_BUF_CLASSES (5)
+#define SOCK_COMM_POOL_SZ (1<<24)
+#define SOCK_COMM_POOL_RESERVE (4)
+#define SOCK_COMM_TRIM_INTERVAL (1000)
 #define SOCK_COMM_THRESHOLD (128 * 1024)
+#define SOCK_COMM_RX_BATCH (32)
+#define SOCK_SHM_RING_SZ (1<<18)
+#define SOCK_SHM_NAME_LEN (32)
+#define SOCK_BOOT_ID_LEN (40)
+#define SOCK_CMA_THRESHOLD (1<<16)
+#define SOCK_CACHE_LINE_SZ (64)
+#define SOCK_DGRAM_BATCH (16)
+#define SOCK_DGRAM_BUF_SZ (1<<16)
+#define SOCK_DGRAM_HDR_MAX_SZ (40)
+#define SOCK_DGRAM_MAX_MSG_SZ (65507 - SOCK_DGRAM_HDR_MAX_SZ)
 
 enum {
 	SOCK_SIGNAL_RD_FD = 0,
@@ -155,13 +203,38 @@ enum {
 #define SOCK_MAJOR_VERSION 1
 #define SOCK_MINOR_VERSION 0
 
-#define SOCK_WIRE_PROTO_VERSION (0)
+#define SOCK_WIRE_PROTO_VERSION (1)
 
 struct sock_service_entry {
 	int service;
 	struct dlist_entry entry;
 };
 
+struct sock_cm_handler;
+typedef void (*sock_cm_event_fn)(struct sock_cm_handler *handler);
+typedef int (*sock_cm_timer_fn)(struct sock_cm_handler *handler);
+
+struct sock_cm_handler {
+	int fd;
+	uint32_t events;	/* FI_EPOLL_IN when 0 */
+	struct sock_cm_loop *loop;
+	sock_cm_event_fn handle;
+	sock_cm_timer_fn timer;
+	struct dlist_entry timer_entry;
+};
+
+struct sock_cm_loop {
+	fi_epoll_t epoll_set;
+	int signal_fds[2];
+	int do_progress;
+	int started;
+	pthread_t thread;
+	fastlock_t lock;
+	int num_handlers;
+	struct sock_cm_handler **handlers;
+	struct dlist_entry timer_list;
+};
+
 struct sock_fabric {
 	struct fid_fabric fab_fid;
 	atomic_t ref;
@@ -171,27 +244,165 @@ struct sock_fabric {
 	struct dlist_entry service_list;
 	struct dlist_entry fab_list_entry;
 	fastlock_t lock;
+	struct sock_cm_loop cm_loop;
+};
+
+/* a pid is only meaningful to peers on the same kernel and pid namespace */
+struct sock_host_id {
+	uint64_t pid_ns;
+	char boot_id[SOCK_BOOT_ID_LEN];
+};
+
+struct sock_conn_hello {
+	uint16_t port;
+	uint8_t version;
+	uint8_t reserved;
+	int32_t pid;
+	struct sock_host_id host;
+	char shm_name[SOCK_SHM_NAME_LEN];
+};
+
+struct sock_conn_hello_resp {
+	uint8_t use_conn;
+	uint8_t use_shm;
+	uint8_t version;
+	uint8_t reserved;
+	int32_t pid;
+	struct sock_host_id host;
+};
+
+enum {
+	SOCK_CONN_STATE_CONNECTED,
+	SOCK_CONN_STATE_QUEUED,
+	SOCK_CONN_STATE_CONNECTING,
+	SOCK_CONN_STATE_HELLO,
+	SOCK_CONN_STATE_WAIT_ACCEPT,
+	SOCK_CONN_STATE_ACCEPTING,
+	SOCK_CONN_STATE_FAILED,
+	SOCK_CONN_STATE_CLOSING,
+	SOCK_CONN_STATE_CLOSED,
+};
+
+/* close handshake events, handled by sock_conn_map_evict */
+#define SOCK_CONN_CLOSE_REQ (1 << 0)
+#define SOCK_CONN_CLOSE_NACK (1 << 1)
+#define SOCK_CONN_EOF (1 << 2)
+
+/*
+ * Comm ring buffers shared by the connections of a progress engine, one
+ * free list per power of two size from SOCK_COMM_BUF_MIN_SZ up to
+ * SOCK_COMM_BUF_SZ.
+ */
+struct sock_comm_pool {
+	fastlock_t lock;
+	struct slist free_list[SOCK_COMM_BUF_CLASSES];
+	size_t num_free[SOCK_COMM_BUF_CLASSES];
+	size_t cached;
 };
 
 struct sock_conn {
         int sock_fd;
         int disconnected;
+        uint16_t key;
         struct sockaddr_in addr;
         struct sock_pe_entry *rx_pe_entry;
         struct sock_pe_entry *tx_pe_entry;
 	struct ringbuf inbuf;
 	struct ringbuf outbuf;
+	size_t inbuf_hwm;
+	size_t outbuf_hwm;
+	struct sock_comm_pool *comm_pool;
 	struct sock_ep *ep;
 	fi_addr_t av_index;
 	struct dlist_entry ep_entry;
+	struct dlist_entry ready_entry;
+	int rx_ready;
+	struct sock_shm *shm;
+
+	/* wire-up, driven by the progress engine */
+	int state;
+	int retry;
+	size_t hello_len;
+	struct sock_conn_hello hello;
+	struct sock_conn_hello_resp resp;
+	struct sock_shm *hello_shm;
+
+	/* connection cache */
+	struct dlist_entry open_entry;
+	int pe_refs;
+	uint64_t lru;
+	uint64_t idle_lru;
+	uint64_t idle_since;
+	int events;
+	struct dlist_entry event_entry;
+	int accept_fd;
+	struct sock_shm *accept_shm;
+};
+
+struct sock_addr_hash_entry {
+	uint32_t ip;
+	uint16_t port;
+	uint16_t in_use;
+	uint64_t value;
+};
+
+struct sock_addr_hash {
+	struct sock_addr_hash_entry *table;
+	size_t size;
+	size_t used;
 };
 
+/* conns are allocated one by one; list nodes inside them must not move */
 struct sock_conn_map {
-        struct sock_conn *table;
+        struct sock_conn **table;
         int used;
         int size;
+	struct sock_addr_hash addr_hash;
 	struct sock_domain *domain;
 	fastlock_t lock;
+
+	/* keys of background connects, queued or in flight */
+	uint16_t *connect_keys;
+	int connect_cnt;
+	int connect_size;
+
+	/* open connections, bounded by sock_conn_cache_size */
+	struct dlist_entry open_list;
+	int open_cnt;
+	uint64_t lru_tick;
+	uint64_t evict_time;
+	uint64_t trim_time;
+	struct dlist_entry event_list;
+
+	struct sock_comm_pool comm_pool;
+};
+
+/*
+ * MR keys are (generation << SOCK_MR_INDEX_BITS | index).  Provider chosen
+ * keys come off a free list of slots and bump the slot generation on
+ * release, so a stale key no longer resolves once its slot is reused.
+ */
+struct sock_mr_slot {
+	struct sock_mr *mr;
+	uint64_t gen;
+	uint32_t next_free;
+};
+
+struct sock_mr_table {
+	struct sock_mr_slot **chunks;
+	int num_chunks;
+	uint32_t free_head;
+};
+
+/*
+ * Cached regions never overlap, so a search tree ordered on the range
+ * with overlapping ranges comparing equal answers interval queries.
+ */
+struct sock_mr_cache {
+	void *root;
+	struct dlist_entry lru_list;
+	size_t max_idle;
+	struct fi_sockets_mr_cache_stats stats;
 };
 
 struct sock_domain {
@@ -205,9 +416,17 @@ struct sock_domain {
 	struct sock_eq *mr_eq;
 
 	enum fi_progress progress_mode;
-	struct index_map mr_idm;
-	struct sock_pe *pe;
-	struct sock_conn_map r_cmap;
+	int pe_profile;
+	int pe_spin_budget;
+	int pe_backoff_max;
+	struct sock_mr_table mr_table;
+	struct sock_mr_cache mr_cache;
+	struct sock_pe **pe;
+	int num_pe;
+	atomic_t pe_next;
+
+	/* serializes remote atomic updates across all PEs */
+	fastlock_t atomic_lock;
 	struct dlist_entry dom_list_entry;
 	struct fi_domain_attr attr;
 };
@@ -215,6 +434,7 @@ struct sock_domain {
 struct sock_trigger {
 	uint8_t op_type;
 	size_t threshold;
+	uint64_t seq;
 	struct dlist_entry entry;
 
 	struct fid_ep	*ep;
@@ -249,11 +469,45 @@ struct sock_trigger {
 	} op;
 };
 
+/* poll and wait sets an object belongs to */
+struct sock_poll_list {
+	fastlock_t lock;
+	struct dlist_entry list;
+};
+
+struct sock_poll_set {
+	fastlock_t member_lock;
+	struct dlist_entry member_list;
+	int num_manual;
+
+	fastlock_t lock;
+	struct dlist_entry ready_list;
+	int num_ready;
+};
+
+struct sock_poll_member {
+	struct dlist_entry entry;
+	struct dlist_entry obj_entry;
+	struct dlist_entry ready_entry;
+	struct fid *fid;
+	struct sock_poll_set *set;
+	struct sock_poll_list *obj;
+	atomic_t ready;
+	int manual;
+};
+
+struct sock_cntr_waiter {
+	uint64_t threshold;
+	struct dlist_entry entry;
+};
+
 struct sock_cntr {
 	struct fid_cntr cntr_fid;
 	struct sock_domain *domain;
 	atomic_t value;
 	atomic_t threshold;
+	atomic_t num_waiters;
+	struct dlist_entry waiter_list;
 	atomic_t ref;
 	atomic_t err_cnt;
 	pthread_cond_t 	cond;
@@ -265,12 +519,17 @@ struct sock_cntr {
 	fastlock_t list_lock;
 
 	fastlock_t trigger_lock;
-	struct dlist_entry trigger_list;
+	struct sock_trigger **trigger_heap;
+	size_t num_triggers;
+	size_t trigger_heap_sz;
+	uint64_t trigger_seq;
+	struct dlist_entry trigger_ready;
+	atomic_t num_pending;
 
 	struct fid_wait *waitset;
 	int signal;
-	int is_waiting;
 	int err_flag;
+	struct sock_poll_list poll_list;
 };
 
 struct sock_mr {
@@ -283,6 +542,13 @@ struct sock_mr {
 	size_t iov_count;
 	struct sock_cntr *cntr;
 	struct sock_cq *cq;
+
+	struct sock_mr *region;
+	int cache_ref;
+	int cached;
+	uintptr_t range[2];
+	struct dlist_entry lru_entry;
+
 	struct iovec mr_iov[1];
 };
 
@@ -307,13 +573,16 @@ struct sock_av {
 	int rx_ctx_bits;
 	struct index_map addr_idm;
 	socklen_t addrlen;
-	struct sock_conn_map *cmap;
 	struct sock_eq *eq;
 	struct sock_av_table_hdr *table_hdr;
 	struct sock_av_addr *table;
 	uint16_t *key;
 	char *name;
 	int shared_fd;
+	struct sock_addr_hash addr_hash;
+	uint64_t hashed;
+	struct dlist_entry ep_list;
+	fastlock_t lock;
 };
 
 struct sock_fid_list {
@@ -324,13 +593,14 @@ struct sock_fid_list {
 struct sock_poll {
 	struct fid_poll poll_fid;
 	struct sock_domain *domain;
-	struct dlist_entry fid_list;
+	struct sock_poll_set pset;
 };
 
 struct sock_wait {
 	struct fid_wait wait_fid;
 	struct sock_fabric *fab;
-	struct dlist_entry fid_list;
+	struct sock_poll_set pset;
+	atomic_t signaled;
 	enum fi_wait_obj type;
 	union {
 		int fd[2];
@@ -359,6 +629,11 @@ enum {
 	SOCK_OP_ATOMIC_COMPLETE = 10,
 	SOCK_OP_ATOMIC_ERROR = 11,
 
+	SOCK_OP_RNDV_READ = 12,
+
+	SOCK_OP_CONN_CLOSE = 13,
+	SOCK_OP_CONN_CLOSE_NACK = 14,
+
 	/* internal */
 	SOCK_OP_RECV,
 	SOCK_OP_TRECV,
@@ -440,6 +715,7 @@ struct sock_eq {
 	int signal;
 	int wait_fd;
 	char service[NI_MAXSERV];
+	struct sock_poll_list poll_list;
 };
 
 struct sock_comp {
@@ -463,20 +739,32 @@ struct sock_comp {
 struct sock_cm_entry {
 	int sock;
 	int do_listen;
-	int signal_fds[2];
 	uint64_t next_msg_id;
 	fastlock_t lock;
 	int shutdown_received;
-	pthread_t listener_thread;
+	struct sock_cm_handler handler;
 	struct dlist_entry msg_list;
 };
 
+/* an accepted connection waiting for its hello, then for our response */
+struct sock_conn_accept {
+	struct sock_cm_handler handler;
+	struct sock_ep *ep;
+	struct sockaddr_in remote;
+	size_t len;
+	struct sock_conn_hello hello;
+	struct sock_conn_hello_resp resp;
+	size_t sent;
+	uint16_t key;
+	struct sock_shm *shm;
+	struct dlist_entry entry;
+};
+
 struct sock_conn_listener {
 	int sock;
 	int do_listen;
-	int is_ready;
-	int signal_fds[2];
-	pthread_t listener_thread;
+	struct sock_cm_handler handler;
+	struct dlist_entry accept_list;
 	char service[NI_MAXSERV];
 };
 
@@ -497,6 +785,7 @@ struct sock_ep {
 	struct sock_eq *eq;
 	struct sock_av *av;
 	struct sock_domain *domain;	
+	struct sock_pe *pe;
 
 	struct sock_rx_ctx *rx_ctx;
 	struct sock_tx_ctx *tx_ctx;
@@ -508,6 +797,7 @@ struct sock_ep {
 
 	struct dlist_entry rx_ctx_entry;
 	struct dlist_entry tx_ctx_entry;
+	struct dlist_entry av_entry;
 
 	struct fi_info info;
 	struct fi_ep_attr ep_attr;
@@ -525,6 +815,9 @@ struct sock_ep {
 	struct sock_cm_entry cm;
 	struct sock_conn_listener listener;
 	struct dlist_entry conn_list;
+	struct dlist_entry ready_list;
+	fi_epoll_t conn_epoll;
+	struct sock_dgram *dgram;
 	fastlock_t lock;
 };
 
@@ -546,7 +839,9 @@ struct sock_rx_entry {
 	uint8_t is_complete;
 	uint8_t is_tagged;
 	uint8_t is_pool_entry;
-	uint8_t reserved[2];
+	uint8_t buf_class;
+	uint8_t is_rndv;
+	uint8_t is_exhausted;
 
 	uint64_t used;
 	uint64_t total_len;
@@ -557,14 +852,32 @@ struct sock_rx_entry {
 	uint64_t data;
 	uint64_t tag;
 	uint64_t ignore;
+	uint64_t seq;
+	uint64_t src_key;
 	struct sock_comp *comp;
-	
+
+	/* rendezvous send waiting to be pulled from the peer */
+	uint64_t rndv_id;
+	uint64_t rndv_len;
+	struct sock_conn *rndv_conn;
+	struct sock_ep *rndv_ep;
+	struct sock_rx_entry *rndv_posted;
+	int rndv_refs;
+	int rndv_err;
+
 	union sock_iov iov[SOCK_EP_MAX_IOV_LIMIT];
 	struct dlist_entry entry;
+	struct dlist_entry match_entry;
 	struct slist_entry pool_entry;
 	struct sock_rx_ctx *rx_ctx;
 };
 
+struct sock_rx_buf_pool {
+	struct slist free_list;
+	size_t num_free;
+	size_t num_used;
+};
+
 struct sock_rx_ctx {
 	struct fid_ep ctx;
 
@@ -584,6 +897,7 @@ struct sock_rx_ctx {
 	struct sock_av *av;
 	struct sock_eq *eq;
  	struct sock_domain *domain;
+	struct sock_pe *pe;
 
 	struct dlist_entry pe_entry;
 	struct dlist_entry cq_entry;
@@ -592,12 +906,114 @@ struct sock_rx_ctx {
 	struct dlist_entry pe_entry_list;
 	struct dlist_entry rx_entry_list;
 	struct dlist_entry rx_buffered_list;
+	struct dlist_entry *rx_buffered_hash;
+	struct dlist_entry rx_rndv_list;
+	struct dlist_entry *rx_match_hash;
+	struct dlist_entry rx_wild_list;
+	uint32_t rx_match_mask;
+	uint64_t rx_seq;
+	uint64_t rx_match_seq;
 	struct dlist_entry ep_list;
 	fastlock_t lock;
 
 	struct fi_rx_attr attr;
 	struct sock_rx_entry *rx_entry_pool;
 	struct slist pool_list;
+
+	struct sock_rx_buf_pool buf_pool[SOCK_RX_BUF_CLASSES];
+	struct slist buf_slab_list;
+	size_t buf_slab_len;
+	size_t buffered_cnt;
+	size_t rndv_pending;
+	size_t rndv_active;
+};
+
+/*
+ * Sequence counters used by the lock-free rings.  Without C11 atomics the
+ * rings are protected by a lock and these become plain loads and stores.
+ */
+#ifdef HAVE_ATOMICS
+typedef atomic_size_t sock_seq_t;
+#define sock_seq_init(seq, v)	atomic_init(seq, v)
+#define sock_seq_load(seq)	atomic_load_explicit(seq, memory_order_acquire)
+#define sock_seq_store(seq, v)	atomic_store_explicit(seq, v, memory_order_release)
+#define sock_seq_cas(seq, old, v)	\
+	atomic_compare_exchange_weak_explicit(seq, &(old), v, \
+		memory_order_relaxed, memory_order_relaxed)
+#define sock_seq_xchg(seq, v)	atomic_exchange(seq, v)
+#define sock_fence()		atomic_thread_fence(memory_order_seq_cst)
+#else
+typedef size_t sock_seq_t;
+#define sock_seq_init(seq, v)	(*(seq) = (v))
+#define sock_seq_load(seq)	(*(seq))
+#define sock_seq_store(seq, v)	(*(seq) = (v))
+#define sock_seq_cas(seq, old, v)	\
+	((*(seq) == (old)) ? (*(seq) = (v), 1) : ((old) = *(seq), 0))
+#define sock_seq_xchg(seq, v)	sock_seq_swap(seq, v)
+#define sock_fence()
+static inline size_t sock_seq_swap(sock_seq_t *seq, size_t v)
+{
+	size_t old = *seq;
+	*seq = v;
+	return old;
+}
+#endif
+
+/*
+ * Single-producer, single-consumer byte ring in a segment shared by the
+ * two ends of a same-host connection.  The reader sets armed before it
+ * falls back to waiting on the socket; a writer that finds it set clears
+ * it and sends one doorbell byte over the socket.
+ */
+struct sock_shm_ring {
+	sock_seq_t head;
+	char pad0[SOCK_CACHE_LINE_SZ - sizeof(sock_seq_t)];
+	sock_seq_t tail;
+	char pad1[SOCK_CACHE_LINE_SZ - sizeof(sock_seq_t)];
+	sock_seq_t armed;
+	char pad2[SOCK_CACHE_LINE_SZ - sizeof(sock_seq_t)];
+	char data[SOCK_SHM_RING_SZ];
+};
+
+struct sock_shm {
+	struct sock_shm_ring *tx;
+	struct sock_shm_ring *rx;
+	void *base;
+	pid_t peer_pid;
+	int cma;
+};
+
+/*
+ * TX command queue.  Application threads reserve a run of cache-line
+ * slots by advancing tail, fill in the command and publish it through
+ * the per-slot sequence number; the progress engine is the only reader.
+ * The doorbell fd is written only when the queue goes from empty to
+ * non-empty.
+ */
+struct sock_tx_ring {
+	char *slots;
+	sock_seq_t *seq;
+	size_t mask;
+	sock_seq_t head;
+	sock_seq_t tail;
+	sock_seq_t doorbell;
+	struct fd_signal signal;
+#ifndef HAVE_ATOMICS
+	fastlock_t lock;
+#endif
+};
+
+struct sock_tx_cmd_hdr {
+	uint32_t slots;
+	uint32_t aborted;
+};
+
+/* cursor over one command in the TX queue */
+struct sock_tx_cmd {
+	struct sock_tx_ctx *tx_ctx;
+	size_t pos;
+	size_t off;
+	size_t slots;
 };
 
 struct sock_tx_ctx {
@@ -607,8 +1023,7 @@ struct sock_tx_ctx {
 	} fid;
 	size_t fclass;
 
-	struct ringbuffd	rbfd;
-	fastlock_t		wlock;
+	struct sock_tx_ring	ring;
 	fastlock_t		rlock;
 
 	uint16_t tx_id;
@@ -623,6 +1038,7 @@ struct sock_tx_ctx {
 	struct sock_av *av;
 	struct sock_eq *eq;
  	struct sock_domain *domain;
+	struct sock_pe *pe;
 
 	struct dlist_entry pe_entry;
 	struct dlist_entry cq_entry;
@@ -630,6 +1046,7 @@ struct sock_tx_ctx {
 
 	struct dlist_entry pe_entry_list;
 	struct dlist_entry ep_list;
+	struct sock_dgram *dgram;
 
 	struct fi_tx_attr attr;
 	fastlock_t lock;
@@ -660,6 +1077,42 @@ struct sock_msg_tsend {
 	/* data */
 };
 
+/*
+ * A send on a UDP-backed datagram endpoint, parked until the progress
+ * engine hands a batch of them to the kernel in one call.
+ */
+struct sock_dgram_slot {
+	struct sock_msg_hdr msg_hdr;
+	uint64_t tag;
+	uint64_t data;
+	struct sockaddr_in sin;
+
+	struct sock_comp *comp;
+	uint64_t flags;
+	uint64_t context;
+	uint64_t addr;
+	uint64_t buf;
+	uint64_t data_len;
+
+	size_t iov_cnt;
+	union sock_iov iov[SOCK_EP_MAX_IOV_LIMIT];
+	char inject[SOCK_EP_MAX_INJECT_SZ];
+};
+
+struct sock_dgram {
+	int sock_fd;
+	struct sock_ep *ep;
+
+	fastlock_t tx_lock;
+	int tx_head;
+	int tx_cnt;
+	struct sock_dgram_slot tx[SOCK_DGRAM_BATCH];
+
+	char *rx_buf;
+	size_t rx_len[SOCK_DGRAM_BATCH];
+	struct sockaddr_in rx_addr[SOCK_DGRAM_BATCH];
+};
+
 struct sock_rma_write_req {
 	struct sock_msg_hdr msg_hdr;
 	/* user data */
@@ -713,13 +1166,15 @@ struct sock_tx_iov {
 struct sock_tx_pe_entry {
 	struct sock_op tx_op;
 	struct sock_comp *comp;
-	uint8_t header_sent;
 	uint8_t send_done;
-	uint8_t reserved[6];
+	uint8_t rndv;
+	uint8_t rndv_wait;
+	uint8_t cma;
+	uint8_t conn_ref;
+	uint8_t reserved[3];
 
 	struct sock_tx_ctx *tx_ctx;
 	struct sock_tx_iov tx_iov[SOCK_EP_MAX_IOV_LIMIT];
-	char inject[SOCK_EP_MAX_INJECT_SZ];
 };
 
 struct sock_rx_pe_entry {
@@ -728,10 +1183,23 @@ struct sock_rx_pe_entry {
 	struct sock_comp *comp;
 	uint8_t header_read;
 	uint8_t pending_send;
-	uint8_t reserved[6];
+	uint8_t cma;
+	uint8_t dropped;
+	uint8_t reserved[4];
 	struct sock_rx_entry *rx_entry;
+	struct sock_pe_entry *rndv_tx;
+	char *atomic_res;
+	uint64_t atomic_done;
 	union sock_iov rx_iov[SOCK_EP_MAX_IOV_LIMIT];
-	char atomic_cmp[SOCK_EP_MAX_ATOMIC_SZ];
+};
+
+/* Side buffer of a PE entry: inject data on TX, atomic operands on RX */
+struct sock_pe_scratch {
+	union {
+		char inject[SOCK_EP_MAX_INJECT_SZ];
+		char atomic_cmp[SOCK_EP_MAX_ATOMIC_SZ];
+		union sock_iov cma_iov[SOCK_EP_MAX_IOV_LIMIT];
+	};
 	char atomic_src[SOCK_EP_MAX_ATOMIC_SZ];
 };
 
@@ -761,7 +1229,8 @@ struct sock_pe_entry {
 	uint8_t is_complete;
 	uint8_t is_error;
 	uint8_t mr_checked;
-	uint8_t reserved[4];
+	uint8_t reserved[2];
+	uint16_t id;
 
 	uint64_t done_len;
 	uint64_t total_len;
@@ -770,19 +1239,39 @@ struct sock_pe_entry {
 	struct sock_ep *ep;
 	struct sock_conn *conn;
 	struct sock_comp *comp;
+	struct sock_pe_scratch *scratch;
 
 	struct dlist_entry entry;
 	struct dlist_entry ctx_entry;
 };
 
+#define SOCK_PE_MAX_SEND_IOV (4 + 2 * SOCK_EP_MAX_IOV_LIMIT)
+
+struct sock_pe_iov {
+	struct iovec iov[SOCK_PE_MAX_SEND_IOV];
+	int iov_cnt;
+	size_t offset;
+	size_t len;
+};
+
 struct sock_pe {
 	struct sock_domain *domain;
+	int index;
 	int num_free_entries;
-	struct sock_pe_entry pe_table[SOCK_PE_MAX_ENTRIES];
+	int num_entries;
+	int max_entries;
+	struct sock_pe_entry **pe_slab;
+	struct sock_pe_scratch **scratch_slab;
 	fastlock_t lock;
 	pthread_mutex_t list_lock;
 	int signal_fds[2];
-	uint64_t waittime;
+	uint64_t idle_since;
+	uint64_t backoff;
+	uint64_t stats_time;
+	struct fi_sockets_pe_stats stats;
+	fi_epoll_t epoll_set;
+	int num_ready;
+	struct sock_conn_map cmap;
 
 	struct dlist_entry free_list;
 	struct dlist_entry busy_list;
@@ -792,12 +1281,33 @@ struct sock_pe {
 
 	pthread_t progress_thread;
 	volatile int do_progress;
-	struct sock_pe_entry *pe_atomic;
 };
 
 typedef int (*sock_cq_report_fn) (struct sock_cq *cq, fi_addr_t addr,
 				  struct sock_pe_entry *pe_entry);
 
+/*
+ * Bounded MPMC completion ring.  Each slot carries a sequence number that
+ * tells producers and consumers whose turn it is, so neither side needs a
+ * lock when C11 atomics are available.
+ */
+struct sock_cq_slot {
+	sock_seq_t seq;
+	fi_addr_t addr;
+	char entry[0];
+};
+
+struct sock_cq_ring {
+	char *slots;
+	size_t slot_size;
+	size_t mask;
+	sock_seq_t head;
+	sock_seq_t tail;
+#ifndef HAVE_ATOMICS
+	fastlock_t lock;
+#endif
+};
+
 struct sock_cq_overflow_entry_t {
 	size_t len;
 	fi_addr_t addr;
@@ -812,15 +1322,19 @@ struct sock_cq {
 	atomic_t ref;
 	struct fi_cq_attr attr;
 
-	struct ringbuf addr_rb;
-	struct ringbuffd cq_rbfd;
+	struct sock_cq_ring ring;
+	struct fd_signal wait_fd;
+	atomic_t waiters;
+	int wait_fd_exported;
 	struct ringbuf cqerr_rb;
 	struct dlist_entry overflow_list;
+	atomic_t overflow_cnt;
 	fastlock_t lock;
 	fastlock_t list_lock;
 
 	struct fid_wait *waitset;
 	int signal;
+	struct sock_poll_list poll_list;
 
 	struct dlist_entry ep_list;
 	struct dlist_entry rx_list;
@@ -880,6 +1394,7 @@ struct sock_conn_req_handle {
 	struct sock_conn_req *req;
 };
 
+/* exchanged on every new connection before it enters the conn map */
 
 int sock_verify_info(struct fi_info *hints);
 int sock_verify_fabric_attr(struct fi_fabric_attr *attr);
@@ -914,10 +1429,19 @@ void sock_fabric_add_service(struct sock_fabric *fab, int service);
 void sock_fabric_remove_service(struct sock_fabric *fab, int service);
 int sock_fabric_check_service(struct sock_fabric *fab, int service);
 
+int sock_cm_loop_init(struct sock_cm_loop *loop);
+void sock_cm_loop_fini(struct sock_cm_loop *loop);
+int sock_cm_loop_add(struct sock_cm_loop *loop,
+		     struct sock_cm_handler *handler);
+void sock_cm_loop_remove(struct sock_cm_handler *handler);
+void sock_cm_loop_del(struct sock_cm_handler *handler);
+void sock_cm_loop_kick(struct sock_cm_handler *handler);
+
 void sock_dom_add_to_list(struct sock_domain *domain);
 int sock_dom_check_list(struct sock_domain *domain);
 void sock_dom_remove_from_list(struct sock_domain *domain);
 struct sock_domain *sock_dom_list_head(void);
+struct sock_pe *sock_dom_select_pe(struct sock_domain *dom);
 
 void sock_fab_add_to_list(struct sock_fabric *fabric);
 int sock_fab_check_list(struct sock_fabric *fabric);
@@ -960,6 +1484,7 @@ int sock_cq_report_error(struct sock_cq *cq, struct sock_pe_entry *entry,
 			 size_t olen, int err, int prov_errno, void *err_data);
 int sock_cq_progress(struct sock_cq *cq);
 int sock_cq_check_size_ok(struct sock_cq *cq);
+int sock_cq_has_entries(struct sock_cq *cq);
 
 
 int sock_eq_open(struct fid_fabric *fabric, struct fi_eq_attr *attr,
@@ -976,13 +1501,28 @@ int sock_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
 int sock_cntr_inc(struct sock_cntr *cntr);
 int sock_cntr_err_inc(struct sock_cntr *cntr);
 int sock_cntr_progress(struct sock_cntr *cntr);
+int sock_cntr_queue_trigger(struct sock_cntr *cntr,
+			    struct sock_trigger *trigger);
 
 
-struct sock_mr *sock_mr_verify_key(struct sock_domain *domain, uint16_t key, 
+struct sock_mr *sock_mr_verify_key(struct sock_domain *domain, uint64_t key, 
 				   void *buf, size_t len, uint64_t access);
 struct sock_mr *sock_mr_verify_desc(struct sock_domain *domain, void *desc, 
 				    void *buf, size_t len, uint64_t access);
-struct sock_mr * sock_mr_get_entry(struct sock_domain *domain, uint16_t key);
+struct sock_mr * sock_mr_get_entry(struct sock_domain *domain, uint64_t key);
+
+void sock_mr_cache_init(struct sock_mr_cache *cache, size_t max_idle);
+struct sock_mr *sock_mr_cache_find(struct sock_mr_cache *cache,
+				   uintptr_t start, uintptr_t end,
+				   uint64_t access);
+struct sock_mr *sock_mr_cache_overlap(struct sock_mr_cache *cache,
+				      uintptr_t start, uintptr_t end);
+int sock_mr_cache_insert(struct sock_mr_cache *cache, struct sock_mr *mr);
+void sock_mr_cache_remove(struct sock_mr_cache *cache, struct sock_mr *mr);
+void sock_mr_cache_hold(struct sock_mr_cache *cache, struct sock_mr *mr);
+struct sock_mr *sock_mr_cache_release(struct sock_mr_cache *cache,
+				      struct sock_mr *mr);
+struct sock_mr *sock_mr_cache_evict(struct sock_mr_cache *cache);
 
 
 struct sock_rx_ctx *sock_rx_ctx_alloc(const struct fi_rx_attr *attr, void *context);
@@ -991,23 +1531,38 @@ void sock_rx_ctx_free(struct sock_rx_ctx *rx_ctx);
 struct sock_tx_ctx *sock_tx_ctx_alloc(const struct fi_tx_attr *attr, void *context);
 struct sock_tx_ctx *sock_stx_ctx_alloc(const struct fi_tx_attr *attr, void *context);
 void sock_tx_ctx_free(struct sock_tx_ctx *tx_ctx);
-void sock_tx_ctx_start(struct sock_tx_ctx *tx_ctx);
-void sock_tx_ctx_write(struct sock_tx_ctx *tx_ctx, const void *buf, size_t len);
-void sock_tx_ctx_commit(struct sock_tx_ctx *tx_ctx);
-void sock_tx_ctx_abort(struct sock_tx_ctx *tx_ctx);
-void sock_tx_ctx_write_op_send(struct sock_tx_ctx *tx_ctx,
+int sock_tx_ctx_start(struct sock_tx_ctx *tx_ctx, struct sock_tx_cmd *cmd,
+		      size_t len);
+void sock_tx_ctx_write(struct sock_tx_cmd *cmd, const void *buf, size_t len);
+void sock_tx_ctx_commit(struct sock_tx_cmd *cmd);
+void sock_tx_ctx_abort(struct sock_tx_cmd *cmd);
+void sock_tx_ctx_write_op_send(struct sock_tx_cmd *cmd,
 		struct sock_op *op, uint64_t flags, uint64_t context,
 		uint64_t dest_addr, uint64_t buf, struct sock_ep *ep,
 		struct sock_conn *conn);
-void sock_tx_ctx_write_op_tsend(struct sock_tx_ctx *tx_ctx,
+void sock_tx_ctx_write_op_tsend(struct sock_tx_cmd *cmd,
 		struct sock_op *op, uint64_t flags, uint64_t context,
 		uint64_t dest_addr, uint64_t buf, struct sock_ep *ep,
 		struct sock_conn *conn, uint64_t tag);
-void sock_tx_ctx_read_op_send(struct sock_tx_ctx *tx_ctx,
+int sock_tx_ctx_empty(struct sock_tx_ctx *tx_ctx);
+size_t sock_tx_ctx_avail(struct sock_tx_ctx *tx_ctx);
+int sock_tx_ctx_read_start(struct sock_tx_ctx *tx_ctx, struct sock_tx_cmd *cmd);
+void sock_tx_ctx_read(struct sock_tx_cmd *cmd, void *buf, size_t len);
+void sock_tx_ctx_read_done(struct sock_tx_cmd *cmd);
+void sock_tx_ctx_read_op_send(struct sock_tx_cmd *cmd,
 		struct sock_op *op, uint64_t *flags, uint64_t *context,
 		uint64_t *dest_addr, uint64_t *buf, struct sock_ep **ep,
 		struct sock_conn **conn);
 
+void sock_poll_list_init(struct sock_poll_list *plist);
+void sock_poll_list_fini(struct sock_poll_list *plist);
+void sock_poll_notify(struct sock_poll_list *plist);
+void sock_poll_set_init(struct sock_poll_set *pset);
+void sock_poll_set_fini(struct sock_poll_set *pset);
+int sock_poll_set_add(struct sock_poll_set *pset, struct fid *fid);
+int sock_poll_set_del(struct sock_poll_set *pset, struct fid *fid);
+void sock_poll_set_progress(struct sock_poll_set *pset);
+int sock_poll_set_ready(struct sock_poll_set *pset, void **context, int count);
 int sock_poll_open(struct fid_domain *domain, struct fi_poll_attr *attr,
 		   struct fid_poll **pollset);
 int sock_wait_open(struct fid_fabric *fabric, struct fi_wait_attr *attr,
@@ -1021,20 +1576,32 @@ int sock_av_open(struct fid_domain *domain, struct fi_av_attr *attr,
 		 struct fid_av **av, void *context);
 fi_addr_t _sock_av_lookup(struct sock_av *av, struct sockaddr *addr);
 fi_addr_t sock_av_get_fiaddr(struct sock_av *av, struct sock_conn *conn);
-fi_addr_t sock_av_lookup_key(struct sock_av *av, int key);
 struct sock_conn *sock_av_lookup_addr(struct sock_ep *ep, 
 				      struct sock_av *av, fi_addr_t addr);
 int sock_av_compare_addr(struct sock_av *av, fi_addr_t addr1, fi_addr_t addr2);
+uint64_t sock_av_addr_key(struct sock_av *av, fi_addr_t addr);
+int sock_av_get_sockaddr(struct sock_av *av, fi_addr_t addr,
+			 struct sockaddr_in *sin);
+void sock_av_connect(struct sock_av *av, int first);
+int sock_addr_hash_init(struct sock_addr_hash *hash, size_t size);
+void sock_addr_hash_free(struct sock_addr_hash *hash);
+int sock_addr_hash_insert(struct sock_addr_hash *hash,
+			  struct sockaddr_in *addr, uint64_t value);
+int sock_addr_hash_lookup(struct sock_addr_hash *hash,
+			  struct sockaddr_in *addr, uint64_t *value);
 int sock_compare_addr(struct sockaddr_in *addr1,
 		      struct sockaddr_in *addr2);
 
 struct sock_conn *sock_conn_map_lookup_key(struct sock_conn_map *conn_map, 
 					   uint16_t key);
-int sock_conn_map_connect(struct sock_ep *ep,
-			       struct sock_domain *dom,
-			       struct sock_conn_map *map, 
-			       struct sockaddr_in *addr,
-			       uint16_t *index);
+int sock_conn_progress(struct sock_conn_map *map, struct sock_conn *conn);
+int sock_conn_map_preconnect(struct sock_ep *ep, struct sock_conn_map *map,
+			     struct sockaddr_in *addr, uint16_t *index);
+void sock_conn_map_progress(struct sock_conn_map *map);
+void sock_conn_map_evict(struct sock_conn_map *map);
+void sock_conn_map_detach(struct sock_conn_map *map, struct sock_ep *ep);
+void sock_conn_event(struct sock_conn_map *map, struct sock_conn *conn,
+		     int event);
 uint16_t sock_conn_map_lookup(struct sock_conn_map *map,
 			      struct sockaddr_in *addr);
 int sock_conn_map_match_or_connect(struct sock_ep *ep,
@@ -1043,13 +1610,14 @@ int sock_conn_map_match_or_connect(struct sock_ep *ep,
 					struct sockaddr_in *addr,
 					uint16_t *index);
 int sock_conn_listen(struct sock_ep *ep);
+void sock_conn_listen_close(struct sock_ep *ep);
 int sock_conn_map_clear_pe_entry(struct sock_conn *conn_entry, uint16_t key);
 void sock_conn_map_destroy(struct sock_conn_map *cmap);
 void sock_set_sockopts(int sock);
 int fd_set_nonblock(int fd);
 int sock_conn_map_init(struct sock_conn_map *map, int init_size);
 
-struct sock_pe *sock_pe_init(struct sock_domain *domain);
+struct sock_pe *sock_pe_init(struct sock_domain *domain, int index);
 void sock_pe_add_tx_ctx(struct sock_pe *pe, struct sock_tx_ctx *ctx);
 void sock_pe_add_rx_ctx(struct sock_pe *pe, struct sock_rx_ctx *ctx);
 void sock_pe_signal(struct sock_pe *pe);
@@ -1061,14 +1629,22 @@ void sock_pe_finalize(struct sock_pe *pe);
 
 
 struct sock_rx_entry *sock_rx_new_entry(struct sock_rx_ctx *rx_ctx);
+void sock_rx_enqueue_entry(struct sock_rx_ctx *rx_ctx,
+			   struct sock_rx_entry *rx_entry);
+void sock_rx_dequeue_entry(struct sock_rx_entry *rx_entry);
 struct sock_rx_entry *sock_rx_new_buffered_entry(struct sock_rx_ctx *rx_ctx,
 						 size_t len);
+void sock_rx_enqueue_buffered_entry(struct sock_rx_ctx *rx_ctx,
+				    struct sock_rx_entry *rx_entry);
 struct sock_rx_entry *sock_rx_get_entry(struct sock_rx_ctx *rx_ctx, 
 					uint64_t addr, uint64_t tag, 
 					uint8_t is_tagged);
 struct sock_rx_entry *sock_rx_get_buffered_entry(struct sock_rx_ctx *rx_ctx, 
 						 uint64_t addr, uint64_t tag, 
 						 uint64_t ignore, uint8_t is_tagged);
+struct sock_rx_entry *sock_rx_get_claimed_entry(struct sock_rx_ctx *rx_ctx,
+						void *context, uint64_t tag,
+						uint64_t ignore, uint8_t is_tagged);
 ssize_t sock_rx_peek_recv(struct sock_rx_ctx *rx_ctx, fi_addr_t addr, 
 			  uint64_t tag, uint64_t ignore, void *context, uint64_t flags, 
 			  uint8_t is_tagged);
@@ -1078,17 +1654,51 @@ ssize_t sock_rx_claim_recv(struct sock_rx_ctx *rx_ctx, void *context,
 			   size_t iov_count);
 size_t sock_rx_avail_len(struct sock_rx_entry *rx_entry);
 void sock_rx_release_entry(struct sock_rx_entry *rx_entry);
+int sock_rx_can_buffer(struct sock_rx_ctx *rx_ctx, size_t len);
+void sock_rx_free_buf_pool(struct sock_rx_ctx *rx_ctx);
+void sock_rx_buffered_stats(struct sock_rx_ctx *rx_ctx,
+			    struct fi_sockets_buffered_recv_stats *stats);
 
 
 int sock_comm_buffer_init(struct sock_conn *conn);
 void sock_comm_buffer_finalize(struct sock_conn *conn);
-ssize_t sock_comm_send(struct sock_conn *conn, const void *buf, size_t len);
+void sock_comm_buffer_trim(struct sock_conn *conn);
+void sock_comm_pool_init(struct sock_comm_pool *pool);
+void sock_comm_pool_fill(struct sock_comm_pool *pool);
+void sock_comm_pool_destroy(struct sock_comm_pool *pool);
+ssize_t sock_comm_sendv(struct sock_conn *conn, const struct iovec *iov,
+			int iov_cnt, size_t len);
 ssize_t sock_comm_recv(struct sock_conn *conn, void *buf, size_t len);
 ssize_t sock_comm_peek(struct sock_conn *conn, void *buf, size_t len);
 ssize_t sock_comm_discard(struct sock_conn *conn, size_t len);
 ssize_t sock_comm_data_avail(struct sock_conn *conn);
+int sock_comm_data_pending(struct sock_conn *conn);
 ssize_t sock_comm_flush(struct sock_conn *conn);
 int sock_comm_tx_done(struct sock_conn *conn);
+int sock_comm_send_ctrl(struct sock_conn *conn, uint8_t op);
+
+int sock_shm_is_local(int sock_fd);
+int sock_shm_host_id(struct sock_host_id *id);
+int sock_shm_same_host(const struct sock_host_id *id);
+int sock_shm_create(struct sock_shm **shm, int sock_fd, char *name);
+int sock_shm_attach(struct sock_shm **shm, const char *name);
+void sock_shm_free(struct sock_shm *shm);
+ssize_t sock_shm_sendv(struct sock_conn *conn, const struct iovec *iov,
+		       int iov_cnt, size_t len);
+ssize_t sock_shm_recv(struct sock_conn *conn, void *buf, size_t len);
+ssize_t sock_shm_peek(struct sock_conn *conn, void *buf, size_t len);
+ssize_t sock_shm_discard(struct sock_conn *conn, size_t len);
+size_t sock_shm_tx_avail(struct sock_conn *conn);
+ssize_t sock_shm_data_avail(struct sock_conn *conn);
+int sock_shm_data_pending(struct sock_conn *conn);
+int sock_shm_cma_write(struct sock_conn *conn, const union sock_iov *local,
+		       size_t local_cnt, const union sock_iov *remote,
+		       size_t remote_cnt);
+
+int sock_dgram_open(struct sock_ep *ep);
+void sock_dgram_close(struct sock_ep *ep);
+int sock_dgram_send_batch(struct sock_dgram *dgram);
+int sock_dgram_recv_batch(struct sock_dgram *dgram);
 
 ssize_t sock_ep_recvmsg(struct fid_ep *ep, const struct fi_msg *msg, 
 			uint64_t flags);
@@ -1108,6 +1718,10 @@ ssize_t sock_ep_tx_atomic(struct fid_ep *ep,
 			  size_t compare_count, struct fi_ioc *resultv, 
 			  void **result_desc, size_t result_count, uint64_t flags);
 
+typedef void (*sock_atomic_fn)(void *res, void *dst, const void *src,
+			       size_t cnt);
+void sock_atomic_init(void);
+sock_atomic_fn sock_atomic_lookup(enum fi_datatype datatype, enum fi_op op);
 
 ssize_t sock_queue_rma_op(struct fid_ep *ep, const struct fi_msg_rma *msg, 
 			  uint64_t flags, uint8_t op_type);
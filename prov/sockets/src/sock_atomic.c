@@ -71,6 +71,7 @@ ssize_t sock_ep_tx_atomic(struct fid_ep *ep,
 	union sock_iov tx_iov;
 	struct sock_conn *conn;
 	struct sock_tx_ctx *tx_ctx;
+	struct sock_tx_cmd cmd;
 	uint64_t total_len, src_len, dst_len;
 	struct sock_ep *sock_ep;
 
@@ -145,13 +146,15 @@ ssize_t sock_ep_tx_atomic(struct fid_ep *ep,
 
 	total_len += (sizeof(struct sock_op_send) +
 		      (msg->rma_iov_count * sizeof(union sock_iov)) +
-		      (result_count * sizeof(union sock_iov)));
+		      (result_count * sizeof(union sock_iov)) +
+		      (compare_count * sizeof(union sock_iov)));
 
-	sock_tx_ctx_start(tx_ctx);
-	if (rbfdavail(&tx_ctx->rbfd) < total_len) {
-		ret = -FI_EAGAIN;
-		goto err;
-	}
+	if (flags & FI_REMOTE_CQ_DATA)
+		total_len += sizeof(uint64_t);
+
+	ret = sock_tx_ctx_start(tx_ctx, &cmd, total_len);
+	if (ret)
+		return ret;
 
 	memset(&tx_op, 0, sizeof(tx_op));
 	tx_op.op = SOCK_OP_ATOMIC;
@@ -166,17 +169,17 @@ ssize_t sock_ep_tx_atomic(struct fid_ep *ep,
 	else
 		tx_op.src_iov_len = msg->iov_count;
 
-	sock_tx_ctx_write_op_send(tx_ctx, &tx_op, flags,
+	sock_tx_ctx_write_op_send(&cmd, &tx_op, flags,
 		(uintptr_t) msg->context, msg->addr,
 		(uintptr_t) msg->msg_iov[0].addr, sock_ep, conn);
 
 	if (flags & FI_REMOTE_CQ_DATA)
-		sock_tx_ctx_write(tx_ctx, &msg->data, sizeof(uint64_t));
+		sock_tx_ctx_write(&cmd, &msg->data, sizeof(uint64_t));
 
 	src_len = 0;
 	if (flags & FI_INJECT) {
 		for (i = 0; i < msg->iov_count; i++) {
-			sock_tx_ctx_write(tx_ctx, msg->msg_iov[i].addr,
+			sock_tx_ctx_write(&cmd, msg->msg_iov[i].addr,
 					  msg->msg_iov[i].count * datatype_sz);
 			src_len += (msg->msg_iov[i].count * datatype_sz);
 		}
@@ -184,13 +187,13 @@ ssize_t sock_ep_tx_atomic(struct fid_ep *ep,
 		for (i = 0; i < msg->iov_count; i++) {
 			tx_iov.ioc.addr = (uintptr_t) msg->msg_iov[i].addr;
 			tx_iov.ioc.count = msg->msg_iov[i].count;
-			sock_tx_ctx_write(tx_ctx, &tx_iov, sizeof(tx_iov));
+			sock_tx_ctx_write(&cmd, &tx_iov, sizeof(tx_iov));
 			src_len += (tx_iov.ioc.count * datatype_sz);
 		}
 	}
 
 #ifdef ENABLE_DEBUG
-	if (src_len > SOCK_EP_MAX_ATOMIC_SZ) {
+	if (src_len > SOCK_EP_MAX_ATOMIC_MSG_SZ) {
 		ret = -FI_EINVAL;
 		goto err;
 	}
@@ -201,7 +204,7 @@ ssize_t sock_ep_tx_atomic(struct fid_ep *ep,
 		tx_iov.ioc.addr = msg->rma_iov[i].addr;
 		tx_iov.ioc.key = msg->rma_iov[i].key;
 		tx_iov.ioc.count = msg->rma_iov[i].count;
-		sock_tx_ctx_write(tx_ctx, &tx_iov, sizeof(tx_iov));
+		sock_tx_ctx_write(&cmd, &tx_iov, sizeof(tx_iov));
 		dst_len += (tx_iov.ioc.count * datatype_sz);
 	}
 
@@ -217,7 +220,7 @@ ssize_t sock_ep_tx_atomic(struct fid_ep *ep,
 	for (i = 0; i < result_count; i++) {
 		tx_iov.ioc.addr = (uintptr_t) resultv[i].addr;
 		tx_iov.ioc.count = resultv[i].count;
-		sock_tx_ctx_write(tx_ctx, &tx_iov, sizeof(tx_iov));
+		sock_tx_ctx_write(&cmd, &tx_iov, sizeof(tx_iov));
 		dst_len += (tx_iov.ioc.count * datatype_sz);
 	}
 
@@ -233,7 +236,7 @@ ssize_t sock_ep_tx_atomic(struct fid_ep *ep,
 	for (i = 0; i < compare_count; i++) {
 		tx_iov.ioc.addr = (uintptr_t) comparev[i].addr;
 		tx_iov.ioc.count = comparev[i].count;
-		sock_tx_ctx_write(tx_ctx, &tx_iov, sizeof(tx_iov));
+		sock_tx_ctx_write(&cmd, &tx_iov, sizeof(tx_iov));
 		dst_len += (tx_iov.ioc.count * datatype_sz);
 	}
 
@@ -245,15 +248,24 @@ ssize_t sock_ep_tx_atomic(struct fid_ep *ep,
 	}
 #endif
 
-	sock_tx_ctx_commit(tx_ctx);
+	sock_tx_ctx_commit(&cmd);
 	return 0;
 
 err:
-	sock_tx_ctx_abort(tx_ctx);
+	sock_tx_ctx_abort(&cmd);
 	return ret;
 }
 
 
+static size_t sock_atomic_ioc_count(const struct fi_ioc *iov, size_t count)
+{
+	size_t i, total = 0;
+
+	for (i = 0; i < count; i++)
+		total += iov[i].count;
+	return total;
+}
+
 static ssize_t sock_ep_atomic_writemsg(struct fid_ep *ep,
 			const struct fi_msg_atomic *msg, uint64_t flags)
 {
@@ -327,7 +339,7 @@ static ssize_t sock_ep_atomic_writev(struct fid_ep *ep,
 
 	rma_iov.addr = addr;
 	rma_iov.key = key;
-	rma_iov.count = count;
+	rma_iov.count = sock_atomic_ioc_count(iov, count);
 	msg.rma_iov = &rma_iov;
 	msg.rma_iov_count = 1;
 
@@ -423,7 +435,7 @@ static ssize_t sock_ep_atomic_readwrite(struct fid_ep *ep,
 	msg.addr = dest_addr;
 
 	rma_iov.addr = addr;
-	rma_iov.count = 1;
+	rma_iov.count = count;
 	rma_iov.key = key;
 	msg.rma_iov = &rma_iov;
 	msg.rma_iov_count = 1;
@@ -432,7 +444,7 @@ static ssize_t sock_ep_atomic_readwrite(struct fid_ep *ep,
 	msg.context = context;
 
 	resultv.addr = result;
-	resultv.count = 1;
+	resultv.count = count;
 
 	return sock_ep_atomic_readwritemsg(ep, &msg, &resultv, &result_desc, 1,
 						SOCK_USE_OP_FLAGS);
@@ -454,7 +466,7 @@ static ssize_t sock_ep_atomic_readwritev(struct fid_ep *ep,
 	msg.addr = dest_addr;
 
 	rma_iov.addr = addr;
-	rma_iov.count = 1;
+	rma_iov.count = sock_atomic_ioc_count(iov, count);
 	rma_iov.key = key;
 	msg.rma_iov = &rma_iov;
 	msg.rma_iov_count = 1;
@@ -514,7 +526,7 @@ static ssize_t sock_ep_atomic_compwrite(struct fid_ep *ep,
 	msg.addr = dest_addr;
 
 	rma_iov.addr = addr;
-	rma_iov.count = 1;
+	rma_iov.count = count;
 	rma_iov.key = key;
 	msg.rma_iov = &rma_iov;
 	msg.rma_iov_count = 1;
@@ -523,9 +535,9 @@ static ssize_t sock_ep_atomic_compwrite(struct fid_ep *ep,
 	msg.context = context;
 
 	resultv.addr = result;
-	resultv.count = 1;
+	resultv.count = count;
 	comparev.addr = (void *)compare;
-	comparev.count = 1;
+	comparev.count = count;
 
 	return sock_ep_atomic_compwritemsg(ep, &msg, &comparev, &compare_desc,
 			1, &resultv, &result_desc, 1, SOCK_USE_OP_FLAGS);
@@ -548,7 +560,7 @@ static ssize_t sock_ep_atomic_compwritev(struct fid_ep *ep,
 	msg.addr = dest_addr;
 
 	rma_iov.addr = addr;
-	rma_iov.count = 1;
+	rma_iov.count = sock_atomic_ioc_count(iov, count);
 	rma_iov.key = key;
 	msg.rma_iov = &rma_iov;
 	msg.rma_iov_count = 1;
@@ -566,34 +578,14 @@ static int sock_ep_atomic_valid(struct fid_ep *ep, enum fi_datatype datatype,
 {
 	size_t datatype_sz;
 
-	switch (datatype) {
-	case FI_FLOAT:
-	case FI_DOUBLE:
-	case FI_LONG_DOUBLE:
-		if (op == FI_BOR || op == FI_BAND ||
-		    op == FI_BXOR || op == FI_MSWAP)
-			return -FI_ENOENT;
-		break;
-
-	case FI_FLOAT_COMPLEX:
-	case FI_DOUBLE_COMPLEX:
-	case FI_LONG_DOUBLE_COMPLEX:
-		if (op == FI_BOR      || op == FI_BAND     ||
-		    op == FI_BXOR     || op == FI_MSWAP    ||
-		    op == FI_MIN      || op == FI_MAX      ||
-		    op == FI_CSWAP_LE || op == FI_CSWAP_LT ||
-		    op == FI_CSWAP_GE || op == FI_CSWAP_GT)
-			return -FI_ENOENT;
-	break;
-	default:
-		break;
-	}
+	if (!sock_atomic_lookup(datatype, op))
+		return -FI_ENOENT;
 
 	datatype_sz = fi_datatype_size(datatype);
 	if (datatype_sz == 0)
 		return -FI_ENOENT;
 
-	*count = (SOCK_EP_MAX_ATOMIC_SZ/datatype_sz);
+	*count = (SOCK_EP_MAX_ATOMIC_MSG_SZ/datatype_sz);
 	return 0;
 }
 
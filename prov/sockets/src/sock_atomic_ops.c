@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2015 Intel Corporation, Inc.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <complex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sock.h"
+#include "sock_util.h"
+
+#define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_EP_DATA, __VA_ARGS__)
+#define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_DATA, __VA_ARGS__)
+
+/*
+ * Remote atomics are applied an array at a time.  Each kernel stores the
+ * previous value of dst[i] into res[i] and then updates dst[i]; for the
+ * compare ops res[] holds the compare operands on entry.  The loops are
+ * kept simple enough for the compiler to vectorize (this file is built
+ * with -ftree-vectorize), and on x86-64 an AVX2 build of the arithmetic
+ * kernels is selected at runtime.
+ */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SOCK_ATOMIC_HAVE_AVX2 1
+#define SOCK_ATOMIC_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define SOCK_ATOMIC_RMW(_op, _sfx, _attr, _t, _type, _expr)		\
+static void _attr							\
+sock_atomic_##_op##_##_t##_sfx(void *restrict res, void *restrict dst,	\
+			       const void *restrict src, size_t cnt)	\
+{									\
+	_type *restrict r = res, *restrict d = dst;			\
+	const _type *restrict s = src;					\
+	size_t i;							\
+									\
+	for (i = 0; i < cnt; i++) {					\
+		r[i] = d[i];						\
+		d[i] = _expr;						\
+	}								\
+}
+
+#define SOCK_ATOMIC_CMP(_op, _t, _type, _cond)				\
+static void								\
+sock_atomic_##_op##_##_t(void *restrict res, void *restrict dst,	\
+			 const void *restrict src, size_t cnt)		\
+{									\
+	_type *restrict r = res, *restrict d = dst, tmp;		\
+	const _type *restrict s = src;					\
+	size_t i;							\
+									\
+	for (i = 0; i < cnt; i++) {					\
+		tmp = d[i];						\
+		if (r[i] _cond tmp)					\
+			d[i] = s[i];					\
+		r[i] = tmp;						\
+	}								\
+}
+
+#define SOCK_ATOMIC_COPY(_t, _type)					\
+static void sock_atomic_read_##_t(void *restrict res,			\
+				  void *restrict dst,			\
+				  const void *restrict src, size_t cnt)	\
+{									\
+	memcpy(res, dst, cnt * sizeof(_type));				\
+}									\
+									\
+static void sock_atomic_write_##_t(void *restrict res,			\
+				   void *restrict dst,			\
+				   const void *restrict src, size_t cnt) \
+{									\
+	memcpy(res, dst, cnt * sizeof(_type));				\
+	memcpy(dst, src, cnt * sizeof(_type));				\
+}
+
+#define SOCK_ATOMIC_DEF_ARITH(_t, _type, _sfx, _attr)			\
+	SOCK_ATOMIC_RMW(min, _sfx, _attr, _t, _type,			\
+			s[i] < d[i] ? s[i] : d[i])			\
+	SOCK_ATOMIC_RMW(max, _sfx, _attr, _t, _type,			\
+			s[i] > d[i] ? s[i] : d[i])			\
+	SOCK_ATOMIC_RMW(sum, _sfx, _attr, _t, _type, d[i] + s[i])	\
+	SOCK_ATOMIC_RMW(prod, _sfx, _attr, _t, _type, d[i] * s[i])
+
+#define SOCK_ATOMIC_DEF_BIT(_t, _type, _sfx, _attr)			\
+	SOCK_ATOMIC_RMW(bor, _sfx, _attr, _t, _type, d[i] | s[i])	\
+	SOCK_ATOMIC_RMW(band, _sfx, _attr, _t, _type, d[i] & s[i])	\
+	SOCK_ATOMIC_RMW(bxor, _sfx, _attr, _t, _type, d[i] ^ s[i])
+
+#define SOCK_ATOMIC_DEF_COMMON(_t, _type)				\
+	SOCK_ATOMIC_RMW(lor, , , _t, _type, d[i] || s[i])		\
+	SOCK_ATOMIC_RMW(land, , , _t, _type, d[i] && s[i])		\
+	SOCK_ATOMIC_RMW(lxor, , , _t, _type,				\
+			(d[i] && !s[i]) || (!d[i] && s[i]))		\
+	SOCK_ATOMIC_COPY(_t, _type)					\
+	SOCK_ATOMIC_CMP(cswap, _t, _type, ==)				\
+	SOCK_ATOMIC_CMP(cswap_ne, _t, _type, !=)
+
+#define SOCK_ATOMIC_DEF_ORDER(_t, _type)				\
+	SOCK_ATOMIC_CMP(cswap_le, _t, _type, <=)			\
+	SOCK_ATOMIC_CMP(cswap_lt, _t, _type, <)				\
+	SOCK_ATOMIC_CMP(cswap_ge, _t, _type, >=)			\
+	SOCK_ATOMIC_CMP(cswap_gt, _t, _type, >)
+
+#define SOCK_ATOMIC_DEF_MSWAP(_t, _type)				\
+static void								\
+sock_atomic_mswap_##_t(void *restrict res, void *restrict dst,		\
+		       const void *restrict src, size_t cnt)		\
+{									\
+	_type *restrict r = res, *restrict d = dst, tmp;		\
+	const _type *restrict s = src;					\
+	size_t i;							\
+									\
+	for (i = 0; i < cnt; i++) {					\
+		tmp = d[i];						\
+		d[i] = (s[i] & r[i]) | (tmp & ~r[i]);			\
+		r[i] = tmp;						\
+	}								\
+}
+
+#define SOCK_ATOMIC_DEF_INT(_t, _type)					\
+	SOCK_ATOMIC_DEF_ARITH(_t, _type, , )				\
+	SOCK_ATOMIC_DEF_BIT(_t, _type, , )				\
+	SOCK_ATOMIC_DEF_COMMON(_t, _type)				\
+	SOCK_ATOMIC_DEF_ORDER(_t, _type)				\
+	SOCK_ATOMIC_DEF_MSWAP(_t, _type)
+
+#define SOCK_ATOMIC_DEF_FLOAT(_t, _type)				\
+	SOCK_ATOMIC_DEF_ARITH(_t, _type, , )				\
+	SOCK_ATOMIC_DEF_COMMON(_t, _type)				\
+	SOCK_ATOMIC_DEF_ORDER(_t, _type)
+
+#define SOCK_ATOMIC_DEF_COMPLEX(_t, _type)				\
+	SOCK_ATOMIC_RMW(sum, , , _t, _type, d[i] + s[i])		\
+	SOCK_ATOMIC_RMW(prod, , , _t, _type, d[i] * s[i])		\
+	SOCK_ATOMIC_DEF_COMMON(_t, _type)
+
+SOCK_ATOMIC_DEF_INT(int8, int8_t)
+SOCK_ATOMIC_DEF_INT(uint8, uint8_t)
+SOCK_ATOMIC_DEF_INT(int16, int16_t)
+SOCK_ATOMIC_DEF_INT(uint16, uint16_t)
+SOCK_ATOMIC_DEF_INT(int32, int32_t)
+SOCK_ATOMIC_DEF_INT(uint32, uint32_t)
+SOCK_ATOMIC_DEF_INT(int64, int64_t)
+SOCK_ATOMIC_DEF_INT(uint64, uint64_t)
+SOCK_ATOMIC_DEF_FLOAT(float, float)
+SOCK_ATOMIC_DEF_FLOAT(double, double)
+SOCK_ATOMIC_DEF_FLOAT(ldouble, long double)
+SOCK_ATOMIC_DEF_COMPLEX(cfloat, float complex)
+SOCK_ATOMIC_DEF_COMPLEX(cdouble, double complex)
+SOCK_ATOMIC_DEF_COMPLEX(cldouble, long double complex)
+
+#define SOCK_ATOMIC_ARITH_OPS(_t, _sfx)					\
+	[FI_MIN] = sock_atomic_min_##_t##_sfx,				\
+	[FI_MAX] = sock_atomic_max_##_t##_sfx,				\
+	[FI_SUM] = sock_atomic_sum_##_t##_sfx,				\
+	[FI_PROD] = sock_atomic_prod_##_t##_sfx
+
+#define SOCK_ATOMIC_BIT_OPS(_t, _sfx)					\
+	[FI_BOR] = sock_atomic_bor_##_t##_sfx,				\
+	[FI_BAND] = sock_atomic_band_##_t##_sfx,			\
+	[FI_BXOR] = sock_atomic_bxor_##_t##_sfx
+
+#define SOCK_ATOMIC_COMMON_OPS(_t)					\
+	[FI_LOR] = sock_atomic_lor_##_t,				\
+	[FI_LAND] = sock_atomic_land_##_t,				\
+	[FI_LXOR] = sock_atomic_lxor_##_t,				\
+	[FI_ATOMIC_READ] = sock_atomic_read_##_t,			\
+	[FI_ATOMIC_WRITE] = sock_atomic_write_##_t,			\
+	[FI_CSWAP] = sock_atomic_cswap_##_t,				\
+	[FI_CSWAP_NE] = sock_atomic_cswap_ne_##_t
+
+#define SOCK_ATOMIC_ORDER_OPS(_t)					\
+	[FI_CSWAP_LE] = sock_atomic_cswap_le_##_t,			\
+	[FI_CSWAP_LT] = sock_atomic_cswap_lt_##_t,			\
+	[FI_CSWAP_GE] = sock_atomic_cswap_ge_##_t,			\
+	[FI_CSWAP_GT] = sock_atomic_cswap_gt_##_t
+
+#define SOCK_ATOMIC_INT_OPS(_t) {					\
+	SOCK_ATOMIC_ARITH_OPS(_t, ),					\
+	SOCK_ATOMIC_BIT_OPS(_t, ),					\
+	SOCK_ATOMIC_COMMON_OPS(_t),					\
+	SOCK_ATOMIC_ORDER_OPS(_t),					\
+	[FI_MSWAP] = sock_atomic_mswap_##_t				\
+}
+
+#define SOCK_ATOMIC_FLOAT_OPS(_t) {					\
+	SOCK_ATOMIC_ARITH_OPS(_t, ),					\
+	SOCK_ATOMIC_COMMON_OPS(_t),					\
+	SOCK_ATOMIC_ORDER_OPS(_t)					\
+}
+
+#define SOCK_ATOMIC_COMPLEX_OPS(_t) {					\
+	[FI_SUM] = sock_atomic_sum_##_t,				\
+	[FI_PROD] = sock_atomic_prod_##_t,				\
+	SOCK_ATOMIC_COMMON_OPS(_t)					\
+}
+
+static sock_atomic_fn sock_atomic_ops[FI_DATATYPE_LAST][FI_ATOMIC_OP_LAST] = {
+	[FI_INT8] = SOCK_ATOMIC_INT_OPS(int8),
+	[FI_UINT8] = SOCK_ATOMIC_INT_OPS(uint8),
+	[FI_INT16] = SOCK_ATOMIC_INT_OPS(int16),
+	[FI_UINT16] = SOCK_ATOMIC_INT_OPS(uint16),
+	[FI_INT32] = SOCK_ATOMIC_INT_OPS(int32),
+	[FI_UINT32] = SOCK_ATOMIC_INT_OPS(uint32),
+	[FI_INT64] = SOCK_ATOMIC_INT_OPS(int64),
+	[FI_UINT64] = SOCK_ATOMIC_INT_OPS(uint64),
+	[FI_FLOAT] = SOCK_ATOMIC_FLOAT_OPS(float),
+	[FI_DOUBLE] = SOCK_ATOMIC_FLOAT_OPS(double),
+	[FI_LONG_DOUBLE] = SOCK_ATOMIC_FLOAT_OPS(ldouble),
+	[FI_FLOAT_COMPLEX] = SOCK_ATOMIC_COMPLEX_OPS(cfloat),
+	[FI_DOUBLE_COMPLEX] = SOCK_ATOMIC_COMPLEX_OPS(cdouble),
+	[FI_LONG_DOUBLE_COMPLEX] = SOCK_ATOMIC_COMPLEX_OPS(cldouble),
+};
+
+#ifdef SOCK_ATOMIC_HAVE_AVX2
+#define SOCK_ATOMIC_DEF_AVX2_INT(_t, _type)				\
+	SOCK_ATOMIC_DEF_ARITH(_t, _type, _avx2, SOCK_ATOMIC_AVX2)	\
+	SOCK_ATOMIC_DEF_BIT(_t, _type, _avx2, SOCK_ATOMIC_AVX2)
+
+SOCK_ATOMIC_DEF_AVX2_INT(int8, int8_t)
+SOCK_ATOMIC_DEF_AVX2_INT(uint8, uint8_t)
+SOCK_ATOMIC_DEF_AVX2_INT(int16, int16_t)
+SOCK_ATOMIC_DEF_AVX2_INT(uint16, uint16_t)
+SOCK_ATOMIC_DEF_AVX2_INT(int32, int32_t)
+SOCK_ATOMIC_DEF_AVX2_INT(uint32, uint32_t)
+SOCK_ATOMIC_DEF_AVX2_INT(int64, int64_t)
+SOCK_ATOMIC_DEF_AVX2_INT(uint64, uint64_t)
+SOCK_ATOMIC_DEF_ARITH(float, float, _avx2, SOCK_ATOMIC_AVX2)
+SOCK_ATOMIC_DEF_ARITH(double, double, _avx2, SOCK_ATOMIC_AVX2)
+
+#define SOCK_ATOMIC_SET(_dt, _op, _fn) sock_atomic_ops[_dt][_op] = _fn
+
+#define SOCK_ATOMIC_SET_ARITH(_dt, _t)					\
+	do {								\
+		SOCK_ATOMIC_SET(_dt, FI_MIN, sock_atomic_min_##_t##_avx2); \
+		SOCK_ATOMIC_SET(_dt, FI_MAX, sock_atomic_max_##_t##_avx2); \
+		SOCK_ATOMIC_SET(_dt, FI_SUM, sock_atomic_sum_##_t##_avx2); \
+		SOCK_ATOMIC_SET(_dt, FI_PROD, sock_atomic_prod_##_t##_avx2); \
+	} while (0)
+
+#define SOCK_ATOMIC_SET_INT(_dt, _t)					\
+	do {								\
+		SOCK_ATOMIC_SET_ARITH(_dt, _t);				\
+		SOCK_ATOMIC_SET(_dt, FI_BOR, sock_atomic_bor_##_t##_avx2); \
+		SOCK_ATOMIC_SET(_dt, FI_BAND, sock_atomic_band_##_t##_avx2); \
+		SOCK_ATOMIC_SET(_dt, FI_BXOR, sock_atomic_bxor_##_t##_avx2); \
+	} while (0)
+
+static void sock_atomic_init_avx2(void)
+{
+	SOCK_ATOMIC_SET_INT(FI_INT8, int8);
+	SOCK_ATOMIC_SET_INT(FI_UINT8, uint8);
+	SOCK_ATOMIC_SET_INT(FI_INT16, int16);
+	SOCK_ATOMIC_SET_INT(FI_UINT16, uint16);
+	SOCK_ATOMIC_SET_INT(FI_INT32, int32);
+	SOCK_ATOMIC_SET_INT(FI_UINT32, uint32);
+	SOCK_ATOMIC_SET_INT(FI_INT64, int64);
+	SOCK_ATOMIC_SET_INT(FI_UINT64, uint64);
+	SOCK_ATOMIC_SET_ARITH(FI_FLOAT, float);
+	SOCK_ATOMIC_SET_ARITH(FI_DOUBLE, double);
+}
+#endif
+
+void sock_atomic_init(void)
+{
+#ifdef SOCK_ATOMIC_HAVE_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		SOCK_LOG_DBG("Using AVX2 atomic kernels\n");
+		sock_atomic_init_avx2();
+	}
+#endif
+}
+
+sock_atomic_fn sock_atomic_lookup(enum fi_datatype datatype, enum fi_op op)
+{
+	if (datatype >= FI_DATATYPE_LAST || op >= FI_ATOMIC_OP_LAST)
+		return NULL;
+	return sock_atomic_ops[datatype][op];
+}
@@ -52,28 +52,67 @@
 #define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_AV, __VA_ARGS__)
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_AV, __VA_ARGS__)
 
-fi_addr_t sock_av_lookup_key(struct sock_av *av, int key)
+/* index AV entries added since the last lookup (possibly by a peer
+ * process sharing the table) */
+static void sock_av_update_hash(struct sock_av *av)
 {
-	int i;
+	for (; av->hashed < av->table_hdr->stored; av->hashed++) {
+		if (sock_addr_hash_insert(&av->addr_hash, (struct sockaddr_in *)
+					  &av->table[av->hashed].addr,
+					  av->hashed))
+			break;
+	}
+}
+
+static int sock_av_lookup_index(struct sock_av *av, struct sockaddr_in *addr,
+				uint64_t *index)
+{
+	int ret;
+
+	fastlock_acquire(&av->lock);
+	sock_av_update_hash(av);
+	ret = sock_addr_hash_lookup(&av->addr_hash, addr, index);
+	fastlock_release(&av->lock);
+	return ret;
+}
+
+/* ip/port of an AV entry packed into one value, 0 if out of range */
+uint64_t sock_av_addr_key(struct sock_av *av, fi_addr_t addr)
+{
+	int index = ((uint64_t)addr & av->mask);
 	struct sock_av_addr *av_addr;
-	struct sock_conn_map *cmap;
+	struct sockaddr_in *sin;
 
-	cmap = av->cmap;
-	for (i = 0; i < av->table_hdr->stored; i++) {
-		av_addr = &av->table[i];
-		if (sock_compare_addr(&cmap->table[key].addr,
-				      (struct sockaddr_in *)&av_addr->addr)) {
-			SOCK_LOG_DBG("LOOKUP: (%d->%d)\n", key, i);
-			return i;
-		}
-	}
+	if (index >= av->table_hdr->stored || index < 0)
+		return 0;
+
+	av_addr = idm_lookup(&av->addr_idm, index);
+	sin = (struct sockaddr_in *) &av_addr->addr;
+	return ((uint64_t) sin->sin_addr.s_addr << 16) | sin->sin_port;
+}
+
+fi_addr_t _sock_av_lookup(struct sock_av *av, struct sockaddr *addr)
+{
+	uint64_t index;
 
-	SOCK_LOG_DBG("Reverse-LOOKUP failed: %d, %s:%d\n", key,
-		       inet_ntoa(cmap->table[key].addr.sin_addr),
-		       ntohs(cmap->table[key].addr.sin_port));
-	return FI_ADDR_NOTAVAIL;
+	if (sock_av_lookup_index(av, (struct sockaddr_in *) addr, &index))
+		return FI_ADDR_NOTAVAIL;
+	return index;
 }
 
+int sock_av_get_sockaddr(struct sock_av *av, fi_addr_t addr,
+			 struct sockaddr_in *sin)
+{
+	int index = ((uint64_t)addr & av->mask);
+	struct sock_av_addr *av_addr;
+
+	if (index >= av->table_hdr->stored || index < 0)
+		return -FI_EINVAL;
+
+	av_addr = idm_lookup(&av->addr_idm, index);
+	memcpy(sin, &av_addr->addr, sizeof(*sin));
+	return 0;
+}
 
 int sock_av_compare_addr(struct sock_av *av,
 			 fi_addr_t addr1, fi_addr_t addr2)
@@ -97,6 +136,13 @@ int sock_av_compare_addr(struct sock_av *av,
 		      sizeof(struct sockaddr_in));
 }
 
+/* each PE has its own connections, so the cached keys are per PE */
+static inline uint16_t *sock_av_key(struct sock_av *av, int idx,
+				    struct sock_pe *pe)
+{
+	return &av->key[idx * av->domain->num_pe + pe->index];
+}
+
 struct sock_conn *sock_av_lookup_addr(struct sock_ep *ep,
 				      struct sock_av *av,
 				      fi_addr_t addr)
@@ -104,6 +150,9 @@ struct sock_conn *sock_av_lookup_addr(struct sock_ep *ep,
 	int idx, ret;
 	int index = ((uint64_t)addr & av->mask);
 	struct sock_av_addr *av_addr;
+	struct sock_conn_map *cmap;
+	struct sock_conn *conn;
+	uint16_t *key;
 
 	if (index >= av->table_hdr->stored || index < 0) {
 		SOCK_LOG_ERROR("requested rank is larger than av table\n");
@@ -111,26 +160,144 @@ struct sock_conn *sock_av_lookup_addr(struct sock_ep *ep,
 		return NULL;
 	}
 
-	if (!av->cmap) {
-		SOCK_LOG_ERROR("EP with no AV bound\n");
-		errno = EINVAL;
-		return NULL;
-	}
-
 	av_addr = idm_lookup(&av->addr_idm, index);
 	idx = av_addr - &av->table[0];
-	if (!av->key[idx]) {
+	cmap = &ep->pe->cmap;
+	key = sock_av_key(av, idx, ep->pe);
+	conn = *key ? sock_conn_map_lookup_key(cmap, *key) : NULL;
+	if (!conn || conn->state == SOCK_CONN_STATE_FAILED) {
 		ret = sock_conn_map_match_or_connect(
-			ep, av->domain, av->cmap,
-			(struct sockaddr_in *)&av_addr->addr,
-			&av->key[idx]);
+			ep, av->domain, cmap,
+			(struct sockaddr_in *)&av_addr->addr, key);
 		if (ret) {
 			SOCK_LOG_ERROR("failed to match or connect to addr %"
 					PRIu64 "\n", addr);
+			errno = -ret;
 			return NULL;
 		}
+		conn = sock_conn_map_lookup_key(cmap, *key);
+	}
+	return conn;
+}
+
+/* an endpoint whose listener can take part in the connect handshake */
+static struct sock_ep *sock_av_cm_ep(struct sock_av *av, struct sock_pe *pe)
+{
+	struct dlist_entry *entry;
+	struct sock_ep *ep, *cm_ep = NULL;
+
+	fastlock_acquire(&av->lock);
+	for (entry = av->ep_list.next; entry != &av->ep_list;
+	     entry = entry->next) {
+		ep = container_of(entry, struct sock_ep, av_entry);
+		if (ep->listener.do_listen && !ep->dgram &&
+		    (!pe || ep->pe == pe)) {
+			cm_ep = ep;
+			break;
+		}
+	}
+	fastlock_release(&av->lock);
+	return cm_ep;
+}
+
+/* queue background connects to the AV entries from first onwards */
+void sock_av_connect(struct sock_av *av, int first)
+{
+	int i, p, queued;
+	struct sock_ep *ep;
+	struct sock_pe *pe;
+	uint16_t *key;
+
+	for (p = 0; p < av->domain->num_pe; p++) {
+		pe = av->domain->pe[p];
+		ep = sock_av_cm_ep(av, pe);
+		if (!ep)
+			continue;
+
+		for (i = first, queued = 0; i < av->table_hdr->stored; i++) {
+			key = sock_av_key(av, i, pe);
+			if (*key || !av->table[i].valid)
+				continue;
+
+			if (sock_conn_map_preconnect(ep, &pe->cmap,
+				(struct sockaddr_in *) &av->table[i].addr, key))
+				break;
+			queued++;
+		}
+
+		if (queued)
+			sock_pe_signal(pe);
+	}
+}
+
+enum {
+	SOCK_AV_CONN_CONNECTED,
+	SOCK_AV_CONN_PENDING,
+	SOCK_AV_CONN_FAILED,
+	SOCK_AV_CONN_CLOSED,
+};
+
+/* an address counts as connected once every PE wiring up the AV has it */
+static int sock_av_conn_status(struct sock_av *av,
+			       struct fi_sockets_av_conn_status *status)
+{
+	int i, p, *state;
+	struct sock_conn *conn;
+	struct sock_pe *pe;
+	struct fi_sockets_av_conn_status st;
+	uint16_t *key;
+
+	if (!sock_av_cm_ep(av, NULL))
+		return -FI_EOPBADSTATE;
+
+	state = calloc(av->table_hdr->stored + 1, sizeof(*state));
+	if (!state)
+		return -FI_ENOMEM;
+
+	sock_av_connect(av, 0);
+	for (p = 0; p < av->domain->num_pe; p++) {
+		pe = av->domain->pe[p];
+		if (!sock_av_cm_ep(av, pe))
+			continue;
+
+		sock_conn_map_progress(&pe->cmap);
+		fastlock_acquire(&pe->cmap.lock);
+		for (i = 0; i < av->table_hdr->stored; i++) {
+			key = sock_av_key(av, i, pe);
+			conn = *key ? sock_conn_map_lookup_key(&pe->cmap, *key) :
+				NULL;
+			if (conn && conn->state == SOCK_CONN_STATE_FAILED)
+				state[i] = SOCK_AV_CONN_FAILED;
+			else if (conn && conn->state == SOCK_CONN_STATE_CLOSED) {
+				if (state[i] == SOCK_AV_CONN_CONNECTED)
+					state[i] = SOCK_AV_CONN_CLOSED;
+			} else if ((!conn ||
+				  conn->state != SOCK_CONN_STATE_CONNECTED) &&
+				 state[i] != SOCK_AV_CONN_FAILED)
+				state[i] = SOCK_AV_CONN_PENDING;
+		}
+		fastlock_release(&pe->cmap.lock);
+	}
+
+	memset(&st, 0, sizeof(st));
+	for (i = 0; i < av->table_hdr->stored; i++) {
+		if (!av->table[i].valid)
+			continue;
+
+		if (state[i] == SOCK_AV_CONN_CONNECTED)
+			st.connected++;
+		else if (state[i] == SOCK_AV_CONN_FAILED)
+			st.failed++;
+		else if (state[i] == SOCK_AV_CONN_CLOSED)
+			st.closed++;
+		else
+			st.pending++;
 	}
-	return sock_conn_map_lookup_key(av->cmap, av->key[idx]);
+	free(state);
+
+	if (status)
+		*status = st;
+	return st.pending ? -FI_EAGAIN : 0;
 }
 
 static inline void sock_av_report_success(struct sock_av *av, void *context,
@@ -168,7 +335,9 @@ static int sock_check_table_in(struct sock_av *_av, struct sockaddr_in *addr,
 			       void *context, int index)
 {
 	void *new_addr;
-	int i, j, ret = 0;
+	int i, ret = 0, first;
+	int num_pe = _av->domain->num_pe;
+	uint64_t j;
 	char sa_ip[INET_ADDRSTRLEN];
 	struct sock_av_addr *av_addr;
 	size_t new_count, table_sz, old_sz;
@@ -178,41 +347,38 @@ static int sock_check_table_in(struct sock_av *_av, struct sockaddr_in *addr,
 
 	if (_av->attr.flags & FI_READ) {
 		for (i = 0; i < count; i++) {
-			for (j = 0; j < _av->table_hdr->stored; j++) {
-
-				if (!sock_av_is_valid_address(&addr[i])) {
-					if (fi_addr)
-						fi_addr[i] = FI_ADDR_NOTAVAIL;
-					sock_av_report_error(_av, context, i,
-								FI_EINVAL);
-					continue;
-				}
+			if (!sock_av_is_valid_address(&addr[i])) {
+				if (fi_addr)
+					fi_addr[i] = FI_ADDR_NOTAVAIL;
+				sock_av_report_error(_av, context, i,
+							FI_EINVAL);
+				continue;
+			}
 
-				av_addr = &_av->table[j];
+			if (sock_av_lookup_index(_av, &addr[i], &j))
+				continue;
 
-				if (memcmp(&av_addr->addr, &addr[i],
-					   sizeof(struct sockaddr_in)) == 0) {
-					SOCK_LOG_DBG("Found addr in shared av\n");
-					if (idm_set(&_av->addr_idm, _av->key[j],
-							 av_addr) < 0) {
-						if (fi_addr)
-							fi_addr[i] = FI_ADDR_NOTAVAIL;
-						sock_av_report_error(_av,
-							context, i, FI_EINVAL);
-						continue;
-					}
+			av_addr = &_av->table[j];
+			SOCK_LOG_DBG("Found addr in shared av\n");
+			if (idm_set(&_av->addr_idm, _av->key[j * num_pe],
+					 av_addr) < 0) {
+				if (fi_addr)
+					fi_addr[i] = FI_ADDR_NOTAVAIL;
+				sock_av_report_error(_av,
+					context, i, FI_EINVAL);
+				continue;
+			}
 
-					if (fi_addr)
-						fi_addr[i] = (fi_addr_t)j;
+			if (fi_addr)
+				fi_addr[i] = (fi_addr_t)j;
 
-					ret++;
-				}
-			}
+			ret++;
 		}
 		sock_av_report_success(_av, context, ret, flags);
 		return (_av->attr.flags & FI_EVENT) ? 0 : ret;
 	}
 
+	first = _av->table_hdr->stored;
 	for (i = 0, ret = 0; i < count; i++) {
 
 		if (_av->table_hdr->stored == _av->table_hdr->size) {
@@ -224,8 +390,8 @@ static int sock_check_table_in(struct sock_av *_av, struct sockaddr_in *addr,
 				continue;
 			} else{
 				new_count = _av->table_hdr->size * 2;
-				_av->key = realloc(_av->key,
-						   sizeof(uint16_t) * new_count);
+				_av->key = realloc(_av->key, sizeof(uint16_t) *
+						   new_count * num_pe);
 				if (!_av->key) {
 					if (fi_addr)
 						fi_addr[i] = FI_ADDR_NOTAVAIL;
@@ -233,6 +399,9 @@ static int sock_check_table_in(struct sock_av *_av, struct sockaddr_in *addr,
 								FI_ENOMEM);
 					continue;
 				}
+				memset(&_av->key[_av->table_hdr->size * num_pe],
+				       0, sizeof(uint16_t) * num_pe *
+				       (new_count - _av->table_hdr->size));
 
 				table_sz = sizeof(struct sock_av_table_hdr) +
 					new_count * sizeof(struct sock_av_addr);
@@ -297,6 +466,9 @@ static int sock_check_table_in(struct sock_av *_av, struct sockaddr_in *addr,
 		_av->table_hdr->stored++;
 		ret++;
 	}
+
+	if (sock_av_preconnect)
+		sock_av_connect(_av, first);
 	sock_av_report_success(_av, context, ret, flags);
 	return (_av->attr.flags & FI_EVENT) ? 0 : ret;
 }
@@ -492,16 +664,31 @@ static int sock_av_close(struct fid *fid)
 	}
 
 	atomic_dec(&av->domain->ref);
+	sock_addr_hash_free(&av->addr_hash);
+	fastlock_destroy(&av->lock);
 	free(av->key);
 	free(av);
 	return 0;
 }
 
+static int sock_av_control(struct fid *fid, int command, void *arg)
+{
+	struct sock_av *av;
+
+	av = container_of(fid, struct sock_av, av_fid.fid);
+	switch (command) {
+	case FI_SOCKETS_AV_CONN_STATUS:
+		return sock_av_conn_status(av, arg);
+	default:
+		return -FI_EINVAL;
+	}
+}
+
 static struct fi_ops sock_av_fi_ops = {
 	.size = sizeof(struct fi_ops),
 	.close = sock_av_close,
 	.bind = sock_av_bind,
-	.control = fi_no_control,
+	.control = sock_av_control,
 	.ops_open = fi_no_ops_open,
 };
 
@@ -569,12 +756,17 @@ int sock_av_open(struct fid_domain *domain, struct fi_av_attr *attr,
 	_av->attr = *attr;
 	_av->attr.count = (attr->count) ? attr->count : sock_av_def_sz;
 
-	_av->key = calloc(_av->attr.count, sizeof(uint16_t));
+	_av->key = calloc(_av->attr.count * dom->num_pe, sizeof(uint16_t));
 	if (!_av->key) {
 		ret = -FI_ENOMEM;
 		goto err1;
 	}
 
+	if (sock_addr_hash_init(&_av->addr_hash, _av->attr.count * 2)) {
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+
 	table_sz = sizeof(struct sock_av_table_hdr) +
 		_av->attr.count * sizeof(struct sock_av_addr);
 
@@ -655,6 +847,8 @@ int sock_av_open(struct fid_domain *domain, struct fi_av_attr *attr,
 	}
 
 	atomic_initialize(&_av->ref, 0);
+	fastlock_init(&_av->lock);
+	dlist_init(&_av->ep_list);
 	atomic_inc(&dom->ref);
 	_av->domain = dom;
 	switch (dom->info.addr_format) {
@@ -677,6 +871,7 @@ err3:
 err2:
 	free(_av->name);
 err1:
+	sock_addr_hash_free(&_av->addr_hash);
 	free(_av->key);
 	free(_av);
 
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2015 Intel Corporation, Inc.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "sock.h"
+#include "sock_util.h"
+
+#define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_EP_CTRL, __VA_ARGS__)
+#define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_CTRL, __VA_ARGS__)
+
+/*
+ * All connection management traffic of a fabric is driven from a single
+ * thread.  Handlers are looked up by fd when an event fires, so that a
+ * handler removed by another thread is never called once the removal
+ * returns.  Handlers run with the loop lock held and may add or remove
+ * handlers themselves.
+ */
+
+static int sock_cm_loop_self(struct sock_cm_loop *loop)
+{
+	return loop->started && pthread_equal(loop->thread, pthread_self());
+}
+
+static void sock_cm_loop_run_timers(struct sock_cm_loop *loop)
+{
+	struct dlist_entry *entry, *next;
+	struct sock_cm_handler *handler;
+
+	for (entry = loop->timer_list.next; entry != &loop->timer_list;
+	     entry = next) {
+		next = entry->next;
+		handler = container_of(entry, struct sock_cm_handler,
+				       timer_entry);
+		if (!handler->timer(handler)) {
+			dlist_remove(entry);
+			dlist_init(entry);
+		}
+	}
+}
+
+static void *sock_cm_loop_thread(void *data)
+{
+	struct sock_cm_loop *loop = data;
+	struct sock_cm_handler *handler;
+	void *ctxs[SOCK_EPOLL_WAIT_SZ];
+	int i, fd, num_fds, timeout = -1;
+	char tmp;
+
+	SOCK_LOG_DBG("Starting CM loop for %p\n", loop);
+	while (*((volatile int *) &loop->do_progress)) {
+		num_fds = fi_epoll_wait(loop->epoll_set, ctxs,
+					SOCK_EPOLL_WAIT_SZ, timeout);
+		if (num_fds < 0) {
+			SOCK_LOG_ERROR("epoll wait failed: %d\n", num_fds);
+			break;
+		}
+
+		fastlock_acquire(&loop->lock);
+		for (i = 0; i < num_fds; i++) {
+			fd = (int) (intptr_t) ctxs[i];
+			if (fd == loop->signal_fds[SOCK_SIGNAL_RD_FD]) {
+				while (read(fd, &tmp, 1) == 1)
+					;
+				continue;
+			}
+
+			handler = fd < loop->num_handlers ?
+				loop->handlers[fd] : NULL;
+			if (handler)
+				handler->handle(handler);
+		}
+
+		sock_cm_loop_run_timers(loop);
+		timeout = dlist_empty(&loop->timer_list) ? -1 :
+			SOCK_CM_COMM_TIMEOUT;
+		fastlock_release(&loop->lock);
+	}
+
+	SOCK_LOG_DBG("CM loop for %p exited\n", loop);
+	return NULL;
+}
+
+static void sock_cm_loop_signal(struct sock_cm_loop *loop)
+{
+	char c = 0;
+
+	if (write(loop->signal_fds[SOCK_SIGNAL_WR_FD], &c, 1) != 1)
+		SOCK_LOG_DBG("Failed to signal\n");
+}
+
+int sock_cm_loop_init(struct sock_cm_loop *loop)
+{
+	int ret;
+
+	memset(loop, 0, sizeof(*loop));
+	fastlock_init(&loop->lock);
+	dlist_init(&loop->timer_list);
+
+	ret = fi_epoll_create(&loop->epoll_set);
+	if (ret)
+		goto err1;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, loop->signal_fds) < 0) {
+		ret = -errno;
+		goto err2;
+	}
+
+	fd_set_nonblock(loop->signal_fds[SOCK_SIGNAL_RD_FD]);
+	ret = fi_epoll_add(loop->epoll_set,
+			   loop->signal_fds[SOCK_SIGNAL_RD_FD], FI_EPOLL_IN,
+			   (void *) (intptr_t)
+			   loop->signal_fds[SOCK_SIGNAL_RD_FD]);
+	if (ret)
+		goto err3;
+	return 0;
+
+err3:
+	close(loop->signal_fds[0]);
+	close(loop->signal_fds[1]);
+err2:
+	fi_epoll_close(loop->epoll_set);
+err1:
+	fastlock_destroy(&loop->lock);
+	return ret;
+}
+
+void sock_cm_loop_fini(struct sock_cm_loop *loop)
+{
+	if (loop->started) {
+		loop->do_progress = 0;
+		sock_cm_loop_signal(loop);
+		if (pthread_join(loop->thread, NULL))
+			SOCK_LOG_ERROR("pthread join failed\n");
+	}
+
+	close(loop->signal_fds[0]);
+	close(loop->signal_fds[1]);
+	fi_epoll_close(loop->epoll_set);
+	free(loop->handlers);
+	fastlock_destroy(&loop->lock);
+}
+
+static int sock_cm_loop_insert(struct sock_cm_loop *loop,
+			       struct sock_cm_handler *handler)
+{
+	struct sock_cm_handler **handlers;
+	int ret, size;
+
+	if (handler->fd >= loop->num_handlers) {
+		size = MAX(loop->num_handlers * 2, handler->fd + 1);
+		handlers = realloc(loop->handlers, size * sizeof(*handlers));
+		if (!handlers)
+			return -FI_ENOMEM;
+
+		memset(&handlers[loop->num_handlers], 0,
+		       (size - loop->num_handlers) * sizeof(*handlers));
+		loop->handlers = handlers;
+		loop->num_handlers = size;
+	}
+
+	ret = fi_epoll_add(loop->epoll_set, handler->fd,
+			   handler->events ? handler->events : FI_EPOLL_IN,
+			   (void *) (intptr_t) handler->fd);
+	if (ret)
+		return ret;
+
+	if (!loop->started) {
+		loop->do_progress = 1;
+		if (pthread_create(&loop->thread, NULL,
+				   sock_cm_loop_thread, loop)) {
+			SOCK_LOG_ERROR("Couldn't create CM thread\n");
+			fi_epoll_del(loop->epoll_set, handler->fd);
+			return -FI_EAGAIN;
+		}
+		loop->started = 1;
+	}
+
+	dlist_init(&handler->timer_entry);
+	handler->loop = loop;
+	loop->handlers[handler->fd] = handler;
+	return 0;
+}
+
+int sock_cm_loop_add(struct sock_cm_loop *loop,
+		     struct sock_cm_handler *handler)
+{
+	int ret;
+
+	if (sock_cm_loop_self(loop))
+		return sock_cm_loop_insert(loop, handler);
+
+	fastlock_acquire(&loop->lock);
+	ret = sock_cm_loop_insert(loop, handler);
+	fastlock_release(&loop->lock);
+	return ret;
+}
+
+/* caller holds the loop lock */
+void sock_cm_loop_remove(struct sock_cm_handler *handler)
+{
+	struct sock_cm_loop *loop = handler->loop;
+
+	if (!loop)
+		return;
+
+	fi_epoll_del(loop->epoll_set, handler->fd);
+	loop->handlers[handler->fd] = NULL;
+	dlist_remove(&handler->timer_entry);
+	dlist_init(&handler->timer_entry);
+	handler->loop = NULL;
+}
+
+void sock_cm_loop_del(struct sock_cm_handler *handler)
+{
+	struct sock_cm_loop *loop = handler->loop;
+
+	if (!loop)
+		return;
+
+	if (sock_cm_loop_self(loop)) {
+		sock_cm_loop_remove(handler);
+		return;
+	}
+
+	fastlock_acquire(&loop->lock);
+	sock_cm_loop_remove(handler);
+	fastlock_release(&loop->lock);
+}
+
+/* run the handler's timer from the loop until it reports nothing pending */
+void sock_cm_loop_kick(struct sock_cm_handler *handler)
+{
+	struct sock_cm_loop *loop = handler->loop;
+
+	if (!loop)
+		return;
+
+	if (sock_cm_loop_self(loop)) {
+		if (dlist_empty(&handler->timer_entry))
+			dlist_insert_tail(&handler->timer_entry,
+					  &loop->timer_list);
+		return;
+	}
+
+	fastlock_acquire(&loop->lock);
+	if (handler->loop && dlist_empty(&handler->timer_entry))
+		dlist_insert_tail(&handler->timer_entry, &loop->timer_list);
+	fastlock_release(&loop->lock);
+	sock_cm_loop_signal(loop);
+}
@@ -66,91 +66,161 @@ int sock_cntr_progress(struct sock_cntr *cntr)
 	for (entry = cntr->tx_list.next; entry != &cntr->tx_list;
 	     entry = entry->next) {
 		tx_ctx = container_of(entry, struct sock_tx_ctx, cntr_entry);
-		sock_pe_progress_tx_ctx(cntr->domain->pe, tx_ctx);
+		sock_pe_progress_tx_ctx(cntr->domain->pe[0], tx_ctx);
 	}
 
 	for (entry = cntr->rx_list.next; entry != &cntr->rx_list;
 	     entry = entry->next) {
 		rx_ctx = container_of(entry, struct sock_rx_ctx, cntr_entry);
-		sock_pe_progress_rx_ctx(cntr->domain->pe, rx_ctx);
+		sock_pe_progress_rx_ctx(cntr->domain->pe[0], rx_ctx);
 	}
 	fastlock_release(&cntr->list_lock);
 
 	return 0;
 }
 
-void sock_cntr_check_trigger_list(struct sock_cntr *cntr)
+static inline int sock_trigger_before(struct sock_trigger *a,
+				      struct sock_trigger *b)
 {
-	struct sock_trigger *trigger;
-	struct dlist_entry *entry;
-	int ret = 0;
-
-	fastlock_acquire(&cntr->trigger_lock);
-	for (entry = cntr->trigger_list.next;
-	     entry != &cntr->trigger_list;) {
-
-		trigger = container_of(entry, struct sock_trigger, entry);
-		entry = entry->next;
+	return a->threshold < b->threshold ||
+		(a->threshold == b->threshold && a->seq < b->seq);
+}
 
-		if (atomic_get(&cntr->value) < trigger->threshold)
-			continue;
+static void sock_cntr_trigger_up(struct sock_cntr *cntr, size_t i)
+{
+	struct sock_trigger **heap = cntr->trigger_heap;
+	struct sock_trigger *trigger = heap[i];
+	size_t parent;
 
-		switch (trigger->op_type) {
-		case SOCK_OP_SEND:
-			ret = sock_ep_sendmsg(trigger->ep, &trigger->op.msg.msg,
-					trigger->flags & ~FI_TRIGGER);
+	while (i) {
+		parent = (i - 1) / 2;
+		if (!sock_trigger_before(trigger, heap[parent]))
 			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = trigger;
+}
 
-		case SOCK_OP_RECV:
-			ret = sock_ep_recvmsg(trigger->ep, &trigger->op.msg.msg,
-					trigger->flags & ~FI_TRIGGER);
+static void sock_cntr_trigger_down(struct sock_cntr *cntr, size_t i)
+{
+	struct sock_trigger **heap = cntr->trigger_heap;
+	struct sock_trigger *trigger = heap[i];
+	size_t child;
+
+	while ((child = 2 * i + 1) < cntr->num_triggers) {
+		if (child + 1 < cntr->num_triggers &&
+		    sock_trigger_before(heap[child + 1], heap[child]))
+			child++;
+		if (!sock_trigger_before(heap[child], trigger))
 			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = trigger;
+}
+
+static ssize_t sock_cntr_issue_trigger(struct sock_trigger *trigger)
+{
+	ssize_t ret;
+
+	switch (trigger->op_type) {
+	case SOCK_OP_SEND:
+		ret = sock_ep_sendmsg(trigger->ep, &trigger->op.msg.msg,
+				trigger->flags & ~FI_TRIGGER);
+		break;
+
+	case SOCK_OP_RECV:
+		ret = sock_ep_recvmsg(trigger->ep, &trigger->op.msg.msg,
+				trigger->flags & ~FI_TRIGGER);
+		break;
+
+	case SOCK_OP_TSEND:
+		ret = sock_ep_tsendmsg(trigger->ep,
+				&trigger->op.tmsg.msg,
+				trigger->flags & ~FI_TRIGGER);
+		break;
 
-		case SOCK_OP_TSEND:
-			ret = sock_ep_tsendmsg(trigger->ep,
-					&trigger->op.tmsg.msg,
+	case SOCK_OP_TRECV:
+		ret = sock_ep_trecvmsg(trigger->ep,
+				&trigger->op.tmsg.msg,
+				trigger->flags & ~FI_TRIGGER);
+		break;
+
+	case SOCK_OP_WRITE:
+		ret = sock_ep_rma_writemsg(trigger->ep,
+					&trigger->op.rma.msg,
 					trigger->flags & ~FI_TRIGGER);
-			break;
+		break;
 
-		case SOCK_OP_TRECV:
-			ret = sock_ep_trecvmsg(trigger->ep,
-					&trigger->op.tmsg.msg,
+	case SOCK_OP_READ:
+		ret = sock_ep_rma_readmsg(trigger->ep,
+					&trigger->op.rma.msg,
 					trigger->flags & ~FI_TRIGGER);
-			break;
+		break;
 
-		case SOCK_OP_WRITE:
-			ret = sock_ep_rma_writemsg(trigger->ep,
-						&trigger->op.rma.msg,
-						trigger->flags & ~FI_TRIGGER);
-			break;
+	case SOCK_OP_ATOMIC:
+		ret = sock_ep_tx_atomic(trigger->ep,
+				&trigger->op.atomic.msg,
+				trigger->op.atomic.comparev,
+				NULL,
+				trigger->op.atomic.compare_count,
+				trigger->op.atomic.resultv,
+				NULL,
+				trigger->op.atomic.result_count,
+				trigger->flags & ~FI_TRIGGER);
+		break;
 
-		case SOCK_OP_READ:
-			ret = sock_ep_rma_readmsg(trigger->ep,
-						&trigger->op.rma.msg,
-						trigger->flags & ~FI_TRIGGER);
-			break;
+	default:
+		SOCK_LOG_ERROR("unsupported op\n");
+		ret = 0;
+		break;
+	}
+	return ret;
+}
 
-		case SOCK_OP_ATOMIC:
-			ret = sock_ep_tx_atomic(trigger->ep,
-					&trigger->op.atomic.msg,
-					trigger->op.atomic.comparev,
-					NULL,
-					trigger->op.atomic.compare_count,
-					trigger->op.atomic.resultv,
-					NULL,
-					trigger->op.atomic.result_count,
-					trigger->flags & ~FI_TRIGGER);
-			break;
+void sock_cntr_check_trigger_list(struct sock_cntr *cntr)
+{
+	struct fid_ep *blocked[SOCK_CNTR_TRIGGER_BLOCKED];
+	struct sock_trigger *trigger;
+	struct dlist_entry *entry;
+	int i, num_blocked = 0;
+	uint64_t value;
 
-		default:
-			SOCK_LOG_ERROR("unsupported op\n");
-			ret = 0;
-			break;
-		}
+	if (!atomic_get(&cntr->num_pending))
+		return;
+
+	fastlock_acquire(&cntr->trigger_lock);
+	value = atomic_get(&cntr->value);
+	while (cntr->num_triggers && cntr->trigger_heap[0]->threshold <= value) {
+		trigger = cntr->trigger_heap[0];
+		cntr->trigger_heap[0] = cntr->trigger_heap[--cntr->num_triggers];
+		if (cntr->num_triggers)
+			sock_cntr_trigger_down(cntr, 0);
+		dlist_insert_tail(&trigger->entry, &cntr->trigger_ready);
+	}
+
+	/*
+	 * A trigger that cannot be issued yet stays queued for the next pass
+	 * and holds back later triggers on the same endpoint to keep them in
+	 * order; triggers on other endpoints still go out.
+	 */
+	for (entry = cntr->trigger_ready.next;
+	     entry != &cntr->trigger_ready;) {
+		trigger = container_of(entry, struct sock_trigger, entry);
+		entry = entry->next;
+
+		for (i = 0; i < num_blocked && blocked[i] != trigger->ep; i++)
+			;
+		if (i < num_blocked)
+			continue;
 
-		if (ret != -FI_EAGAIN) {
+		if (sock_cntr_issue_trigger(trigger) != -FI_EAGAIN) {
 			dlist_remove(&trigger->entry);
+			atomic_dec(&cntr->num_pending);
 			free(trigger);
+		} else if (num_blocked < SOCK_CNTR_TRIGGER_BLOCKED) {
+			blocked[num_blocked++] = trigger->ep;
 		} else {
 			break;
 		}
@@ -158,6 +228,39 @@ void sock_cntr_check_trigger_list(struct sock_cntr *cntr)
 	fastlock_release(&cntr->trigger_lock);
 }
 
+int sock_cntr_queue_trigger(struct sock_cntr *cntr,
+			    struct sock_trigger *trigger)
+{
+	struct sock_trigger **heap;
+	size_t size, threshold;
+
+	fastlock_acquire(&cntr->trigger_lock);
+	if (cntr->num_triggers == cntr->trigger_heap_sz) {
+		size = cntr->trigger_heap_sz ? cntr->trigger_heap_sz * 2 :
+			SOCK_CNTR_TRIGGER_HEAP_SZ;
+		heap = realloc(cntr->trigger_heap, size * sizeof(*heap));
+		if (!heap) {
+			fastlock_release(&cntr->trigger_lock);
+			return -FI_ENOMEM;
+		}
+		cntr->trigger_heap = heap;
+		cntr->trigger_heap_sz = size;
+	}
+
+	/* once queued, the trigger may be issued and freed by another thread */
+	threshold = trigger->threshold;
+	trigger->seq = cntr->trigger_seq++;
+	cntr->trigger_heap[cntr->num_triggers] = trigger;
+	sock_cntr_trigger_up(cntr, cntr->num_triggers++);
+	atomic_inc(&cntr->num_pending);
+	fastlock_release(&cntr->trigger_lock);
+
+	/* the counter may have reached the threshold while we queued */
+	if (atomic_get(&cntr->value) >= threshold)
+		sock_cntr_check_trigger_list(cntr);
+	return 0;
+}
+
 static uint64_t sock_cntr_read(struct fid_cntr *cntr)
 {
 	struct sock_cntr *_cntr;
@@ -166,13 +269,40 @@ static uint64_t sock_cntr_read(struct fid_cntr *cntr)
 	return atomic_get(&_cntr->value);
 }
 
-int sock_cntr_inc(struct sock_cntr *cntr)
+/* caller holds cntr->mut */
+static void sock_cntr_update_threshold(struct sock_cntr *cntr)
 {
+	struct sock_cntr_waiter *waiter;
+	struct dlist_entry *entry;
+	uint64_t threshold = ~0;
+
+	for (entry = cntr->waiter_list.next; entry != &cntr->waiter_list;
+	     entry = entry->next) {
+		waiter = container_of(entry, struct sock_cntr_waiter, entry);
+		if (waiter->threshold < threshold)
+			threshold = waiter->threshold;
+	}
+	atomic_set(&cntr->threshold, threshold);
+}
+
+static void sock_cntr_signal(struct sock_cntr *cntr, int value)
+{
+	sock_poll_notify(&cntr->poll_list);
+	if (cntr->signal)
+		sock_wait_signal(cntr->waitset);
+
+	if (!atomic_get(&cntr->num_waiters) ||
+	    value < atomic_get(&cntr->threshold))
+		return;
+
 	pthread_mutex_lock(&cntr->mut);
-	atomic_inc(&cntr->value);
-	if (atomic_get(&cntr->value) >= atomic_get(&cntr->threshold))
-		pthread_cond_signal(&cntr->cond);
+	pthread_cond_broadcast(&cntr->cond);
 	pthread_mutex_unlock(&cntr->mut);
+}
+
+int sock_cntr_inc(struct sock_cntr *cntr)
+{
+	sock_cntr_signal(cntr, atomic_inc(&cntr->value));
 	sock_cntr_check_trigger_list(cntr);
 	return 0;
 }
@@ -183,8 +313,12 @@ int sock_cntr_err_inc(struct sock_cntr *cntr)
 	atomic_inc(&cntr->err_cnt);
 	if (!cntr->err_flag)
 		cntr->err_flag = 1;
-	pthread_cond_signal(&cntr->cond);
+	pthread_cond_broadcast(&cntr->cond);
 	pthread_mutex_unlock(&cntr->mut);
+
+	sock_poll_notify(&cntr->poll_list);
+	if (cntr->signal)
+		sock_wait_signal(cntr->waitset);
 	return 0;
 }
 
@@ -193,11 +327,8 @@ static int sock_cntr_add(struct fid_cntr *cntr, uint64_t value)
 	struct sock_cntr *_cntr;
 
 	_cntr = container_of(cntr, struct sock_cntr, cntr_fid);
-	pthread_mutex_lock(&_cntr->mut);
-	atomic_set(&_cntr->value, atomic_get(&_cntr->value) + value);
-	if (atomic_get(&_cntr->value) >= atomic_get(&_cntr->threshold))
-		pthread_cond_signal(&_cntr->cond);
-	pthread_mutex_unlock(&_cntr->mut);
+	atomic_add(&_cntr->value, value);
+	sock_cntr_signal(_cntr, atomic_get(&_cntr->value));
 	sock_cntr_check_trigger_list(_cntr);
 	return 0;
 }
@@ -207,11 +338,8 @@ static int sock_cntr_set(struct fid_cntr *cntr, uint64_t value)
 	struct sock_cntr *_cntr;
 
 	_cntr = container_of(cntr, struct sock_cntr, cntr_fid);
-	pthread_mutex_lock(&_cntr->mut);
 	atomic_set(&_cntr->value, value);
-	if (atomic_get(&_cntr->value) >= atomic_get(&_cntr->threshold))
-		pthread_cond_signal(&_cntr->cond);
-	pthread_mutex_unlock(&_cntr->mut);
+	sock_cntr_signal(_cntr, value);
 	sock_cntr_check_trigger_list(_cntr);
 	return 0;
 }
@@ -220,8 +348,9 @@ static int sock_cntr_wait(struct fid_cntr *cntr, uint64_t threshold,
 				int timeout)
 {
 	int ret = 0;
-	uint64_t start_ms = 0, end_ms = 0;
+	uint64_t start_ms = 0, end_ms = 0, now;
 	struct sock_cntr *_cntr;
+	struct sock_cntr_waiter waiter;
 
 	_cntr = container_of(cntr, struct sock_cntr, cntr_fid);
 	pthread_mutex_lock(&_cntr->mut);
@@ -236,21 +365,13 @@ static int sock_cntr_wait(struct fid_cntr *cntr, uint64_t threshold,
 		goto out;
 	}
 
-	if (_cntr->is_waiting) {
-		ret = -FI_EBUSY;
-		goto out;
+	if (timeout >= 0) {
+		start_ms = fi_gettime_ms();
+		end_ms = start_ms + timeout;
 	}
 
-	_cntr->is_waiting = 1;
-	atomic_set(&_cntr->threshold, threshold);
-
 	if (_cntr->domain->progress_mode == FI_PROGRESS_MANUAL) {
 		pthread_mutex_unlock(&_cntr->mut);
-		if (timeout >= 0) {
-			start_ms = fi_gettime_ms();
-			end_ms = start_ms + timeout;
-		}
-
 		while (atomic_get(&_cntr->value) < threshold) {
 			sock_cntr_progress(_cntr);
 			if (timeout >= 0 && fi_gettime_ms() >= end_ms) {
@@ -260,11 +381,32 @@ static int sock_cntr_wait(struct fid_cntr *cntr, uint64_t threshold,
 		}
 		pthread_mutex_lock(&_cntr->mut);
 	} else {
-		ret = fi_wait_cond(&_cntr->cond, &_cntr->mut, timeout);
+		waiter.threshold = threshold;
+		dlist_insert_tail(&waiter.entry, &_cntr->waiter_list);
+		sock_cntr_update_threshold(_cntr);
+		atomic_inc(&_cntr->num_waiters);
+
+		while (atomic_get(&_cntr->value) < threshold &&
+		       !_cntr->err_flag) {
+			if (timeout >= 0) {
+				now = fi_gettime_ms();
+				if (now >= end_ms) {
+					ret = FI_ETIMEDOUT;
+					break;
+				}
+				timeout = end_ms - now;
+			}
+			ret = fi_wait_cond(&_cntr->cond, &_cntr->mut, timeout);
+			if (ret && ret != ETIMEDOUT)
+				break;
+			ret = 0;
+		}
+
+		atomic_dec(&_cntr->num_waiters);
+		dlist_remove(&waiter.entry);
+		sock_cntr_update_threshold(_cntr);
 	}
 
-	_cntr->is_waiting = 0;
-	atomic_set(&_cntr->threshold, ~0);
 	pthread_mutex_unlock(&_cntr->mut);
 	sock_cntr_check_trigger_list(_cntr);
 	return (_cntr->err_flag) ? -FI_EAVAIL : -ret;
@@ -321,11 +463,23 @@ static int sock_cntr_control(struct fid *fid, int command, void *arg)
 static int sock_cntr_close(struct fid *fid)
 {
 	struct sock_cntr *cntr;
+	struct sock_trigger *trigger;
 
 	cntr = container_of(fid, struct sock_cntr, cntr_fid.fid);
 	if (atomic_get(&cntr->ref))
 		return -FI_EBUSY;
 
+	while (cntr->num_triggers)
+		free(cntr->trigger_heap[--cntr->num_triggers]);
+	free(cntr->trigger_heap);
+	while (!dlist_empty(&cntr->trigger_ready)) {
+		trigger = container_of(cntr->trigger_ready.next,
+				       struct sock_trigger, entry);
+		dlist_remove(&trigger->entry);
+		free(trigger);
+	}
+
+	sock_poll_list_fini(&cntr->poll_list);
 	if (cntr->signal && cntr->attr.wait_obj == FI_WAIT_FD)
 		sock_wait_close(&cntr->waitset->fid);
 
@@ -398,7 +552,6 @@ int sock_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
 	struct sock_domain *dom;
 	struct sock_cntr *_cntr;
 	struct fi_wait_attr wait_attr;
-	struct sock_fid_list *list_entry;
 	struct sock_wait *wait;
 
 	dom = container_of(domain, struct sock_domain, dom_fid);
@@ -409,6 +562,9 @@ int sock_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
 	if (!_cntr)
 		return -FI_ENOMEM;
 
+	_cntr->domain = dom;
+	sock_poll_list_init(&_cntr->poll_list);
+
 	ret = pthread_cond_init(&_cntr->cond, NULL);
 	if (ret)
 		goto err;
@@ -447,10 +603,9 @@ int sock_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
 		_cntr->waitset = attr->wait_set;
 		_cntr->signal = 1;
 		wait = container_of(attr->wait_set, struct sock_wait, wait_fid);
-		list_entry = calloc(1, sizeof(*list_entry));
-		dlist_init(&list_entry->entry);
-		list_entry->fid = &_cntr->cntr_fid.fid;
-		dlist_insert_after(&list_entry->entry, &wait->fid_list);
+		ret = sock_poll_set_add(&wait->pset, &_cntr->cntr_fid.fid);
+		if (ret)
+			goto err;
 		break;
 
 	default:
@@ -465,11 +620,14 @@ int sock_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
 
 	atomic_initialize(&_cntr->value, 0);
 	atomic_initialize(&_cntr->threshold, ~0);
+	atomic_initialize(&_cntr->num_waiters, 0);
+	dlist_init(&_cntr->waiter_list);
+	atomic_initialize(&_cntr->num_pending, 0);
 
 	dlist_init(&_cntr->tx_list);
 	dlist_init(&_cntr->rx_list);
 
-	dlist_init(&_cntr->trigger_list);
+	dlist_init(&_cntr->trigger_ready);
 	fastlock_init(&_cntr->trigger_lock);
 
 	_cntr->cntr_fid.fid.fclass = FI_CLASS_CNTR;
@@ -478,7 +636,6 @@ int sock_cntr_open(struct fid_domain *domain, struct fi_cntr_attr *attr,
 	_cntr->cntr_fid.ops = &sock_cntr_ops;
 
 	atomic_inc(&dom->ref);
-	_cntr->domain = dom;
 	*cntr = &_cntr->cntr_fid;
 	return 0;
 
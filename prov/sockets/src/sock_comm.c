@@ -49,6 +49,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <pthread.h>
 
@@ -81,6 +82,9 @@ ssize_t sock_comm_flush(struct sock_conn *conn)
 	size_t endlen, len, xfer_len;
 
 	len = rbused(&conn->outbuf);
+	if (!len)
+		return 0;
+
 	endlen = conn->outbuf.size -
 			(conn->outbuf.rcnt & conn->outbuf.size_mask);
 
@@ -109,29 +113,256 @@ int sock_comm_tx_done(struct sock_conn *conn)
 	return rbempty(&conn->outbuf);
 }
 
-ssize_t sock_comm_send(struct sock_conn *conn, const void *buf, size_t len)
+static int sock_comm_buf_class(size_t size)
 {
-	ssize_t ret, used;
+	int buf_class = 0;
 
-	if (len >= SOCK_COMM_THRESHOLD) {
-		used = rbused(&conn->outbuf);
-		if (used == sock_comm_flush(conn)) {
-			return sock_comm_send_socket(conn, buf, len);
-		} else {
-			return 0;
+	while ((SOCK_COMM_BUF_MIN_SZ << buf_class) < size)
+		buf_class++;
+	return buf_class;
+}
+
+void sock_comm_pool_init(struct sock_comm_pool *pool)
+{
+	int i;
+
+	fastlock_init(&pool->lock);
+	for (i = 0; i < SOCK_COMM_BUF_CLASSES; i++) {
+		slist_init(&pool->free_list[i]);
+		pool->num_free[i] = 0;
+	}
+	pool->cached = 0;
+}
+
+void sock_comm_pool_destroy(struct sock_comm_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < SOCK_COMM_BUF_CLASSES; i++) {
+		while (!slist_empty(&pool->free_list[i]))
+			free(slist_remove_head(&pool->free_list[i]));
+		pool->num_free[i] = 0;
+	}
+	pool->cached = 0;
+	fastlock_destroy(&pool->lock);
+}
+
+/* new buffers are touched up front so the data path does not fault */
+static void *sock_comm_pool_alloc(size_t size)
+{
+	void *buf;
+
+	buf = malloc(size);
+	if (buf)
+		memset(buf, 0, size);
+	return buf;
+}
+
+static void *sock_comm_pool_get(struct sock_comm_pool *pool, size_t size)
+{
+	int buf_class = sock_comm_buf_class(size);
+	void *buf = NULL;
+
+	fastlock_acquire(&pool->lock);
+	if (!slist_empty(&pool->free_list[buf_class])) {
+		buf = slist_remove_head(&pool->free_list[buf_class]);
+		pool->num_free[buf_class]--;
+		pool->cached -= size;
+	}
+	fastlock_release(&pool->lock);
+
+	return buf ? buf : sock_comm_pool_alloc(size);
+}
+
+static void sock_comm_pool_put(struct sock_comm_pool *pool, void *buf,
+			       size_t size)
+{
+	int buf_class = sock_comm_buf_class(size);
+
+	fastlock_acquire(&pool->lock);
+	if (pool->cached + size <= SOCK_COMM_POOL_SZ) {
+		slist_insert_head(buf, &pool->free_list[buf_class]);
+		pool->num_free[buf_class]++;
+		pool->cached += size;
+		buf = NULL;
+	}
+	fastlock_release(&pool->lock);
+	free(buf);
+}
+
+/* keep a few minimum size buffers ready for connections that wake up */
+void sock_comm_pool_fill(struct sock_comm_pool *pool)
+{
+	void *buf;
+
+	while (pool->num_free[0] < SOCK_COMM_POOL_RESERVE &&
+	       pool->cached + SOCK_COMM_BUF_MIN_SZ <= SOCK_COMM_POOL_SZ) {
+		buf = sock_comm_pool_alloc(SOCK_COMM_BUF_MIN_SZ);
+		if (!buf)
+			break;
+		sock_comm_pool_put(pool, buf, SOCK_COMM_BUF_MIN_SZ);
+	}
+}
+
+/*
+ * Comm buffers are not allocated until a connection first needs to
+ * buffer data.  They start at SOCK_COMM_BUF_MIN_SZ and double, up to
+ * SOCK_COMM_BUF_SZ, whenever traffic fills them; sock_comm_buffer_trim
+ * shrinks them back.  A size of 0 returns the buffer to the pool.
+ */
+static int sock_comm_rb_resize(struct sock_conn *conn, struct ringbuf *rb,
+			       size_t size)
+{
+	void *buf = NULL;
+	size_t used = rbused(rb);
+
+	if (size) {
+		buf = sock_comm_pool_get(conn->comm_pool, size);
+		if (!buf)
+			return -FI_ENOMEM;
+		if (used)
+			rbpeek(rb, buf, used);
+	}
+
+	if (rb->buf)
+		sock_comm_pool_put(conn->comm_pool, rb->buf, rb->size);
+	rb->buf = buf;
+	rb->size = size;
+	rb->size_mask = size ? size - 1 : 0;
+	rb->rcnt = 0;
+	rb->wcnt = rb->wpos = used;
+	return 0;
+}
+
+static void sock_comm_rb_grow(struct sock_conn *conn, struct ringbuf *rb,
+			      size_t len)
+{
+	size_t size = rb->size ? rb->size : SOCK_COMM_BUF_MIN_SZ;
+
+	while (size - rbused(rb) < len && size < SOCK_COMM_BUF_SZ)
+		size <<= 1;
+
+	if (size != rb->size && !sock_comm_rb_resize(conn, rb, size))
+		SOCK_LOG_DBG("comm buffer grown to %lu\n", size);
+}
+
+/*
+ * Called periodically for open connections.  A ring that saw no traffic
+ * since the last call goes back to the pool, one that stayed well below
+ * its size is cut down to twice its high water mark.
+ */
+static void sock_comm_rb_trim(struct sock_conn *conn, struct ringbuf *rb,
+			      size_t *hwm)
+{
+	size_t size;
+
+	if (rb->buf && rbempty(rb)) {
+		if (!*hwm) {
+			sock_comm_rb_resize(conn, rb, 0);
+		} else if (*hwm <= rb->size / 4) {
+			size = MAX(roundup_power_of_two(*hwm * 2),
+				   SOCK_COMM_BUF_MIN_SZ);
+			if (size < rb->size)
+				sock_comm_rb_resize(conn, rb, size);
 		}
 	}
+	*hwm = 0;
+}
 
-	if (rbavail(&conn->outbuf) < len) {
-		ret = sock_comm_flush(conn);
-		if (ret <= 0)
+static void sock_comm_rb_release(struct sock_conn *conn, struct ringbuf *rb)
+{
+	if (rb->buf)
+		sock_comm_pool_put(conn->comm_pool, rb->buf, rb->size);
+	memset(rb, 0, sizeof(*rb));
+}
+
+void sock_comm_buffer_trim(struct sock_conn *conn)
+{
+	sock_comm_rb_trim(conn, &conn->inbuf, &conn->inbuf_hwm);
+	sock_comm_rb_trim(conn, &conn->outbuf, &conn->outbuf_hwm);
+}
+
+static ssize_t sock_comm_bufferv(struct sock_conn *conn,
+				 const struct iovec *iov, int iov_cnt,
+				 size_t offset, size_t len)
+{
+	int i;
+	size_t copy, done = 0;
+
+	if (len - offset >= SOCK_COMM_THRESHOLD)
+		return 0;
+
+	if (rbavail(&conn->outbuf) < len - offset) {
+		sock_comm_rb_grow(conn, &conn->outbuf, len - offset);
+		if (rbavail(&conn->outbuf) < len - offset)
 			return 0;
 	}
 
-	ret = MIN(rbavail(&conn->outbuf), len);
-	rbwrite(&conn->outbuf, buf, ret);
+	for (i = 0; i < iov_cnt; i++) {
+		if (offset >= iov[i].iov_len) {
+			offset -= iov[i].iov_len;
+			continue;
+		}
+		copy = iov[i].iov_len - offset;
+		rbwrite(&conn->outbuf, (char *) iov[i].iov_base + offset, copy);
+		done += copy;
+		offset = 0;
+	}
 	rbcommit(&conn->outbuf);
-	SOCK_LOG_DBG("buffered %lu\n", ret);
+	conn->outbuf_hwm = MAX(conn->outbuf_hwm, rbused(&conn->outbuf));
+	SOCK_LOG_DBG("buffered %lu\n", done);
+	return done;
+}
+
+/* a header-only control message, sent whole or not at all */
+int sock_comm_send_ctrl(struct sock_conn *conn, uint8_t op)
+{
+	struct sock_msg_hdr hdr;
+	struct iovec iov;
+
+	if (!conn->shm && rbavail(&conn->outbuf) < sizeof(hdr))
+		sock_comm_rb_grow(conn, &conn->outbuf, sizeof(hdr));
+
+	if (conn->shm ? sock_shm_tx_avail(conn) < sizeof(hdr) :
+	    rbavail(&conn->outbuf) < sizeof(hdr))
+		return -FI_EAGAIN;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = SOCK_WIRE_PROTO_VERSION;
+	hdr.op_type = op;
+	hdr.msg_len = htonll(sizeof(hdr));
+	iov.iov_base = &hdr;
+	iov.iov_len = sizeof(hdr);
+	return sock_comm_sendv(conn, &iov, 1, sizeof(hdr)) == sizeof(hdr) ?
+		0 : -FI_EIO;
+}
+
+ssize_t sock_comm_sendv(struct sock_conn *conn, const struct iovec *iov,
+			int iov_cnt, size_t len)
+{
+	ssize_t ret;
+
+	if (conn->shm)
+		return sock_shm_sendv(conn, iov, iov_cnt, len);
+
+	if (!rbempty(&conn->outbuf)) {
+		sock_comm_flush(conn);
+		if (!rbempty(&conn->outbuf))
+			return sock_comm_bufferv(conn, iov, iov_cnt, 0, len);
+	}
+
+	ret = writev(conn->sock_fd, iov, iov_cnt);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			SOCK_LOG_DBG("writev %s\n", strerror(errno));
+			return ret;
+		}
+		ret = 0;
+	}
+	SOCK_LOG_DBG("wrote to network: %lu\n", ret);
+
+	if (ret < len)
+		ret += sock_comm_bufferv(conn, iov, iov_cnt, ret, len);
 	return ret;
 }
 
@@ -156,63 +387,76 @@ static ssize_t sock_comm_recv_socket(struct sock_conn *conn, void *buf,
 	return ret;
 }
 
+/*
+ * Read ahead as much as the socket has queued into the free space of the
+ * inbuf, spanning the ring wrap with a single readv, so a burst of small
+ * messages is pulled in and parsed out of the buffer with one syscall.
+ */
 static ssize_t sock_comm_recv_buffer(struct sock_conn *conn)
 {
-	int ret;
-	size_t endlen;
+	ssize_t ret;
+	size_t avail, endlen;
+	struct iovec iov[2];
+	int iov_cnt = 1;
+
+	if (!conn->inbuf.buf)
+		sock_comm_rb_grow(conn, &conn->inbuf, 1);
 
-	if (rbavail(&conn->inbuf) == 0)
+	avail = rbavail(&conn->inbuf);
+	if (avail == 0)
 		return 0;
 
 	endlen = conn->inbuf.size - (conn->inbuf.wpos & conn->inbuf.size_mask);
-	if (rbavail(&conn->inbuf) <= endlen) {
-		ret = sock_comm_recv_socket(conn, (char *) conn->inbuf.buf +
-				(conn->inbuf.wpos & conn->inbuf.size_mask),
-				rbavail(&conn->inbuf));
-		conn->inbuf.wpos += ret;
-		rbcommit(&conn->inbuf);
-		return 0;
-	} else {
-		ret = sock_comm_recv_socket(conn, (char *) conn->inbuf.buf +
-			(conn->inbuf.wpos & conn->inbuf.size_mask), endlen);
-		if (ret <= 0)
-			return 0;
+	iov[0].iov_base = (char *) conn->inbuf.buf +
+			(conn->inbuf.wpos & conn->inbuf.size_mask);
+	iov[0].iov_len = MIN(avail, endlen);
+	if (avail > endlen) {
+		iov[1].iov_base = conn->inbuf.buf;
+		iov[1].iov_len = avail - endlen;
+		iov_cnt = 2;
 	}
 
-	conn->inbuf.wpos += ret;
-	rbcommit(&conn->inbuf);
-	if (ret != endlen)
-		return ret;
+	ret = readv(conn->sock_fd, iov, iov_cnt);
+	if (ret == 0) {
+		conn->disconnected = 1;
+		return 0;
+	}
 
-	ret = sock_comm_recv_socket(conn, conn->inbuf.buf, rbavail(&conn->inbuf));
-	if (ret <= 0)
+	if (ret < 0) {
+		SOCK_LOG_DBG("readv %s\n", strerror(errno));
 		return 0;
+	}
 
+	SOCK_LOG_DBG("buffered from network: %lu\n", ret);
 	conn->inbuf.wpos += ret;
 	rbcommit(&conn->inbuf);
-	return 0;
+	conn->inbuf_hwm = MAX(conn->inbuf_hwm, rbused(&conn->inbuf));
+	if (ret == avail)
+		sock_comm_rb_grow(conn, &conn->inbuf, avail + 1);
+	return ret;
 }
 
 ssize_t sock_comm_recv(struct sock_conn *conn, void *buf, size_t len)
 {
-	int ret = 0;
-	ssize_t used, read_len;
+	ssize_t ret = 0, used, read_len;
+
+	if (conn->shm)
+		return sock_shm_recv(conn, buf, len);
 
 	used = rbused(&conn->inbuf);
-	if (used == 0) {
-		ret = sock_comm_recv_socket(conn, buf, len);
+	if (used < len && len - used < SOCK_COMM_THRESHOLD) {
 		sock_comm_recv_buffer(conn);
-		return ret;
+		used = rbused(&conn->inbuf);
 	}
 
 	read_len = MIN(len, used);
-	rbread(&conn->inbuf, buf, read_len);
+	if (read_len)
+		rbread(&conn->inbuf, buf, read_len);
 	if (len > used) {
 		ret = sock_comm_recv_socket(conn, (char *) buf + used,
 						len - used);
 		if (ret <= 0)
 			ret = 0;
-		sock_comm_recv_buffer(conn);
 	}
 	SOCK_LOG_DBG("read from buffer: %lu\n", ret + read_len);
 	return ret + read_len;
@@ -220,7 +464,11 @@ ssize_t sock_comm_recv(struct sock_conn *conn, void *buf, size_t len)
 
 ssize_t sock_comm_peek(struct sock_conn *conn, void *buf, size_t len)
 {
-	sock_comm_recv_buffer(conn);
+	if (conn->shm)
+		return sock_shm_peek(conn, buf, len);
+
+	if (rbused(&conn->inbuf) < len)
+		sock_comm_recv_buffer(conn);
 	if (rbused(&conn->inbuf) >= len) {
 		rbpeek(&conn->inbuf, buf, len);
 		return len;
@@ -230,22 +478,39 @@ ssize_t sock_comm_peek(struct sock_conn *conn, void *buf, size_t len)
 
 ssize_t sock_comm_discard(struct sock_conn *conn, size_t len)
 {
+	if (conn->shm)
+		return sock_shm_discard(conn, len);
 	return rbdiscard(&conn->inbuf, len);
 }
 
 ssize_t sock_comm_data_avail(struct sock_conn *conn)
 {
+	if (conn->shm)
+		return sock_shm_data_avail(conn);
 	return rbused(&conn->inbuf);
 }
 
+int sock_comm_data_pending(struct sock_conn *conn)
+{
+
+	if (conn->shm)
+		return sock_shm_data_pending(conn);
+
+	if (rbused(&conn->inbuf))
+		return 1;
+
+	return sock_comm_recv_buffer(conn) > 0;
+}
+
 int sock_comm_buffer_init(struct sock_conn *conn)
 {
 	socklen_t size = SOCK_COMM_BUF_SZ;
 	socklen_t optlen = sizeof(socklen_t);
 
 	sock_set_sockopts(conn->sock_fd);
-	rbinit(&conn->inbuf, SOCK_COMM_BUF_SZ);
-	rbinit(&conn->outbuf, SOCK_COMM_BUF_SZ);
+	sock_comm_rb_release(conn, &conn->inbuf);
+	sock_comm_rb_release(conn, &conn->outbuf);
+	conn->inbuf_hwm = conn->outbuf_hwm = 0;
 
 	if (setsockopt(conn->sock_fd, SOL_SOCKET, SO_RCVBUF, &size, optlen))
 		SOCK_LOG_ERROR("setsockopt SO_RCVBUF failed\n");
@@ -264,6 +529,8 @@ int sock_comm_buffer_init(struct sock_conn *conn)
 
 void sock_comm_buffer_finalize(struct sock_conn *conn)
 {
-	rbfree(&conn->inbuf);
-	rbfree(&conn->outbuf);
+	sock_comm_rb_release(conn, &conn->inbuf);
+	sock_comm_rb_release(conn, &conn->outbuf);
+	sock_shm_free(conn->shm);
+	conn->shm = NULL;
 }
@@ -43,6 +43,7 @@
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -57,14 +58,133 @@
 #define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_EP_CTRL, __VA_ARGS__)
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_CTRL, __VA_ARGS__)
 
+static inline size_t sock_addr_hash_slot(struct sock_addr_hash *hash,
+					 uint32_t ip, uint16_t port)
+{
+	uint64_t key = ((uint64_t) ip << 16) | port;
+	return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32) &
+		(hash->size - 1);
+}
+
+int sock_addr_hash_init(struct sock_addr_hash *hash, size_t size)
+{
+	hash->size = roundup_power_of_two(MAX(size, 2));
+	hash->used = 0;
+	hash->table = calloc(hash->size, sizeof(*hash->table));
+	return hash->table ? 0 : -FI_ENOMEM;
+}
+
+void sock_addr_hash_free(struct sock_addr_hash *hash)
+{
+	free(hash->table);
+	hash->table = NULL;
+	hash->size = hash->used = 0;
+}
+
+static int sock_addr_hash_grow(struct sock_addr_hash *hash)
+{
+	struct sock_addr_hash_entry *old_table, *entry;
+	size_t i, old_size, slot;
+
+	old_table = hash->table;
+	old_size = hash->size;
+
+	hash->table = calloc(old_size * 2, sizeof(*hash->table));
+	if (!hash->table) {
+		hash->table = old_table;
+		return -FI_ENOMEM;
+	}
+	hash->size = old_size * 2;
+
+	for (i = 0; i < old_size; i++) {
+		if (!old_table[i].in_use)
+			continue;
+		slot = sock_addr_hash_slot(hash, old_table[i].ip,
+					   old_table[i].port);
+		for (entry = &hash->table[slot]; entry->in_use;
+		     entry = &hash->table[slot]) {
+			slot = (slot + 1) & (hash->size - 1);
+		}
+		*entry = old_table[i];
+	}
+	free(old_table);
+	return 0;
+}
+
+/*
+ * Open-addressing (linear probe) index keyed on IP and port.  Entries
+ * are never removed, so the first value stored for an address wins.
+ */
+int sock_addr_hash_insert(struct sock_addr_hash *hash,
+			  struct sockaddr_in *addr, uint64_t value)
+{
+	struct sock_addr_hash_entry *entry;
+	size_t slot;
+
+	if ((hash->used + 1) * 2 > hash->size && sock_addr_hash_grow(hash))
+		return -FI_ENOMEM;
+
+	slot = sock_addr_hash_slot(hash, addr->sin_addr.s_addr,
+				   addr->sin_port);
+	for (entry = &hash->table[slot]; entry->in_use;
+	     entry = &hash->table[slot]) {
+		if (entry->ip == addr->sin_addr.s_addr &&
+		    entry->port == addr->sin_port)
+			return 0;
+		slot = (slot + 1) & (hash->size - 1);
+	}
+
+	entry->ip = addr->sin_addr.s_addr;
+	entry->port = addr->sin_port;
+	entry->value = value;
+	entry->in_use = 1;
+	hash->used++;
+	return 0;
+}
+
+int sock_addr_hash_lookup(struct sock_addr_hash *hash,
+			  struct sockaddr_in *addr, uint64_t *value)
+{
+	struct sock_addr_hash_entry *entry;
+	size_t slot;
+
+	if (!hash->size)
+		return -FI_ENOENT;
+
+	slot = sock_addr_hash_slot(hash, addr->sin_addr.s_addr,
+				   addr->sin_port);
+	for (entry = &hash->table[slot]; entry->in_use;
+	     entry = &hash->table[slot]) {
+		if (entry->ip == addr->sin_addr.s_addr &&
+		    entry->port == addr->sin_port) {
+			*value = entry->value;
+			return 0;
+		}
+		slot = (slot + 1) & (hash->size - 1);
+	}
+	return -FI_ENOENT;
+}
+
 int sock_conn_map_init(struct sock_conn_map *map, int init_size)
 {
 	map->table = calloc(init_size, sizeof(*map->table));
 	if (!map->table)
 		return -FI_ENOMEM;
 
+	if (sock_addr_hash_init(&map->addr_hash, init_size * 2)) {
+		free(map->table);
+		return -FI_ENOMEM;
+	}
+
 	map->used = 0;
 	map->size = init_size;
+	map->connect_keys = NULL;
+	map->connect_cnt = map->connect_size = 0;
+	map->open_cnt = 0;
+	map->lru_tick = map->evict_time = map->trim_time = 0;
+	dlist_init(&map->open_list);
+	dlist_init(&map->event_list);
+	sock_comm_pool_init(&map->comm_pool);
 	return 0;
 }
 
@@ -83,17 +203,46 @@ static int sock_conn_map_increase(struct sock_conn_map *map, int new_size)
 	return 0;
 }
 
+/* drop an outgoing attempt that is still in flight */
+static void sock_conn_abort(struct sock_conn *conn)
+{
+	if (conn->state == SOCK_CONN_STATE_CONNECTED)
+		return;
+
+	if (conn->hello_shm) {
+		shm_unlink(conn->hello.shm_name);
+		sock_shm_free(conn->hello_shm);
+		conn->hello_shm = NULL;
+	}
+
+	if (conn->sock_fd >= 0) {
+		close(conn->sock_fd);
+		conn->sock_fd = -1;
+	}
+}
+
 void sock_conn_map_destroy(struct sock_conn_map *cmap)
 {
 	int i;
 
 	for (i = 0; i < cmap->used; i++) {
-		sock_comm_buffer_finalize(&cmap->table[i]);
-		close(cmap->table[i].sock_fd);
+		sock_conn_abort(cmap->table[i]);
+		sock_comm_buffer_finalize(cmap->table[i]);
+		if (cmap->table[i]->sock_fd >= 0)
+			close(cmap->table[i]->sock_fd);
+		if (cmap->table[i]->accept_fd >= 0)
+			close(cmap->table[i]->accept_fd);
+		sock_shm_free(cmap->table[i]->accept_shm);
+		free(cmap->table[i]);
 	}
 	free(cmap->table);
 	cmap->table = NULL;
 	cmap->used = cmap->size = 0;
+	free(cmap->connect_keys);
+	cmap->connect_keys = NULL;
+	cmap->connect_cnt = cmap->connect_size = 0;
+	sock_addr_hash_free(&cmap->addr_hash);
+	sock_comm_pool_destroy(&cmap->comm_pool);
 }
 
 struct sock_conn *
@@ -105,7 +254,7 @@ sock_conn_map_lookup_key(struct sock_conn_map *conn_map, uint16_t key)
 		return NULL;
 	}
 
-	return &conn_map->table[key - 1];
+	return conn_map->table[key - 1];
 }
 
 int sock_compare_addr(struct sockaddr_in *addr1,
@@ -118,43 +267,80 @@ int sock_compare_addr(struct sockaddr_in *addr1,
 uint16_t sock_conn_map_lookup(struct sock_conn_map *map,
 			      struct sockaddr_in *addr)
 {
-	int i;
+	uint64_t key;
 
-	for (i = 0; i < map->used; i++) {
-		if (sock_compare_addr(&map->table[i].addr, addr))
-			return i + 1;
-	}
-	return 0;
+	if (sock_addr_hash_lookup(&map->addr_hash, addr, &key))
+		return 0;
+	return (uint16_t) key;
 }
 
 static int sock_conn_map_insert(struct sock_conn_map *map,
 				struct sockaddr_in *addr,
-				struct sock_ep *ep,
-				int conn_fd)
+				struct sock_ep *ep)
 {
 	int index;
+	struct sock_conn *conn;
 
 	if (map->size == map->used) {
 		if (sock_conn_map_increase(map, map->size * 2))
 			return 0;
 	}
 
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return 0;
+
 	index = map->used;
-	map->table[index].addr = *addr;
-	map->table[index].sock_fd = conn_fd;
-	map->table[index].ep = ep;
-	sock_comm_buffer_init(&map->table[index]);
-	map->table[index].av_index = (ep->av) ?
-		sock_av_lookup_key(ep->av, index) :
+	if (sock_addr_hash_insert(&map->addr_hash, addr, index + 1)) {
+		free(conn);
+		return 0;
+	}
+
+	map->table[index] = conn;
+	conn->key = index + 1;
+	conn->addr = *addr;
+	conn->sock_fd = -1;
+	conn->accept_fd = -1;
+	conn->comm_pool = &map->comm_pool;
+	dlist_init(&conn->open_entry);
+	dlist_init(&conn->event_entry);
+	conn->ep = ep;
+	conn->av_index = (ep->av) ?
+		_sock_av_lookup(ep->av, (struct sockaddr *) addr) :
 		FI_ADDR_NOTAVAIL;
 
+	map->used++;
+	return index + 1;
+}
+
+/* hand a wired-up socket over to the progress engine */
+static void sock_conn_establish(struct sock_conn_map *map,
+				struct sock_conn *conn, int conn_fd,
+				struct sock_shm *shm)
+{
+	struct sock_ep *ep = conn->ep;
+	uint16_t key = conn->key;
+
+	conn->sock_fd = conn_fd;
+	conn->shm = shm;
+	sock_comm_buffer_init(conn);
+
 	fastlock_acquire(&ep->lock);
-	dlist_insert_tail(&map->table[index].ep_entry, &ep->conn_list);
+	dlist_insert_tail(&conn->ep_entry, &ep->conn_list);
+	if (fi_epoll_add(ep->conn_epoll, conn_fd, FI_EPOLL_IN | FI_EPOLL_ET,
+			 (void *) (uintptr_t) key))
+		SOCK_LOG_ERROR("failed to add conn to ep poll set\n");
 	fastlock_release(&ep->lock);
 
-	map->used++;
-	sock_pe_signal(ep->domain->pe);
-	return index + 1;
+	if (fi_epoll_add(ep->pe->epoll_set, conn_fd,
+			 FI_EPOLL_IN | FI_EPOLL_ET, NULL))
+		SOCK_LOG_ERROR("failed to add conn to PE poll set\n");
+
+	conn->lru = map->lru_tick;
+	conn->state = SOCK_CONN_STATE_CONNECTED;
+	dlist_insert_tail(&conn->open_entry, &map->open_list);
+	map->open_cnt++;
+	sock_pe_signal(ep->pe);
 }
 
 int fd_set_nonblock(int fd)
@@ -200,120 +386,225 @@ void sock_set_sockopts(int sock)
 	fd_set_nonblock(sock);
 }
 
-int sock_conn_map_connect(struct sock_ep *ep,
-			       struct sock_domain *dom,
-			       struct sock_conn_map *map,
-			       struct sockaddr_in *addr,
-			       uint16_t *index)
+/*
+ * Both ends of a simultaneous connect keep the connection opened by the
+ * side with the lower listening port, breaking ties on the IP address.
+ */
+static int sock_conn_addr_lower(struct sockaddr_in *addr1,
+				struct sockaddr_in *addr2)
 {
-	int conn_fd, optval = 0, ret;
-	char use_conn;
-	struct timeval tv;
-	socklen_t optlen;
-	fd_set fds;
-	struct sockaddr_in src_addr;
-	int do_retry = sock_conn_retry;
+	if (addr1->sin_port != addr2->sin_port)
+		return ntohs(addr1->sin_port) < ntohs(addr2->sin_port);
+	return ntohl(addr1->sin_addr.s_addr) < ntohl(addr2->sin_addr.s_addr);
+}
 
-	*index = 0;
-	memcpy(&src_addr, ep->src_addr, sizeof(src_addr));
+static int sock_conn_start(struct sock_conn *conn)
+{
+	int conn_fd, ret;
 
-bind_retry:
 	conn_fd = socket(AF_INET, SOCK_STREAM, 0);
 	if (conn_fd < 0) {
 		SOCK_LOG_ERROR("failed to create conn_fd, errno: %d\n", errno);
-		errno = FI_EOTHER;
-		return -errno;
-	}
-
-	sock_set_sockopt_reuseaddr(conn_fd);
-	SOCK_LOG_DBG("Connecting to: %s:%d\n", inet_ntoa(addr->sin_addr),
-		      ntohs(addr->sin_port));
-	SOCK_LOG_DBG("Connecting using address:%s\n",
-			inet_ntoa(src_addr.sin_addr));
-
-retry:
-	if (connect(conn_fd, (struct sockaddr *) addr, sizeof(*addr)) < 0) {
-		if (errno == EINPROGRESS) {
-			/* timeout after 5 secs */
-			tv.tv_sec = 5;
-			tv.tv_usec = 0;
-			FD_ZERO(&fds);
-			FD_SET(conn_fd, &fds);
-			if (select(conn_fd+1, NULL, &fds, NULL, &tv) > 0) {
-				optlen = sizeof(int);
-				getsockopt(conn_fd, SOL_SOCKET, SO_ERROR,
-					   &optval, &optlen);
-				if (optval) {
-					SOCK_LOG_ERROR("failed to connect %d - %s\n",
-							optval, strerror(optval));
-					goto err;
-				}
-			} else {
-				SOCK_LOG_ERROR("Timeout or error to connect %d - %s\n",
-						optval, strerror(optval));
-				goto err;
-			}
-		} else if (errno == ETIMEDOUT && do_retry) {
-			do_retry--;
-			SOCK_LOG_ERROR("Connect timed out, retrying - %s\n",
-				       strerror(errno));
-			goto retry;
-		} else if (errno == EADDRNOTAVAIL && do_retry) {
-			do_retry--;
-			SOCK_LOG_ERROR("Connect failed with address not available, retrying - %s\n",
-				       strerror(errno));
-			close(conn_fd);
-			goto bind_retry;
-		} else {
-			SOCK_LOG_ERROR("Error connecting %d - %s\n", errno,
-				       strerror(errno));
-			goto err;
-		}
+		return -FI_EOTHER;
 	}
 
-	do {
-		ret = send(conn_fd,
-			   &((struct sockaddr_in *) ep->src_addr)->sin_port,
-			   sizeof(((struct sockaddr_in *) ep->src_addr)->sin_port), 0);
-	} while (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+	sock_set_sockopts_conn(conn_fd);
+	fd_set_nonblock(conn_fd);
+	SOCK_LOG_DBG("Connecting to: %s:%d\n", inet_ntoa(conn->addr.sin_addr),
+		      ntohs(conn->addr.sin_port));
 
-	if (ret != sizeof(((struct sockaddr_in *) ep->src_addr)->sin_port)) {
-		SOCK_LOG_ERROR("Cannot exchange port\n");
-		goto err;
+	if (connect(conn_fd, (struct sockaddr *) &conn->addr,
+		    sizeof(conn->addr)) < 0 && errno != EINPROGRESS) {
+		ret = -errno;
+		SOCK_LOG_ERROR("Error connecting %d - %s\n", errno,
+			       strerror(errno));
+		close(conn_fd);
+		return ret;
 	}
 
+	conn->sock_fd = conn_fd;
+	conn->hello_len = 0;
+	conn->state = SOCK_CONN_STATE_CONNECTING;
+	return 0;
+}
+
+/*
+ * Kick off wire-up of conn; the connect, hello exchange and accept are
+ * stepped by sock_conn_progress from the progress engine so the caller
+ * never blocks.  Called with the map lock held.
+ */
+static int sock_conn_connect(struct sock_conn *conn)
+{
+	int ret;
+
+	conn->retry = sock_conn_retry;
 	do {
-		ret = recv(conn_fd, &use_conn, sizeof(use_conn), MSG_WAITALL);
-	} while (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+		ret = sock_conn_start(conn);
+	} while (ret == -EADDRNOTAVAIL && conn->retry-- > 0);
 
-	if (ret != sizeof(use_conn)) {
-		SOCK_LOG_ERROR("Cannot exchange port: %d - %s\n",
-			       ret, strerror(errno));
-		use_conn = 0;
+	if (ret)
+		conn->state = SOCK_CONN_STATE_FAILED;
+	return ret;
+}
+
+static void sock_conn_fail(struct sock_conn *conn, int err)
+{
+	SOCK_LOG_ERROR("failed to connect to %s:%d - %s\n",
+		       inet_ntoa(conn->addr.sin_addr),
+		       ntohs(conn->addr.sin_port), strerror(err));
+	sock_conn_abort(conn);
+
+	if ((err == ETIMEDOUT || err == EADDRNOTAVAIL) && conn->retry-- > 0 &&
+	    !sock_conn_start(conn))
+		return;
+	conn->state = SOCK_CONN_STATE_FAILED;
+}
+
+static int sock_conn_connected(struct sock_conn *conn)
+{
+	struct pollfd poll_fd;
+	socklen_t optlen;
+	int err = 0;
+
+	poll_fd.fd = conn->sock_fd;
+	poll_fd.events = POLLOUT;
+	if (poll(&poll_fd, 1, 0) <= 0)
+		return 0;
+
+	optlen = sizeof(err);
+	if (getsockopt(conn->sock_fd, SOL_SOCKET, SO_ERROR, &err, &optlen))
+		err = errno;
+	if (err) {
+		sock_conn_fail(conn, err);
+		return 0;
 	}
 
-	SOCK_LOG_DBG("Connect response: %d\n", use_conn);
+	memset(&conn->hello, 0, sizeof(conn->hello));
+	conn->hello.port = conn->ep->src_addr->sin_port;
+	conn->hello.version = SOCK_WIRE_PROTO_VERSION;
+	conn->hello.pid = htonl(getpid());
+	if (sock_shm_enable && sock_shm_is_local(conn->sock_fd) &&
+	    (sock_shm_host_id(&conn->hello.host) ||
+	     sock_shm_create(&conn->hello_shm, conn->sock_fd,
+			     conn->hello.shm_name)))
+		conn->hello.shm_name[0] = '\0';
+
+	conn->state = SOCK_CONN_STATE_HELLO;
+	return 1;
+}
 
-	if (use_conn) {
-		fastlock_acquire(&map->lock);
-		ret = sock_conn_map_insert(map, addr, ep, conn_fd);
-		fastlock_release(&map->lock);
+static void sock_conn_hello(struct sock_conn_map *map, struct sock_conn *conn)
+{
+	ssize_t ret;
+	size_t len;
+	struct sock_shm *shm;
+
+	while (conn->hello_len < sizeof(conn->hello)) {
+		ret = send(conn->sock_fd, (char *) &conn->hello + conn->hello_len,
+			   sizeof(conn->hello) - conn->hello_len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			sock_conn_fail(conn, errno);
+			return;
+		}
+		conn->hello_len += ret;
+	}
+
+	while ((len = conn->hello_len - sizeof(conn->hello)) <
+	       sizeof(conn->resp)) {
+		ret = recv(conn->sock_fd, (char *) &conn->resp + len,
+			   sizeof(conn->resp) - len, 0);
+		if (ret <= 0) {
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				return;
+			SOCK_LOG_ERROR("Cannot exchange port: %zd - %s\n",
+				       ret, strerror(errno));
+			sock_conn_fail(conn, ret ? errno : ECONNRESET);
+			return;
+		}
+		conn->hello_len += ret;
+	}
+
+	SOCK_LOG_DBG("Connect response: %d, shm: %d\n", conn->resp.use_conn,
+		     conn->resp.use_shm);
+	if (conn->resp.version != SOCK_WIRE_PROTO_VERSION) {
+		SOCK_LOG_ERROR("Peer refused, wire protocol %d (ours: %d)\n",
+			       conn->resp.version, SOCK_WIRE_PROTO_VERSION);
+		sock_conn_fail(conn, EPROTO);
+		return;
+	}
+
+	/* the peer has the segment mapped (or never will) by now */
+	shm = conn->hello_shm;
+	conn->hello_shm = NULL;
+	if (shm) {
+		shm_unlink(conn->hello.shm_name);
+		if (conn->resp.use_conn && conn->resp.use_shm) {
+			shm->peer_pid = ntohl(conn->resp.pid);
+			shm->cma = sock_cma_threshold > 0 &&
+				   shm->peer_pid > 0 &&
+				   sock_shm_same_host(&conn->resp.host);
+		} else {
+			sock_shm_free(shm);
+			shm = NULL;
+		}
+	}
+
+	if (conn->resp.use_conn) {
+		sock_conn_establish(map, conn, conn->sock_fd, shm);
 	} else {
-		close(conn_fd);
+		/* the peer's own connection to us wins; the listener takes it */
 		SOCK_LOG_DBG("waiting for an accept\n");
-		for (ret = 0; !ret; ) {
-			fastlock_acquire(&map->lock);
-			ret = sock_conn_map_lookup(map, addr);
-			fastlock_release(&map->lock);
-		}
-		SOCK_LOG_DBG("got accept\n");
+		close(conn->sock_fd);
+		conn->sock_fd = -1;
+		conn->state = SOCK_CONN_STATE_WAIT_ACCEPT;
 	}
+}
 
-	*index = ret;
-	return 0;
-err:
-	close(conn_fd);
-	return -errno;
+/*
+ * Step the wire-up state machine of conn.  Returns 0 once it can carry
+ * traffic, -FI_EAGAIN while it is still being set up.
+ */
+static void sock_conn_step(struct sock_conn_map *map, struct sock_conn *conn)
+{
+	switch (conn->state) {
+	case SOCK_CONN_STATE_QUEUED:
+	case SOCK_CONN_STATE_CLOSED:
+		if (sock_conn_connect(conn))
+			break;
+		/* fall through */
+	case SOCK_CONN_STATE_CONNECTING:
+		if (!sock_conn_connected(conn))
+			break;
+		/* fall through */
+	case SOCK_CONN_STATE_HELLO:
+		sock_conn_hello(map, conn);
+		break;
+	default:
+		break;
+	}
+}
+
+int sock_conn_progress(struct sock_conn_map *map, struct sock_conn *conn)
+{
+	int ret;
+
+	fastlock_acquire(&map->lock);
+	sock_conn_step(map, conn);
+	switch (conn->state) {
+	case SOCK_CONN_STATE_CONNECTED:
+		ret = 0;
+		break;
+	case SOCK_CONN_STATE_FAILED:
+		ret = -FI_ECONNREFUSED;
+		break;
+	default:
+		ret = -FI_EAGAIN;
+		break;
+	}
+	fastlock_release(&map->lock);
+	return ret;
 }
 
 int sock_conn_map_match_or_connect(struct sock_ep *ep,
@@ -322,108 +613,619 @@ int sock_conn_map_match_or_connect(struct sock_ep *ep,
 					struct sockaddr_in *addr,
 					uint16_t *index)
 {
-	int ret;
+	int ret = 0;
+	struct sock_conn *conn;
+
 	fastlock_acquire(&map->lock);
 	*index = sock_conn_map_lookup(map, addr);
+	if (!*index) {
+		*index = sock_conn_map_insert(map, addr, ep);
+		if (!*index) {
+			ret = -FI_ENOMEM;
+			goto out;
+		}
+		sock_conn_map_lookup_key(map, *index)->state =
+			SOCK_CONN_STATE_FAILED;
+	}
+
+	conn = sock_conn_map_lookup_key(map, *index);
+	if (conn->state == SOCK_CONN_STATE_FAILED) {
+		ret = sock_conn_connect(conn);
+		if (ret)
+			*index = 0;
+	}
+out:
 	fastlock_release(&map->lock);
+	return ret;
+}
+
+/*
+ * Queue a background connect to addr.  Queued connects are started by
+ * sock_conn_map_progress, at most sock_conn_inflight at a time, so a
+ * large AV does not flood the peers' listen backlogs.
+ */
+int sock_conn_map_preconnect(struct sock_ep *ep, struct sock_conn_map *map,
+			     struct sockaddr_in *addr, uint16_t *index)
+{
+	int ret = 0, size;
+	uint16_t *keys;
+	struct sock_conn *conn;
+
+	fastlock_acquire(&map->lock);
+	*index = sock_conn_map_lookup(map, addr);
+	if (*index)
+		goto out;
+
+	*index = sock_conn_map_insert(map, addr, ep);
+	if (!*index) {
+		ret = -FI_ENOMEM;
+		goto out;
+	}
 
-	if (!(*index)) {
-		ret = sock_conn_map_connect(ep, dom, map, addr, index);
-		if (ret) {
-			SOCK_LOG_ERROR("connect failed\n");
-			return -errno;
+	conn = sock_conn_map_lookup_key(map, *index);
+	conn->state = SOCK_CONN_STATE_FAILED;
+	if (map->connect_cnt == map->connect_size) {
+		size = MAX(map->connect_size * 2, SOCK_CM_DEF_INFLIGHT);
+		keys = realloc(map->connect_keys, size * sizeof(*keys));
+		if (!keys) {
+			ret = -FI_ENOMEM;
+			goto out;
 		}
+		map->connect_keys = keys;
+		map->connect_size = size;
 	}
-	return 0;
+
+	conn->state = SOCK_CONN_STATE_QUEUED;
+	map->connect_keys[map->connect_cnt++] = *index;
+out:
+	fastlock_release(&map->lock);
+	return ret;
 }
 
-static void *_sock_conn_listen(void *arg)
+void sock_conn_map_progress(struct sock_conn_map *map)
 {
-	uint16_t index;
-	int conn_fd, ret;
-	char tmp, use_conn;
-	socklen_t addr_size;
-	struct sockaddr_in remote;
-	struct pollfd poll_fds[2];
+	int i, inflight = 0;
+	struct sock_conn *conn;
 
-	struct sock_ep *ep = (struct sock_ep *)arg;
-	struct sock_conn_listener *listener = &ep->listener;
-	struct sock_conn_map *map = &ep->domain->r_cmap;
-
-	poll_fds[0].fd = listener->sock;
-	poll_fds[1].fd = listener->signal_fds[1];
-	poll_fds[0].events = poll_fds[1].events = POLLIN;
-	listener->is_ready = 1;
-
-	while (listener->do_listen) {
-		if (poll(poll_fds, 2, -1) > 0) {
-			if (poll_fds[1].revents & POLLIN) {
-				ret = read(listener->signal_fds[1], &tmp, 1);
-				if (ret != 1) {
-					SOCK_LOG_ERROR("Invalid signal\n");
-					goto err;
-				}
-				continue;
-			}
-		} else {
-			goto err;
+	if (!map->connect_cnt)
+		return;
+
+	fastlock_acquire(&map->lock);
+	for (i = 0; i < map->connect_cnt; i++) {
+		conn = sock_conn_map_lookup_key(map, map->connect_keys[i]);
+		if (conn->state == SOCK_CONN_STATE_QUEUED)
+			continue;
+
+		sock_conn_step(map, conn);
+		if (conn->state == SOCK_CONN_STATE_CONNECTING ||
+		    conn->state == SOCK_CONN_STATE_HELLO)
+			inflight++;
+	}
+
+	for (i = 0; i < map->connect_cnt; ) {
+		conn = sock_conn_map_lookup_key(map, map->connect_keys[i]);
+		if (conn->state == SOCK_CONN_STATE_QUEUED &&
+		    inflight < sock_conn_inflight && !sock_conn_connect(conn))
+			inflight++;
+
+		if (conn->state == SOCK_CONN_STATE_CONNECTED ||
+		    conn->state == SOCK_CONN_STATE_FAILED) {
+			map->connect_keys[i] =
+				map->connect_keys[--map->connect_cnt];
+			continue;
 		}
+		i++;
+	}
+	fastlock_release(&map->lock);
+}
 
-		addr_size = sizeof(remote);
-		conn_fd = accept(listener->sock, (struct sockaddr *) &remote,
-					&addr_size);
-		SOCK_LOG_DBG("CONN: accepted conn-req: %d\n", conn_fd);
-		if (conn_fd < 0) {
-			SOCK_LOG_ERROR("failed to accept: %d\n", errno);
-			goto err;
+/*
+ * Connection cache.  An idle RDM connection may be closed to bound fd and
+ * buffer usage; its map entry and key stay, and the next transfer to the
+ * peer reconnects.  Closing is a handshake so no message is lost: the
+ * closing side sends SOCK_OP_CONN_CLOSE and starts no more transfers.  A
+ * peer that is idle too closes its socket, and the EOF completes the
+ * close on our side; a busy peer answers SOCK_OP_CONN_CLOSE_NACK.
+ */
+static int sock_conn_cacheable(struct sock_conn *conn)
+{
+	return conn->ep->ep_type == FI_EP_RDM &&
+	       !sock_compare_addr(&conn->addr, conn->ep->src_addr);
+}
+
+static int sock_conn_busy(struct sock_conn *conn)
+{
+	return conn->pe_refs || conn->tx_pe_entry || conn->rx_pe_entry ||
+	       !sock_comm_tx_done(conn) || sock_comm_data_avail(conn);
+}
+
+static void sock_conn_release(struct sock_conn_map *map,
+			      struct sock_conn *conn)
+{
+	struct sock_ep *ep = conn->ep;
+	struct sock_shm *shm;
+	int fd;
+
+	SOCK_LOG_DBG("closing conn to %s:%d\n", inet_ntoa(conn->addr.sin_addr),
+		     ntohs(conn->addr.sin_port));
+
+	fastlock_acquire(&ep->lock);
+	dlist_remove(&conn->ep_entry);
+	fi_epoll_del(ep->conn_epoll, conn->sock_fd);
+	fastlock_release(&ep->lock);
+	fi_epoll_del(ep->pe->epoll_set, conn->sock_fd);
+
+	dlist_remove(&conn->open_entry);
+	dlist_init(&conn->open_entry);
+	map->open_cnt--;
+
+	sock_comm_buffer_finalize(conn);
+	close(conn->sock_fd);
+	conn->sock_fd = -1;
+	conn->disconnected = 0;
+
+	if (conn->accept_fd >= 0) {
+		fd = conn->accept_fd;
+		shm = conn->accept_shm;
+		conn->accept_fd = -1;
+		conn->accept_shm = NULL;
+		sock_conn_establish(map, conn, fd, shm);
+	} else {
+		conn->state = SOCK_CONN_STATE_CLOSED;
+	}
+}
+
+/* called by the progress engine, with the PE lock held */
+void sock_conn_event(struct sock_conn_map *map, struct sock_conn *conn,
+		     int event)
+{
+	if (!conn->events)
+		dlist_insert_tail(&conn->event_entry, &map->event_list);
+	conn->events |= event;
+}
+
+static void sock_conn_handle_event(struct sock_conn_map *map,
+				   struct sock_conn *conn)
+{
+	if (conn->events & SOCK_CONN_CLOSE_NACK) {
+		if (conn->state == SOCK_CONN_STATE_CLOSING)
+			conn->state = SOCK_CONN_STATE_CONNECTED;
+		conn->events &= ~SOCK_CONN_CLOSE_NACK;
+	}
+
+	if (conn->state != SOCK_CONN_STATE_CONNECTED &&
+	    conn->state != SOCK_CONN_STATE_CLOSING) {
+		conn->events = 0;
+		return;
+	}
+
+	if (!sock_conn_cacheable(conn) || sock_conn_busy(conn)) {
+		if ((conn->events & SOCK_CONN_CLOSE_REQ) && !conn->tx_pe_entry &&
+		    !conn->disconnected &&
+		    !sock_comm_send_ctrl(conn, SOCK_OP_CONN_CLOSE_NACK))
+			conn->events &= ~SOCK_CONN_CLOSE_REQ;
+		if (!sock_conn_cacheable(conn))
+			conn->events &= ~SOCK_CONN_EOF;
+		return;
+	}
+
+	/* wait for the last message to clear the ready list */
+	if (!conn->rx_ready) {
+		sock_conn_release(map, conn);
+		conn->events = 0;
+	}
+}
+
+static int sock_conn_lru_cmp(const void *a, const void *b)
+{
+	const struct sock_conn *c1 = *(struct sock_conn * const *) a;
+	const struct sock_conn *c2 = *(struct sock_conn * const *) b;
+
+	return c1->lru < c2->lru ? -1 : c1->lru > c2->lru;
+}
+
+static void sock_conn_close(struct sock_conn *conn)
+{
+	if (!sock_comm_send_ctrl(conn, SOCK_OP_CONN_CLOSE))
+		conn->state = SOCK_CONN_STATE_CLOSING;
+}
+
+/*
+ * Close connections idle for sock_conn_idle_timeout, then the least
+ * recently used idle ones until the map is back within
+ * sock_conn_cache_size.
+ */
+static void sock_conn_map_shrink(struct sock_conn_map *map, uint64_t now)
+{
+	struct sock_conn **idle, *conn;
+	struct dlist_entry *entry;
+	int i, cnt = 0, excess;
+
+	excess = sock_conn_cache_size ? map->open_cnt - sock_conn_cache_size : 0;
+	idle = excess > 0 ? malloc(map->open_cnt * sizeof(*idle)) : NULL;
+
+	for (entry = map->open_list.next; entry != &map->open_list;
+	     entry = entry->next) {
+		conn = container_of(entry, struct sock_conn, open_entry);
+		if (conn->lru != conn->idle_lru) {
+			conn->idle_lru = conn->lru;
+			conn->idle_since = now;
 		}
 
-		sock_set_sockopts_conn(conn_fd);
-		SOCK_LOG_DBG("ACCEPT: %s, %d\n", inet_ntoa(remote.sin_addr),
-				ntohs(remote.sin_port));
+		if (conn->state == SOCK_CONN_STATE_CLOSING) {
+			excess--;
+			continue;
+		}
 
-		do {
-			ret = recv(conn_fd, &remote.sin_port,
-				   sizeof(remote.sin_port), MSG_WAITALL);
-		} while (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+		if (conn->state != SOCK_CONN_STATE_CONNECTED || conn->events ||
+		    conn->rx_ready || conn->disconnected ||
+		    !sock_conn_cacheable(conn) || sock_conn_busy(conn))
+			continue;
 
-		if (ret != sizeof(remote.sin_port)) {
-			SOCK_LOG_ERROR("Cannot exchange port: %d - %s\n", ret,
-					strerror(errno));
-			close(conn_fd);
+		if (sock_conn_idle_timeout &&
+		    now - conn->idle_since >= sock_conn_idle_timeout) {
+			sock_conn_close(conn);
+			excess--;
+		} else if (idle) {
+			idle[cnt++] = conn;
+		}
+	}
+
+	if (idle && excess > 0) {
+		qsort(idle, cnt, sizeof(*idle), sock_conn_lru_cmp);
+		for (i = 0; i < cnt && excess > 0; i++, excess--)
+			sock_conn_close(idle[i]);
+	}
+	free(idle);
+}
+
+static void sock_conn_map_trim(struct sock_conn_map *map)
+{
+	struct dlist_entry *entry;
+	struct sock_conn *conn;
+
+	for (entry = map->open_list.next; entry != &map->open_list;
+	     entry = entry->next) {
+		conn = container_of(entry, struct sock_conn, open_entry);
+		sock_comm_buffer_trim(conn);
+	}
+	sock_comm_pool_fill(&map->comm_pool);
+}
+
+void sock_conn_map_evict(struct sock_conn_map *map)
+{
+	struct dlist_entry *entry;
+	struct sock_conn *conn;
+	uint64_t now = 0;
+
+	if (!dlist_empty(&map->open_list)) {
+		now = fi_gettime_ms();
+		if (now - map->evict_time < SOCK_CM_EVICT_INTERVAL)
+			now = 0;
+	}
+
+	if (!now && dlist_empty(&map->event_list))
+		return;
+
+	fastlock_acquire(&map->lock);
+	for (entry = map->event_list.next; entry != &map->event_list;) {
+		conn = container_of(entry, struct sock_conn, event_entry);
+		entry = entry->next;
+
+		sock_conn_handle_event(map, conn);
+		if (!conn->events) {
+			dlist_remove(&conn->event_entry);
+			dlist_init(&conn->event_entry);
+		}
+	}
+
+	if (now) {
+		map->evict_time = now;
+		if (sock_conn_idle_timeout || (sock_conn_cache_size &&
+					       map->open_cnt > sock_conn_cache_size))
+			sock_conn_map_shrink(map, now);
+		if (now - map->trim_time >= SOCK_COMM_TRIM_INTERVAL) {
+			map->trim_time = now;
+			sock_conn_map_trim(map);
+		}
+	}
+	fastlock_release(&map->lock);
+}
+
+/* keep the progress engine off the connections of a closing endpoint */
+void sock_conn_map_detach(struct sock_conn_map *map, struct sock_ep *ep)
+{
+	struct sock_pe *pe = container_of(map, struct sock_pe, cmap);
+	struct dlist_entry *entry;
+	struct sock_conn *conn;
+	int i;
+
+	fastlock_acquire(&pe->lock);
+	fastlock_acquire(&map->lock);
+	for (entry = ep->conn_list.next; entry != &ep->conn_list;
+	     entry = entry->next) {
+		conn = container_of(entry, struct sock_conn, ep_entry);
+		if (!dlist_empty(&conn->open_entry)) {
+			dlist_remove(&conn->open_entry);
+			dlist_init(&conn->open_entry);
+			map->open_cnt--;
+		}
+		if (conn->events) {
+			dlist_remove(&conn->event_entry);
+			dlist_init(&conn->event_entry);
+			conn->events = 0;
+		}
+	}
+
+	for (i = 0; i < map->connect_cnt; ) {
+		conn = sock_conn_map_lookup_key(map, map->connect_keys[i]);
+		if (conn->ep == ep) {
+			sock_conn_abort(conn);
+			conn->state = SOCK_CONN_STATE_FAILED;
+			map->connect_keys[i] =
+				map->connect_keys[--map->connect_cnt];
 			continue;
 		}
+		i++;
+	}
+	fastlock_release(&map->lock);
+	fastlock_release(&pe->lock);
+}
 
-		SOCK_LOG_DBG("Remote port: %d\n", ntohs(remote.sin_port));
+/* caller holds the map lock */
+static struct sock_conn *sock_conn_accept_lookup(struct sock_conn_map *map,
+						 struct sock_conn_accept *pending)
+{
+	uint16_t index;
+	struct sock_conn *conn;
+	struct sock_conn_hello *hello = &pending->hello;
+
+	index = sock_conn_map_lookup(map, &pending->remote);
+	conn = index ? sock_conn_map_lookup_key(map, index) : NULL;
+	if (!conn || ((pid_t) ntohl(hello->pid) == getpid() &&
+		      hello->port == pending->ep->src_addr->sin_port)) {
+		/* a connect to ourselves keeps both of its ends */
+		index = sock_conn_map_insert(map, &pending->remote,
+					     pending->ep);
+		return index ? sock_conn_map_lookup_key(map, index) : NULL;
+	}
 
-		fastlock_acquire(&map->lock);
-		index = sock_conn_map_lookup(map, &remote);
-		if (!index) {
-			sock_conn_map_insert(map, &remote, ep, conn_fd);
-			use_conn = 1;
-		} else {
-			use_conn = 0;
+	if (conn->state == SOCK_CONN_STATE_CONNECTED ||
+	    conn->state == SOCK_CONN_STATE_ACCEPTING ||
+	    (conn->state == SOCK_CONN_STATE_CLOSING &&
+	     conn->accept_fd >= 0) ||
+	    ((conn->state == SOCK_CONN_STATE_CONNECTING ||
+	      conn->state == SOCK_CONN_STATE_HELLO) &&
+	     !sock_conn_addr_lower(&pending->remote, conn->ep->src_addr)))
+		return NULL;
+	return conn;
+}
+
+/*
+ * Hand the accepted socket to its connection once our response is on
+ * the wire, or drop it if the response could not be sent or the
+ * connection was given up meanwhile.  Caller holds the CM loop lock.
+ */
+static void sock_conn_accept_complete(struct sock_conn_accept *pending,
+				      int err)
+{
+	struct sock_conn_map *map = &pending->ep->pe->cmap;
+	struct sock_conn *conn;
+	int conn_fd = pending->handler.fd;
+
+	sock_cm_loop_remove(&pending->handler);
+	dlist_remove(&pending->entry);
+
+	fastlock_acquire(&map->lock);
+	conn = pending->key ? sock_conn_map_lookup_key(map, pending->key) :
+		NULL;
+	if (err) {
+		if (conn && conn->state == SOCK_CONN_STATE_ACCEPTING)
+			conn->state = SOCK_CONN_STATE_FAILED;
+		conn = NULL;
+	} else if (conn && conn->state == SOCK_CONN_STATE_CLOSING &&
+		   conn->accept_fd < 0) {
+		/* the peer took our close; switch over at EOF */
+		conn->accept_fd = conn_fd;
+		conn->accept_shm = pending->shm;
+	} else if (conn && conn->state == SOCK_CONN_STATE_ACCEPTING) {
+		sock_conn_establish(map, conn, conn_fd, pending->shm);
+	} else {
+		conn = NULL;
+	}
+	fastlock_release(&map->lock);
+
+	if (!conn) {
+		sock_shm_free(pending->shm);
+		shutdown(conn_fd, SHUT_RDWR);
+		close(conn_fd);
+	}
+	SOCK_LOG_DBG("Use conn: %d, shm: %d\n", conn != NULL,
+		     conn && pending->resp.use_shm);
+	free(pending);
+}
+
+/* caller holds the CM loop lock */
+static void sock_conn_accept_abort(struct sock_conn_accept *pending)
+{
+	sock_conn_accept_complete(pending, -FI_ECANCELED);
+}
+
+static void sock_conn_handle_resp(struct sock_cm_handler *handler)
+{
+	struct sock_conn_accept *pending;
+	ssize_t ret;
+
+	pending = container_of(handler, struct sock_conn_accept, handler);
+	while (pending->sent < sizeof(pending->resp)) {
+		ret = send(handler->fd, (char *) &pending->resp + pending->sent,
+			   sizeof(pending->resp) - pending->sent, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			SOCK_LOG_ERROR("Cannot exchange port: %s\n",
+				       strerror(errno));
+			sock_conn_accept_complete(pending, -errno);
+			return;
 		}
-		fastlock_release(&map->lock);
+		pending->sent += ret;
+	}
+	sock_conn_accept_complete(pending, 0);
+}
 
-		do {
-			ret = send(conn_fd, &use_conn, sizeof(use_conn), 0);
-		} while (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+/*
+ * Decide what the accepted socket is for and answer the peer.  The
+ * response has to be on the wire before the progress engine can send
+ * anything on the connection, so a connection we take is parked in
+ * SOCK_CONN_STATE_ACCEPTING and the response is finished from the CM
+ * loop as the socket drains.
+ */
+static void sock_conn_accept_done(struct sock_conn_accept *pending)
+{
+	struct sock_conn_hello *hello = &pending->hello;
+	struct sock_conn_map *map = &pending->ep->pe->cmap;
+	struct sock_cm_handler *handler = &pending->handler;
+	struct sock_cm_loop *loop = handler->loop;
+	struct sock_conn *conn;
 
-		if (ret != sizeof(use_conn))
-			SOCK_LOG_ERROR("Cannot exchange port\n");
+	pending->remote.sin_port = hello->port;
+	hello->shm_name[SOCK_SHM_NAME_LEN - 1] = '\0';
+	SOCK_LOG_DBG("Remote port: %d\n", ntohs(pending->remote.sin_port));
 
-		if (!use_conn) {
-			shutdown(conn_fd, SHUT_RDWR);
+	memset(&pending->resp, 0, sizeof(pending->resp));
+	pending->resp.version = SOCK_WIRE_PROTO_VERSION;
+	pending->resp.pid = htonl(getpid());
+
+	/* a refusal still answers, so the peer can report why */
+	fastlock_acquire(&map->lock);
+	if (hello->version != SOCK_WIRE_PROTO_VERSION) {
+		SOCK_LOG_ERROR("Refusing peer with wire protocol %d (ours: %d)\n",
+			       hello->version, SOCK_WIRE_PROTO_VERSION);
+		conn = NULL;
+	} else {
+		conn = sock_conn_accept_lookup(map, pending);
+	}
+	if (conn) {
+		if (hello->shm_name[0] && sock_shm_enable &&
+		    sock_shm_is_local(handler->fd) &&
+		    (pid_t) ntohl(hello->pid) > 0 &&
+		    sock_shm_same_host(&hello->host) &&
+		    !sock_shm_host_id(&pending->resp.host) &&
+		    !sock_shm_attach(&pending->shm, hello->shm_name)) {
+			pending->shm->peer_pid = ntohl(hello->pid);
+			pending->shm->cma = sock_cma_threshold > 0;
+			pending->resp.use_shm = 1;
+		}
+
+		if (conn->state != SOCK_CONN_STATE_CLOSING) {
+			sock_conn_abort(conn);
+			conn->state = SOCK_CONN_STATE_ACCEPTING;
+		}
+		pending->key = conn->key;
+		pending->resp.use_conn = 1;
+	}
+	fastlock_release(&map->lock);
+
+	sock_cm_loop_remove(handler);
+	handler->handle = sock_conn_handle_resp;
+	handler->events = FI_EPOLL_OUT;
+	if (sock_cm_loop_add(loop, handler)) {
+		sock_conn_accept_complete(pending, -FI_ENOMEM);
+		return;
+	}
+	sock_conn_handle_resp(handler);
+}
+
+static void sock_conn_handle_hello(struct sock_cm_handler *handler)
+{
+	struct sock_conn_accept *pending;
+	ssize_t ret;
+
+	pending = container_of(handler, struct sock_conn_accept, handler);
+	ret = recv(handler->fd, (char *) &pending->hello + pending->len,
+		   sizeof(pending->hello) - pending->len, 0);
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+
+	if (ret <= 0) {
+		SOCK_LOG_ERROR("Cannot exchange port: %zd - %s\n", ret,
+			       strerror(errno));
+		sock_conn_accept_abort(pending);
+		return;
+	}
+
+	pending->len += ret;
+	if (pending->len < sizeof(pending->hello))
+		return;
+
+	sock_conn_accept_done(pending);
+}
+
+static void sock_conn_handle_listen(struct sock_cm_handler *handler)
+{
+	int conn_fd;
+	socklen_t addr_size;
+	struct sock_conn_accept *pending;
+	struct sock_conn_listener *listener;
+
+	listener = container_of(handler, struct sock_conn_listener, handler);
+	while (1) {
+		pending = calloc(1, sizeof(*pending));
+		if (!pending) {
+			SOCK_LOG_ERROR("failed to allocate accept entry\n");
+			return;
+		}
+
+		addr_size = sizeof(pending->remote);
+		conn_fd = accept(listener->sock,
+				 (struct sockaddr *) &pending->remote,
+				 &addr_size);
+		if (conn_fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				SOCK_LOG_ERROR("failed to accept: %d\n", errno);
+			free(pending);
+			return;
+		}
+
+		SOCK_LOG_DBG("ACCEPT: %s, %d\n",
+			     inet_ntoa(pending->remote.sin_addr),
+			     ntohs(pending->remote.sin_port));
+		sock_set_sockopts_conn(conn_fd);
+		fd_set_nonblock(conn_fd);
+
+		pending->ep = container_of(listener, struct sock_ep, listener);
+		pending->handler.fd = conn_fd;
+		pending->handler.handle = sock_conn_handle_hello;
+		if (sock_cm_loop_add(handler->loop, &pending->handler)) {
 			close(conn_fd);
+			free(pending);
+			continue;
 		}
-		SOCK_LOG_DBG("Use conn: %d\n", use_conn);
+		dlist_insert_tail(&pending->entry, &listener->accept_list);
 	}
+}
 
-err:
+void sock_conn_listen_close(struct sock_ep *ep)
+{
+	struct sock_conn_listener *listener = &ep->listener;
+	struct sock_cm_loop *loop = &ep->domain->fab->cm_loop;
+	struct sock_conn_accept *pending;
+
+	if (!listener->do_listen)
+		return;
+
+	fastlock_acquire(&loop->lock);
+	sock_cm_loop_remove(&listener->handler);
+	while (!dlist_empty(&listener->accept_list)) {
+		pending = container_of(listener->accept_list.next,
+				       struct sock_conn_accept, entry);
+		sock_conn_accept_abort(pending);
+	}
+	fastlock_release(&loop->lock);
+
+	listener->do_listen = 0;
 	close(listener->sock);
-	SOCK_LOG_DBG("Listener thread exited\n");
-	return NULL;
+	SOCK_LOG_DBG("Listener closed\n");
 }
 
 int sock_conn_listen(struct sock_ep *ep)
@@ -505,19 +1307,17 @@ int sock_conn_listen(struct sock_ep *ep)
 
 	((struct sockaddr_in *) (ep->src_addr))->sin_port =
 		htons(atoi(listener->service));
-	listener->do_listen = 1;
 	listener->sock = listen_fd;
-
-	sock_fabric_add_service(domain->fab, atoi(listener->service));
-	if (socketpair(AF_UNIX, SOCK_STREAM, 0, listener->signal_fds) < 0)
+	listener->handler.fd = listen_fd;
+	listener->handler.handle = sock_conn_handle_listen;
+	dlist_init(&listener->accept_list);
+	if (sock_cm_loop_add(&domain->fab->cm_loop, &listener->handler)) {
+		SOCK_LOG_ERROR("failed to add listener to CM loop\n");
 		goto err;
+	}
 
-	fd_set_nonblock(listener->signal_fds[1]);
-	if (pthread_create(&listener->listener_thread, 0,
-			   _sock_conn_listen, ep)) {
-		SOCK_LOG_ERROR("failed to create conn listener thread\n");
-		goto err;
-	} while (!*((volatile int*)&listener->is_ready));
+	listener->do_listen = 1;
+	sock_fabric_add_service(domain->fab, atoi(listener->service));
 	return 0;
 err:
 	if (listen_fd >= 0)
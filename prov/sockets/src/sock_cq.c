@@ -60,17 +60,18 @@ int sock_cq_progress(struct sock_cq *cq)
 	if (cq->domain->progress_mode == FI_PROGRESS_AUTO)
 		return 0;
 
+	/* manual progress domains run a single PE */
 	fastlock_acquire(&cq->list_lock);
 	for (entry = cq->tx_list.next; entry != &cq->tx_list;
 	     entry = entry->next) {
 		tx_ctx = container_of(entry, struct sock_tx_ctx, cq_entry);
-		sock_pe_progress_tx_ctx(cq->domain->pe, tx_ctx);
+		sock_pe_progress_tx_ctx(cq->domain->pe[0], tx_ctx);
 	}
 
 	for (entry = cq->rx_list.next; entry != &cq->rx_list;
 	     entry = entry->next) {
 		rx_ctx = container_of(entry, struct sock_rx_ctx, cq_entry);
-		sock_pe_progress_rx_ctx(cq->domain->pe, rx_ctx);
+		sock_pe_progress_rx_ctx(cq->domain->pe[0], rx_ctx);
 	}
 	fastlock_release(&cq->list_lock);
 
@@ -107,46 +108,170 @@ static ssize_t sock_cq_entry_size(struct sock_cq *sock_cq)
 	return size;
 }
 
+#ifdef HAVE_ATOMICS
+#define sock_cq_ring_lock(cq)
+#define sock_cq_ring_unlock(cq)
+#else
+#define sock_cq_ring_lock(cq)		fastlock_acquire(&(cq)->ring.lock)
+#define sock_cq_ring_unlock(cq)		fastlock_release(&(cq)->ring.lock)
+#endif
+
+static inline struct sock_cq_slot *sock_cq_ring_slot(struct sock_cq_ring *ring,
+						     size_t pos)
+{
+	return (struct sock_cq_slot *)
+		(ring->slots + (pos & ring->mask) * ring->slot_size);
+}
+
+static int sock_cq_ring_init(struct sock_cq_ring *ring, size_t size,
+			     size_t entry_size)
+{
+	size_t i, count = 1;
+
+	while (count < size)
+		count <<= 1;
+
+	ring->slot_size = (sizeof(struct sock_cq_slot) + entry_size + 7) & ~7;
+	ring->slots = calloc(count, ring->slot_size);
+	if (!ring->slots)
+		return -FI_ENOMEM;
+
+	ring->mask = count - 1;
+#ifndef HAVE_ATOMICS
+	fastlock_init(&ring->lock);
+#endif
+	for (i = 0; i < count; i++)
+		sock_seq_init(&sock_cq_ring_slot(ring, i)->seq, i);
+	sock_seq_init(&ring->head, 0);
+	sock_seq_init(&ring->tail, 0);
+	return 0;
+}
+
+static void sock_cq_ring_free(struct sock_cq_ring *ring)
+{
+#ifndef HAVE_ATOMICS
+	fastlock_destroy(&ring->lock);
+#endif
+	free(ring->slots);
+}
+
+static inline size_t sock_cq_ring_used(struct sock_cq_ring *ring)
+{
+	return sock_seq_load(&ring->tail) - sock_seq_load(&ring->head);
+}
+
+static int sock_cq_ring_put(struct sock_cq *cq, fi_addr_t addr,
+			    const void *buf, size_t len)
+{
+	struct sock_cq_ring *ring = &cq->ring;
+	struct sock_cq_slot *slot;
+	size_t pos, seq;
+
+	sock_cq_ring_lock(cq);
+	pos = sock_seq_load(&ring->tail);
+	for (;;) {
+		slot = sock_cq_ring_slot(ring, pos);
+		seq = sock_seq_load(&slot->seq);
+		if (seq == pos) {
+			if (sock_seq_cas(&ring->tail, pos, pos + 1))
+				break;
+		} else if ((ssize_t) (seq - pos) < 0) {
+			sock_cq_ring_unlock(cq);
+			return 0;
+		} else {
+			pos = sock_seq_load(&ring->tail);
+		}
+	}
+
+	slot->addr = addr;
+	memcpy(slot->entry, buf, len);
+	sock_seq_store(&slot->seq, pos + 1);
+	sock_cq_ring_unlock(cq);
+	return 1;
+}
+
+static int sock_cq_ring_get(struct sock_cq *cq, void *buf, fi_addr_t *addr)
+{
+	struct sock_cq_ring *ring = &cq->ring;
+	struct sock_cq_slot *slot;
+	size_t pos, seq;
+
+	sock_cq_ring_lock(cq);
+	pos = sock_seq_load(&ring->head);
+	for (;;) {
+		slot = sock_cq_ring_slot(ring, pos);
+		seq = sock_seq_load(&slot->seq);
+		if (seq == pos + 1) {
+			if (sock_seq_cas(&ring->head, pos, pos + 1))
+				break;
+		} else if ((ssize_t) (seq - (pos + 1)) < 0) {
+			sock_cq_ring_unlock(cq);
+			return 0;
+		} else {
+			pos = sock_seq_load(&ring->head);
+		}
+	}
+
+	memcpy(buf, slot->entry, cq->cq_entry_size);
+	if (addr)
+		*addr = slot->addr;
+	sock_seq_store(&slot->seq, pos + ring->mask + 1);
+	sock_cq_ring_unlock(cq);
+	return 1;
+}
+
+/* only wake the fd when someone may be sleeping on it */
+static inline void sock_cq_signal_fd(struct sock_cq *cq)
+{
+	sock_fence();
+	if (!atomic_get(&cq->waiters) && !cq->wait_fd_exported)
+		return;
+
+	fastlock_acquire(&cq->lock);
+	fd_signal_set(&cq->wait_fd);
+	fastlock_release(&cq->lock);
+}
+
+static inline void sock_cq_reset_fd(struct sock_cq *cq)
+{
+	if (cq->wait_fd.rcnt == cq->wait_fd.wcnt)
+		return;
+
+	fastlock_acquire(&cq->lock);
+	if (!sock_cq_ring_used(&cq->ring))
+		fd_signal_reset(&cq->wait_fd);
+	fastlock_release(&cq->lock);
+}
+
 static ssize_t _sock_cq_write(struct sock_cq *cq, fi_addr_t addr,
 			      const void *buf, size_t len)
 {
-	ssize_t ret;
 	struct sock_cq_overflow_entry_t *overflow_entry;
 
-	fastlock_acquire(&cq->lock);
-	if (rbfdavail(&cq->cq_rbfd) < len) {
+	/* keep completions in order behind anything already overflowed */
+	if (atomic_get(&cq->overflow_cnt) ||
+	    !sock_cq_ring_put(cq, addr, buf, len)) {
 		SOCK_LOG_ERROR("Not enough space in CQ\n");
 		overflow_entry = calloc(1, sizeof(*overflow_entry) + len);
-		if (!overflow_entry) {
-			ret = -FI_ENOSPC;
-			goto out;
-		}
+		if (!overflow_entry)
+			return -FI_ENOSPC;
 
 		memcpy(&overflow_entry->cq_entry[0], buf, len);
 		overflow_entry->len = len;
 		overflow_entry->addr = addr;
+		fastlock_acquire(&cq->lock);
 		dlist_insert_tail(&overflow_entry->entry, &cq->overflow_list);
-		ret = len;
-		goto out;
+		atomic_inc(&cq->overflow_cnt);
+		fastlock_release(&cq->lock);
 	}
 
+	if (cq->domain->progress_mode != FI_PROGRESS_MANUAL)
+		sock_cq_signal_fd(cq);
 
-	rbwrite(&cq->addr_rb, &addr, sizeof(addr));
-	rbcommit(&cq->addr_rb);
-
-	rbfdwrite(&cq->cq_rbfd, buf, len);
-	if (cq->domain->progress_mode == FI_PROGRESS_MANUAL)
-		rbcommit(&cq->cq_rbfd.rb);
-	else
-		rbfdcommit(&cq->cq_rbfd);
-
-	ret = len;
-
+	sock_poll_notify(&cq->poll_list);
 	if (cq->signal)
 		sock_wait_signal(cq->waitset);
-out:
-	fastlock_release(&cq->lock);
-	return ret;
+	return len;
 }
 
 static int sock_cq_report_context(struct sock_cq *cq, fi_addr_t addr,
@@ -218,60 +343,61 @@ static void sock_cq_set_report_fn(struct sock_cq *sock_cq)
 	}
 }
 
-static inline void sock_cq_copy_overflow_list(struct sock_cq *cq, size_t count)
+static void sock_cq_copy_overflow_list(struct sock_cq *cq)
 {
-	ssize_t i;
 	struct sock_cq_overflow_entry_t *overflow_entry;
 
-	for (i = 0; i < count && !dlist_empty(&cq->overflow_list); i++) {
+	fastlock_acquire(&cq->lock);
+	while (!dlist_empty(&cq->overflow_list)) {
 		overflow_entry = container_of(cq->overflow_list.next,
 					      struct sock_cq_overflow_entry_t,
 					      entry);
-		rbwrite(&cq->addr_rb, &overflow_entry->addr, sizeof(fi_addr_t));
-		rbcommit(&cq->addr_rb);
-
-		rbfdwrite(&cq->cq_rbfd, &overflow_entry->cq_entry[0], overflow_entry->len);
-		if (cq->domain->progress_mode == FI_PROGRESS_MANUAL)
-			rbcommit(&cq->cq_rbfd.rb);
-		else
-			rbfdcommit(&cq->cq_rbfd);
+		if (!sock_cq_ring_put(cq, overflow_entry->addr,
+				      &overflow_entry->cq_entry[0],
+				      overflow_entry->len))
+			break;
 
 		dlist_remove(&overflow_entry->entry);
+		atomic_dec(&cq->overflow_cnt);
 		free(overflow_entry);
 	}
+	fastlock_release(&cq->lock);
 }
 
-static inline ssize_t sock_cq_rbuf_read(struct sock_cq *cq, void *buf,
-					size_t count, fi_addr_t *src_addr,
-					size_t cq_entry_len)
+static ssize_t sock_cq_ring_read(struct sock_cq *cq, void *buf,
+				 size_t count, fi_addr_t *src_addr)
 {
 	ssize_t i;
-	fi_addr_t addr;
 
-	rbfdread(&cq->cq_rbfd, buf, cq_entry_len * count);
 	for (i = 0; i < count; i++) {
-		rbread(&cq->addr_rb, &addr, sizeof(addr));
-		if (src_addr)
-			src_addr[i] = addr;
+		if (!sock_cq_ring_get(cq, (char *) buf + i * cq->cq_entry_size,
+				      src_addr ? &src_addr[i] : NULL))
+			break;
 	}
-	sock_cq_copy_overflow_list(cq, count);
-	return count;
+
+	if (atomic_get(&cq->overflow_cnt))
+		sock_cq_copy_overflow_list(cq);
+	sock_cq_reset_fd(cq);
+	return i;
+}
+
+int sock_cq_has_entries(struct sock_cq *cq)
+{
+	return sock_cq_ring_used(&cq->ring) || rbused(&cq->cqerr_rb);
 }
 
 static ssize_t sock_cq_sreadfrom(struct fid_cq *cq, void *buf, size_t count,
 			fi_addr_t *src_addr, const void *cond, int timeout)
 {
-	int ret = 0;
+	ssize_t ret = 0;
 	size_t threshold;
 	struct sock_cq *sock_cq;
 	uint64_t start_ms = 0, end_ms = 0;
-	ssize_t cq_entry_len, avail;
 
 	sock_cq = container_of(cq, struct sock_cq, cq_fid);
 	if (rbused(&sock_cq->cqerr_rb))
 		return -FI_EAVAIL;
 
-	cq_entry_len = sock_cq->cq_entry_size;
 	if (sock_cq->attr.wait_cond == FI_CQ_COND_THRESHOLD)
 		threshold = MIN((uintptr_t) cond, count);
 	else
@@ -285,32 +411,26 @@ static ssize_t sock_cq_sreadfrom(struct fid_cq *cq, void *buf, size_t count,
 
 		do {
 			sock_cq_progress(sock_cq);
-			fastlock_acquire(&sock_cq->lock);
-			avail = rbfdused(&sock_cq->cq_rbfd);
-			if (avail)
-				ret = sock_cq_rbuf_read(sock_cq, buf,
-					MIN(threshold, avail / cq_entry_len),
-					src_addr, cq_entry_len);
-			fastlock_release(&sock_cq->lock);
+			ret = sock_cq_ring_read(sock_cq, buf, threshold,
+						src_addr);
 			if (ret == 0 && timeout >= 0) {
 				if (fi_gettime_ms() >= end_ms)
 					return -FI_EAGAIN;
 			}
 		} while (ret == 0);
 	} else {
-		ret = rbfdwait(&sock_cq->cq_rbfd, timeout);
-		if (ret > 0) {
-			fastlock_acquire(&sock_cq->lock);
-			ret = 0;
-			avail = rbfdused(&sock_cq->cq_rbfd);
-			if (avail)
-				ret = sock_cq_rbuf_read(sock_cq, buf,
-					MIN(threshold, avail / cq_entry_len),
-					src_addr, cq_entry_len);
-			fastlock_release(&sock_cq->lock);
+		ret = sock_cq_ring_read(sock_cq, buf, threshold, src_addr);
+		if (ret == 0 && timeout) {
+			atomic_inc(&sock_cq->waiters);
+			sock_fence();
+			if (!sock_cq_has_entries(sock_cq))
+				fd_signal_poll(&sock_cq->wait_fd, timeout);
+			atomic_dec(&sock_cq->waiters);
+			ret = sock_cq_ring_read(sock_cq, buf, threshold,
+						src_addr);
 		}
 	}
-	return (ret == 0 || ret == -FI_ETIMEDOUT) ? -FI_EAGAIN : ret;
+	return (ret == 0) ? -FI_EAGAIN : ret;
 }
 
 static ssize_t sock_cq_sread(struct fid_cq *cq, void *buf, size_t len,
@@ -367,12 +487,13 @@ static int sock_cq_close(struct fid *fid)
 	if (atomic_get(&cq->ref))
 		return -FI_EBUSY;
 
+	sock_poll_list_fini(&cq->poll_list);
 	if (cq->signal && cq->attr.wait_obj == FI_WAIT_MUTEX_COND)
 		sock_wait_close(&cq->waitset->fid);
 
-	rbfree(&cq->addr_rb);
+	sock_cq_ring_free(&cq->ring);
 	rbfree(&cq->cqerr_rb);
-	rbfdfree(&cq->cq_rbfd);
+	fd_signal_free(&cq->wait_fd);
 
 	fastlock_destroy(&cq->lock);
 	fastlock_destroy(&cq->list_lock);
@@ -386,7 +507,9 @@ static int sock_cq_signal(struct fid_cq *cq)
 {
 	struct sock_cq *sock_cq;
 	sock_cq = container_of(cq, struct sock_cq, cq_fid);
-	rbfdsignal(&sock_cq->cq_rbfd);
+	fastlock_acquire(&sock_cq->lock);
+	fd_signal_set(&sock_cq->wait_fd);
+	fastlock_release(&sock_cq->lock);
 	return 0;
 }
 
@@ -413,7 +536,8 @@ static int sock_cq_control(struct fid *fid, int command, void *arg)
 		case FI_WAIT_NONE:
 		case FI_WAIT_FD:
 		case FI_WAIT_UNSPEC:
-			memcpy(arg, &cq->cq_rbfd.fd[RB_READ_FD], sizeof(int));
+			memcpy(arg, &cq->wait_fd.fd[FI_READ_FD], sizeof(int));
+			cq->wait_fd_exported = 1;
 			break;
 
 		case FI_WAIT_SET:
@@ -490,7 +614,6 @@ int sock_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 	struct sock_domain *sock_dom;
 	struct sock_cq *sock_cq;
 	struct fi_wait_attr wait_attr;
-	struct sock_fid_list *list_entry;
 	struct sock_wait *wait;
 	int ret;
 
@@ -526,15 +649,16 @@ int sock_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 	dlist_init(&sock_cq->ep_list);
 	dlist_init(&sock_cq->overflow_list);
 
-	ret = rbfdinit(&sock_cq->cq_rbfd, sock_cq->attr.size *
-			sock_cq->cq_entry_size);
+	ret = sock_cq_ring_init(&sock_cq->ring, sock_cq->attr.size,
+				sock_cq->cq_entry_size);
 	if (ret)
 		goto err1;
 
-	ret = rbinit(&sock_cq->addr_rb,
-			sock_cq->attr.size * sizeof(fi_addr_t));
+	ret = fd_signal_init(&sock_cq->wait_fd);
 	if (ret)
 		goto err2;
+	atomic_initialize(&sock_cq->waiters, 0);
+	atomic_initialize(&sock_cq->overflow_cnt, 0);
 
 	ret = rbinit(&sock_cq->cqerr_rb, sock_cq->attr.size *
 			sizeof(struct fi_cq_err_entry));
@@ -542,6 +666,7 @@ int sock_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 		goto err3;
 
 	fastlock_init(&sock_cq->lock);
+	sock_poll_list_init(&sock_cq->poll_list);
 
 	switch (sock_cq->attr.wait_obj) {
 	case FI_WAIT_NONE:
@@ -570,10 +695,9 @@ int sock_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 		sock_cq->waitset = attr->wait_set;
 		sock_cq->signal = 1;
 		wait = container_of(attr->wait_set, struct sock_wait, wait_fid);
-		list_entry = calloc(1, sizeof(*list_entry));
-		dlist_init(&list_entry->entry);
-		list_entry->fid = &sock_cq->cq_fid.fid;
-		dlist_insert_after(&list_entry->entry, &wait->fid_list);
+		ret = sock_poll_set_add(&wait->pset, &sock_cq->cq_fid.fid);
+		if (ret)
+			goto err4;
 		break;
 
 	default:
@@ -589,9 +713,9 @@ int sock_cq_open(struct fid_domain *domain, struct fi_cq_attr *attr,
 err4:
 	rbfree(&sock_cq->cqerr_rb);
 err3:
-	rbfree(&sock_cq->addr_rb);
+	fd_signal_free(&sock_cq->wait_fd);
 err2:
-	rbfdfree(&sock_cq->cq_rbfd);
+	sock_cq_ring_free(&sock_cq->ring);
 err1:
 	free(sock_cq);
 	return ret;
@@ -626,7 +750,12 @@ int sock_cq_report_error(struct sock_cq *cq, struct sock_pe_entry *entry,
 
 	rbwrite(&cq->cqerr_rb, &err_entry, sizeof(err_entry));
 	rbcommit(&cq->cqerr_rb);
-	ret = 0;
+	fastlock_release(&cq->lock);
+
+	sock_poll_notify(&cq->poll_list);
+	if (cq->signal)
+		sock_wait_signal(cq->waitset);
+	return 0;
 
 out:
 	fastlock_release(&cq->lock);
@@ -635,11 +764,5 @@ out:
 
 int sock_cq_check_size_ok(struct sock_cq *cq)
 {
-	int ret = 1;
-	fastlock_acquire(&cq->lock);
-	if (rbfdavail(&cq->cq_rbfd) < sock_cq_entry_size(cq))
-		ret = 0;
-
-	fastlock_release(&cq->lock);
-	return ret;
+	return sock_cq_ring_used(&cq->ring) <= cq->ring.mask;
 }
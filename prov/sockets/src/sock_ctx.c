@@ -34,6 +34,7 @@
 #  include <config.h>
 #endif /* HAVE_CONFIG_H */
 
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -47,6 +48,8 @@ struct sock_rx_ctx *sock_rx_ctx_alloc(const struct fi_rx_attr *attr,
 					void *context)
 {
 	struct sock_rx_ctx *rx_ctx;
+	int i;
+
 	rx_ctx = calloc(1, sizeof(*rx_ctx));
 	if (!rx_ctx)
 		return NULL;
@@ -58,7 +61,12 @@ struct sock_rx_ctx *sock_rx_ctx_alloc(const struct fi_rx_attr *attr,
 	dlist_init(&rx_ctx->pe_entry_list);
 	dlist_init(&rx_ctx->rx_entry_list);
 	dlist_init(&rx_ctx->rx_buffered_list);
+	dlist_init(&rx_ctx->rx_rndv_list);
+	dlist_init(&rx_ctx->rx_wild_list);
 	dlist_init(&rx_ctx->ep_list);
+	slist_init(&rx_ctx->buf_slab_list);
+	for (i = 0; i < SOCK_RX_BUF_CLASSES; i++)
+		slist_init(&rx_ctx->buf_pool[i].free_list);
 
 	fastlock_init(&rx_ctx->lock);
 
@@ -73,9 +81,92 @@ void sock_rx_ctx_free(struct sock_rx_ctx *rx_ctx)
 {
 	fastlock_destroy(&rx_ctx->lock);
 	free(rx_ctx->rx_entry_pool);
+	free(rx_ctx->rx_match_hash);
+	free(rx_ctx->rx_buffered_hash);
+	sock_rx_free_buf_pool(rx_ctx);
 	free(rx_ctx);
 }
 
+#ifdef HAVE_ATOMICS
+#define sock_tx_ring_lock(ring)
+#define sock_tx_ring_unlock(ring)
+#else
+#define sock_tx_ring_lock(ring)		fastlock_acquire(&(ring)->lock)
+#define sock_tx_ring_unlock(ring)	fastlock_release(&(ring)->lock)
+#endif
+
+static int sock_tx_ring_init(struct sock_tx_ring *ring, size_t len)
+{
+	size_t i, count = 16;
+	int ret;
+
+	while (count * SOCK_TX_SLOT_SZ < len)
+		count <<= 1;
+
+	if (posix_memalign((void **) &ring->slots, SOCK_TX_SLOT_SZ,
+			   count * SOCK_TX_SLOT_SZ))
+		return -FI_ENOMEM;
+
+	ring->seq = calloc(count, sizeof(*ring->seq));
+	if (!ring->seq) {
+		ret = -FI_ENOMEM;
+		goto err1;
+	}
+
+	ret = fd_signal_init(&ring->signal);
+	if (ret)
+		goto err2;
+
+	ring->mask = count - 1;
+	for (i = 0; i < count; i++)
+		sock_seq_init(&ring->seq[i], 0);
+	sock_seq_init(&ring->head, 0);
+	sock_seq_init(&ring->tail, 0);
+	sock_seq_init(&ring->doorbell, 0);
+#ifndef HAVE_ATOMICS
+	fastlock_init(&ring->lock);
+#endif
+	return 0;
+
+err2:
+	free(ring->seq);
+err1:
+	free(ring->slots);
+	return ret;
+}
+
+static void sock_tx_ring_free(struct sock_tx_ring *ring)
+{
+#ifndef HAVE_ATOMICS
+	fastlock_destroy(&ring->lock);
+#endif
+	fd_signal_free(&ring->signal);
+	free(ring->seq);
+	free(ring->slots);
+}
+
+static void sock_tx_ring_copy_in(struct sock_tx_ring *ring, size_t off,
+				 const void *buf, size_t len)
+{
+	size_t size = (ring->mask + 1) * SOCK_TX_SLOT_SZ, n;
+
+	off &= size - 1;
+	n = MIN(len, size - off);
+	memcpy(ring->slots + off, buf, n);
+	memcpy(ring->slots, (const char *) buf + n, len - n);
+}
+
+static void sock_tx_ring_copy_out(struct sock_tx_ring *ring, size_t off,
+				  void *buf, size_t len)
+{
+	size_t size = (ring->mask + 1) * SOCK_TX_SLOT_SZ, n;
+
+	off &= size - 1;
+	n = MIN(len, size - off);
+	memcpy(buf, ring->slots + off, n);
+	memcpy((char *) buf + n, ring->slots, len - n);
+}
+
 static struct sock_tx_ctx *sock_tx_context_alloc(const struct fi_tx_attr *attr,
 					     void *context, size_t fclass)
 {
@@ -86,10 +177,10 @@ static struct sock_tx_ctx *sock_tx_context_alloc(const struct fi_tx_attr *attr,
 	if (!tx_ctx)
 		return NULL;
 
-	if (rbfdinit(&tx_ctx->rbfd,
+	if (sock_tx_ring_init(&tx_ctx->ring,
 		(attr->size) ? attr->size * SOCK_EP_TX_ENTRY_SZ :
 		SOCK_EP_TX_SZ * SOCK_EP_TX_ENTRY_SZ))
-		goto err;
+		goto err1;
 
 	dlist_init(&tx_ctx->cq_entry);
 	dlist_init(&tx_ctx->cntr_entry);
@@ -99,7 +190,6 @@ static struct sock_tx_ctx *sock_tx_context_alloc(const struct fi_tx_attr *attr,
 	dlist_init(&tx_ctx->ep_list);
 
 	fastlock_init(&tx_ctx->rlock);
-	fastlock_init(&tx_ctx->wlock);
 	fastlock_init(&tx_ctx->lock);
 
 	switch (fclass) {
@@ -114,18 +204,22 @@ static struct sock_tx_ctx *sock_tx_context_alloc(const struct fi_tx_attr *attr,
 		tx_ctx->fclass = FI_CLASS_STX_CTX;
 		break;
 	default:
-		goto err;
+		goto err2;
 	}
 	tx_ctx->attr = *attr;
 	tx_ctx->attr.op_flags |= FI_TRANSMIT_COMPLETE;
 
 	tx_ctx->rx_ctrl_ctx = sock_rx_ctx_alloc(&rx_attr, NULL);
 	if (!tx_ctx->rx_ctrl_ctx)
-		goto err;
+		goto err2;
 	tx_ctx->rx_ctrl_ctx->is_ctrl_ctx = 1;
 	return tx_ctx;
 
-err:
+err2:
+	fastlock_destroy(&tx_ctx->rlock);
+	fastlock_destroy(&tx_ctx->lock);
+	sock_tx_ring_free(&tx_ctx->ring);
+err1:
 	free(tx_ctx);
 	return NULL;
 }
@@ -146,73 +240,193 @@ struct sock_tx_ctx *sock_stx_ctx_alloc(const struct fi_tx_attr *attr,
 void sock_tx_ctx_free(struct sock_tx_ctx *tx_ctx)
 {
 	fastlock_destroy(&tx_ctx->rlock);
-	fastlock_destroy(&tx_ctx->wlock);
 	fastlock_destroy(&tx_ctx->lock);
-	rbfdfree(&tx_ctx->rbfd);
+	sock_tx_ring_free(&tx_ctx->ring);
 	sock_rx_ctx_free(tx_ctx->rx_ctrl_ctx);
 	free(tx_ctx);
 }
 
-void sock_tx_ctx_start(struct sock_tx_ctx *tx_ctx)
+int sock_tx_ctx_start(struct sock_tx_ctx *tx_ctx, struct sock_tx_cmd *cmd,
+		      size_t len)
+{
+	struct sock_tx_ring *ring = &tx_ctx->ring;
+	size_t pos, slots;
+
+	slots = (len + sizeof(struct sock_tx_cmd_hdr) + SOCK_TX_SLOT_SZ - 1) /
+		SOCK_TX_SLOT_SZ;
+
+	sock_tx_ring_lock(ring);
+	pos = sock_seq_load(&ring->tail);
+	do {
+		if (pos + slots - sock_seq_load(&ring->head) > ring->mask + 1) {
+			sock_tx_ring_unlock(ring);
+			return -FI_EAGAIN;
+		}
+	} while (!sock_seq_cas(&ring->tail, pos, pos + slots));
+	sock_tx_ring_unlock(ring);
+
+	cmd->tx_ctx = tx_ctx;
+	cmd->pos = pos;
+	cmd->slots = slots;
+	cmd->off = sizeof(struct sock_tx_cmd_hdr);
+	return 0;
+}
+
+void sock_tx_ctx_write(struct sock_tx_cmd *cmd, const void *buf, size_t len)
 {
-	fastlock_acquire(&tx_ctx->wlock);
+	assert(cmd->off + len <= cmd->slots * SOCK_TX_SLOT_SZ);
+	sock_tx_ring_copy_in(&cmd->tx_ctx->ring,
+			     cmd->pos * SOCK_TX_SLOT_SZ + cmd->off, buf, len);
+	cmd->off += len;
 }
 
-void sock_tx_ctx_write(struct sock_tx_ctx *tx_ctx, const void *buf, size_t len)
+static void sock_tx_ctx_publish(struct sock_tx_cmd *cmd, int aborted)
 {
-	rbfdwrite(&tx_ctx->rbfd, buf, len);
+	struct sock_tx_ring *ring = &cmd->tx_ctx->ring;
+	struct sock_tx_cmd_hdr hdr;
+
+	hdr.slots = cmd->slots;
+	hdr.aborted = aborted;
+	sock_tx_ring_copy_in(ring, cmd->pos * SOCK_TX_SLOT_SZ,
+			     &hdr, sizeof(hdr));
+
+	sock_tx_ring_lock(ring);
+	sock_seq_store(&ring->seq[cmd->pos & ring->mask], cmd->pos + 1);
+	sock_tx_ring_unlock(ring);
 }
 
-void sock_tx_ctx_commit(struct sock_tx_ctx *tx_ctx)
+void sock_tx_ctx_commit(struct sock_tx_cmd *cmd)
 {
-	if (tx_ctx->domain->progress_mode == FI_PROGRESS_MANUAL)
-		rbcommit(&tx_ctx->rbfd.rb);
-	else
-		rbfdcommit(&tx_ctx->rbfd);
+	struct sock_tx_ring *ring = &cmd->tx_ctx->ring;
+	char c = 0;
+
+	sock_tx_ctx_publish(cmd, 0);
+	if (cmd->tx_ctx->domain->progress_mode == FI_PROGRESS_MANUAL)
+		return;
 
-	fastlock_release(&tx_ctx->wlock);
+	/* only the poster that sets the doorbell writes to the fd */
+	sock_fence();
+	if (sock_seq_load(&ring->doorbell) ||
+	    sock_seq_xchg(&ring->doorbell, 1))
+		return;
+
+	if (write(ring->signal.fd[FI_WRITE_FD], &c, sizeof(c)) != sizeof(c))
+		SOCK_LOG_ERROR("Failed to signal TX ctx\n");
 }
 
-void sock_tx_ctx_abort(struct sock_tx_ctx *tx_ctx)
+void sock_tx_ctx_abort(struct sock_tx_cmd *cmd)
 {
-	rbfdabort(&tx_ctx->rbfd);
-	fastlock_release(&tx_ctx->wlock);
+	/* the slots are already claimed; publish them for the PE to skip */
+	sock_tx_ctx_publish(cmd, 1);
 }
 
-void sock_tx_ctx_write_op_send(struct sock_tx_ctx *tx_ctx,
+void sock_tx_ctx_write_op_send(struct sock_tx_cmd *cmd,
 		struct sock_op *op, uint64_t flags, uint64_t context,
 		uint64_t dest_addr, uint64_t buf, struct sock_ep *ep,
 		struct sock_conn *conn)
 {
-	sock_tx_ctx_write(tx_ctx, op, sizeof(*op));
-	sock_tx_ctx_write(tx_ctx, &flags, sizeof(flags));
-	sock_tx_ctx_write(tx_ctx, &context, sizeof(context));
-	sock_tx_ctx_write(tx_ctx, &dest_addr, sizeof(dest_addr));
-	sock_tx_ctx_write(tx_ctx, &buf, sizeof(buf));
-	sock_tx_ctx_write(tx_ctx, &ep, sizeof(ep));
-	sock_tx_ctx_write(tx_ctx, &conn, sizeof(conn));
+	sock_tx_ctx_write(cmd, op, sizeof(*op));
+	sock_tx_ctx_write(cmd, &flags, sizeof(flags));
+	sock_tx_ctx_write(cmd, &context, sizeof(context));
+	sock_tx_ctx_write(cmd, &dest_addr, sizeof(dest_addr));
+	sock_tx_ctx_write(cmd, &buf, sizeof(buf));
+	sock_tx_ctx_write(cmd, &ep, sizeof(ep));
+	sock_tx_ctx_write(cmd, &conn, sizeof(conn));
 }
 
-void sock_tx_ctx_write_op_tsend(struct sock_tx_ctx *tx_ctx,
+void sock_tx_ctx_write_op_tsend(struct sock_tx_cmd *cmd,
 		struct sock_op *op, uint64_t flags, uint64_t context,
 		uint64_t dest_addr, uint64_t buf, struct sock_ep *ep,
 		struct sock_conn *conn, uint64_t tag)
 {
-	sock_tx_ctx_write_op_send(tx_ctx, op, flags, context, dest_addr,
+	sock_tx_ctx_write_op_send(cmd, op, flags, context, dest_addr,
 			buf, ep, conn);
-	sock_tx_ctx_write(tx_ctx, &tag, sizeof(tag));
+	sock_tx_ctx_write(cmd, &tag, sizeof(tag));
+}
+
+int sock_tx_ctx_empty(struct sock_tx_ctx *tx_ctx)
+{
+	return sock_seq_load(&tx_ctx->ring.head) ==
+		sock_seq_load(&tx_ctx->ring.tail);
+}
+
+size_t sock_tx_ctx_avail(struct sock_tx_ctx *tx_ctx)
+{
+	struct sock_tx_ring *ring = &tx_ctx->ring;
+
+	return (ring->mask + 1 - (sock_seq_load(&ring->tail) -
+		sock_seq_load(&ring->head))) * SOCK_TX_SLOT_SZ;
+}
+
+/* the doorbell is cleared only once its byte has been consumed */
+static void sock_tx_ring_reset(struct sock_tx_ring *ring)
+{
+	char c;
+
+	if (!sock_seq_load(&ring->doorbell))
+		return;
+
+	if (read(ring->signal.fd[FI_READ_FD], &c, sizeof(c)) == sizeof(c))
+		sock_seq_store(&ring->doorbell, 0);
+}
+
+/* called by the PE with tx_ctx->rlock held */
+int sock_tx_ctx_read_start(struct sock_tx_ctx *tx_ctx, struct sock_tx_cmd *cmd)
+{
+	struct sock_tx_ring *ring = &tx_ctx->ring;
+	struct sock_tx_cmd_hdr hdr;
+	size_t pos, seq;
+
+	for (;;) {
+		pos = sock_seq_load(&ring->head);
+		sock_tx_ring_lock(ring);
+		seq = sock_seq_load(&ring->seq[pos & ring->mask]);
+		sock_tx_ring_unlock(ring);
+		if (seq != pos + 1) {
+			if (pos == sock_seq_load(&ring->tail))
+				sock_tx_ring_reset(ring);
+			return 0;
+		}
+
+		sock_tx_ring_copy_out(ring, pos * SOCK_TX_SLOT_SZ,
+				      &hdr, sizeof(hdr));
+		cmd->tx_ctx = tx_ctx;
+		cmd->pos = pos;
+		cmd->slots = hdr.slots;
+		cmd->off = sizeof(hdr);
+		if (!hdr.aborted)
+			return 1;
+		sock_tx_ctx_read_done(cmd);
+	}
+}
+
+void sock_tx_ctx_read(struct sock_tx_cmd *cmd, void *buf, size_t len)
+{
+	sock_tx_ring_copy_out(&cmd->tx_ctx->ring,
+			      cmd->pos * SOCK_TX_SLOT_SZ + cmd->off, buf, len);
+	cmd->off += len;
+}
+
+void sock_tx_ctx_read_done(struct sock_tx_cmd *cmd)
+{
+	struct sock_tx_ring *ring = &cmd->tx_ctx->ring;
+	size_t head = cmd->pos + cmd->slots;
+
+	sock_seq_store(&ring->head, head);
+	if (head == sock_seq_load(&ring->tail))
+		sock_tx_ring_reset(ring);
 }
 
-void sock_tx_ctx_read_op_send(struct sock_tx_ctx *tx_ctx,
+void sock_tx_ctx_read_op_send(struct sock_tx_cmd *cmd,
 		struct sock_op *op, uint64_t *flags, uint64_t *context,
 		uint64_t *dest_addr, uint64_t *buf, struct sock_ep **ep,
 		struct sock_conn **conn)
 {
-	rbfdread(&tx_ctx->rbfd, op, sizeof(*op));
-	rbfdread(&tx_ctx->rbfd, flags, sizeof(*flags));
-	rbfdread(&tx_ctx->rbfd, context, sizeof(*context));
-	rbfdread(&tx_ctx->rbfd, dest_addr, sizeof(*dest_addr));
-	rbfdread(&tx_ctx->rbfd, buf, sizeof(*buf));
-	rbfdread(&tx_ctx->rbfd, ep, sizeof(*ep));
-	rbfdread(&tx_ctx->rbfd, conn, sizeof(*conn));
+	sock_tx_ctx_read(cmd, op, sizeof(*op));
+	sock_tx_ctx_read(cmd, flags, sizeof(*flags));
+	sock_tx_ctx_read(cmd, context, sizeof(*context));
+	sock_tx_ctx_read(cmd, dest_addr, sizeof(*dest_addr));
+	sock_tx_ctx_read(cmd, buf, sizeof(*buf));
+	sock_tx_ctx_read(cmd, ep, sizeof(*ep));
+	sock_tx_ctx_read(cmd, conn, sizeof(*conn));
 }
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2015 Intel Corporation, Inc.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "sock.h"
+#include "sock_util.h"
+
+#define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_EP_DATA, __VA_ARGS__)
+#define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_DATA, __VA_ARGS__)
+
+#define SOCK_DGRAM_SOCK_BUF_SZ (1<<22)
+
+/*
+ * Datagram endpoints carry their traffic over one unconnected UDP socket
+ * bound to the same address and port as the endpoint's listener, so an
+ * AV entry names both.  Sends and receives are handed to the kernel in
+ * batches of up to SOCK_DGRAM_BATCH frames.
+ */
+int sock_dgram_open(struct sock_ep *ep)
+{
+	int sock_fd, size = SOCK_DGRAM_SOCK_BUF_SZ;
+	struct sock_dgram *dgram;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+
+	if (getsockname(ep->listener.sock, (struct sockaddr *) &addr,
+			&addr_len))
+		return -errno;
+
+	sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock_fd < 0)
+		return -errno;
+
+	if (bind(sock_fd, (struct sockaddr *) &addr, addr_len)) {
+		SOCK_LOG_ERROR("failed to bind datagram socket: %s\n",
+			       strerror(errno));
+		close(sock_fd);
+		return -errno;
+	}
+
+	if (setsockopt(sock_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) ||
+	    setsockopt(sock_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)))
+		SOCK_LOG_DBG("failed to size datagram socket buffers\n");
+	fd_set_nonblock(sock_fd);
+
+	dgram = calloc(1, sizeof(*dgram));
+	if (!dgram)
+		goto err1;
+
+	dgram->rx_buf = malloc(SOCK_DGRAM_BATCH * SOCK_DGRAM_BUF_SZ);
+	if (!dgram->rx_buf)
+		goto err2;
+
+	dgram->sock_fd = sock_fd;
+	dgram->ep = ep;
+	fastlock_init(&dgram->tx_lock);
+
+	if (fi_epoll_add(ep->pe->epoll_set, sock_fd, FI_EPOLL_IN, NULL)) {
+		SOCK_LOG_ERROR("failed to add datagram socket to PE poll set\n");
+		goto err3;
+	}
+
+	ep->dgram = dgram;
+	SOCK_LOG_DBG("Datagram socket bound to port %d\n", ntohs(addr.sin_port));
+	return 0;
+
+err3:
+	fastlock_destroy(&dgram->tx_lock);
+	free(dgram->rx_buf);
+err2:
+	free(dgram);
+err1:
+	close(sock_fd);
+	return -FI_ENOMEM;
+}
+
+void sock_dgram_close(struct sock_ep *ep)
+{
+	struct sock_dgram *dgram = ep->dgram;
+
+	if (!dgram)
+		return;
+
+	fastlock_acquire(&ep->lock);
+	ep->dgram = NULL;
+	fastlock_release(&ep->lock);
+
+	fi_epoll_del(ep->pe->epoll_set, dgram->sock_fd);
+	close(dgram->sock_fd);
+	fastlock_destroy(&dgram->tx_lock);
+	free(dgram->rx_buf);
+	free(dgram);
+}
+
+static void sock_dgram_build_msg(struct sock_dgram_slot *slot,
+				 struct iovec *iov, struct msghdr *msg)
+{
+	size_t i, cnt = 0;
+
+	iov[cnt].iov_base = &slot->msg_hdr;
+	iov[cnt++].iov_len = sizeof(slot->msg_hdr);
+
+	if (slot->msg_hdr.op_type == SOCK_OP_TSEND) {
+		iov[cnt].iov_base = &slot->tag;
+		iov[cnt++].iov_len = SOCK_TAG_SIZE;
+	}
+
+	if (slot->flags & FI_REMOTE_CQ_DATA) {
+		iov[cnt].iov_base = &slot->data;
+		iov[cnt++].iov_len = SOCK_CQ_DATA_SIZE;
+	}
+
+	if (slot->flags & FI_INJECT) {
+		iov[cnt].iov_base = slot->inject;
+		iov[cnt++].iov_len = slot->data_len;
+	} else {
+		for (i = 0; i < slot->iov_cnt; i++) {
+			iov[cnt].iov_base = (void *) (uintptr_t) slot->iov[i].iov.addr;
+			iov[cnt++].iov_len = slot->iov[i].iov.len;
+		}
+	}
+
+	memset(msg, 0, sizeof(*msg));
+	msg->msg_name = &slot->sin;
+	msg->msg_namelen = sizeof(slot->sin);
+	msg->msg_iov = iov;
+	msg->msg_iovlen = cnt;
+}
+
+/*
+ * Returns the number of queued frames, starting at tx_head, that the
+ * kernel has taken.  A frame it refuses outright is counted as sent:
+ * datagram delivery is best effort.
+ */
+int sock_dgram_send_batch(struct sock_dgram *dgram)
+{
+	struct iovec iov[SOCK_DGRAM_BATCH][SOCK_EP_MAX_IOV_LIMIT + 3];
+	int i, cnt, ret;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr msgs[SOCK_DGRAM_BATCH];
+#else
+	struct msghdr msg;
+#endif
+
+	cnt = MIN(dgram->tx_cnt, SOCK_DGRAM_BATCH - dgram->tx_head);
+
+#ifdef HAVE_SENDMMSG
+	for (i = 0; i < cnt; i++) {
+		sock_dgram_build_msg(&dgram->tx[dgram->tx_head + i], iov[i],
+				     &msgs[i].msg_hdr);
+		msgs[i].msg_len = 0;
+	}
+
+	ret = sendmmsg(dgram->sock_fd, msgs, cnt, 0);
+#else
+	for (i = 0; i < cnt; i++) {
+		sock_dgram_build_msg(&dgram->tx[dgram->tx_head + i], iov[i],
+				     &msg);
+		if (sendmsg(dgram->sock_fd, &msg, 0) < 0)
+			break;
+	}
+	ret = i ? i : -1;
+#endif
+	if (ret >= 0)
+		return ret;
+
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ||
+	    errno == EINTR)
+		return 0;
+
+	SOCK_LOG_DBG("datagram dropped: %s\n", strerror(errno));
+	return 1;
+}
+
+/*
+ * Fills rx_buf/rx_len/rx_addr with up to SOCK_DGRAM_BATCH frames and
+ * returns how many were read.  Truncated frames come back with length 0.
+ */
+int sock_dgram_recv_batch(struct sock_dgram *dgram)
+{
+	struct iovec iov[SOCK_DGRAM_BATCH];
+	int i, ret;
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr msgs[SOCK_DGRAM_BATCH];
+
+	for (i = 0; i < SOCK_DGRAM_BATCH; i++) {
+		iov[i].iov_base = dgram->rx_buf + i * SOCK_DGRAM_BUF_SZ;
+		iov[i].iov_len = SOCK_DGRAM_BUF_SZ;
+		memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+		msgs[i].msg_hdr.msg_name = &dgram->rx_addr[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(dgram->rx_addr[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = recvmmsg(dgram->sock_fd, msgs, SOCK_DGRAM_BATCH, MSG_DONTWAIT,
+		       NULL);
+	for (i = 0; i < ret; i++) {
+		dgram->rx_len[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ?
+				   0 : msgs[i].msg_len;
+	}
+#else
+	struct msghdr msg;
+	ssize_t len;
+
+	for (i = 0; i < SOCK_DGRAM_BATCH; i++) {
+		iov[i].iov_base = dgram->rx_buf + i * SOCK_DGRAM_BUF_SZ;
+		iov[i].iov_len = SOCK_DGRAM_BUF_SZ;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &dgram->rx_addr[i];
+		msg.msg_namelen = sizeof(dgram->rx_addr[i]);
+		msg.msg_iov = &iov[i];
+		msg.msg_iovlen = 1;
+
+		len = recvmsg(dgram->sock_fd, &msg, MSG_DONTWAIT);
+		if (len < 0)
+			break;
+		dgram->rx_len[i] = (msg.msg_flags & MSG_TRUNC) ? 0 : len;
+	}
+	ret = i ? i : -1;
+#endif
+	if (ret >= 0)
+		return ret;
+
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+		return 0;
+
+	SOCK_LOG_ERROR("failed to receive datagrams: %s\n", strerror(errno));
+	return -errno;
+}
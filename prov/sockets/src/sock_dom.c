@@ -50,7 +50,7 @@ const struct fi_domain_attr sock_domain_attr = {
 	.data_progress = FI_PROGRESS_AUTO,
 	.resource_mgmt = FI_RM_ENABLED,
 	.mr_mode = FI_MR_SCALABLE,
-	.mr_key_size = sizeof(uint16_t),
+	.mr_key_size = SOCK_MR_SCALABLE_KEY_SIZE,
 	.cq_data_size = sizeof(uint64_t),
 	.cq_cnt = SOCK_EP_MAX_CQ_CNT,
 	.ep_cnt = SOCK_EP_MAX_EP_CNT,
@@ -139,7 +139,9 @@ int sock_verify_domain_attr(struct fi_domain_attr *attr)
 		return -FI_ENODATA;
 	}
 
-	if (attr->mr_key_size > sock_domain_attr.mr_key_size)
+	/* scalable keys are application chosen table indices */
+	if (attr->mr_key_size > (attr->mr_mode == FI_MR_SCALABLE ?
+				 SOCK_MR_SCALABLE_KEY_SIZE : sizeof(uint64_t)))
 		return -FI_ENODATA;
 
 	if (attr->cq_data_size > sock_domain_attr.cq_data_size)
@@ -160,6 +162,302 @@ int sock_verify_domain_attr(struct fi_domain_attr *attr)
 	return 0;
 }
 
+static void sock_dom_finalize_pe(struct sock_domain *dom)
+{
+	int i;
+
+	for (i = 0; i < dom->num_pe; i++)
+		sock_pe_finalize(dom->pe[i]);
+	free(dom->pe);
+	dom->pe = NULL;
+	dom->num_pe = 0;
+}
+
+static int sock_dom_init_pe(struct sock_domain *dom)
+{
+	int i, num_pe;
+
+	num_pe = 1;
+	if (dom->progress_mode == FI_PROGRESS_AUTO) {
+		num_pe = MAX(1, MIN(sock_pe_threads, SOCK_PE_MAX_THREADS));
+		if (num_pe != sock_pe_threads)
+			SOCK_LOG_ERROR("using %d progress threads\n", num_pe);
+	}
+
+	dom->pe = calloc(num_pe, sizeof(*dom->pe));
+	if (!dom->pe)
+		return -FI_ENOMEM;
+
+	for (i = 0; i < num_pe; i++) {
+		dom->pe[i] = sock_pe_init(dom, i);
+		if (!dom->pe[i]) {
+			sock_dom_finalize_pe(dom);
+			return -FI_ENOMEM;
+		}
+		dom->num_pe++;
+	}
+	atomic_initialize(&dom->pe_next, 0);
+	return 0;
+}
+
+struct sock_pe *sock_dom_select_pe(struct sock_domain *dom)
+{
+	return dom->pe[(unsigned) atomic_inc(&dom->pe_next) % dom->num_pe];
+}
+
+static void sock_dom_set_pe_profile(struct sock_domain *dom, int profile)
+{
+	dom->pe_profile = profile;
+	if (profile == FI_SOCKETS_PE_PROFILE_CPU) {
+		dom->pe_spin_budget = SOCK_PE_CPU_SPIN_BUDGET;
+		dom->pe_backoff_max = SOCK_PE_CPU_BACKOFF_MAX;
+	} else {
+		dom->pe_spin_budget = sock_pe_waittime * 1000;
+		dom->pe_backoff_max = SOCK_PE_LATENCY_BACKOFF_MAX;
+	}
+
+	if (sock_pe_spin_budget >= 0)
+		dom->pe_spin_budget = sock_pe_spin_budget;
+	if (sock_pe_backoff_max >= 0)
+		dom->pe_backoff_max = sock_pe_backoff_max;
+}
+
+static void sock_dom_pe_stats(struct sock_domain *dom,
+			      struct fi_sockets_pe_stats *stats)
+{
+	struct fi_sockets_pe_stats *pe_stats;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < dom->num_pe; i++) {
+		pe_stats = &dom->pe[i]->stats;
+		stats->busy += pe_stats->busy;
+		stats->spin += pe_stats->spin;
+		stats->backoff += pe_stats->backoff;
+		stats->blocked += pe_stats->blocked;
+		stats->num_blocks += pe_stats->num_blocks;
+	}
+}
+
+#define SOCK_MR_NO_SLOT ((uint32_t) -1)
+
+static int sock_mr_table_init(struct sock_mr_table *table)
+{
+	table->chunks = calloc(SOCK_MR_NUM_CHUNKS, sizeof(*table->chunks));
+	if (!table->chunks)
+		return -FI_ENOMEM;
+	table->free_head = SOCK_MR_NO_SLOT;
+	return 0;
+}
+
+static void sock_mr_table_finalize(struct sock_mr_table *table)
+{
+	int i;
+
+	for (i = 0; i < SOCK_MR_NUM_CHUNKS && table->chunks; i++)
+		free(table->chunks[i]);
+	free(table->chunks);
+}
+
+static inline struct sock_mr_slot *sock_mr_slot(struct sock_mr_table *table,
+						uint64_t index)
+{
+	struct sock_mr_slot *chunk;
+
+	chunk = table->chunks[index >> SOCK_MR_CHUNK_BITS];
+	return chunk ? &chunk[index & (SOCK_MR_CHUNK_SZ - 1)] : NULL;
+}
+
+static struct sock_mr_slot *sock_mr_alloc_chunk(struct sock_mr_table *table,
+						int chunk_index)
+{
+	struct sock_mr_slot *chunk;
+	int i;
+
+	chunk = calloc(SOCK_MR_CHUNK_SZ, sizeof(*chunk));
+	if (!chunk)
+		return NULL;
+
+	for (i = 0; i < SOCK_MR_CHUNK_SZ; i++)
+		chunk[i].gen = 1;
+	table->chunks[chunk_index] = chunk;
+	return chunk;
+}
+
+/* provider chosen key: pop a free slot, adding a chunk if none is left */
+static int sock_get_mr_key(struct sock_mr_table *table, uint64_t *key)
+{
+	struct sock_mr_slot *chunk, *slot;
+	uint32_t index, base;
+	int i;
+
+	if (table->free_head == SOCK_MR_NO_SLOT) {
+		if (table->num_chunks == SOCK_MR_NUM_CHUNKS)
+			return -FI_ENOKEY;
+
+		chunk = sock_mr_alloc_chunk(table, table->num_chunks);
+		if (!chunk)
+			return -FI_ENOMEM;
+
+		base = table->num_chunks++ << SOCK_MR_CHUNK_BITS;
+		for (i = SOCK_MR_CHUNK_SZ - 1; i >= 0; i--) {
+			chunk[i].next_free = table->free_head;
+			table->free_head = base + i;
+		}
+	}
+
+	index = table->free_head;
+	slot = sock_mr_slot(table, index);
+	table->free_head = slot->next_free;
+	*key = (slot->gen << SOCK_MR_INDEX_BITS) | index;
+	return 0;
+}
+
+/* application requested key: the slot is addressed directly, generation 0 */
+static int sock_set_mr_key(struct sock_mr_table *table, uint64_t key)
+{
+	struct sock_mr_slot *slot;
+
+	if (key > SOCK_MR_MAX_INDEX)
+		return -FI_ENOKEY;
+
+	slot = sock_mr_slot(table, key);
+	if (!slot) {
+		if (!sock_mr_alloc_chunk(table, key >> SOCK_MR_CHUNK_BITS))
+			return -FI_ENOMEM;
+		slot = sock_mr_slot(table, key);
+	}
+
+	if (slot->mr)
+		return -FI_ENOKEY;
+	slot->gen = 0;
+	return 0;
+}
+
+static void sock_put_mr_key(struct sock_domain *dom, uint64_t key)
+{
+	struct sock_mr_table *table = &dom->mr_table;
+	struct sock_mr_slot *slot;
+	uint32_t index;
+
+	index = key & SOCK_MR_MAX_INDEX;
+	slot = sock_mr_slot(table, index);
+	slot->mr = NULL;
+	if (dom->attr.mr_mode != FI_MR_BASIC)
+		return;
+
+	slot->gen = (slot->gen + 1) & SOCK_MR_GEN_MASK;
+	if (!slot->gen)
+		slot->gen = 1;
+	slot->next_free = table->free_head;
+	table->free_head = index;
+}
+
+static void sock_mr_free_region(struct sock_domain *dom, struct sock_mr *mr)
+{
+	sock_put_mr_key(dom, mr->mr_fid.key);
+	free(mr);
+}
+
+/* an idle region keeps its slot, but its key no longer resolves */
+static void sock_mr_hide_region(struct sock_domain *dom, struct sock_mr *mr)
+{
+	sock_mr_slot(&dom->mr_table, mr->mr_fid.key & SOCK_MR_MAX_INDEX)->mr =
+		NULL;
+}
+
+/* a reused region gets a new generation so keys handed out before fail */
+static void sock_mr_expose_region(struct sock_domain *dom, struct sock_mr *mr)
+{
+	struct sock_mr_slot *slot;
+	uint32_t index;
+
+	index = mr->mr_fid.key & SOCK_MR_MAX_INDEX;
+	slot = sock_mr_slot(&dom->mr_table, index);
+	slot->gen = (slot->gen + 1) & SOCK_MR_GEN_MASK;
+	if (!slot->gen)
+		slot->gen = 1;
+	slot->mr = mr;
+	mr->mr_fid.key = (slot->gen << SOCK_MR_INDEX_BITS) | index;
+}
+
+/*
+ * Register mr against a cached region with the same range and access,
+ * creating one if needed.  Idle cached regions overlapping the new range
+ * are dropped; if one is still in use the new region is not cached.
+ */
+static int sock_mr_cache_reg(struct sock_domain *dom, struct sock_mr *mr,
+			     const struct fi_mr_attr *attr, uint64_t *key)
+{
+	struct sock_mr_cache *cache = &dom->mr_cache;
+	struct sock_mr *region, *old;
+	uintptr_t start, end;
+	int ret;
+
+	start = (uintptr_t) attr->mr_iov[0].iov_base;
+	end = start + attr->mr_iov[0].iov_len;
+
+	region = sock_mr_cache_find(cache, start, end, attr->access);
+	if (region) {
+		if (region->cache_ref == 1)
+			sock_mr_expose_region(dom, region);
+		goto out;
+	}
+
+	while ((old = sock_mr_cache_overlap(cache, start, end)) &&
+	       !old->cache_ref) {
+		sock_mr_cache_remove(cache, old);
+		sock_mr_free_region(dom, old);
+	}
+
+	region = calloc(1, sizeof(*region));
+	if (!region)
+		return -FI_ENOMEM;
+
+	region->domain = dom;
+	region->access = attr->access;
+	region->offset = start;
+	region->iov_count = 1;
+	region->mr_iov[0].iov_base = (void *) start;
+	region->mr_iov[0].iov_len = end - start;
+
+	ret = sock_get_mr_key(&dom->mr_table, &region->mr_fid.key);
+	if (ret)
+		goto err1;
+
+	if (old) {
+		region->cache_ref = 1;
+	} else {
+		ret = sock_mr_cache_insert(cache, region);
+		if (ret)
+			goto err2;
+	}
+
+	sock_mr_slot(&dom->mr_table, region->mr_fid.key & SOCK_MR_MAX_INDEX)->mr =
+		region;
+out:
+	mr->region = region;
+	*key = region->mr_fid.key;
+	return 0;
+err2:
+	sock_put_mr_key(dom, region->mr_fid.key);
+err1:
+	free(region);
+	return ret;
+}
+
+static void sock_mr_cache_finalize(struct sock_domain *dom)
+{
+	struct sock_mr *region;
+
+	while ((region = sock_mr_cache_evict(&dom->mr_cache)))
+		sock_mr_free_region(dom, region);
+	SOCK_LOG_DBG("MR cache hits: %llu, misses: %llu, evictions: %llu\n",
+		     (unsigned long long) dom->mr_cache.stats.hits,
+		     (unsigned long long) dom->mr_cache.stats.misses,
+		     (unsigned long long) dom->mr_cache.stats.evictions);
+}
+
 static int sock_dom_close(struct fid *fid)
 {
 	struct sock_domain *dom;
@@ -167,36 +465,36 @@ static int sock_dom_close(struct fid *fid)
 	if (atomic_get(&dom->ref))
 		return -FI_EBUSY;
 
-	sock_pe_finalize(dom->pe);
-	if (dom->r_cmap.size)
-		sock_conn_map_destroy(&dom->r_cmap);
-	fastlock_destroy(&dom->r_cmap.lock);
+	sock_dom_finalize_pe(dom);
+	sock_mr_cache_finalize(dom);
+	sock_mr_table_finalize(&dom->mr_table);
 	fastlock_destroy(&dom->lock);
+	fastlock_destroy(&dom->atomic_lock);
 	sock_dom_remove_from_list(dom);
+	atomic_dec(&dom->fab->ref);
 	free(dom);
 	return 0;
 }
 
-static uint16_t sock_get_mr_key(struct sock_domain *dom)
-{
-	uint16_t i;
-
-	for (i = 1; i < IDX_MAX_INDEX; i++) {
-		if (!idm_lookup(&dom->mr_idm, i))
-			return i;
-	}
-	return 0;
-}
-
 static int sock_mr_close(struct fid *fid)
 {
 	struct sock_domain *dom;
 	struct sock_mr *mr;
 
+	struct sock_mr *region;
+
 	mr = container_of(fid, struct sock_mr, mr_fid.fid);
 	dom = mr->domain;
 	fastlock_acquire(&dom->lock);
-	idm_clear(&dom->mr_idm , (int) mr->mr_fid.key);
+	if (mr->region) {
+		if (mr->region->cache_ref == 1)
+			sock_mr_hide_region(dom, mr->region);
+		region = sock_mr_cache_release(&dom->mr_cache, mr->region);
+		if (region)
+			sock_mr_free_region(dom, region);
+	} else {
+		sock_put_mr_key(dom, mr->mr_fid.key);
+	}
 	fastlock_release(&dom->lock);
 	atomic_dec(&dom->ref);
 	free(mr);
@@ -208,8 +506,23 @@ static int sock_mr_bind(struct fid *fid, struct fid *bfid, uint64_t flags)
 	struct sock_cntr *cntr;
 	struct sock_cq *cq;
 	struct sock_mr *mr;
+	int ret = 0;
 
 	mr = container_of(fid, struct sock_mr, mr_fid.fid);
+
+	/* completions are tied to the key, so a bound region leaves the cache */
+	if (mr->region) {
+		fastlock_acquire(&mr->domain->lock);
+		if (mr->region->cache_ref > 1)
+			ret = -FI_EBUSY;
+		else
+			sock_mr_cache_remove(&mr->domain->mr_cache, mr->region);
+		fastlock_release(&mr->domain->lock);
+		if (ret)
+			return ret;
+		mr = mr->region;
+	}
+
 	switch (bfid->fclass) {
 	case FI_CLASS_CQ:
 		cq = container_of(bfid, struct sock_cq, cq_fid.fid);
@@ -243,17 +556,22 @@ static struct fi_ops sock_mr_fi_ops = {
 	.ops_open = fi_no_ops_open,
 };
 
-struct sock_mr *sock_mr_get_entry(struct sock_domain *domain, uint16_t key)
+struct sock_mr *sock_mr_get_entry(struct sock_domain *domain, uint64_t key)
 {
-	return (struct sock_mr *)idm_lookup(&domain->mr_idm, key);
+	struct sock_mr_slot *slot;
+
+	slot = sock_mr_slot(&domain->mr_table, key & SOCK_MR_MAX_INDEX);
+	if (!slot || slot->gen != (key >> SOCK_MR_INDEX_BITS))
+		return NULL;
+	return slot->mr;
 }
 
-struct sock_mr *sock_mr_verify_key(struct sock_domain *domain, uint16_t key,
+struct sock_mr *sock_mr_verify_key(struct sock_domain *domain, uint64_t key,
 				   void *buf, size_t len, uint64_t access)
 {
 	int i;
 	struct sock_mr *mr;
-	mr = idm_lookup(&domain->mr_idm, key);
+	mr = sock_mr_get_entry(domain, key);
 
 	if (!mr)
 		return NULL;
@@ -288,6 +606,7 @@ static int sock_regattr(struct fid *fid, const struct fi_mr_attr *attr,
 	struct sock_mr *_mr;
 	uint64_t key;
 	struct fid_domain *domain;
+	int ret;
 
 	if (fid->fclass != FI_CLASS_DOMAIN || !attr || attr->iov_count <= 0) {
 		return -FI_EINVAL;
@@ -295,10 +614,6 @@ static int sock_regattr(struct fid *fid, const struct fi_mr_attr *attr,
 
 	domain = container_of(fid, struct fid_domain, fid);
 	dom = container_of(domain, struct sock_domain, dom_fid);
-	if ((dom->attr.mr_mode == FI_MR_SCALABLE) &&
-	    ((attr->requested_key > IDX_MAX_INDEX) ||
-	     idm_lookup(&dom->mr_idm, (int) attr->requested_key)))
-		return -FI_ENOKEY;
 
 	_mr = calloc(1, sizeof(*_mr) +
 		     sizeof(_mr->mr_iov) * (attr->iov_count - 1));
@@ -317,9 +632,19 @@ static int sock_regattr(struct fid *fid, const struct fi_mr_attr *attr,
 		(uintptr_t) attr->mr_iov[0].iov_base;
 
 	fastlock_acquire(&dom->lock);
-	key = (dom->attr.mr_mode == FI_MR_BASIC) ?
-		sock_get_mr_key(dom) : (uint16_t) attr->requested_key;
-	if (idm_set(&dom->mr_idm, key, _mr) < 0)
+	if (dom->mr_cache.max_idle && attr->iov_count == 1 && !flags) {
+		ret = sock_mr_cache_reg(dom, _mr, attr, &key);
+	} else {
+		if (dom->attr.mr_mode == FI_MR_BASIC) {
+			ret = sock_get_mr_key(&dom->mr_table, &key);
+		} else {
+			key = attr->requested_key;
+			ret = sock_set_mr_key(&dom->mr_table, key);
+		}
+		if (!ret)
+			sock_mr_slot(&dom->mr_table, key & SOCK_MR_MAX_INDEX)->mr = _mr;
+	}
+	if (ret)
 		goto err;
 	_mr->mr_fid.key = key;
 	_mr->mr_fid.mem_desc = (void *) (uintptr_t) key;
@@ -343,7 +668,7 @@ static int sock_regattr(struct fid *fid, const struct fi_mr_attr *attr,
 err:
 	fastlock_release(&dom->lock);
 	free(_mr);
-	return -errno;
+	return ret;
 }
 
 static int sock_regv(struct fid *fid, const struct iovec *iov,
@@ -422,11 +747,42 @@ static int sock_scalable_ep(struct fid_domain *domain, struct fi_info *info,
 	}
 }
 
+static int sock_dom_control(struct fid *fid, int command, void *arg)
+{
+	struct sock_domain *dom;
+
+	dom = container_of(fid, struct sock_domain, dom_fid.fid);
+	switch (command) {
+	case FI_SOCKETS_DOM_MR_CACHE_STATS:
+		fastlock_acquire(&dom->lock);
+		memcpy(arg, &dom->mr_cache.stats, sizeof(dom->mr_cache.stats));
+		fastlock_release(&dom->lock);
+		break;
+	case FI_SOCKETS_DOM_GET_PE_PROFILE:
+		*(int *) arg = dom->pe_profile;
+		break;
+	case FI_SOCKETS_DOM_SET_PE_PROFILE:
+		if (*(int *) arg != FI_SOCKETS_PE_PROFILE_LATENCY &&
+		    *(int *) arg != FI_SOCKETS_PE_PROFILE_CPU)
+			return -FI_EINVAL;
+		fastlock_acquire(&dom->lock);
+		sock_dom_set_pe_profile(dom, *(int *) arg);
+		fastlock_release(&dom->lock);
+		break;
+	case FI_SOCKETS_DOM_PE_STATS:
+		sock_dom_pe_stats(dom, arg);
+		break;
+	default:
+		return -FI_EINVAL;
+	}
+	return 0;
+}
+
 static struct fi_ops sock_dom_fi_ops = {
 	.size = sizeof(struct fi_ops),
 	.close = sock_dom_close,
 	.bind = sock_dom_bind,
-	.control = fi_no_control,
+	.control = sock_dom_control,
 	.ops_open = fi_no_ops_open,
 };
 
@@ -468,7 +824,10 @@ int sock_domain(struct fid_fabric *fabric, struct fi_info *info,
 		return -FI_ENOMEM;
 
 	fastlock_init(&sock_domain->lock);
+	fastlock_init(&sock_domain->atomic_lock);
 	atomic_initialize(&sock_domain->ref, 0);
+	if (sock_mr_table_init(&sock_domain->mr_table))
+		goto err;
 
 	if (info) {
 		sock_domain->info = *info;
@@ -489,19 +848,14 @@ int sock_domain(struct fid_fabric *fabric, struct fi_info *info,
 	else
 		sock_domain->progress_mode = info->domain_attr->data_progress;
 
-	sock_domain->pe = sock_pe_init(sock_domain);
-	if (!sock_domain->pe) {
+	sock_dom_set_pe_profile(sock_domain, sock_pe_profile);
+	if (sock_dom_init_pe(sock_domain)) {
 		SOCK_LOG_ERROR("Failed to init PE\n");
 		goto err;
 	}
 
-	if (sock_conn_map_init(&sock_domain->r_cmap, sock_cm_def_map_sz))
-		goto err;
-
-	sock_domain->r_cmap.domain = sock_domain;
-	fastlock_init(&sock_domain->r_cmap.lock);
-
 	sock_domain->fab = fab;
+	atomic_inc(&fab->ref);
 	*dom = &sock_domain->dom_fid;
 
 	if (info->domain_attr)
@@ -509,10 +863,17 @@ int sock_domain(struct fid_fabric *fabric, struct fi_info *info,
 	else
 		sock_domain->attr = sock_domain_attr;
 
+	sock_mr_cache_init(&sock_domain->mr_cache,
+			   (sock_domain->attr.mr_mode == FI_MR_BASIC) ?
+			   sock_mr_cache_size : 0);
+
 	sock_dom_add_to_list(sock_domain);
 	return 0;
 
 err:
+	sock_mr_table_finalize(&sock_domain->mr_table);
+	fastlock_destroy(&sock_domain->lock);
+	fastlock_destroy(&sock_domain->atomic_lock);
 	free(sock_domain);
 	return -FI_EINVAL;
 }
@@ -272,10 +272,10 @@ static int sock_ctx_enable(struct fid_ep *ep)
 		rx_ctx = container_of(ep, struct sock_rx_ctx, ctx.fid);
 		rx_ctx->enabled = 1;
 		if (!rx_ctx->progress) {
-			sock_pe_add_rx_ctx(rx_ctx->domain->pe, rx_ctx);
+			sock_pe_add_rx_ctx(rx_ctx->ep->pe, rx_ctx);
 			rx_ctx->progress = 1;
 		}
-		if (!rx_ctx->ep->listener.listener_thread &&
+		if (!rx_ctx->ep->listener.do_listen &&
 		    sock_conn_listen(rx_ctx->ep)) {
 			SOCK_LOG_ERROR("failed to create listener\n");
 		}
@@ -285,10 +285,10 @@ static int sock_ctx_enable(struct fid_ep *ep)
 		tx_ctx = container_of(ep, struct sock_tx_ctx, fid.ctx.fid);
 		tx_ctx->enabled = 1;
 		if (!tx_ctx->progress) {
-			sock_pe_add_tx_ctx(tx_ctx->domain->pe, tx_ctx);
+			sock_pe_add_tx_ctx(tx_ctx->ep->pe, tx_ctx);
 			tx_ctx->progress = 1;
 		}
-		if (!tx_ctx->ep->listener.listener_thread &&
+		if (!tx_ctx->ep->listener.do_listen &&
 		    sock_conn_listen(tx_ctx->ep)) {
 			SOCK_LOG_ERROR("failed to create listener\n");
 		}
@@ -397,6 +397,12 @@ static int sock_ctx_getopt(fid_t fid, int level, int optname,
 		*((size_t *) optval) = SOCK_EP_MAX_CM_DATA_SZ;
 		*optlen = sizeof(size_t);
 		break;
+	case FI_SOCKETS_OPT_BUFFERED_RECV_STATS:
+		if (*optlen < sizeof(struct fi_sockets_buffered_recv_stats))
+			return -FI_ETOOSMALL;
+		sock_rx_buffered_stats(rx_ctx, optval);
+		*optlen = sizeof(struct fi_sockets_buffered_recv_stats);
+		break;
 	default:
 		return -FI_ENOPROTOOPT;
 	}
@@ -435,7 +441,7 @@ static ssize_t sock_rx_ctx_cancel(struct sock_rx_ctx *rx_ctx, void *context)
 	     entry != &rx_ctx->rx_entry_list; entry = entry->next) {
 
 		rx_entry = container_of(entry, struct sock_rx_entry, entry);
-		if (rx_entry->is_busy)
+		if (rx_entry->is_busy || rx_entry->rndv_refs)
 			continue;
 
 		if ((uintptr_t) context == rx_entry->context) {
@@ -458,7 +464,7 @@ static ssize_t sock_rx_ctx_cancel(struct sock_rx_ctx *rx_ctx, void *context)
 			if (rx_ctx->comp.recv_cntr)
 				sock_cntr_err_inc(rx_ctx->comp.recv_cntr);
 
-			dlist_remove(&rx_entry->entry);
+			sock_rx_dequeue_entry(rx_entry);
 			sock_rx_release_entry(rx_entry);
 			ret = 0;
 			break;
@@ -542,9 +548,7 @@ static ssize_t sock_tx_size_left(struct fid_ep *ep)
 		return -FI_EINVAL;
 	}
 
-	fastlock_acquire(&tx_ctx->wlock);
-	num_left = rbfdavail(&tx_ctx->rbfd)/SOCK_EP_TX_ENTRY_SZ;
-	fastlock_release(&tx_ctx->wlock);
+	num_left = sock_tx_ctx_avail(tx_ctx)/SOCK_EP_TX_ENTRY_SZ;
 	return num_left;
 }
 
@@ -562,7 +566,6 @@ struct fi_ops_ep sock_ctx_ep_ops = {
 static int sock_ep_close(struct fid *fid)
 {
 	struct sock_ep *sock_ep;
-	char c = 0;
 
 	switch (fid->fclass) {
 	case FI_CLASS_EP:
@@ -582,19 +585,16 @@ static int sock_ep_close(struct fid *fid)
 		return -FI_EBUSY;
 
 	if (sock_ep->ep_type == FI_EP_MSG) {
-		sock_ep->cm.do_listen = 0;
-		if (write(sock_ep->cm.signal_fds[0], &c, 1) != 1)
-			SOCK_LOG_DBG("Failed to signal\n");
-
-		if (sock_ep->cm.listener_thread &&
-		    pthread_join(sock_ep->cm.listener_thread, NULL)) {
-			SOCK_LOG_ERROR("pthread join failed (%d)\n", errno);
-		}
-		close(sock_ep->cm.signal_fds[0]);
-		close(sock_ep->cm.signal_fds[1]);
+		sock_cm_loop_del(&sock_ep->cm.handler);
+		if (sock_ep->cm.sock >= 0)
+			close(sock_ep->cm.sock);
 	} else {
-		if (sock_ep->av)
+		if (sock_ep->av) {
+			fastlock_acquire(&sock_ep->av->lock);
+			dlist_remove(&sock_ep->av_entry);
+			fastlock_release(&sock_ep->av->lock);
 			atomic_dec(&sock_ep->av->ref);
+		}
 	}
 
 	if (sock_ep->tx_shared) {
@@ -609,17 +609,7 @@ static int sock_ep_close(struct fid *fid)
 		fastlock_release(&sock_ep->rx_ctx->lock);
 	}
 
-	sock_ep->listener.do_listen = 0;
-	if (write(sock_ep->listener.signal_fds[0], &c, 1) != 1)
-		SOCK_LOG_DBG("Failed to signal\n");
-
-	if (sock_ep->listener.listener_thread &&
-	    pthread_join(sock_ep->listener.listener_thread, NULL)) {
-		SOCK_LOG_ERROR("pthread join failed (%d)\n", errno);
-	}
-
-	close(sock_ep->listener.signal_fds[0]);
-	close(sock_ep->listener.signal_fds[1]);
+	sock_conn_listen_close(sock_ep);
 	fastlock_destroy(&sock_ep->cm.lock);
 
 	if (sock_ep->fclass != FI_CLASS_SEP && !sock_ep->tx_shared) {
@@ -631,6 +621,8 @@ static int sock_ep_close(struct fid *fid)
 		sock_pe_remove_rx_ctx(sock_ep->rx_array[0]);
 		sock_rx_ctx_free(sock_ep->rx_array[0]);
 	}
+	sock_dgram_close(sock_ep);
+	sock_conn_map_detach(&sock_ep->pe->cmap, sock_ep);
 
 	free(sock_ep->tx_array);
 	free(sock_ep->rx_array);
@@ -644,6 +636,7 @@ static int sock_ep_close(struct fid *fid)
 				   atoi(sock_ep->listener.service));
 
 	atomic_dec(&sock_ep->domain->ref);
+	fi_epoll_close(sock_ep->conn_epoll);
 	fastlock_destroy(&sock_ep->lock);
 	free(sock_ep);
 	return 0;
@@ -818,9 +811,12 @@ static int sock_ep_bind(struct fid *fid, struct fid *bfid, uint64_t flags)
 			return -FI_EINVAL;
 
 		ep->av = av;
-		av->cmap = &av->domain->r_cmap;
 		atomic_inc(&av->ref);
 
+		fastlock_acquire(&av->lock);
+		dlist_insert_tail(&ep->av_entry, &av->ep_list);
+		fastlock_release(&av->lock);
+
 		if (ep->tx_ctx &&
 		    ep->tx_ctx->fid.ctx.fid.fclass == FI_CLASS_TX_CTX) {
 			ep->tx_ctx->av = av;
@@ -934,7 +930,7 @@ int sock_ep_enable(struct fid_ep *ep)
 	    sock_ep->tx_ctx->fid.ctx.fid.fclass == FI_CLASS_TX_CTX) {
 		sock_ep->tx_ctx->enabled = 1;
 		if (!sock_ep->tx_ctx->progress) {
-			sock_pe_add_tx_ctx(sock_ep->domain->pe, sock_ep->tx_ctx);
+			sock_pe_add_tx_ctx(sock_ep->pe, sock_ep->tx_ctx);
 			sock_ep->tx_ctx->progress = 1;
 		}
 	}
@@ -943,7 +939,7 @@ int sock_ep_enable(struct fid_ep *ep)
 	    sock_ep->rx_ctx->ctx.fid.fclass == FI_CLASS_RX_CTX) {
 		sock_ep->rx_ctx->enabled = 1;
 		if (!sock_ep->rx_ctx->progress) {
-				sock_pe_add_rx_ctx(sock_ep->domain->pe,
+				sock_pe_add_rx_ctx(sock_ep->pe,
 							sock_ep->rx_ctx);
 				sock_ep->rx_ctx->progress = 1;
 		}
@@ -953,7 +949,7 @@ int sock_ep_enable(struct fid_ep *ep)
 		if (sock_ep->tx_array[i]) {
 			sock_ep->tx_array[i]->enabled = 1;
 			if (!sock_ep->tx_array[i]->progress) {
-				sock_pe_add_tx_ctx(sock_ep->domain->pe,
+				sock_pe_add_tx_ctx(sock_ep->pe,
 							sock_ep->tx_array[i]);
 				sock_ep->tx_array[i]->progress = 1;
 			}
@@ -964,7 +960,7 @@ int sock_ep_enable(struct fid_ep *ep)
 		if (sock_ep->rx_array[i]) {
 			sock_ep->rx_array[i]->enabled = 1;
 			if (!sock_ep->rx_array[i]->progress) {
-				sock_pe_add_rx_ctx(sock_ep->domain->pe,
+				sock_pe_add_rx_ctx(sock_ep->pe,
 							sock_ep->rx_array[i]);
 				sock_ep->rx_array[i]->progress = 1;
 			}
@@ -972,8 +968,28 @@ int sock_ep_enable(struct fid_ep *ep)
 	}
 
 	if (sock_ep->ep_type != FI_EP_MSG &&
-	    !sock_ep->listener.listener_thread && sock_conn_listen(sock_ep))
+	    !sock_ep->listener.do_listen && sock_conn_listen(sock_ep))
 		SOCK_LOG_ERROR("cannot start connection thread\n");
+
+	if (sock_ep->ep_type == FI_EP_DGRAM && sock_dgram_udp &&
+	    sock_ep->listener.do_listen && !sock_ep->dgram) {
+		if (sock_dgram_open(sock_ep))
+			SOCK_LOG_ERROR("cannot open datagram socket, using TCP\n");
+	}
+
+	if (sock_ep->dgram) {
+		if (sock_ep->tx_ctx &&
+		    sock_ep->tx_ctx->fid.ctx.fid.fclass == FI_CLASS_TX_CTX)
+			sock_ep->tx_ctx->dgram = sock_ep->dgram;
+
+		for (i = 0; i < sock_ep->ep_attr.tx_ctx_cnt; i++) {
+			if (sock_ep->tx_array[i])
+				sock_ep->tx_array[i]->dgram = sock_ep->dgram;
+		}
+	}
+
+	if (sock_av_preconnect && sock_ep->av)
+		sock_av_connect(sock_ep->av, 0);
 	return 0;
 }
 
@@ -1022,6 +1038,15 @@ static int sock_ep_getopt(fid_t fid, int level, int optname,
 		*optlen = sizeof(size_t);
 		break;
 
+	case FI_SOCKETS_OPT_BUFFERED_RECV_STATS:
+		if (!sock_ep->rx_ctx)
+			return -FI_ENOPROTOOPT;
+		if (*optlen < sizeof(struct fi_sockets_buffered_recv_stats))
+			return -FI_ETOOSMALL;
+		sock_rx_buffered_stats(sock_ep->rx_ctx, optval);
+		*optlen = sizeof(struct fi_sockets_buffered_recv_stats);
+		break;
+
 	default:
 		return -FI_ENOPROTOOPT;
 	}
@@ -1276,7 +1301,8 @@ static void sock_set_domain_attr(const struct fi_domain_attr *hint_attr,
 	if (attr->data_progress == FI_PROGRESS_UNSPEC)
 		attr->data_progress = sock_domain_attr.data_progress;
 	if (attr->mr_mode == FI_MR_UNSPEC)
-		attr->mr_mode = sock_domain_attr.mr_mode;
+		attr->mr_mode = attr->mr_key_size > sock_domain_attr.mr_key_size ?
+				FI_MR_BASIC : sock_domain_attr.mr_mode;
 
 	if (attr->cq_cnt == 0)
 		attr->cq_cnt = sock_domain_attr.cq_cnt;
@@ -1291,7 +1317,8 @@ static void sock_set_domain_attr(const struct fi_domain_attr *hint_attr,
 	if (attr->max_ep_rx_ctx == 0)
 		attr->max_ep_rx_ctx = sock_domain_attr.max_ep_rx_ctx;
 
-	attr->mr_key_size = sock_domain_attr.mr_key_size;
+	attr->mr_key_size = attr->mr_mode == FI_MR_BASIC ?
+			    sizeof(uint64_t) : sock_domain_attr.mr_key_size;
 	attr->cq_data_size = sock_domain_attr.cq_data_size;
 	attr->resource_mgmt = sock_domain_attr.resource_mgmt;
 out:
@@ -1391,7 +1418,7 @@ static int sock_ep_assign_src_addr(struct sock_ep *sock_ep, struct fi_info *info
 int sock_alloc_endpoint(struct fid_domain *domain, struct fi_info *info,
 		  struct sock_ep **ep, void *context, size_t fclass)
 {
-	int ret, flags;
+	int ret;
 	struct sock_ep *sock_ep;
 	struct sock_tx_ctx *tx_ctx;
 	struct sock_rx_ctx *rx_ctx;
@@ -1488,6 +1515,11 @@ int sock_alloc_endpoint(struct fid_domain *domain, struct fi_info *info,
 	atomic_initialize(&sock_ep->num_rx_ctx, 0);
 	fastlock_init(&sock_ep->lock);
 	dlist_init(&sock_ep->conn_list);
+	dlist_init(&sock_ep->ready_list);
+	if (fi_epoll_create(&sock_ep->conn_epoll)) {
+		SOCK_LOG_ERROR("failed to create conn poll set\n");
+		goto err;
+	}
 
 	if (sock_ep->ep_attr.tx_ctx_cnt == FI_SHARED_CONTEXT)
 		sock_ep->tx_shared = 1;
@@ -1536,16 +1568,11 @@ int sock_alloc_endpoint(struct fid_domain *domain, struct fi_info *info,
 		memcpy(&sock_ep->info, info, sizeof(struct fi_info));
 
 	sock_ep->domain = sock_dom;
+	sock_ep->pe = sock_dom_select_pe(sock_dom);
 	fastlock_init(&sock_ep->cm.lock);
 	if (sock_ep->ep_type == FI_EP_MSG) {
 		dlist_init(&sock_ep->cm.msg_list);
-		if (socketpair(AF_UNIX, SOCK_STREAM, 0,
-			       sock_ep->cm.signal_fds) < 0)
-			goto err;
-
-		flags = fcntl(sock_ep->cm.signal_fds[1], F_GETFL, 0);
-		if (fcntl(sock_ep->cm.signal_fds[1], F_SETFL, flags | O_NONBLOCK))
-			SOCK_LOG_ERROR("fcntl failed");
+		sock_ep->cm.sock = -1;
 	}
 
 	atomic_inc(&sock_dom->ref);
@@ -1563,17 +1590,22 @@ err:
 struct sock_conn *sock_ep_lookup_conn(struct sock_ep *ep)
 {
 	int ret;
-	if (!ep->key) {
+	struct sock_conn *conn;
+
+	conn = ep->key ? sock_conn_map_lookup_key(&ep->pe->cmap, ep->key) :
+		NULL;
+	if (!conn || conn->state == SOCK_CONN_STATE_FAILED) {
 		ret = sock_conn_map_match_or_connect(
-			ep, ep->domain, &ep->domain->r_cmap, ep->dest_addr,
+			ep, ep->domain, &ep->pe->cmap, ep->dest_addr,
 			&ep->key);
 		if (ret) {
 			SOCK_LOG_ERROR("failed to match or connect to addr\n");
 			errno = EINVAL;
 			return NULL;
 		}
+		conn = sock_conn_map_lookup_key(&ep->pe->cmap, ep->key);
 	}
-	return sock_conn_map_lookup_key(&ep->domain->r_cmap, ep->key);
+	return conn;
 }
 
 int sock_ep_is_send_cq_low(struct sock_comp *comp, uint64_t flags)
@@ -62,7 +62,7 @@ const struct fi_ep_attr sock_dgram_ep_attr = {
 	.type = FI_EP_DGRAM,
 	.protocol = FI_PROTO_SOCK_TCP,
 	.protocol_version = SOCK_WIRE_PROTO_VERSION,
-	.max_msg_size = SOCK_EP_MAX_MSG_SZ,
+	.max_msg_size = SOCK_DGRAM_MAX_MSG_SZ,
 	.msg_prefix_size = SOCK_EP_MSG_PREFIX_SZ,
 	.max_order_raw_size = SOCK_EP_MAX_ORDER_RAW_SZ,
 	.max_order_war_size = SOCK_EP_MAX_ORDER_WAR_SZ,
@@ -94,6 +94,12 @@ const struct fi_rx_attr sock_dgram_rx_attr = {
 	.iov_limit = SOCK_EP_MAX_IOV_LIMIT,
 };
 
+/* only the UDP path is bound by the datagram size limit */
+static size_t sock_dgram_max_msg_size(void)
+{
+	return sock_dgram_udp ? SOCK_DGRAM_MAX_MSG_SZ : SOCK_EP_MAX_MSG_SZ;
+}
+
 static int sock_dgram_verify_rx_attr(const struct fi_rx_attr *attr)
 {
 	if (!attr)
@@ -159,10 +165,11 @@ int sock_dgram_verify_ep_attr(struct fi_ep_attr *ep_attr,
 			return -FI_ENODATA;
 		}
 
-		if (ep_attr->protocol_version != sock_dgram_ep_attr.protocol_version)
+		if (ep_attr->protocol_version &&
+		    ep_attr->protocol_version != sock_dgram_ep_attr.protocol_version)
 			return -FI_ENODATA;
 
-		if (ep_attr->max_msg_size > sock_dgram_ep_attr.max_msg_size)
+		if (ep_attr->max_msg_size > sock_dgram_max_msg_size())
 			return -FI_ENODATA;
 
 		if (ep_attr->msg_prefix_size > sock_dgram_ep_attr.msg_prefix_size)
@@ -206,6 +213,7 @@ int sock_dgram_fi_info(void *src_addr, void *dest_addr, struct fi_info *hints,
 	*(*info)->tx_attr = sock_dgram_tx_attr;
 	*(*info)->rx_attr = sock_dgram_rx_attr;
 	*(*info)->ep_attr = sock_dgram_ep_attr;
+	(*info)->ep_attr->max_msg_size = sock_dgram_max_msg_size();
 
 	if (hints && hints->ep_attr) {
 		if (hints->ep_attr->rx_ctx_cnt)
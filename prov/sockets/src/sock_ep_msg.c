@@ -161,7 +161,8 @@ int sock_msg_verify_ep_attr(struct fi_ep_attr *ep_attr,
 			return -FI_ENODATA;
 		}
 
-		if (ep_attr->protocol_version != sock_msg_ep_attr.protocol_version)
+		if (ep_attr->protocol_version &&
+		    ep_attr->protocol_version != sock_msg_ep_attr.protocol_version)
 			return -FI_ENODATA;
 
 		if (ep_attr->max_msg_size > sock_msg_ep_attr.max_msg_size)
@@ -350,13 +351,13 @@ static int sock_ep_cm_setname(fid_t fid, void *addr, size_t addrlen)
 	case FI_CLASS_EP:
 	case FI_CLASS_SEP:
 		sock_ep = container_of(fid, struct sock_ep, ep.fid);
-		if (sock_ep->listener.listener_thread)
+		if (sock_ep->listener.do_listen)
 			return -FI_EINVAL;
 		memcpy(sock_ep->src_addr, addr, addrlen);
 		return sock_conn_listen(sock_ep);
 	case FI_CLASS_PEP:
 		sock_pep = container_of(fid, struct sock_pep, pep.fid);
-		if (sock_pep->cm.listener_thread)
+		if (sock_pep->cm.handler.loop)
 			return -FI_EINVAL;
 		memcpy(&sock_pep->src_addr, addr, addrlen);
 		return sock_pep_create_listener(sock_pep);
@@ -384,7 +385,7 @@ static int sock_ep_cm_create_socket(void)
 	int sock, optval;
 	sock = socket(AF_INET, SOCK_DGRAM, 0);
 	if (sock < 0)
-		return 0;
+		return -1;
 
 	optval = 1;
 	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
@@ -398,8 +399,6 @@ static int sock_ep_cm_enqueue_msg(struct sock_cm_entry *cm,
 				  void *msg, size_t len,
 				  fid_t fid, struct sock_eq *eq)
 {
-	char c = 0;
-	int ret = 0;
 	struct sock_cm_msg_list_entry *list_entry;
 
 	list_entry = calloc(1, sizeof(*list_entry) + len);
@@ -416,15 +415,9 @@ static int sock_ep_cm_enqueue_msg(struct sock_cm_entry *cm,
 	dlist_insert_tail(&list_entry->entry, &cm->msg_list);
 	fastlock_release(&cm->lock);
 
-	ret = write(cm->signal_fds[0], &c, 1);
-	if (ret != 1) {
-		SOCK_LOG_DBG("failed to signal\n");
-		ret = -FI_EIO;
-	} else {
-		ret = 0;
-		SOCK_LOG_DBG("Enqueued CM Msg\n");
-	}
-	return ret;
+	sock_cm_loop_kick(&cm->handler);
+	SOCK_LOG_DBG("Enqueued CM Msg\n");
+	return 0;
 }
 
 static int sock_ep_cm_send_msg(struct sock_cm_entry *cm,
@@ -469,10 +462,12 @@ static void sock_ep_cm_release_entry(struct sock_cm_msg_list_entry *msg_entry)
 	free(msg_entry);
 }
 
-static void sock_ep_cm_flush_msg(struct sock_cm_entry *cm)
+static int sock_ep_cm_flush_msg(struct sock_cm_entry *cm)
 {
 	struct dlist_entry *entry, *next_entry;
 	struct sock_cm_msg_list_entry *msg_entry;
+	int pending;
+
 	fastlock_acquire(&cm->lock);
 	for (entry = cm->msg_list.next; entry != &cm->msg_list;) {
 		msg_entry = container_of(entry,
@@ -499,7 +494,15 @@ static void sock_ep_cm_flush_msg(struct sock_cm_entry *cm)
 			SOCK_LOG_DBG("Failed to send out cm message\n");
 		entry = next_entry;
 	}
+	pending = !dlist_empty(&cm->msg_list);
 	fastlock_release(&cm->lock);
+	return pending;
+}
+
+static int sock_ep_cm_flush_timer(struct sock_cm_handler *handler)
+{
+	return sock_ep_cm_flush_msg(container_of(handler, struct sock_cm_entry,
+						 handler));
 }
 
 static int sock_ep_cm_send_ack(struct sock_cm_entry *cm,
@@ -577,71 +580,30 @@ static void sock_ep_cm_handle_ack(struct sock_cm_entry *cm,
 }
 
 
-static void *sock_msg_ep_listener_thread(void *data)
+static void sock_ep_cm_handle_msg(struct sock_cm_handler *handler)
 {
-	struct pollfd poll_fds[2];
-	struct sock_ep *ep = (struct sock_ep *)data;
+	struct sock_ep *ep = container_of(handler, struct sock_ep, cm.handler);
 	struct sock_conn_response *conn_response;
 	struct fi_eq_cm_entry *cm_entry;
 
 	struct sockaddr_in from_addr;
 	socklen_t addr_len;
-	int ret, user_data_sz, entry_sz, timeout;
-	char tmp = 0;
-
-	ep->cm.sock = sock_ep_cm_create_socket();
-	if (!ep->cm.sock) {
-		SOCK_LOG_ERROR("Cannot open socket\n");
-		return NULL;
-	}
+	int ret, user_data_sz, entry_sz;
 
-	SOCK_LOG_DBG("Starting listener thread for EP: %p\n", ep);
 	conn_response = calloc(1, sizeof(*conn_response) + SOCK_EP_MAX_CM_DATA_SZ);
-	if (!conn_response) {
-		SOCK_LOG_ERROR("cannot allocate\n");
-		return NULL;
-	}
-
 	cm_entry = calloc(1, sizeof(*cm_entry) + SOCK_EP_MAX_CM_DATA_SZ);
-	if (!cm_entry) {
-		free(conn_response);
+	if (!conn_response || !cm_entry) {
 		SOCK_LOG_ERROR("cannot allocate\n");
-		return NULL;
+		goto out;
 	}
 
-	poll_fds[0].fd = ep->cm.sock;
-	poll_fds[1].fd = ep->cm.signal_fds[1];
-	poll_fds[0].events = poll_fds[1].events = POLLIN;
-
-	while (*((volatile int*) &ep->cm.do_listen)) {
-		timeout = dlist_empty(&ep->cm.msg_list) ? -1 :
-					SOCK_CM_COMM_TIMEOUT;
-		ret = poll(poll_fds, 2, timeout);
-		if (ret > 0) {
-			if (poll_fds[1].revents & POLLIN) {
-				ret = read(ep->cm.signal_fds[1], &tmp, 1);
-				if (ret != 1) {
-					SOCK_LOG_DBG("Invalid signal\n");
-					break;
-				}
-				sock_ep_cm_flush_msg(&ep->cm);
-				continue;
-			}
-		} else {
-			if (ret == 0) {
-				sock_ep_cm_flush_msg(&ep->cm);
-				continue;
-			} else {
-				break;
-			}
-		}
-
+	while (1) {
 		addr_len = sizeof(from_addr);
 		ret = recvfrom(ep->cm.sock, (char *) conn_response,
 			       sizeof(*conn_response) + SOCK_EP_MAX_CM_DATA_SZ,
 			       0, (struct sockaddr *) &from_addr, &addr_len);
-		if (ret <= 0)
-			continue;
+		if (ret < 0)
+			break;
 
 		SOCK_LOG_DBG("Total received: %d\n", ret);
 
@@ -652,6 +614,10 @@ static void *sock_msg_ep_listener_thread(void *data)
 			sock_ep_cm_send_ack(&ep->cm, &from_addr,
 						conn_response->hdr.msg_id);
 
+		/* nothing more is reported after a reject or shutdown */
+		if (!ep->cm.do_listen)
+			continue;
+
 		user_data_sz = ret - sizeof(*conn_response);
 		switch (conn_response->hdr.type) {
 
@@ -695,7 +661,8 @@ static void *sock_msg_ep_listener_thread(void *data)
 						&conn_response->user_data,
 						user_data_sz))
 				SOCK_LOG_ERROR("Error in writing to EQ\n");
-			goto out;
+			ep->cm.do_listen = 0;
+			break;
 
 		case SOCK_CONN_SHUTDOWN:
 			SOCK_LOG_DBG("Received SOCK_CONN_SHUTDOWN\n");
@@ -712,7 +679,8 @@ static void *sock_msg_ep_listener_thread(void *data)
 			if (sock_eq_report_event(ep->eq, FI_SHUTDOWN, cm_entry,
 						 entry_sz, 0))
 				SOCK_LOG_ERROR("Error in writing to EQ\n");
-			goto out;
+			ep->cm.do_listen = 0;
+			break;
 
 		default:
 			SOCK_LOG_ERROR("Invalid event: %d\n", conn_response->hdr.type);
@@ -723,9 +691,6 @@ static void *sock_msg_ep_listener_thread(void *data)
 out:
 	free(conn_response);
 	free(cm_entry);
-	close(ep->cm.sock);
-	ep->cm.listener_thread = 0L;
-	return NULL;
 }
 
 static int sock_ep_cm_connect(struct fid_ep *ep, const void *addr,
@@ -741,7 +706,7 @@ static int sock_ep_cm_connect(struct fid_ep *ep, const void *addr,
 	if (!_eq || paramlen > SOCK_EP_MAX_CM_DATA_SZ)
 		return -FI_EINVAL;
 
-	if (!_ep->listener.listener_thread && sock_conn_listen(_ep))
+	if (!_ep->listener.do_listen && sock_conn_listen(_ep))
 		return -FI_EINVAL;
 
 	req = calloc(1, sizeof(*req) + paramlen);
@@ -799,7 +764,7 @@ static int sock_ep_cm_accept(struct fid_ep *ep, const void *param,
 	if (_ep->is_disabled || _ep->cm.shutdown_received)
 		return -FI_EINVAL;
 
-	if (!_ep->listener.listener_thread && sock_conn_listen(_ep))
+	if (!_ep->listener.do_listen && sock_conn_listen(_ep))
 		return -FI_EINVAL;
 
 	response = calloc(1, sizeof(*response) + paramlen);
@@ -932,15 +897,28 @@ int sock_msg_ep(struct fid_domain *domain, struct fi_info *info,
 	if (ret)
 		return ret;
 
+	endpoint->cm.sock = sock_ep_cm_create_socket();
+	if (endpoint->cm.sock < 0) {
+		SOCK_LOG_ERROR("Cannot open socket\n");
+		goto err;
+	}
+
+	fd_set_nonblock(endpoint->cm.sock);
 	endpoint->cm.do_listen = 1;
-	if (pthread_create(&endpoint->cm.listener_thread, NULL,
-			   sock_msg_ep_listener_thread, endpoint)) {
-		SOCK_LOG_ERROR("Couldn't create listener thread\n");
-		return -FI_EINVAL;
+	endpoint->cm.handler.fd = endpoint->cm.sock;
+	endpoint->cm.handler.handle = sock_ep_cm_handle_msg;
+	endpoint->cm.handler.timer = sock_ep_cm_flush_timer;
+	if (sock_cm_loop_add(&endpoint->domain->fab->cm_loop,
+			     &endpoint->cm.handler)) {
+		SOCK_LOG_ERROR("Couldn't add endpoint to CM loop\n");
+		goto err;
 	}
 
 	*ep = &endpoint->ep;
 	return 0;
+err:
+	fi_close(&endpoint->ep.fid);
+	return -FI_EINVAL;
 }
 
 static int sock_pep_fi_bind(fid_t fid, struct fid *bfid, uint64_t flags)
@@ -964,25 +942,15 @@ static int sock_pep_fi_bind(fid_t fid, struct fid *bfid, uint64_t flags)
 
 static int sock_pep_fi_close(fid_t fid)
 {
-	int ret;
-	char c = 0;
 	struct sock_pep *pep;
 
 	pep = container_of(fid, struct sock_pep, pep.fid);
-	pep->cm.do_listen = 0;
-	ret = write(pep->cm.signal_fds[0], &c, 1);
-	if (ret != 1)
-		SOCK_LOG_DBG("Failed to signal\n");
-
-	if (pep->cm.listener_thread &&
-	    pthread_join(pep->cm.listener_thread, NULL)) {
-		SOCK_LOG_DBG("pthread join failed\n");
-	}
-
-	close(pep->cm.signal_fds[0]);
-	close(pep->cm.signal_fds[1]);
+	sock_cm_loop_del(&pep->cm.handler);
+	if (pep->cm.sock >= 0)
+		close(pep->cm.sock);
 	fastlock_destroy(&pep->cm.lock);
 
+	atomic_dec(&pep->sock_fab->ref);
 	free(pep);
 	return 0;
 }
@@ -1017,49 +985,25 @@ static struct fi_info *sock_ep_msg_process_info(struct sock_conn_req *req)
 			    req->info.dest_addr, req->info.src_addr);
 }
 
-static void *sock_pep_listener_thread(void *data)
+static void sock_pep_cm_handle_msg(struct sock_cm_handler *handler)
 {
-	struct sock_pep *pep = (struct sock_pep *) data;
+	struct sock_pep *pep = container_of(handler, struct sock_pep,
+					    cm.handler);
 	struct sock_conn_req_handle *handle = NULL;
 	struct sock_conn_req *conn_req = NULL;
 	struct fi_eq_cm_entry *cm_entry;
 	struct sockaddr_in from_addr;
-	struct pollfd poll_fds[2];
 
 	socklen_t addr_len;
-	int ret = 0, user_data_sz, entry_sz, timeout;
-	char tmp = 0;
+	int ret, user_data_sz, entry_sz;
 
-	SOCK_LOG_DBG("Starting listener thread for PEP: %p\n", pep);
 	cm_entry = calloc(1, sizeof(*cm_entry) + SOCK_EP_MAX_CM_DATA_SZ);
 	if (!cm_entry) {
 		SOCK_LOG_ERROR("cannot allocate\n");
-		return NULL;
+		return;
 	}
 
-	poll_fds[0].fd = pep->cm.sock;
-	poll_fds[1].fd = pep->cm.signal_fds[1];
-	poll_fds[0].events = poll_fds[1].events = POLLIN;
-	while (*((volatile int *) &pep->cm.do_listen)) {
-		timeout = dlist_empty(&pep->cm.msg_list) ? -1 :
-					SOCK_CM_COMM_TIMEOUT;
-		if (poll(poll_fds, 2, timeout) > 0) {
-			if (poll_fds[1].revents & POLLIN) {
-				ret = read(pep->cm.signal_fds[1], &tmp, 1);
-				if (ret != 1)
-					SOCK_LOG_DBG("Invalid signal\n");
-				sock_ep_cm_flush_msg(&pep->cm);
-				continue;
-			}
-		} else {
-			if (ret == 0) {
-				sock_ep_cm_flush_msg(&pep->cm);
-				continue;
-			} else {
-				break;
-			}
-		}
-
+	while (1) {
 		if (handle == NULL) {
 			handle = calloc(1, sizeof(*handle));
 			if (!handle)
@@ -1082,9 +1026,10 @@ static void *sock_pep_listener_thread(void *data)
 		ret = recvfrom(pep->cm.sock, (char *) conn_req,
 			       sizeof(*conn_req) + SOCK_EP_MAX_CM_DATA_SZ, 0,
 			       (struct sockaddr *) &from_addr, &addr_len);
-		SOCK_LOG_DBG("Total received: %d\n", ret);
+		if (ret < 0)
+			break;
 
-		if (ret <= 0)
+		if (ret < sizeof(struct sock_conn_hdr))
 			continue;
 		memcpy(&conn_req->from_addr, &from_addr, sizeof(struct sockaddr_in));
 		SOCK_LOG_DBG("CM msg received: %d\n", ret);
@@ -1113,6 +1058,8 @@ static void *sock_pep_listener_thread(void *data)
 
 			cm_entry->fid = &pep->pep.fid;
 			cm_entry->info = sock_ep_msg_process_info(conn_req);
+			if (!cm_entry->info)
+				break;
 			cm_entry->info->handle = &handle->handle;
 
 			memcpy(&cm_entry->data, &conn_req->user_data,
@@ -1127,43 +1074,32 @@ static void *sock_pep_listener_thread(void *data)
 
 		default:
 			SOCK_LOG_ERROR("Invalid event: %d\n", conn_req->hdr.type);
-			goto out;
+			break;
 		}
 	}
 
-out:
-	if (conn_req)
-		free(conn_req);
-	if (handle)
-		free(handle);
+	free(conn_req);
+	free(handle);
 	free(cm_entry);
-	close(pep->cm.sock);
-	return NULL;
-}
-
-static int sock_pep_start_listener_thread(struct sock_pep *pep)
-{
-	if (pthread_create(&pep->cm.listener_thread, NULL,
-			   sock_pep_listener_thread, (void *)pep)) {
-		SOCK_LOG_ERROR("Couldn't create listener thread\n");
-		return -FI_EINVAL;
-	}
-	return 0;
 }
 
 static int sock_pep_listen(struct fid_pep *pep)
 {
 	struct sock_pep *_pep;
 	_pep = container_of(pep, struct sock_pep, pep);
-	if (_pep->cm.listener_thread)
+	if (_pep->cm.handler.loop)
 		return 0;
 
 	if (!_pep->cm.do_listen && sock_pep_create_listener(_pep)) {
-		SOCK_LOG_ERROR("Failed to create pep thread\n");
+		SOCK_LOG_ERROR("Failed to create pep listener\n");
 		return -FI_EINVAL;
 	}
 
-	return sock_pep_start_listener_thread(_pep);
+	fd_set_nonblock(_pep->cm.sock);
+	_pep->cm.handler.fd = _pep->cm.sock;
+	_pep->cm.handler.handle = sock_pep_cm_handle_msg;
+	_pep->cm.handler.timer = sock_ep_cm_flush_timer;
+	return sock_cm_loop_add(&_pep->sock_fab->cm_loop, &_pep->cm.handler);
 }
 
 static int sock_pep_reject(struct fid_pep *pep, fid_t handle,
@@ -1280,13 +1216,7 @@ int sock_msg_passive_ep(struct fid_fabric *fabric, struct fi_info *info,
 		goto err;
 	}
 
-	ret = socketpair(AF_UNIX, SOCK_STREAM, 0, _pep->cm.signal_fds);
-	if (ret) {
-		ret = -errno;
-		goto err;
-	}
-
-	fd_set_nonblock(_pep->cm.signal_fds[1]);
+	_pep->cm.sock = -1;
 	dlist_init(&_pep->cm.msg_list);
 
 	_pep->pep.fid.fclass = FI_CLASS_PEP;
@@ -1297,6 +1227,7 @@ int sock_msg_passive_ep(struct fid_fabric *fabric, struct fi_info *info,
 	fastlock_init(&_pep->cm.lock);
 
 	_pep->sock_fab = container_of(fabric, struct sock_fabric, fab_fid);
+	atomic_inc(&_pep->sock_fab->ref);
 	*pep = &_pep->pep;
 	return 0;
 err:
@@ -181,6 +181,7 @@ ssize_t sock_eq_report_event(struct sock_eq *sock_eq, uint32_t event,
 
 	fastlock_acquire(&sock_eq->lock);
 	dlistfd_insert_tail(&entry->entry, &sock_eq->list);
+	sock_poll_notify(&sock_eq->poll_list);
 	if (sock_eq->signal)
 		sock_wait_signal(sock_eq->waitset);
 	fastlock_release(&sock_eq->lock);
@@ -227,6 +228,7 @@ ssize_t sock_eq_report_error(struct sock_eq *sock_eq, fid_t fid, void *context,
 	fastlock_acquire(&sock_eq->lock);
 	dlistfd_insert_tail(&entry->entry, &sock_eq->err_list);
 	dlistfd_signal(&sock_eq->list);
+	sock_poll_notify(&sock_eq->poll_list);
 	if (sock_eq->signal)
 		sock_wait_signal(sock_eq->waitset);
 	fastlock_release(&sock_eq->lock);
@@ -272,6 +274,7 @@ static int sock_eq_fi_close(struct fid *fid)
 	sock_eq = container_of(fid, struct sock_eq, eq);
 	sock_eq_clean_err_data_list(sock_eq, 1);
 
+	sock_poll_list_fini(&sock_eq->poll_list);
 	dlistfd_head_free(&sock_eq->list);
 	dlistfd_head_free(&sock_eq->err_list);
 	fastlock_destroy(&sock_eq->lock);
@@ -357,6 +360,7 @@ int sock_eq_open(struct fid_fabric *fabric, struct fi_eq_attr *attr,
 	int ret;
 	struct sock_eq *sock_eq;
 	struct fi_wait_attr wait_attr;
+	struct sock_wait *wait;
 
 	ret = _sock_eq_verify_attr(attr);
 	if (ret)
@@ -388,6 +392,7 @@ int sock_eq_open(struct fid_fabric *fabric, struct fi_eq_attr *attr,
 		goto err2;
 
 	fastlock_init(&sock_eq->lock);
+	sock_poll_list_init(&sock_eq->poll_list);
 	atomic_inc(&sock_eq->sock_fab->ref);
 
 	switch (sock_eq->attr.wait_obj) {
@@ -413,6 +418,10 @@ int sock_eq_open(struct fid_fabric *fabric, struct fi_eq_attr *attr,
 		}
 		sock_eq->waitset = attr->wait_set;
 		sock_eq->signal = 1;
+		wait = container_of(attr->wait_set, struct sock_wait, wait_fid);
+		ret = sock_poll_set_add(&wait->pset, &sock_eq->eq.fid);
+		if (ret)
+			goto err2;
 		break;
 	default:
 		break;
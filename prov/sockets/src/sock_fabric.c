@@ -38,6 +38,7 @@
 #include <string.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <limits.h>
@@ -51,6 +52,9 @@
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_FABRIC, __VA_ARGS__)
 
 int sock_pe_waittime = SOCK_PE_WAITTIME;
+int sock_pe_profile = FI_SOCKETS_PE_PROFILE_LATENCY;
+int sock_pe_spin_budget = -1;
+int sock_pe_backoff_max = -1;
 const char sock_fab_name[] = "IP";
 const char sock_dom_name[] = "sockets";
 const char sock_prov_name[] = "sockets";
@@ -60,6 +64,17 @@ int sock_av_def_sz = SOCK_AV_DEF_SZ;
 int sock_cq_def_sz = SOCK_CQ_DEF_SZ;
 int sock_eq_def_sz = SOCK_EQ_DEF_SZ;
 char *sock_pe_affinity_str = NULL;
+int sock_pe_threads = SOCK_PE_THREADS;
+int sock_pe_max_entries = SOCK_PE_DEF_MAX_ENTRIES;
+int sock_mr_cache_size = 0;
+int sock_rndv_threshold = 0;
+int sock_shm_enable = 1;
+int sock_cma_threshold = SOCK_CMA_THRESHOLD;
+int sock_dgram_udp = 1;
+int sock_av_preconnect = 0;
+int sock_conn_inflight = SOCK_CM_DEF_INFLIGHT;
+int sock_conn_cache_size = -1;
+int sock_conn_idle_timeout = 0;
 #if ENABLE_DEBUG
 int sock_dgram_drop_rate = 0;
 #endif
@@ -295,6 +310,7 @@ static int sock_fabric_close(fid_t fid)
 		return -FI_EBUSY;
 
 	sock_fab_remove_from_list(fab);
+	sock_cm_loop_fini(&fab->cm_loop);
 	fastlock_destroy(&fab->lock);
 	free(fab);
 	return 0;
@@ -308,10 +324,30 @@ static struct fi_ops sock_fab_fi_ops = {
 	.ops_open = fi_no_ops_open,
 };
 
+/* leave half of the open file limit to the application */
+static int sock_def_conn_cache_size(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur == RLIM_INFINITY)
+		return 0;
+	return (int) MIN(rl.rlim_cur / 2, INT_MAX);
+}
+
 static void sock_read_default_params()
 {
+	char *profile;
+
 	if (!read_default_params) {
 		fi_param_get_int(&sock_prov, "pe_waittime", &sock_pe_waittime);
+		if (fi_param_get_str(&sock_prov, "pe_profile", &profile) == FI_SUCCESS) {
+			if (!strcmp(profile, "cpu"))
+				sock_pe_profile = FI_SOCKETS_PE_PROFILE_CPU;
+			else if (strcmp(profile, "latency"))
+				SOCK_LOG_ERROR("unknown pe_profile %s\n", profile);
+		}
+		fi_param_get_int(&sock_prov, "pe_spin_budget", &sock_pe_spin_budget);
+		fi_param_get_int(&sock_prov, "pe_backoff_max", &sock_pe_backoff_max);
 		fi_param_get_int(&sock_prov, "max_conn_retry", &sock_conn_retry);
 		fi_param_get_int(&sock_prov, "def_conn_map_sz", &sock_cm_def_map_sz);
 		fi_param_get_int(&sock_prov, "def_av_sz", &sock_av_def_sz);
@@ -319,6 +355,19 @@ static void sock_read_default_params()
 		fi_param_get_int(&sock_prov, "def_eq_sz", &sock_eq_def_sz);
 		if (fi_param_get_str(&sock_prov, "pe_affinity", &sock_pe_affinity_str) != FI_SUCCESS)
 			sock_pe_affinity_str = NULL;
+		fi_param_get_int(&sock_prov, "pe_threads", &sock_pe_threads);
+		fi_param_get_int(&sock_prov, "pe_max_entries", &sock_pe_max_entries);
+		fi_param_get_int(&sock_prov, "mr_cache_size", &sock_mr_cache_size);
+		fi_param_get_int(&sock_prov, "rndv_threshold", &sock_rndv_threshold);
+		fi_param_get_int(&sock_prov, "shm_enable", &sock_shm_enable);
+		fi_param_get_int(&sock_prov, "cma_threshold", &sock_cma_threshold);
+		fi_param_get_int(&sock_prov, "dgram_udp", &sock_dgram_udp);
+		fi_param_get_int(&sock_prov, "av_preconnect", &sock_av_preconnect);
+		fi_param_get_int(&sock_prov, "conn_inflight", &sock_conn_inflight);
+		fi_param_get_int(&sock_prov, "conn_cache_size", &sock_conn_cache_size);
+		fi_param_get_int(&sock_prov, "conn_idle_timeout", &sock_conn_idle_timeout);
+		if (sock_conn_cache_size < 0)
+			sock_conn_cache_size = sock_def_conn_cache_size();
 #if ENABLE_DEBUG
 		fi_param_get_int(&sock_prov, "dgram_drop_rate", &sock_dgram_drop_rate);
 #endif
@@ -340,6 +389,11 @@ static int sock_fabric(struct fi_fabric_attr *attr,
 
 	sock_read_default_params();
 
+	if (sock_cm_loop_init(&fab->cm_loop)) {
+		free(fab);
+		return -FI_ENOMEM;
+	}
+
 	fastlock_init(&fab->lock);
 	dlist_init(&fab->service_list);
 
@@ -528,6 +582,8 @@ static int sock_getinfo(uint32_t version, const char *node, const char *service,
 	    (hints->dest_addrlen != sizeof(struct sockaddr_in)))
 		return -FI_ENODATA;
 
+	sock_read_default_params();
+
 	ret = sock_verify_info(hints);
 	if (ret)
 		return ret;
@@ -604,6 +660,21 @@ SOCKETS_INI
 	fi_param_define(&sock_prov, "pe_waittime", FI_PARAM_INT,
 			"How many milliseconds to spin while waiting for progress");
 
+	fi_param_define(&sock_prov, "pe_profile", FI_PARAM_STRING,
+			"How auto progress threads wait for work: 'latency' "
+			"busy-polls for pe_waittime before blocking, 'cpu' "
+			"blocks soon after going idle (default: latency). "
+			"Domains can switch with fi_control()");
+
+	fi_param_define(&sock_prov, "pe_spin_budget", FI_PARAM_INT,
+			"Microseconds an idle progress thread busy-polls before "
+			"backing off (default: set by pe_profile)");
+
+	fi_param_define(&sock_prov, "pe_backoff_max", FI_PARAM_INT,
+			"Longest sleep in microseconds between polls of an idle "
+			"progress thread; sleeps double up to it, then the "
+			"thread blocks (default: set by pe_profile)");
+
 	fi_param_define(&sock_prov, "max_conn_retry", FI_PARAM_INT,
 			"Number of connection retries before reporting as failure");
 
@@ -623,9 +694,58 @@ SOCKETS_INI
 			"If specified, bind the progress thread to the indicated range(s) of Linux virtual processor ID(s). "
 			"This option is currently not supported on OS X. Usage: id_start[-id_end[:stride]][,]");
 
+	fi_param_define(&sock_prov, "pe_threads", FI_PARAM_INT,
+			"Number of progress threads per domain (default: 1). "
+			"Endpoints are spread across the threads; with more than one "
+			"thread, each is pinned to the next processor in pe_affinity");
+
+	fi_param_define(&sock_prov, "pe_max_entries", FI_PARAM_INT,
+			"Maximum number of in-flight operations per progress thread "
+			"(default: 1024). Entries are allocated on demand");
+
+	fi_param_define(&sock_prov, "mr_cache_size", FI_PARAM_INT,
+			"Number of unused memory registrations kept for reuse "
+			"by FI_MR_BASIC domains (default: 0, cache disabled)");
+
+	fi_param_define(&sock_prov, "rndv_threshold", FI_PARAM_INT,
+			"Sends of at least this many bytes wait for the matching "
+			"receive before moving data (default: 0, disabled)");
+
+	fi_param_define(&sock_prov, "shm_enable", FI_PARAM_INT,
+			"Carry traffic between endpoints on the same host over "
+			"shared memory instead of loopback TCP (default: 1)");
+
+	fi_param_define(&sock_prov, "cma_threshold", FI_PARAM_INT,
+			"Same-host RMA reads and rendezvous transfers of at least "
+			"this many bytes are copied with cross memory attach "
+			"(default: 65536, 0 disables)");
+
+	fi_param_define(&sock_prov, "dgram_udp", FI_PARAM_INT,
+			"Carry datagram endpoint traffic over UDP instead of "
+			"per-peer TCP connections (default: 1)");
+
+	fi_param_define(&sock_prov, "av_preconnect", FI_PARAM_INT,
+			"Connect to addresses in the background as they are "
+			"inserted into an AV instead of on first use (default: 0)");
+
+	fi_param_define(&sock_prov, "conn_inflight", FI_PARAM_INT,
+			"Maximum number of background connects in progress at "
+			"once per domain (default: 64)");
+
+	fi_param_define(&sock_prov, "conn_cache_size", FI_PARAM_INT,
+			"Maximum number of open RDM connections per progress "
+			"engine; idle ones beyond it are closed least recently "
+			"used first (default: half the open file limit, 0 for "
+			"no limit)");
+
+	fi_param_define(&sock_prov, "conn_idle_timeout", FI_PARAM_INT,
+			"Close RDM connections idle for this many milliseconds "
+			"(default: 0, never)");
+
 	fastlock_init(&sock_list_lock);
 	dlist_init(&sock_fab_list);
 	dlist_init(&sock_dom_list);
+	sock_atomic_init();
 #if ENABLE_DEBUG
 	fi_param_define(&sock_prov, "dgram_drop_rate", FI_PARAM_INT,
 			"Drop every Nth dgram frame (debug only)");
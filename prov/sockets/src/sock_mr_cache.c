@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2015 Intel Corporation, Inc.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <search.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sock.h"
+#include "sock_util.h"
+
+#define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_MR, __VA_ARGS__)
+#define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_MR, __VA_ARGS__)
+
+/*
+ * Registration cache for FI_MR_BASIC domains.  Cached regions are shared
+ * by registrations of exactly the same range and access, and are kept on
+ * an LRU list once the last user closes them.  All calls are made with
+ * the domain lock held.
+ */
+
+static int sock_mr_cache_cmp(const void *a, const void *b)
+{
+	const uintptr_t *ra = a, *rb = b;
+
+	if (ra[1] <= rb[0])
+		return -1;
+	if (ra[0] >= rb[1])
+		return 1;
+	return 0;
+}
+
+void sock_mr_cache_init(struct sock_mr_cache *cache, size_t max_idle)
+{
+	memset(cache, 0, sizeof(*cache));
+	dlist_init(&cache->lru_list);
+	cache->max_idle = max_idle;
+}
+
+struct sock_mr *sock_mr_cache_overlap(struct sock_mr_cache *cache,
+				      uintptr_t start, uintptr_t end)
+{
+	uintptr_t range[2] = { start, end };
+	void **node;
+
+	node = tfind(range, &cache->root, sock_mr_cache_cmp);
+	return node ? container_of(*node, struct sock_mr, range) : NULL;
+}
+
+struct sock_mr *sock_mr_cache_find(struct sock_mr_cache *cache,
+				   uintptr_t start, uintptr_t end,
+				   uint64_t access)
+{
+	struct sock_mr *mr;
+
+	mr = sock_mr_cache_overlap(cache, start, end);
+	if (mr && mr->range[0] == start && mr->range[1] == end &&
+	    mr->access == access) {
+		cache->stats.hits++;
+		sock_mr_cache_hold(cache, mr);
+		return mr;
+	}
+	cache->stats.misses++;
+	return NULL;
+}
+
+int sock_mr_cache_insert(struct sock_mr_cache *cache, struct sock_mr *mr)
+{
+	mr->range[0] = (uintptr_t) mr->mr_iov[0].iov_base;
+	mr->range[1] = mr->range[0] + mr->mr_iov[0].iov_len;
+	if (!tsearch(mr->range, &cache->root, sock_mr_cache_cmp))
+		return -FI_ENOMEM;
+
+	mr->cached = 1;
+	mr->cache_ref = 1;
+	dlist_init(&mr->lru_entry);
+	cache->stats.cached++;
+	return 0;
+}
+
+void sock_mr_cache_remove(struct sock_mr_cache *cache, struct sock_mr *mr)
+{
+	if (!mr->cached)
+		return;
+
+	tdelete(mr->range, &cache->root, sock_mr_cache_cmp);
+	mr->cached = 0;
+	cache->stats.cached--;
+	if (!mr->cache_ref) {
+		dlist_remove(&mr->lru_entry);
+		cache->stats.idle--;
+	}
+}
+
+void sock_mr_cache_hold(struct sock_mr_cache *cache, struct sock_mr *mr)
+{
+	if (!mr->cache_ref++) {
+		dlist_remove(&mr->lru_entry);
+		cache->stats.idle--;
+	}
+}
+
+struct sock_mr *sock_mr_cache_evict(struct sock_mr_cache *cache)
+{
+	struct sock_mr *mr;
+
+	if (dlist_empty(&cache->lru_list))
+		return NULL;
+
+	mr = container_of(cache->lru_list.next, struct sock_mr, lru_entry);
+	sock_mr_cache_remove(cache, mr);
+	cache->stats.evictions++;
+	SOCK_LOG_DBG("evicting region %p\n", (void *) mr->range[0]);
+	return mr;
+}
+
+/* returns a region the caller must deregister, if any */
+struct sock_mr *sock_mr_cache_release(struct sock_mr_cache *cache,
+				      struct sock_mr *mr)
+{
+	if (--mr->cache_ref)
+		return NULL;
+
+	if (!mr->cached)
+		return mr;
+
+	dlist_insert_tail(&mr->lru_entry, &cache->lru_list);
+	cache->stats.idle++;
+	return (cache->stats.idle > cache->max_idle) ?
+		sock_mr_cache_evict(cache) : NULL;
+}
@@ -59,6 +59,26 @@
 #define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_EP_DATA, __VA_ARGS__)
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_DATA, __VA_ARGS__)
 
+/* datagram sends go out over UDP and need no connection */
+static int sock_msg_dgram_check(struct sock_tx_ctx *tx_ctx,
+				const struct iovec *iov, size_t count,
+				fi_addr_t addr)
+{
+	struct sockaddr_in sin;
+	size_t i, len = 0;
+
+	for (i = 0; i < count; i++)
+		len += iov[i].iov_len;
+	if (len > SOCK_DGRAM_MAX_MSG_SZ)
+		return -FI_EMSGSIZE;
+
+	if (!tx_ctx->av || sock_av_get_sockaddr(tx_ctx->av, addr, &sin)) {
+		SOCK_LOG_ERROR("Address lookup failed\n");
+		return -FI_EINVAL;
+	}
+	return 0;
+}
+
 ssize_t sock_ep_recvmsg(struct fid_ep *ep, const struct fi_msg *msg,
 			uint64_t flags)
 {
@@ -137,7 +157,7 @@ ssize_t sock_ep_recvmsg(struct fid_ep *ep, const struct fi_msg *msg,
 
 	SOCK_LOG_DBG("New rx_entry: %p (ctx: %p)\n", rx_entry, rx_ctx);
 	fastlock_acquire(&rx_ctx->lock);
-	dlist_insert_tail(&rx_entry->entry, &rx_ctx->rx_entry_list);
+	sock_rx_enqueue_entry(rx_ctx, rx_entry);
 	fastlock_release(&rx_ctx->lock);
 	return 0;
 }
@@ -184,6 +204,7 @@ ssize_t sock_ep_sendmsg(struct fid_ep *ep, const struct fi_msg *msg,
 	union sock_iov tx_iov;
 	struct sock_conn *conn;
 	struct sock_tx_ctx *tx_ctx;
+	struct sock_tx_cmd cmd;
 	struct sock_ep *sock_ep;
 
 	switch (ep->fid.fclass) {
@@ -211,17 +232,26 @@ ssize_t sock_ep_sendmsg(struct fid_ep *ep, const struct fi_msg *msg,
 	if (sock_drop_packet(sock_ep))
 		return 0;
 
-	if (sock_ep->connected) {
-		conn = sock_ep_lookup_conn(sock_ep);
+	if (tx_ctx->dgram) {
+		ret = sock_msg_dgram_check(tx_ctx, msg->msg_iov,
+					   msg->iov_count, msg->addr);
+		if (ret)
+			return ret;
+		conn = NULL;
 	} else {
-		conn = sock_av_lookup_addr(sock_ep, tx_ctx->av, msg->addr);
-		if (!conn) {
-			SOCK_LOG_ERROR("Address lookup failed\n");
-			return -errno;
+		if (sock_ep->connected) {
+			conn = sock_ep_lookup_conn(sock_ep);
+		} else {
+			conn = sock_av_lookup_addr(sock_ep, tx_ctx->av,
+						   msg->addr);
+			if (!conn) {
+				SOCK_LOG_ERROR("Address lookup failed\n");
+				return -errno;
+			}
 		}
+		if (!conn)
+			return -FI_EAGAIN;
 	}
-	if (!conn)
-		return -FI_EAGAIN;
 
 	SOCK_LOG_DBG("New sendmsg on TX: %p using conn: %p\n",
 		      tx_ctx, conn);
@@ -249,10 +279,8 @@ ssize_t sock_ep_sendmsg(struct fid_ep *ep, const struct fi_msg *msg,
 		for (i = 0; i < msg->iov_count; i++)
 			total_len += msg->msg_iov[i].iov_len;
 
-		if (total_len > SOCK_EP_MAX_INJECT_SZ) {
-			ret = -FI_EINVAL;
-			goto err;
-		}
+		if (total_len > SOCK_EP_MAX_INJECT_SZ)
+			return -FI_EINVAL;
 		tx_op.src_iov_len = total_len;
 	} else {
 		tx_op.src_iov_len = msg->iov_count;
@@ -264,38 +292,32 @@ ssize_t sock_ep_sendmsg(struct fid_ep *ep, const struct fi_msg *msg,
 	if (flags & FI_REMOTE_CQ_DATA)
 		total_len += sizeof(uint64_t);
 
-	sock_tx_ctx_start(tx_ctx);
-	if (rbfdavail(&tx_ctx->rbfd) < total_len) {
-		ret = -FI_EAGAIN;
-		goto err;
-	}
+	ret = sock_tx_ctx_start(tx_ctx, &cmd, total_len);
+	if (ret)
+		return ret;
 
-	sock_tx_ctx_write_op_send(tx_ctx, &tx_op, flags, (uintptr_t) msg->context,
+	sock_tx_ctx_write_op_send(&cmd, &tx_op, flags, (uintptr_t) msg->context,
 			msg->addr, (uintptr_t) msg->msg_iov[0].iov_base,
 			sock_ep, conn);
 
 	if (flags & FI_REMOTE_CQ_DATA)
-		sock_tx_ctx_write(tx_ctx, &msg->data, sizeof(msg->data));
+		sock_tx_ctx_write(&cmd, &msg->data, sizeof(msg->data));
 
 	if (flags & FI_INJECT) {
 		for (i = 0; i < msg->iov_count; i++) {
-			sock_tx_ctx_write(tx_ctx, msg->msg_iov[i].iov_base,
+			sock_tx_ctx_write(&cmd, msg->msg_iov[i].iov_base,
 					  msg->msg_iov[i].iov_len);
 		}
 	} else {
 		for (i = 0; i < msg->iov_count; i++) {
 			tx_iov.iov.addr = (uintptr_t) msg->msg_iov[i].iov_base;
 			tx_iov.iov.len = msg->msg_iov[i].iov_len;
-			sock_tx_ctx_write(tx_ctx, &tx_iov, sizeof(tx_iov));
+			sock_tx_ctx_write(&cmd, &tx_iov, sizeof(tx_iov));
 		}
 	}
 
-	sock_tx_ctx_commit(tx_ctx);
+	sock_tx_ctx_commit(&cmd);
 	return 0;
-
-err:
-	sock_tx_ctx_abort(tx_ctx);
-	return ret;
 }
 
 static ssize_t sock_ep_send(struct fid_ep *ep, const void *buf, size_t len,
@@ -479,7 +501,7 @@ ssize_t sock_ep_trecvmsg(struct fid_ep *ep,
 
 	fastlock_acquire(&rx_ctx->lock);
 	SOCK_LOG_DBG("New rx_entry: %p (ctx: %p)\n", rx_entry, rx_ctx);
-	dlist_insert_tail(&rx_entry->entry, &rx_ctx->rx_entry_list);
+	sock_rx_enqueue_entry(rx_ctx, rx_entry);
 	fastlock_release(&rx_ctx->lock);
 	return 0;
 }
@@ -533,6 +555,7 @@ ssize_t sock_ep_tsendmsg(struct fid_ep *ep,
 	union sock_iov tx_iov;
 	struct sock_conn *conn;
 	struct sock_tx_ctx *tx_ctx;
+	struct sock_tx_cmd cmd;
 	struct sock_ep *sock_ep;
 
 	switch (ep->fid.fclass) {
@@ -560,17 +583,26 @@ ssize_t sock_ep_tsendmsg(struct fid_ep *ep,
 	if (sock_drop_packet(sock_ep))
 		return 0;
 
-	if (sock_ep->connected) {
-		conn = sock_ep_lookup_conn(sock_ep);
+	if (tx_ctx->dgram) {
+		ret = sock_msg_dgram_check(tx_ctx, msg->msg_iov,
+					   msg->iov_count, msg->addr);
+		if (ret)
+			return ret;
+		conn = NULL;
 	} else {
-		conn = sock_av_lookup_addr(sock_ep, tx_ctx->av, msg->addr);
-		if (!conn) {
-			SOCK_LOG_ERROR("Address lookup failed\n");
-			return -errno;
+		if (sock_ep->connected) {
+			conn = sock_ep_lookup_conn(sock_ep);
+		} else {
+			conn = sock_av_lookup_addr(sock_ep, tx_ctx->av,
+						   msg->addr);
+			if (!conn) {
+				SOCK_LOG_ERROR("Address lookup failed\n");
+				return -errno;
+			}
 		}
+		if (!conn)
+			return -FI_EAGAIN;
 	}
-	if (!conn)
-		return -FI_EAGAIN;
 
 	SOCK_EP_SET_TX_OP_FLAGS(flags);
 	if (flags & SOCK_USE_OP_FLAGS)
@@ -596,10 +628,8 @@ ssize_t sock_ep_tsendmsg(struct fid_ep *ep,
 			total_len += msg->msg_iov[i].iov_len;
 
 		tx_op.src_iov_len = total_len;
-		if (total_len > SOCK_EP_MAX_INJECT_SZ) {
-			ret = -FI_EINVAL;
-			goto err;
-		}
+		if (total_len > SOCK_EP_MAX_INJECT_SZ)
+			return -FI_EINVAL;
 	} else {
 		total_len = msg->iov_count * sizeof(union sock_iov);
 		tx_op.src_iov_len = msg->iov_count;
@@ -609,39 +639,33 @@ ssize_t sock_ep_tsendmsg(struct fid_ep *ep,
 	if (flags & FI_REMOTE_CQ_DATA)
 		total_len += sizeof(uint64_t);
 
-	sock_tx_ctx_start(tx_ctx);
-	if (rbfdavail(&tx_ctx->rbfd) < total_len) {
-		ret = -FI_EAGAIN;
-		goto err;
-	}
+	ret = sock_tx_ctx_start(tx_ctx, &cmd, total_len);
+	if (ret)
+		return ret;
 
-	sock_tx_ctx_write_op_tsend(tx_ctx, &tx_op, flags,
+	sock_tx_ctx_write_op_tsend(&cmd, &tx_op, flags,
 			(uintptr_t) msg->context, msg->addr,
 			(uintptr_t) msg->msg_iov[0].iov_base,
 			sock_ep, conn, msg->tag);
 
 	if (flags & FI_REMOTE_CQ_DATA)
-		sock_tx_ctx_write(tx_ctx, &msg->data, sizeof(msg->data));
+		sock_tx_ctx_write(&cmd, &msg->data, sizeof(msg->data));
 
 	if (flags & FI_INJECT) {
 		for (i = 0; i < msg->iov_count; i++) {
-			sock_tx_ctx_write(tx_ctx, msg->msg_iov[i].iov_base,
+			sock_tx_ctx_write(&cmd, msg->msg_iov[i].iov_base,
 					  msg->msg_iov[i].iov_len);
 		}
 	} else {
 		for (i = 0; i < msg->iov_count; i++) {
 			tx_iov.iov.addr = (uintptr_t) msg->msg_iov[i].iov_base;
 			tx_iov.iov.len = msg->msg_iov[i].iov_len;
-			sock_tx_ctx_write(tx_ctx, &tx_iov, sizeof(tx_iov));
+			sock_tx_ctx_write(&cmd, &tx_iov, sizeof(tx_iov));
 		}
 	}
 
-	sock_tx_ctx_commit(tx_ctx);
+	sock_tx_ctx_commit(&cmd);
 	return 0;
-
-err:
-	sock_tx_ctx_abort(tx_ctx);
-	return ret;
 }
 
 static ssize_t sock_ep_tsend(struct fid_ep *ep, const void *buf, size_t len,
@@ -43,118 +43,327 @@
 #define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_CORE, __VA_ARGS__)
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_CORE, __VA_ARGS__)
 
-static int sock_poll_add(struct fid_poll *pollset, struct fid *event_fid,
-			 uint64_t flags)
+void sock_poll_list_init(struct sock_poll_list *plist)
 {
-	struct sock_poll *poll;
-	struct sock_fid_list *list_item;
+	fastlock_init(&plist->lock);
+	dlist_init(&plist->list);
+}
 
-	poll = container_of(pollset, struct sock_poll, poll_fid.fid);
-	list_item = calloc(1, sizeof(*list_item));
-	if (!list_item)
+static void sock_poll_member_unready(struct sock_poll_member *member)
+{
+	struct sock_poll_set *pset = member->set;
+
+	fastlock_acquire(&pset->lock);
+	if (atomic_get(&member->ready)) {
+		dlist_remove(&member->ready_entry);
+		atomic_set(&member->ready, 0);
+		pset->num_ready--;
+	}
+	fastlock_release(&pset->lock);
+}
+
+void sock_poll_list_fini(struct sock_poll_list *plist)
+{
+	struct sock_poll_member *member;
+	struct dlist_entry list;
+
+	fastlock_acquire(&plist->lock);
+	dlist_init(&list);
+	while (!dlist_empty(&plist->list)) {
+		member = container_of(plist->list.next,
+				      struct sock_poll_member, obj_entry);
+		dlist_remove(&member->obj_entry);
+		dlist_insert_tail(&member->obj_entry, &list);
+	}
+	fastlock_release(&plist->lock);
+
+	while (!dlist_empty(&list)) {
+		member = container_of(list.next, struct sock_poll_member,
+				      obj_entry);
+		dlist_remove(&member->obj_entry);
+
+		fastlock_acquire(&member->set->member_lock);
+		dlist_remove(&member->entry);
+		member->set->num_manual -= member->manual;
+		fastlock_release(&member->set->member_lock);
+
+		sock_poll_member_unready(member);
+		free(member);
+	}
+	fastlock_destroy(&plist->lock);
+}
+
+static void sock_poll_member_ready(struct sock_poll_member *member)
+{
+	struct sock_poll_set *pset = member->set;
+
+	fastlock_acquire(&pset->lock);
+	if (!atomic_get(&member->ready)) {
+		atomic_set(&member->ready, 1);
+		dlist_insert_tail(&member->ready_entry, &pset->ready_list);
+		pset->num_ready++;
+	}
+	fastlock_release(&pset->lock);
+}
+
+void sock_poll_notify(struct sock_poll_list *plist)
+{
+	struct sock_poll_member *member;
+	struct dlist_entry *entry;
+
+	if (dlist_empty(&plist->list))
+		return;
+
+	fastlock_acquire(&plist->lock);
+	for (entry = plist->list.next; entry != &plist->list;
+	     entry = entry->next) {
+		member = container_of(entry, struct sock_poll_member,
+				      obj_entry);
+		if (!atomic_get(&member->ready))
+			sock_poll_member_ready(member);
+	}
+	fastlock_release(&plist->lock);
+}
+
+void sock_poll_set_init(struct sock_poll_set *pset)
+{
+	fastlock_init(&pset->member_lock);
+	dlist_init(&pset->member_list);
+	fastlock_init(&pset->lock);
+	dlist_init(&pset->ready_list);
+	pset->num_manual = 0;
+	pset->num_ready = 0;
+}
+
+static void sock_poll_member_free(struct sock_poll_member *member)
+{
+	fastlock_acquire(&member->obj->lock);
+	dlist_remove(&member->obj_entry);
+	fastlock_release(&member->obj->lock);
+
+	sock_poll_member_unready(member);
+	dlist_remove(&member->entry);
+	member->set->num_manual -= member->manual;
+	free(member);
+}
+
+void sock_poll_set_fini(struct sock_poll_set *pset)
+{
+	fastlock_acquire(&pset->member_lock);
+	while (!dlist_empty(&pset->member_list))
+		sock_poll_member_free(container_of(pset->member_list.next,
+						   struct sock_poll_member,
+						   entry));
+	fastlock_release(&pset->member_lock);
+
+	fastlock_destroy(&pset->member_lock);
+	fastlock_destroy(&pset->lock);
+}
+
+int sock_poll_set_add(struct sock_poll_set *pset, struct fid *fid)
+{
+	struct sock_poll_member *member;
+	struct sock_poll_list *plist;
+	struct sock_cq *cq;
+	struct sock_cntr *cntr;
+	struct sock_eq *eq;
+	int manual = 0;
+
+	switch (fid->fclass) {
+	case FI_CLASS_CQ:
+		cq = container_of(fid, struct sock_cq, cq_fid);
+		plist = &cq->poll_list;
+		manual = cq->domain->progress_mode == FI_PROGRESS_MANUAL;
+		break;
+
+	case FI_CLASS_CNTR:
+		cntr = container_of(fid, struct sock_cntr, cntr_fid);
+		plist = &cntr->poll_list;
+		manual = cntr->domain->progress_mode == FI_PROGRESS_MANUAL;
+		break;
+
+	case FI_CLASS_EQ:
+		eq = container_of(fid, struct sock_eq, eq);
+		plist = &eq->poll_list;
+		break;
+
+	default:
+		SOCK_LOG_ERROR("Invalid fid class: %zu\n", fid->fclass);
+		return -FI_EINVAL;
+	}
+
+	member = calloc(1, sizeof(*member));
+	if (!member)
 		return -FI_ENOMEM;
 
-	list_item->fid = event_fid;
-	dlist_init(&list_item->entry);
-	dlist_insert_after(&list_item->entry, &poll->fid_list);
+	member->fid = fid;
+	member->set = pset;
+	member->obj = plist;
+	member->manual = manual;
+	atomic_initialize(&member->ready, 0);
+
+	fastlock_acquire(&pset->member_lock);
+	dlist_insert_tail(&member->entry, &pset->member_list);
+	pset->num_manual += manual;
+
+	fastlock_acquire(&plist->lock);
+	dlist_insert_tail(&member->obj_entry, &plist->list);
+	fastlock_release(&plist->lock);
+	fastlock_release(&pset->member_lock);
+
+	/* pick up anything that was already pending */
+	if (fid->fclass != FI_CLASS_CNTR)
+		sock_poll_member_ready(member);
 	return 0;
 }
 
-static int sock_poll_del(struct fid_poll *pollset, struct fid *event_fid,
-			 uint64_t flags)
+int sock_poll_set_del(struct sock_poll_set *pset, struct fid *fid)
 {
-	struct sock_poll *poll;
-	struct sock_fid_list *list_item;
-	struct dlist_entry *p, *head;
+	struct sock_poll_member *member;
+	struct dlist_entry *entry;
+	int ret = -FI_ENOENT;
 
-	poll = container_of(pollset, struct sock_poll, poll_fid.fid);
-	head = &poll->fid_list;
-	for (p = head->next; p != head; p = p->next) {
-		list_item = container_of(p, struct sock_fid_list, entry);
-		if (list_item->fid == event_fid) {
-			dlist_remove(p);
-			free(list_item);
+	fastlock_acquire(&pset->member_lock);
+	for (entry = pset->member_list.next; entry != &pset->member_list;
+	     entry = entry->next) {
+		member = container_of(entry, struct sock_poll_member, entry);
+		if (member->fid == fid) {
+			sock_poll_member_free(member);
+			ret = 0;
 			break;
 		}
 	}
-	return 0;
+	fastlock_release(&pset->member_lock);
+	return ret;
 }
 
-static int sock_poll_poll(struct fid_poll *pollset, void **context, int count)
+void sock_poll_set_progress(struct sock_poll_set *pset)
+{
+	struct sock_poll_member *member;
+	struct dlist_entry *entry;
+
+	if (!pset->num_manual)
+		return;
+
+	fastlock_acquire(&pset->member_lock);
+	for (entry = pset->member_list.next; entry != &pset->member_list;
+	     entry = entry->next) {
+		member = container_of(entry, struct sock_poll_member, entry);
+		if (!member->manual)
+			continue;
+
+		if (member->fid->fclass == FI_CLASS_CQ)
+			sock_cq_progress(container_of(member->fid,
+						      struct sock_cq, cq_fid));
+		else
+			sock_cntr_progress(container_of(member->fid,
+						struct sock_cntr, cntr_fid));
+	}
+	fastlock_release(&pset->member_lock);
+}
+
+static int sock_poll_has_events(struct sock_poll_member *member)
 {
-	struct sock_poll *poll;
-	struct sock_cq *cq;
 	struct sock_eq *eq;
-	struct sock_cntr *cntr;
-	struct sock_fid_list *list_item;
-	struct dlist_entry *p, *head;
-	int ret_count = 0;
+	int ret;
 
-	poll = container_of(pollset, struct sock_poll, poll_fid.fid);
-	head = &poll->fid_list;
-
-	for (p = head->next; p != head && ret_count < count; p = p->next) {
-		list_item = container_of(p, struct sock_fid_list, entry);
-		switch (list_item->fid->fclass) {
-		case FI_CLASS_CQ:
-			cq = container_of(list_item->fid, struct sock_cq,
-						cq_fid);
-			sock_cq_progress(cq);
-			fastlock_acquire(&cq->lock);
-			if (rbfdused(&cq->cq_rbfd) || rbused(&cq->cqerr_rb)) {
-				*context++ = cq->cq_fid.fid.context;
-				ret_count++;
-			}
-			fastlock_release(&cq->lock);
-			break;
+	switch (member->fid->fclass) {
+	case FI_CLASS_CQ:
+		return sock_cq_has_entries(container_of(member->fid,
+							struct sock_cq,
+							cq_fid));
+	case FI_CLASS_EQ:
+		eq = container_of(member->fid, struct sock_eq, eq);
+		fastlock_acquire(&eq->lock);
+		ret = !dlistfd_empty(&eq->list) || !dlistfd_empty(&eq->err_list);
+		fastlock_release(&eq->lock);
+		return ret;
+	default:
+		return 0;
+	}
+}
 
-		case FI_CLASS_CNTR:
-			cntr = container_of(list_item->fid, struct sock_cntr,
-						cntr_fid);
-			sock_cntr_progress(cntr);
-			pthread_mutex_lock(&cntr->mut);
-			if (atomic_get(&cntr->value) >=
-				atomic_get(&cntr->threshold)) {
-				*context++ = cntr->cntr_fid.fid.context;
-				ret_count++;
-			}
-			pthread_mutex_unlock(&cntr->mut);
-			break;
+/*
+ * Visit only members that have been signaled. CQs and EQs stay on the
+ * ready list while they hold entries; a counter is reported once for
+ * each batch of updates. The member lock is held throughout so that
+ * a concurrent del or object close cannot free a member we have popped.
+ */
+int sock_poll_set_ready(struct sock_poll_set *pset, void **context, int count)
+{
+	struct sock_poll_member *member;
+	int ready, num, ret_count = 0;
 
-		case FI_CLASS_EQ:
-			eq = container_of(list_item->fid, struct sock_eq, eq);
-			fastlock_acquire(&eq->lock);
-			if (!dlistfd_empty(&eq->list) ||
-				!dlistfd_empty(&eq->err_list)) {
-				*context++ = eq->eq.fid.context;
-				ret_count++;
-			}
-			fastlock_release(&eq->lock);
-			break;
+	fastlock_acquire(&pset->member_lock);
+	fastlock_acquire(&pset->lock);
+	num = pset->num_ready;
+	fastlock_release(&pset->lock);
 
-		default:
+	while (num-- > 0 && ret_count < count) {
+		fastlock_acquire(&pset->lock);
+		if (dlist_empty(&pset->ready_list)) {
+			fastlock_release(&pset->lock);
 			break;
 		}
-	}
+		member = container_of(pset->ready_list.next,
+				      struct sock_poll_member, ready_entry);
+		dlist_remove(&member->ready_entry);
+		pset->num_ready--;
+		atomic_set(&member->ready, 0);
+		fastlock_release(&pset->lock);
 
+		if (member->fid->fclass == FI_CLASS_CNTR) {
+			ready = 1;
+		} else {
+			ready = sock_poll_has_events(member);
+			if (ready)
+				sock_poll_member_ready(member);
+		}
+
+		if (ready) {
+			if (context)
+				context[ret_count] = member->fid->context;
+			ret_count++;
+		}
+	}
+	fastlock_release(&pset->member_lock);
 	return ret_count;
 }
 
+static int sock_poll_add(struct fid_poll *pollset, struct fid *event_fid,
+			 uint64_t flags)
+{
+	struct sock_poll *poll;
+
+	poll = container_of(pollset, struct sock_poll, poll_fid.fid);
+	return sock_poll_set_add(&poll->pset, event_fid);
+}
+
+static int sock_poll_del(struct fid_poll *pollset, struct fid *event_fid,
+			 uint64_t flags)
+{
+	struct sock_poll *poll;
+
+	poll = container_of(pollset, struct sock_poll, poll_fid.fid);
+	sock_poll_set_del(&poll->pset, event_fid);
+	return 0;
+}
+
+static int sock_poll_poll(struct fid_poll *pollset, void **context, int count)
+{
+	struct sock_poll *poll;
+
+	poll = container_of(pollset, struct sock_poll, poll_fid.fid);
+	sock_poll_set_progress(&poll->pset);
+	return sock_poll_set_ready(&poll->pset, context, count);
+}
+
 static int sock_poll_close(fid_t fid)
 {
 	struct sock_poll *poll;
-	struct sock_fid_list *list_item;
-	struct dlist_entry *p, *head;
 
 	poll = container_of(fid, struct sock_poll, poll_fid.fid);
-
-	head = &poll->fid_list;
-	while (!dlist_empty(head)) {
-		p = head->next;
-		list_item = container_of(p, struct sock_fid_list, entry);
-		dlist_remove(p);
-		free(list_item);
-	}
+	sock_poll_set_fini(&poll->pset);
 
 	atomic_dec(&poll->domain->ref);
 	free(poll);
@@ -197,7 +406,7 @@ int sock_poll_open(struct fid_domain *domain, struct fi_poll_attr *attr,
 	if (!poll)
 		return -FI_ENOMEM;
 
-	dlist_init(&poll->fid_list);
+	sock_poll_set_init(&poll->pset);
 	poll->poll_fid.fid.fclass = FI_CLASS_POLL;
 	poll->poll_fid.fid.context = 0;
 	poll->poll_fid.fid.ops = &sock_poll_fi_ops;
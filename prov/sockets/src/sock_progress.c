@@ -41,15 +41,16 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <poll.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <inttypes.h>
@@ -61,7 +62,6 @@
 #define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_EP_DATA, __VA_ARGS__)
 #define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_DATA, __VA_ARGS__)
 
-#define PE_INDEX(_pe, _e) (_e - &_pe->pe_table[0])
 #define SOCK_GET_RX_ID(_addr, _bits) (((_bits) == 0) ? 0 : \
 		(((uint64_t)_addr) >> (64 - _bits)))
 
@@ -79,25 +79,49 @@ static inline int sock_pe_is_data_msg(int msg_id)
 	}
 }
 
-static inline ssize_t sock_pe_send_field(struct sock_pe_entry *pe_entry,
-					 void *field, size_t field_len,
-					 size_t start_offset)
+static inline void sock_pe_iov_init(struct sock_pe_iov *v)
 {
-	int ret;
-	size_t offset, data_len;
+	v->iov_cnt = 0;
+	v->offset = 0;
+	v->len = 0;
+}
 
-	if (pe_entry->done_len >= start_offset + field_len)
-		return 0;
+/*
+ * Queue the part of a field that has not been sent yet.  Fields are
+ * laid out back to back on the wire, so done_len tells us how much of
+ * each one has already gone out.
+ */
+static inline void sock_pe_iov_add(struct sock_pe_entry *pe_entry,
+				   struct sock_pe_iov *v,
+				   void *field, size_t field_len)
+{
+	size_t skip;
 
-	offset = pe_entry->done_len - start_offset;
-	data_len = field_len - offset;
-	ret = sock_comm_send(pe_entry->conn, (char *) field + offset, data_len);
+	if (field_len && pe_entry->done_len < v->offset + field_len) {
+		skip = (pe_entry->done_len > v->offset) ?
+			pe_entry->done_len - v->offset : 0;
+		v->iov[v->iov_cnt].iov_base = (char *) field + skip;
+		v->iov[v->iov_cnt].iov_len = field_len - skip;
+		v->iov_cnt++;
+		v->len += field_len - skip;
+	}
+	v->offset += field_len;
+}
+
+static inline ssize_t sock_pe_send_iov(struct sock_pe_entry *pe_entry,
+				       struct sock_pe_iov *v)
+{
+	ssize_t ret;
 
+	if (!v->len)
+		return 0;
+
+	ret = sock_comm_sendv(pe_entry->conn, v->iov, v->iov_cnt, v->len);
 	if (ret <= 0)
 		return -1;
 
 	pe_entry->done_len += ret;
-	return (ret == data_len) ? 0 : -1;
+	return (ret == v->len) ? 0 : -1;
 }
 
 static inline ssize_t sock_pe_recv_field(struct sock_pe_entry *pe_entry,
@@ -137,16 +161,29 @@ static inline void sock_pe_discard_field(struct sock_pe_entry *pe_entry)
 	}
 }
 
+/* the connection cache leaves connections with PE entries on them open */
+static void sock_pe_conn_get(struct sock_conn *conn)
+{
+	conn->pe_refs++;
+	conn->lru = ++conn->ep->pe->cmap.lru_tick;
+}
+
 static void sock_pe_release_entry(struct sock_pe *pe,
 				  struct sock_pe_entry *pe_entry)
 {
 	dlist_remove(&pe_entry->ctx_entry);
 
+	if (pe_entry->type == SOCK_PE_RX || pe_entry->pe.tx.conn_ref)
+		pe_entry->conn->pe_refs--;
+
 	if (pe_entry->conn->tx_pe_entry == pe_entry)
 		pe_entry->conn->tx_pe_entry = NULL;
 	if (pe_entry->conn->rx_pe_entry == pe_entry)
 		pe_entry->conn->rx_pe_entry = NULL;
 
+	if (pe_entry->type == SOCK_PE_RX)
+		free(pe_entry->pe.rx.atomic_res);
+
 	pe->num_free_entries++;
 	pe_entry->conn = NULL;
 
@@ -171,12 +208,61 @@ static void sock_pe_release_entry(struct sock_pe *pe,
 	SOCK_LOG_DBG("progress entry %p released\n", pe_entry);
 }
 
+static int sock_pe_grow_table(struct sock_pe *pe)
+{
+	int i, slab;
+	struct sock_pe_entry *entries;
+	struct sock_pe_scratch *scratch;
+
+	if (pe->num_entries >= pe->max_entries)
+		return -FI_ENOSPC;
+
+	entries = calloc(SOCK_PE_SLAB_ENTRIES, sizeof(*entries));
+	if (!entries)
+		return -FI_ENOMEM;
+
+	scratch = calloc(SOCK_PE_SLAB_ENTRIES, sizeof(*scratch));
+	if (!scratch) {
+		free(entries);
+		return -FI_ENOMEM;
+	}
+
+	slab = pe->num_entries / SOCK_PE_SLAB_ENTRIES;
+	pe->pe_slab[slab] = entries;
+	pe->scratch_slab[slab] = scratch;
+
+	for (i = 0; i < SOCK_PE_SLAB_ENTRIES; i++) {
+		entries[i].id = pe->num_entries + i;
+		entries[i].scratch = &scratch[i];
+		dlist_insert_tail(&entries[i].entry, &pe->free_list);
+	}
+
+	pe->num_entries += SOCK_PE_SLAB_ENTRIES;
+	pe->num_free_entries += SOCK_PE_SLAB_ENTRIES;
+	SOCK_LOG_DBG("PE table grown to %d entries\n", pe->num_entries);
+	return 0;
+}
+
+static inline struct sock_pe_entry *sock_pe_lookup_entry(struct sock_pe *pe,
+							 uint16_t id)
+{
+	if (id >= pe->num_entries)
+		return NULL;
+	return &pe->pe_slab[id / SOCK_PE_SLAB_ENTRIES][id % SOCK_PE_SLAB_ENTRIES];
+}
+
+/* free entries, counting the ones the table may still grow by */
+static inline int sock_pe_avail_entries(struct sock_pe *pe)
+{
+	return pe->num_free_entries + pe->max_entries - pe->num_entries;
+}
+
 static struct sock_pe_entry *sock_pe_acquire_entry(struct sock_pe *pe)
 {
 	struct dlist_entry *entry;
 	struct sock_pe_entry *pe_entry;
 
-	if (dlist_empty(&pe->free_list))
+	if (dlist_empty(&pe->free_list) && sock_pe_grow_table(pe))
 		return NULL;
 
 	pe->num_free_entries--;
@@ -185,7 +271,7 @@ static struct sock_pe_entry *sock_pe_acquire_entry(struct sock_pe *pe)
 	dlist_remove(&pe_entry->entry);
 	dlist_insert_tail(&pe_entry->entry, &pe->busy_list);
 	SOCK_LOG_DBG("progress entry %p acquired : %lu\n", pe_entry,
-		      PE_INDEX(pe, pe_entry));
+		      pe_entry->id);
 	return pe_entry;
 }
 
@@ -341,10 +427,123 @@ static void sock_pe_report_tx_rma_write_err(struct sock_pe_entry *pe_entry,
 				     err, -err, NULL);
 }
 
+/*
+ * Messages that arrive while a multi-recv buffer is busy are buffered.
+ * Once it is free again, have the next buffered pass look at it anew.
+ */
+static inline void sock_rx_rematch_posted(struct sock_rx_ctx *rx_ctx,
+					  struct sock_rx_entry *rx_posted)
+{
+	if (!dlist_empty(&rx_ctx->rx_buffered_list) &&
+	    rx_posted->seq < rx_ctx->rx_match_seq)
+		rx_ctx->rx_match_seq = rx_posted->seq;
+}
+
+/*
+ * A multi-recv buffer is dequeued once it runs low, but it is released
+ * only with the last of its eager receives and rendezvous pulls to
+ * finish; that completion carries FI_MULTI_RECV.  Returns 1 if the
+ * caller's completion is the one.  Called with rx_ctx->lock held.
+ */
+static int sock_rx_multi_recv_done(struct sock_rx_ctx *rx_ctx,
+				   struct sock_rx_entry *rx_posted)
+{
+	if (!rx_posted->is_exhausted &&
+	    sock_rx_avail_len(rx_posted) < rx_ctx->min_multi_recv) {
+		rx_posted->is_exhausted = 1;
+		sock_rx_dequeue_entry(rx_posted);
+	}
+	if (!rx_posted->is_exhausted)
+		sock_rx_rematch_posted(rx_ctx, rx_posted);
+	return rx_posted->is_exhausted && !rx_posted->rndv_refs;
+}
+
+/* the pull for a rendezvous receive has finished on this side */
+static void sock_pe_finish_rndv(struct sock_pe_entry *pull, int err)
+{
+	struct sock_rx_entry *rx_buffered, *rx_posted;
+	struct sock_rx_ctx *rx_ctx;
+	struct sock_pe_entry pe_entry;
+	uint64_t rem;
+
+	rx_buffered = (struct sock_rx_entry *) (uintptr_t) pull->context;
+	rx_posted = rx_buffered->rndv_posted;
+	rx_ctx = rx_buffered->rx_ctx;
+
+	memset(&pe_entry, 0, sizeof(pe_entry));
+	pe_entry.type = SOCK_PE_RX;
+	pe_entry.comp = rx_buffered->comp;
+	pe_entry.addr = rx_buffered->addr;
+	pe_entry.context = rx_posted->context;
+	pe_entry.flags = rx_buffered->flags;
+	pe_entry.tag = rx_buffered->tag;
+	pe_entry.data = rx_buffered->data;
+	pe_entry.data_len = rx_buffered->used;
+	if (pull->pe.tx.tx_op.dest_iov_len)
+		pe_entry.buf = pull->pe.tx.tx_iov[0].dst.iov.addr;
+
+	if (rx_posted->flags & FI_MULTI_RECV) {
+		fastlock_acquire(&rx_ctx->lock);
+		rx_posted->rndv_refs--;
+		if (sock_rx_multi_recv_done(rx_ctx, rx_posted))
+			pe_entry.flags |= FI_MULTI_RECV;
+		fastlock_release(&rx_ctx->lock);
+	}
+
+	rem = (rx_posted->flags & FI_DISCARD) ? 0 :
+		rx_buffered->rndv_len - rx_buffered->used;
+	if (err) {
+		if (pe_entry.comp->recv_cntr)
+			sock_cntr_err_inc(pe_entry.comp->recv_cntr);
+		if (pe_entry.comp->recv_cq)
+			sock_cq_report_error(pe_entry.comp->recv_cq, &pe_entry,
+					     rx_buffered->rndv_len, err, -err,
+					     NULL);
+	} else if (rem) {
+		SOCK_LOG_DBG("Not enough space in posted recv buffer\n");
+		sock_pe_report_rx_error(&pe_entry, rem);
+	} else if (!(rx_posted->flags & SOCK_NO_COMPLETION)) {
+		sock_pe_report_rx_completion(&pe_entry);
+	}
+
+	fastlock_acquire(&rx_ctx->lock);
+	rx_ctx->rndv_active--;
+	sock_rx_release_entry(rx_buffered);
+	if (!(rx_posted->flags & FI_MULTI_RECV) ||
+	    (pe_entry.flags & FI_MULTI_RECV)) {
+		sock_rx_release_entry(rx_posted);
+		rx_ctx->num_left++;
+	}
+	fastlock_release(&rx_ctx->lock);
+}
+
+static void sock_pe_report_tx_error(struct sock_pe_entry *pe_entry, int err)
+{
+	switch (pe_entry->msg_hdr.op_type) {
+	case SOCK_OP_WRITE:
+		sock_pe_report_tx_rma_write_err(pe_entry, err);
+		break;
+	case SOCK_OP_READ:
+		sock_pe_report_tx_rma_read_err(pe_entry, err);
+		break;
+	case SOCK_OP_RNDV_READ:
+		sock_pe_finish_rndv(pe_entry, err);
+		break;
+	default:
+		if (pe_entry->comp->send_cntr)
+			sock_cntr_err_inc(pe_entry->comp->send_cntr);
+		if (pe_entry->comp->send_cq)
+			sock_cq_report_error(pe_entry->comp->send_cq, pe_entry,
+					     0, err, -err, NULL);
+		break;
+	}
+}
+
 static void sock_pe_progress_pending_ack(struct sock_pe *pe,
 					 struct sock_pe_entry *pe_entry)
 {
-	int len, data_len, i;
+	int data_len, i;
+	struct sock_pe_iov v;
 	struct sock_conn *conn = pe_entry->conn;
 
 	if (!conn)
@@ -361,38 +560,33 @@ static void sock_pe_progress_pending_ack(struct sock_pe *pe,
 		conn->tx_pe_entry = pe_entry;
 	}
 
-	if (sock_pe_send_field(pe_entry, &pe_entry->response,
-			       sizeof(pe_entry->response), 0))
-		return;
-	len = sizeof(struct sock_msg_response);
+	sock_pe_iov_init(&v);
+	sock_pe_iov_add(pe_entry, &v, &pe_entry->response,
+			sizeof(pe_entry->response));
 
 	switch (pe_entry->response.msg_hdr.op_type) {
 	case SOCK_OP_READ_COMPLETE:
 		for (i = 0; i < pe_entry->msg_hdr.dest_iov_len; i++) {
-			if (sock_pe_send_field(
-				    pe_entry,
-				    (char *) (uintptr_t) pe_entry->pe.rx.rx_iov[i].iov.addr,
-				    pe_entry->pe.rx.rx_iov[i].iov.len, len))
-				return;
-			len += pe_entry->pe.rx.rx_iov[i].iov.len;
+			sock_pe_iov_add(pe_entry, &v,
+				(char *) (uintptr_t) pe_entry->pe.rx.rx_iov[i].iov.addr,
+				pe_entry->pe.rx.rx_iov[i].iov.len);
 		}
 		break;
 
 	case SOCK_OP_ATOMIC_COMPLETE:
-		data_len = pe_entry->total_len - len;
-		if (data_len) {
-			if (sock_pe_send_field(pe_entry,
-					       &pe_entry->pe.rx.atomic_cmp[0],
-					       data_len, len))
-				return;
-			len += data_len;
-		}
+		data_len = pe_entry->total_len - sizeof(pe_entry->response);
+		sock_pe_iov_add(pe_entry, &v, pe_entry->pe.rx.atomic_res ?
+				pe_entry->pe.rx.atomic_res :
+				&pe_entry->scratch->atomic_cmp[0], data_len);
 		break;
 
 	default:
 		break;
 	}
 
+	if (sock_pe_send_iov(pe_entry, &v))
+		return;
+
 	if (pe_entry->total_len == pe_entry->done_len && !pe_entry->rem) {
 		sock_comm_flush(pe_entry->conn);
 		if (!sock_comm_tx_done(pe_entry->conn))
@@ -400,6 +594,12 @@ static void sock_pe_progress_pending_ack(struct sock_pe *pe,
 		pe_entry->is_complete = 1;
 		pe_entry->pe.rx.pending_send = 0;
 		pe_entry->conn->tx_pe_entry = NULL;
+
+		/* the rendezvous payload is out, so the send is done */
+		if (pe_entry->pe.rx.rndv_tx) {
+			sock_pe_report_tx_completion(pe_entry->pe.rx.rndv_tx);
+			pe_entry->pe.rx.rndv_tx->is_complete = 1;
+		}
 	}
 }
 
@@ -414,14 +614,13 @@ static void sock_pe_send_response(struct sock_pe *pe,
 	response->pe_entry_id = htons(pe_entry->msg_hdr.pe_entry_id);
 	response->err = htonl(err);
 	response->msg_hdr.dest_iov_len = 0;
-	response->msg_hdr.flags = 0;
+	response->msg_hdr.flags = htonll(pe_entry->pe.rx.cma ? SOCK_CMA : 0);
 	response->msg_hdr.msg_len = sizeof(*response) + data_len;
 	response->msg_hdr.version = SOCK_WIRE_PROTO_VERSION;
 	response->msg_hdr.op_type = op_type;
 	response->msg_hdr.msg_len = htonll(response->msg_hdr.msg_len);
 	response->msg_hdr.rx_id = pe_entry->msg_hdr.rx_id;
 
-	pe->pe_atomic = NULL;
 	pe_entry->done_len = 0;
 	pe_entry->pe.rx.pending_send = 1;
 	pe_entry->conn->rx_pe_entry = NULL;
@@ -448,28 +647,60 @@ static inline int sock_pe_read_response(struct sock_pe_entry *pe_entry)
 	return 0;
 }
 
+/*
+ * Match a response to the TX entry waiting for it.  A response naming an
+ * entry that is not an outstanding request is logged and dropped along
+ * with its payload.
+ */
+static struct sock_pe_entry *sock_pe_response_entry(struct sock_pe *pe,
+						    struct sock_pe_entry *pe_entry)
+{
+	struct sock_pe_entry *waiting_entry;
+
+	waiting_entry = sock_pe_lookup_entry(pe, pe_entry->response.pe_entry_id);
+	if (waiting_entry && waiting_entry->type == SOCK_PE_TX)
+		return waiting_entry;
+
+	SOCK_LOG_ERROR("Dropping response for unknown PE entry %d\n",
+		       pe_entry->response.pe_entry_id);
+	pe_entry->is_error = 1;
+	pe_entry->rem = pe_entry->total_len - pe_entry->done_len;
+	pe_entry->done_len = pe_entry->total_len;
+	return NULL;
+}
+
 static int sock_pe_handle_ack(struct sock_pe *pe,
 			struct sock_pe_entry *pe_entry)
 {
 	struct sock_pe_entry *waiting_entry;
-	struct sock_msg_response *response;
 
 	if (sock_pe_read_response(pe_entry))
 		return 0;
 
-	response = &pe_entry->response;
-	assert(response->pe_entry_id <= SOCK_PE_MAX_ENTRIES);
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
+	waiting_entry = sock_pe_response_entry(pe, pe_entry);
+	if (!waiting_entry)
+		return 0;
 	SOCK_LOG_DBG("Received ack for PE entry %p (index: %d)\n",
-		      waiting_entry, response->pe_entry_id);
+		      waiting_entry, pe_entry->response.pe_entry_id);
 
-	assert(waiting_entry->type == SOCK_PE_TX);
 	sock_pe_report_tx_completion(waiting_entry);
 	waiting_entry->is_complete = 1;
 	pe_entry->is_complete = 1;
 	return 0;
 }
 
+static int sock_pe_handle_conn_close(struct sock_pe *pe,
+				     struct sock_pe_entry *pe_entry)
+{
+	struct sock_conn *conn = pe_entry->conn;
+
+	sock_conn_event(&conn->ep->pe->cmap, conn,
+			pe_entry->msg_hdr.op_type == SOCK_OP_CONN_CLOSE ?
+			SOCK_CONN_CLOSE_REQ : SOCK_CONN_CLOSE_NACK);
+	pe_entry->is_complete = 1;
+	return 0;
+}
+
 static int sock_pe_handle_error(struct sock_pe *pe,
 				struct sock_pe_entry *pe_entry)
 {
@@ -480,17 +711,16 @@ static int sock_pe_handle_error(struct sock_pe *pe,
 		return 0;
 
 	response = &pe_entry->response;
-	assert(response->pe_entry_id <= SOCK_PE_MAX_ENTRIES);
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
+	waiting_entry = sock_pe_response_entry(pe, pe_entry);
+	if (!waiting_entry)
+		return 0;
 	SOCK_LOG_ERROR("Received error for PE entry %p (index: %d)\n",
 		      waiting_entry, response->pe_entry_id);
 
-	assert(waiting_entry->type == SOCK_PE_TX);
-
 	switch (pe_entry->msg_hdr.op_type) {
 	case SOCK_OP_READ_ERROR:
-		sock_pe_report_tx_rma_read_err(waiting_entry,
-					       pe_entry->response.err);
+		/* a pull, an RMA read, or a rendezvous send nobody can pull */
+		sock_pe_report_tx_error(waiting_entry, pe_entry->response.err);
 		break;
 	case SOCK_OP_WRITE_ERROR:
 	case SOCK_OP_ATOMIC_ERROR:
@@ -509,23 +739,21 @@ static int sock_pe_handle_read_complete(struct sock_pe *pe,
 					struct sock_pe_entry *pe_entry)
 {
 	struct sock_pe_entry *waiting_entry;
-	struct sock_msg_response *response;
 	int len, i;
 
 	if (sock_pe_read_response(pe_entry))
 		return 0;
 
-	response = &pe_entry->response;
-	assert(response->pe_entry_id <= SOCK_PE_MAX_ENTRIES);
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
+	waiting_entry = sock_pe_response_entry(pe, pe_entry);
+	if (!waiting_entry)
+		return 0;
 	SOCK_LOG_DBG("Received read complete for PE entry %p (index: %d)\n",
-		      waiting_entry, response->pe_entry_id);
-
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
-	assert(waiting_entry->type == SOCK_PE_TX);
+		      waiting_entry, pe_entry->response.pe_entry_id);
 
+	/* with CMA the data is already in place */
 	len = sizeof(struct sock_msg_response);
-	for (i = 0; i < waiting_entry->pe.tx.tx_op.dest_iov_len; i++) {
+	for (i = 0; i < waiting_entry->pe.tx.tx_op.dest_iov_len &&
+		    !(pe_entry->msg_hdr.flags & SOCK_CMA); i++) {
 		if (sock_pe_recv_field(
 			    pe_entry,
 			    (char *) (uintptr_t) waiting_entry->pe.tx.tx_iov[i].dst.iov.addr,
@@ -534,7 +762,10 @@ static int sock_pe_handle_read_complete(struct sock_pe *pe,
 		len += waiting_entry->pe.tx.tx_iov[i].dst.iov.len;
 	}
 
-	sock_pe_report_read_completion(waiting_entry);
+	if (waiting_entry->pe.tx.tx_op.op == SOCK_OP_RNDV_READ)
+		sock_pe_finish_rndv(waiting_entry, 0);
+	else
+		sock_pe_report_read_completion(waiting_entry);
 	waiting_entry->is_complete = 1;
 	pe_entry->is_complete = 1;
 	return 0;
@@ -544,18 +775,16 @@ static int sock_pe_handle_write_complete(struct sock_pe *pe,
 					struct sock_pe_entry *pe_entry)
 {
 	struct sock_pe_entry *waiting_entry;
-	struct sock_msg_response *response;
 
 	if (sock_pe_read_response(pe_entry))
 		return 0;
 
-	response = &pe_entry->response;
-	assert(response->pe_entry_id <= SOCK_PE_MAX_ENTRIES);
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
+	waiting_entry = sock_pe_response_entry(pe, pe_entry);
+	if (!waiting_entry)
+		return 0;
 	SOCK_LOG_DBG("Received ack for PE entry %p (index: %d)\n",
-		      waiting_entry, response->pe_entry_id);
+		      waiting_entry, pe_entry->response.pe_entry_id);
 
-	assert(waiting_entry->type == SOCK_PE_TX);
 	sock_pe_report_write_completion(waiting_entry);
 	waiting_entry->is_complete = 1;
 	pe_entry->is_complete = 1;
@@ -567,20 +796,16 @@ static int sock_pe_handle_atomic_complete(struct sock_pe *pe,
 {
 	size_t datatype_sz;
 	struct sock_pe_entry *waiting_entry;
-	struct sock_msg_response *response;
 	int len, i;
 
 	if (sock_pe_read_response(pe_entry))
 		return 0;
 
-	response = &pe_entry->response;
-	assert(response->pe_entry_id <= SOCK_PE_MAX_ENTRIES);
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
+	waiting_entry = sock_pe_response_entry(pe, pe_entry);
+	if (!waiting_entry)
+		return 0;
 	SOCK_LOG_DBG("Received atomic complete for PE entry %p (index: %d)\n",
-		      waiting_entry, response->pe_entry_id);
-
-	waiting_entry = &pe->pe_table[response->pe_entry_id];
-	assert(waiting_entry->type == SOCK_PE_TX);
+		      waiting_entry, pe_entry->response.pe_entry_id);
 
 	len = sizeof(struct sock_msg_response);
 	datatype_sz = fi_datatype_size(waiting_entry->pe.tx.tx_op.atomic.datatype);
@@ -604,11 +829,43 @@ static int sock_pe_handle_atomic_complete(struct sock_pe *pe,
 	return 0;
 }
 
+/*
+ * A same-host requester appends its destination iovs to a read request
+ * so that the responder can write the data straight into them.
+ */
+static ssize_t sock_pe_cma_iov_cnt(struct sock_pe_entry *pe_entry, uint64_t len)
+{
+	uint64_t entry_len;
+
+	if (!(pe_entry->msg_hdr.flags & SOCK_CMA))
+		return 0;
+
+	entry_len = pe_entry->total_len - len;
+	if (entry_len > sizeof(pe_entry->scratch->cma_iov) ||
+	    entry_len % sizeof(union sock_iov)) {
+		SOCK_LOG_ERROR("Invalid CMA request\n");
+		return -FI_EINVAL;
+	}
+	return entry_len / sizeof(union sock_iov);
+}
+
+static void sock_pe_try_cma(struct sock_pe_entry *pe_entry, size_t cnt)
+{
+	if (!cnt || sock_shm_cma_write(pe_entry->conn, pe_entry->pe.rx.rx_iov,
+				       pe_entry->msg_hdr.dest_iov_len,
+				       pe_entry->scratch->cma_iov, cnt))
+		return;
+
+	pe_entry->pe.rx.cma = 1;
+	pe_entry->msg_hdr.dest_iov_len = 0;
+}
+
 static int sock_pe_process_rx_read(struct sock_pe *pe,
 					struct sock_rx_ctx *rx_ctx,
 					struct sock_pe_entry *pe_entry)
 {
 	int i;
+	ssize_t cma_cnt;
 	struct sock_mr *mr;
 	uint64_t len, entry_len, data_len;
 
@@ -619,6 +876,18 @@ static int sock_pe_process_rx_read(struct sock_pe *pe,
 		return 0;
 	len += entry_len;
 
+	cma_cnt = sock_pe_cma_iov_cnt(pe_entry, len);
+	if (cma_cnt < 0) {
+		pe_entry->is_error = 1;
+		pe_entry->rem = pe_entry->total_len - pe_entry->done_len;
+		sock_pe_send_response(pe, rx_ctx, pe_entry, 0,
+				      SOCK_OP_READ_ERROR, FI_EINVAL);
+		return 0;
+	}
+	if (sock_pe_recv_field(pe_entry, &pe_entry->scratch->cma_iov[0],
+			       cma_cnt * sizeof(union sock_iov), len))
+		return 0;
+
 	/* verify mr */
 	data_len = 0;
 	for (i = 0; i < pe_entry->msg_hdr.dest_iov_len && !pe_entry->mr_checked; i++) {
@@ -645,11 +914,69 @@ static int sock_pe_process_rx_read(struct sock_pe *pe,
 		data_len += pe_entry->pe.rx.rx_iov[i].iov.len;
 	}
 	pe_entry->mr_checked = 1;
+	sock_pe_try_cma(pe_entry, cma_cnt);
+
 	pe_entry->buf = pe_entry->pe.rx.rx_iov[0].iov.addr;
 	pe_entry->data_len = data_len;
 	pe_entry->flags |= (FI_RMA | FI_REMOTE_READ);
 	sock_pe_report_remote_read(rx_ctx, pe_entry);
-	sock_pe_send_response(pe, rx_ctx, pe_entry, data_len,
+	sock_pe_send_response(pe, rx_ctx, pe_entry,
+			      pe_entry->pe.rx.cma ? 0 : data_len,
+			      SOCK_OP_READ_COMPLETE, 0);
+	return 0;
+}
+
+static int sock_pe_process_rx_rndv_read(struct sock_pe *pe,
+					struct sock_rx_ctx *rx_ctx,
+					struct sock_pe_entry *pe_entry)
+{
+	int i;
+	ssize_t cma_cnt;
+	union sock_iov *req;
+	struct sock_pe_entry *tx_entry;
+	uint64_t len, rem, data_len;
+
+	len = sizeof(struct sock_msg_hdr);
+	if (sock_pe_recv_field(pe_entry, &pe_entry->pe.rx.rx_iov[0],
+			       sizeof(union sock_iov), len))
+		return 0;
+	len += sizeof(union sock_iov);
+
+	cma_cnt = sock_pe_cma_iov_cnt(pe_entry, len);
+	if (cma_cnt > 0 &&
+	    sock_pe_recv_field(pe_entry, &pe_entry->scratch->cma_iov[0],
+			       cma_cnt * sizeof(union sock_iov), len))
+		return 0;
+
+	req = &pe_entry->pe.rx.rx_iov[0];
+	tx_entry = sock_pe_lookup_entry(pe, (uint16_t) req->iov.key);
+	if (cma_cnt < 0 || !tx_entry || tx_entry->type != SOCK_PE_TX ||
+	    !tx_entry->pe.tx.rndv_wait || tx_entry->conn != pe_entry->conn ||
+	    req->iov.len > tx_entry->data_len) {
+		SOCK_LOG_ERROR("Invalid rendezvous request for entry %" PRIu64 "\n",
+			       req->iov.key);
+		pe_entry->msg_hdr.dest_iov_len = 0;
+		pe_entry->rem = pe_entry->total_len - pe_entry->done_len;
+		sock_pe_send_response(pe, rx_ctx, pe_entry, 0,
+				      SOCK_OP_READ_ERROR, FI_EINVAL);
+		return 0;
+	}
+
+	/* req aliases rx_iov[0], which is rewritten below */
+	data_len = rem = req->iov.len;
+	tx_entry->pe.tx.rndv_wait = 0;
+	for (i = 0; i < tx_entry->pe.tx.tx_op.src_iov_len && rem; i++) {
+		pe_entry->pe.rx.rx_iov[i].iov.addr =
+			tx_entry->pe.tx.tx_iov[i].src.iov.addr;
+		pe_entry->pe.rx.rx_iov[i].iov.len =
+			MIN(tx_entry->pe.tx.tx_iov[i].src.iov.len, rem);
+		rem -= pe_entry->pe.rx.rx_iov[i].iov.len;
+	}
+	pe_entry->msg_hdr.dest_iov_len = i;
+	pe_entry->pe.rx.rndv_tx = tx_entry;
+	sock_pe_try_cma(pe_entry, cma_cnt);
+	sock_pe_send_response(pe, rx_ctx, pe_entry,
+			      pe_entry->pe.rx.cma ? 0 : data_len - rem,
 			      SOCK_OP_READ_COMPLETE, 0);
 	return 0;
 }
@@ -732,401 +1059,39 @@ out:
 	return ret;
 }
 
-#define SOCK_ATOMIC_UPDATE_INT(_cmp, _src, _dst, _tmp) do {		\
-	_cmp = cmp, _dst = dst, _src = src;			        \
-	switch (op) {							\
-	case FI_MIN:							\
-		*_cmp = *_dst;						\
-		if (*_src < *_dst)					\
-			*_dst = *_src;					\
-		break;							\
-									\
-	case FI_MAX:							\
-		*_cmp = *_dst;						\
-		if (*_src > *_dst)					\
-			*_dst = *_src;					\
-		break;							\
-									\
-	case FI_SUM:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst + *_src;					\
-		break;							\
-									\
-	case FI_PROD:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst * *_src;					\
-		break;							\
-									\
-	case FI_LOR:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst || *_src;					\
-		break;							\
-									\
-	case FI_LAND:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst && *_src;					\
-		break;							\
-									\
-	case FI_BOR:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst | *_src;					\
-		break;							\
-									\
-	case FI_BAND:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst & *_src;					\
-		break;							\
-									\
-	case FI_LXOR:							\
-		*_cmp = *_dst;						\
-									\
-		*_dst = ((*_dst && !*_src) || (!*_dst && *_src));	\
-		break;							\
-									\
-	case FI_BXOR:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst ^ *_src;					\
-		break;							\
-									\
-	case FI_ATOMIC_READ:						\
-		*_cmp = *_dst;						\
-		break;							\
-									\
-	case FI_ATOMIC_WRITE:						\
-		*_cmp = *_dst;						\
-		*_dst = *_src;						\
-		break;							\
-									\
-	case FI_CSWAP:							\
-		if (*_cmp == *_dst)					\
-			*_dst = *_src;					\
-		else							\
-			*_cmp = *_dst;					\
-		break;							\
-									\
-	case FI_CSWAP_NE:						\
-		_tmp = *_dst;						\
-		if (*_cmp != *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	case FI_CSWAP_LE:						\
-		_tmp = *_dst;						\
-		if (*_cmp <= *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	case FI_CSWAP_LT:						\
-		_tmp = *_dst;						\
-		if (*_cmp < *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	case FI_CSWAP_GE:						\
-		_tmp = *_dst;						\
-		if (*_cmp >= *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	case FI_CSWAP_GT:						\
-		_tmp = *_dst;						\
-		if (*_cmp > *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	case FI_MSWAP:							\
-		_tmp = *_dst;						\
-		*_dst = (*_src & *_cmp) | (*_dst & ~(*_cmp));		\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	default:							\
-		SOCK_LOG_ERROR("Atomic operation type not supported\n"); \
-		break;							\
-	}								\
-} while (0)
-
-#define SOCK_ATOMIC_UPDATE_FLOAT(_cmp, _src, _dst) do {			\
-	_cmp = cmp, _dst = dst, _src = src;			        \
-	switch (op) {							\
-	case FI_MIN:							\
-		*_cmp = *_dst;						\
-		if (*_src < *_dst)					\
-			*_dst = *_src;					\
-		break;							\
-									\
-	case FI_MAX:							\
-		*_cmp = *_dst;						\
-		if (*_src > *_dst)					\
-			*_dst = *_src;					\
-		break;							\
-									\
-	case FI_SUM:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst + *_src;					\
-		break;							\
-									\
-	case FI_PROD:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst * *_src;					\
-		break;							\
-									\
-	case FI_LOR:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst || *_src;					\
-		break;							\
-									\
-	case FI_LAND:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst && *_src;					\
-		break;							\
-									\
-	case FI_ATOMIC_READ:						\
-		*_cmp = *_dst;						\
-		break;							\
-									\
-	case FI_ATOMIC_WRITE:						\
-		*_cmp = *_dst;						\
-		*_dst = *_src;						\
-		break;							\
-									\
-	case FI_CSWAP:							\
-		if (*_cmp == *_dst)					\
-			*_dst = *_src;					\
-		else							\
-			*_cmp = *_dst;					\
-		break;							\
-									\
-	case FI_CSWAP_NE:						\
-		_tmp = *_dst;						\
-		if (*_cmp != *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	case FI_CSWAP_LE:						\
-		_tmp = *_dst;						\
-		if (*_cmp <= *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	case FI_CSWAP_LT:						\
-		_tmp = *_dst;						\
-		if (*_cmp < *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	case FI_CSWAP_GE:						\
-		_tmp = *_dst;						\
-		if (*_cmp >= *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	case FI_CSWAP_GT:						\
-		_tmp = *_dst;						\
-		if (*_cmp > *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	default:							\
-		SOCK_LOG_ERROR("Atomic operation type not supported\n"); \
-		break;							\
-	}								\
-} while (0)
-
-#define SOCK_ATOMIC_UPDATE_COMPLEX(_cmp, _src, _dst) do {		\
-	_cmp = cmp, _dst = dst, _src = src;			        \
-	switch (op) {							\
-	case FI_SUM:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst + *_src;					\
-		break;							\
-									\
-	case FI_PROD:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst * *_src;					\
-		break;							\
-									\
-	case FI_LOR:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst || *_src;					\
-		break;							\
-									\
-	case FI_LAND:							\
-		*_cmp = *_dst;						\
-		*_dst = *_dst && *_src;					\
-		break;							\
-									\
-	case FI_ATOMIC_READ:						\
-		*_cmp = *_dst;						\
-		break;							\
-									\
-	case FI_ATOMIC_WRITE:						\
-		*_cmp = *_dst;						\
-		*_dst = *_src;						\
-		break;							\
-									\
-	case FI_CSWAP:							\
-		if (*_cmp == *_dst)					\
-			*_dst = *_src;					\
-		else							\
-			*_cmp = *_dst;					\
-		break;							\
-									\
-	case FI_CSWAP_NE:						\
-		_tmp = *_dst;						\
-		if (*_cmp != *_dst)					\
-			*_dst = *_src;					\
-		*_cmp = _tmp;						\
-		break;							\
-									\
-	default:							\
-		SOCK_LOG_ERROR("Atomic operation type not supported\n");\
-		break;							\
-	}								\
-} while (0)
-
-
-static int sock_pe_update_atomic(void *cmp, void *dst, void *src,
-				 enum fi_datatype datatype, enum fi_op op)
-{
-	switch (datatype) {
-	case FI_INT8:
-	{
-		int8_t *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_INT(_cmp, _src, _dst, _tmp);
-		break;
-	}
-
-	case FI_UINT8:
-	{
-		uint8_t *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_INT(_cmp, _src, _dst, _tmp);
-		break;
-	}
-
-	case FI_INT16:
-	{
-		int16_t *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_INT(_cmp, _src, _dst, _tmp);
-		break;
-	}
-
-	case FI_UINT16:
-	{
-		uint16_t *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_INT(_cmp, _src, _dst, _tmp);
-		break;
-	}
-
-	case FI_INT32:
-	{
-		int32_t *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_INT(_cmp, _src, _dst, _tmp);
-		break;
-	}
-
-	case FI_UINT32:
-	{
-		uint32_t *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_INT(_cmp, _src, _dst, _tmp);
-		break;
-	}
-
-	case FI_INT64:
-	{
-		int64_t *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_INT(_cmp, _src, _dst, _tmp);
-		break;
-	}
-
-	case FI_UINT64:
-	{
-		uint64_t *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_INT(_cmp, _src, _dst, _tmp);
-		break;
-	}
-
-	case FI_FLOAT:
-	{
-		float *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_FLOAT(_cmp, _src, _dst);
-		break;
-	}
-
-	case FI_DOUBLE:
-	{
-		double *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_FLOAT(_cmp, _src, _dst);
-		break;
-	}
-
-	case FI_LONG_DOUBLE:
-	{
-		long double *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_FLOAT(_cmp, _src, _dst);
-		break;
-	}
-
-	case FI_DOUBLE_COMPLEX:
-	{
-		double complex *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_COMPLEX(_cmp, _src, _dst);
-		break;
-	}
-
-	case FI_FLOAT_COMPLEX:
-	{
-		float complex *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_COMPLEX(_cmp, _src, _dst);
-		break;
-	}
+static void sock_pe_apply_atomic(struct sock_pe_entry *pe_entry,
+				 sock_atomic_fn fn, char *res, char *src,
+				 uint64_t offset, size_t len, size_t datatype_sz)
+{
+	int i;
+	size_t iov_len, seg;
 
-	case FI_LONG_DOUBLE_COMPLEX:
-	{
-		long double complex *_cmp, *_dst, *_src, _tmp;
-		_cmp = cmp, _src = src, _dst = dst;
-		SOCK_ATOMIC_UPDATE_COMPLEX(_cmp, _src, _dst);
-		break;
-	}
+	for (i = 0; i < pe_entry->pe.rx.rx_op.dest_iov_len && len; i++) {
+		iov_len = pe_entry->pe.rx.rx_iov[i].ioc.count * datatype_sz;
+		if (offset >= iov_len) {
+			offset -= iov_len;
+			continue;
+		}
 
-	default:
-		SOCK_LOG_ERROR("Atomic datatype not supported\n");
-		break;
+		seg = MIN(iov_len - offset, len);
+		fn(res, (char *) (uintptr_t) pe_entry->pe.rx.rx_iov[i].ioc.addr +
+		   offset, src, seg / datatype_sz);
+		res += seg;
+		src += seg;
+		len -= seg;
+		offset = 0;
 	}
-	return 0;
 }
 
-
 static int sock_pe_process_rx_atomic(struct sock_pe *pe,
 				struct sock_rx_ctx *rx_ctx,
 				struct sock_pe_entry *pe_entry)
 {
-	int i, j, ret = 0;
-	size_t datatype_sz;
+	int i, ret = 0;
+	size_t datatype_sz, chunk;
 	struct sock_mr *mr;
+	sock_atomic_fn fn;
+	char *res;
 	uint64_t offset, len, entry_len;
 
 
@@ -1157,9 +1122,29 @@ static int sock_pe_process_rx_atomic(struct sock_pe *pe,
 	}
 	entry_len *= datatype_sz;
 
+	/*
+	 * Operations larger than the scratch area keep their compare
+	 * operands and results in a buffer sized to the whole request.
+	 */
+	if (entry_len > SOCK_EP_MAX_ATOMIC_SZ && !pe_entry->pe.rx.atomic_res &&
+	    (pe_entry->pe.rx.rx_op.atomic.cmp_iov_len ||
+	     pe_entry->pe.rx.rx_op.atomic.res_iov_len)) {
+		pe_entry->pe.rx.atomic_res = malloc(entry_len);
+		if (!pe_entry->pe.rx.atomic_res) {
+			SOCK_LOG_ERROR("failed to allocate atomic buffer\n");
+			pe_entry->is_error = 1;
+			pe_entry->rem = pe_entry->total_len - pe_entry->done_len;
+			sock_pe_send_response(pe, rx_ctx, pe_entry, 0,
+					      SOCK_OP_ATOMIC_ERROR, FI_ENOMEM);
+			return 0;
+		}
+	}
+
 	/* cmp data */
 	if (pe_entry->pe.rx.rx_op.atomic.cmp_iov_len) {
-		if (sock_pe_recv_field(pe_entry, &pe_entry->pe.rx.atomic_cmp[0],
+		if (sock_pe_recv_field(pe_entry, pe_entry->pe.rx.atomic_res ?
+				       pe_entry->pe.rx.atomic_res :
+				       &pe_entry->scratch->atomic_cmp[0],
 				       entry_len, len))
 			return 0;
 		len += entry_len;
@@ -1187,35 +1172,46 @@ static int sock_pe_process_rx_atomic(struct sock_pe *pe,
 	}
 	pe_entry->mr_checked = 1;
 
-	/* src data */
-	if (pe_entry->pe.rx.rx_op.atomic.op != FI_ATOMIC_READ && pe_entry->pe.rx.rx_op.src_iov_len) {
-		if (sock_pe_recv_field(pe_entry, &pe_entry->pe.rx.atomic_src[0],
-				       entry_len, len))
-			return 0;
-		len += entry_len;
-	}
-
-	if (pe->pe_atomic) {
-		if (pe->pe_atomic != pe_entry)
-			return 0;
-	} else {
-		pe->pe_atomic = pe_entry;
+	fn = sock_atomic_lookup(pe_entry->pe.rx.rx_op.atomic.datatype,
+				pe_entry->pe.rx.rx_op.atomic.op);
+	if (!fn) {
+		SOCK_LOG_ERROR("Atomic operation not supported\n");
+		pe_entry->is_error = 1;
+		pe_entry->rem = pe_entry->total_len - pe_entry->done_len;
+		sock_pe_send_response(pe, rx_ctx, pe_entry, 0,
+				      SOCK_OP_ATOMIC_ERROR, FI_ENOSYS);
+		return 0;
 	}
 
-	offset = 0;
-	for (i = 0; i < pe_entry->pe.rx.rx_op.dest_iov_len; i++) {
-		for (j = 0; j < pe_entry->pe.rx.rx_iov[i].ioc.count; j++) {
-			sock_pe_update_atomic((char *) &pe_entry->pe.rx.atomic_cmp[0] + offset,
-					      (char *) (uintptr_t) pe_entry->pe.rx.rx_iov[i].ioc.addr + j * datatype_sz,
-					      (char *) &pe_entry->pe.rx.atomic_src[0] + offset,
-					      pe_entry->pe.rx.rx_op.atomic.datatype,
-					      pe_entry->pe.rx.rx_op.atomic.op);
-			offset += datatype_sz;
+	/*
+	 * src data is streamed through the scratch area and applied per
+	 * chunk.  Atomicity is per element, so the domain lock is held only
+	 * while a chunk is applied, never across a partial read.
+	 */
+	for (offset = pe_entry->pe.rx.atomic_done; offset < entry_len;
+	     offset += chunk) {
+		chunk = MIN(entry_len - offset, SOCK_EP_MAX_ATOMIC_SZ);
+		if (pe_entry->pe.rx.rx_op.atomic.op != FI_ATOMIC_READ &&
+		    pe_entry->pe.rx.rx_op.src_iov_len) {
+			if (sock_pe_recv_field(pe_entry,
+					       &pe_entry->scratch->atomic_src[0],
+					       chunk, len + offset))
+				return 0;
 		}
+
+		res = pe_entry->pe.rx.atomic_res ?
+			pe_entry->pe.rx.atomic_res + offset :
+			&pe_entry->scratch->atomic_cmp[0];
+		fastlock_acquire(&rx_ctx->domain->atomic_lock);
+		sock_pe_apply_atomic(pe_entry, fn, res,
+				     &pe_entry->scratch->atomic_src[0],
+				     offset, chunk, datatype_sz);
+		fastlock_release(&rx_ctx->domain->atomic_lock);
+		pe_entry->pe.rx.atomic_done = offset + chunk;
 	}
 
 	pe_entry->buf = pe_entry->pe.rx.rx_iov[0].iov.addr;
-	pe_entry->data_len = offset;
+	pe_entry->data_len = entry_len;
 
 	if (pe_entry->flags & FI_REMOTE_CQ_DATA) {
 		sock_pe_report_rx_completion(pe_entry);
@@ -1234,12 +1230,182 @@ static int sock_pe_process_rx_atomic(struct sock_pe *pe,
 	return ret;
 }
 
-ssize_t sock_rx_peek_recv(struct sock_rx_ctx *rx_ctx, fi_addr_t addr,
-			  uint64_t tag, uint64_t ignore, void *context,
-			  uint64_t flags, uint8_t is_tagged)
+static struct sock_tx_ctx *sock_pe_rndv_tx_ctx(struct sock_ep *ep)
 {
-	struct sock_rx_entry *rx_buffered;
-	struct sock_pe_entry pe_entry;
+	if (ep->tx_ctx)
+		return ep->tx_ctx;
+	return ep->tx_array ? ep->tx_array[0] : NULL;
+}
+
+/*
+ * Complete the receive matched to a rendezvous send that cannot be
+ * pulled with an error.  Called with rx_ctx->lock held.
+ */
+static void sock_pe_fail_rndv(struct sock_rx_ctx *rx_ctx,
+			      struct sock_rx_entry *rx_buffered)
+{
+	struct sock_rx_entry *rx_posted = rx_buffered->rndv_posted;
+	struct sock_pe_entry pe_entry;
+
+	SOCK_LOG_ERROR("Failing rendezvous receive: %s\n",
+		       fi_strerror(rx_buffered->rndv_err));
+	if (!(rx_posted->flags & SOCK_NO_COMPLETION)) {
+		memset(&pe_entry, 0, sizeof(pe_entry));
+		pe_entry.type = SOCK_PE_RX;
+		pe_entry.comp = rx_buffered->comp;
+		pe_entry.addr = rx_buffered->addr;
+		pe_entry.context = rx_posted->context;
+		pe_entry.flags = (rx_posted->flags | FI_MSG | FI_RECV) &
+				 ~FI_MULTI_RECV;
+		if (rx_buffered->is_tagged)
+			pe_entry.flags |= FI_TAGGED;
+		pe_entry.tag = rx_buffered->tag;
+		pe_entry.data = rx_buffered->data;
+		if (pe_entry.comp->recv_cntr)
+			sock_cntr_err_inc(pe_entry.comp->recv_cntr);
+		if (pe_entry.comp->recv_cq)
+			sock_cq_report_error(pe_entry.comp->recv_cq, &pe_entry,
+					     rx_buffered->rndv_len,
+					     rx_buffered->rndv_err,
+					     -rx_buffered->rndv_err, NULL);
+	}
+
+	rx_posted->is_busy = 0;
+	if (!(rx_posted->flags & FI_MULTI_RECV)) {
+		sock_rx_dequeue_entry(rx_posted);
+		sock_rx_release_entry(rx_posted);
+		rx_ctx->num_left++;
+	} else if (!rx_posted->is_exhausted) {
+		sock_rx_rematch_posted(rx_ctx, rx_posted);
+	}
+
+	dlist_remove(&rx_buffered->entry);
+	rx_ctx->rndv_pending--;
+	sock_rx_release_entry(rx_buffered);
+}
+
+/*
+ * Queue a pull of a matched rendezvous send on the receiving endpoint's
+ * TX context.  The request names the sender's PE entry; its reply lands
+ * directly in the posted buffers.  Called with rx_ctx->lock held.
+ */
+static void sock_pe_start_rndv(struct sock_rx_ctx *rx_ctx,
+			       struct sock_rx_entry *rx_buffered)
+{
+	struct sock_rx_entry *rx_posted = rx_buffered->rndv_posted;
+	union sock_iov dst_iov[SOCK_EP_MAX_IOV_LIMIT], src_iov;
+	struct sock_tx_ctx *tx_ctx;
+	struct sock_tx_cmd cmd;
+	struct sock_op tx_op;
+	size_t i, n, total_len;
+	uint64_t used, rem, len;
+
+	tx_ctx = sock_pe_rndv_tx_ctx(rx_buffered->rndv_ep);
+	if (!rx_buffered->rndv_err && (!tx_ctx || !tx_ctx->enabled))
+		rx_buffered->rndv_err = FI_EOPNOTSUPP;
+	if (rx_buffered->rndv_err) {
+		sock_pe_fail_rndv(rx_ctx, rx_buffered);
+		return;
+	}
+
+	n = 0;
+	used = rx_posted->used;
+	rem = rx_buffered->rndv_len;
+	for (i = 0; i < rx_posted->rx_op.dest_iov_len && rem > 0; i++) {
+		if (used >= rx_posted->iov[i].iov.len) {
+			used -= rx_posted->iov[i].iov.len;
+			continue;
+		}
+		len = MIN(rx_posted->iov[i].iov.len - used, rem);
+		dst_iov[n].iov.addr = rx_posted->iov[i].iov.addr + used;
+		dst_iov[n].iov.len = len;
+		dst_iov[n].iov.key = 0;
+		rem -= len;
+		used = 0;
+		n++;
+	}
+
+	src_iov.iov.addr = 0;
+	src_iov.iov.len = rx_buffered->rndv_len - rem;
+	src_iov.iov.key = rx_buffered->rndv_id;
+
+	total_len = sizeof(struct sock_op_send) +
+		(n + 1) * sizeof(union sock_iov);
+	if (sock_tx_ctx_start(tx_ctx, &cmd, total_len))
+		return;
+
+	memset(&tx_op, 0, sizeof(tx_op));
+	tx_op.op = SOCK_OP_RNDV_READ;
+	tx_op.src_iov_len = 1;
+	tx_op.dest_iov_len = n;
+	sock_tx_ctx_write_op_send(&cmd, &tx_op, 0, (uintptr_t) rx_buffered,
+			rx_buffered->addr, n ? dst_iov[0].iov.addr : 0,
+			rx_buffered->rndv_ep, rx_buffered->rndv_conn);
+	sock_tx_ctx_write(&cmd, &src_iov, sizeof(src_iov));
+	for (i = 0; i < n; i++)
+		sock_tx_ctx_write(&cmd, &dst_iov[i], sizeof(dst_iov[i]));
+	sock_tx_ctx_commit(&cmd);
+
+	rx_buffered->used = src_iov.iov.len;
+	rx_posted->used += src_iov.iov.len;
+	rx_buffered->flags |= rx_posted->flags | FI_MSG | FI_RECV;
+	if (rx_buffered->is_tagged)
+		rx_buffered->flags |= FI_TAGGED;
+	rx_buffered->flags &= ~FI_MULTI_RECV;
+
+	if (rx_posted->flags & FI_MULTI_RECV) {
+		rx_posted->rndv_refs++;
+		sock_rx_multi_recv_done(rx_ctx, rx_posted);
+	} else {
+		sock_rx_dequeue_entry(rx_posted);
+	}
+	rx_posted->is_busy = 0;
+
+	dlist_remove(&rx_buffered->entry);
+	rx_ctx->rndv_pending--;
+	rx_ctx->rndv_active++;
+}
+
+/* hand a peeked or claimed rendezvous send a receive of its own */
+static ssize_t sock_rx_claim_rndv(struct sock_rx_ctx *rx_ctx,
+				  struct sock_rx_entry *rx_buffered,
+				  void *context, uint64_t flags,
+				  const struct iovec *msg_iov, size_t iov_count)
+{
+	struct sock_rx_entry *rx_posted;
+	size_t i;
+
+	rx_posted = sock_rx_new_entry(rx_ctx);
+	if (!rx_posted)
+		return -FI_ENOMEM;
+
+	rx_posted->flags = flags;
+	rx_posted->context = (uintptr_t) context;
+	rx_posted->is_tagged = rx_buffered->is_tagged;
+	if (!(flags & FI_DISCARD)) {
+		rx_posted->rx_op.dest_iov_len = iov_count;
+		for (i = 0; i < iov_count; i++) {
+			rx_posted->iov[i].iov.addr = (uintptr_t) msg_iov[i].iov_base;
+			rx_posted->iov[i].iov.len = msg_iov[i].iov_len;
+			rx_posted->total_len += msg_iov[i].iov_len;
+		}
+	}
+
+	rx_buffered->is_claimed = 1;
+	rx_buffered->rndv_posted = rx_posted;
+	rx_ctx->rndv_pending++;
+	sock_rx_dequeue_entry(rx_buffered);
+	dlist_insert_tail(&rx_buffered->entry, &rx_ctx->rx_rndv_list);
+	return 0;
+}
+
+ssize_t sock_rx_peek_recv(struct sock_rx_ctx *rx_ctx, fi_addr_t addr,
+			  uint64_t tag, uint64_t ignore, void *context,
+			  uint64_t flags, uint8_t is_tagged)
+{
+	struct sock_rx_entry *rx_buffered;
+	struct sock_pe_entry pe_entry;
+	ssize_t ret = 0;
 
 	fastlock_acquire(&rx_ctx->lock);
 	rx_buffered = sock_rx_get_buffered_entry(rx_ctx,
@@ -1255,23 +1421,34 @@ ssize_t sock_rx_peek_recv(struct sock_rx_ctx *rx_ctx, fi_addr_t addr,
 		pe_entry.flags |= FI_TAGGED;
 
 	if (rx_buffered) {
-		pe_entry.data_len = rx_buffered->total_len;
+		pe_entry.data_len = rx_buffered->is_rndv ?
+			rx_buffered->rndv_len : rx_buffered->total_len;
 		pe_entry.tag = rx_buffered->tag;
 		rx_buffered->context = (uintptr_t)context;
 		if (flags & FI_CLAIM)
 			rx_buffered->is_claimed = 1;
 
 		if (flags & FI_DISCARD) {
-			dlist_remove(&rx_buffered->entry);
-			sock_rx_release_entry(rx_buffered);
+			if (rx_buffered->is_rndv) {
+				/* the sender still waits for its data to be pulled */
+				ret = sock_rx_claim_rndv(rx_ctx, rx_buffered, context,
+							 FI_DISCARD | SOCK_NO_COMPLETION,
+							 NULL, 0);
+				if (ret)
+					goto out;
+			} else {
+				sock_rx_dequeue_entry(rx_buffered);
+				sock_rx_release_entry(rx_buffered);
+			}
 		}
 		sock_pe_report_rx_completion(&pe_entry);
 	} else {
 		sock_cq_report_error(rx_ctx->comp.recv_cq, &pe_entry, 0,
 				     FI_ENOMSG, -FI_ENOMSG, NULL);
 	}
+out:
 	fastlock_release(&rx_ctx->lock);
-	return 0;
+	return ret;
 }
 
 ssize_t sock_rx_claim_recv(struct sock_rx_ctx *rx_ctx, void *context,
@@ -1281,26 +1458,21 @@ ssize_t sock_rx_claim_recv(struct sock_rx_ctx *rx_ctx, void *context,
 {
 	ssize_t ret = 0;
 	size_t rem = 0, i, offset, len;
-	struct dlist_entry *entry;
 	struct sock_pe_entry pe_entry;
-	struct sock_rx_entry *rx_buffered = NULL;
+	struct sock_rx_entry *rx_buffered;
 
 	fastlock_acquire(&rx_ctx->lock);
-	for (entry = rx_ctx->rx_buffered_list.next;
-	     entry != &rx_ctx->rx_buffered_list; entry = entry->next) {
-		rx_buffered = container_of(entry, struct sock_rx_entry, entry);
-		if (rx_buffered->is_claimed &&
-		    (uintptr_t)rx_buffered->context == (uintptr_t)context &&
-		    is_tagged == rx_buffered->is_tagged &&
-		    (tag & ~ignore) == (rx_buffered->tag & ~ignore))
-			break;
-		else
-			rx_buffered = NULL;
-	}
-
-	if (rx_buffered) {
+	rx_buffered = sock_rx_get_claimed_entry(rx_ctx, context, tag, ignore,
+						is_tagged);
+
+	if (rx_buffered && rx_buffered->is_rndv) {
+		if (!rx_buffered->rndv_posted)
+			ret = sock_rx_claim_rndv(rx_ctx, rx_buffered, context,
+						 flags, msg_iov, iov_count);
+	} else if (rx_buffered) {
 		memset(&pe_entry, 0, sizeof(pe_entry));
 		pe_entry.comp = &rx_ctx->comp;
+		pe_entry.addr = rx_buffered->addr;
 		pe_entry.data_len = rx_buffered->total_len;
 		pe_entry.tag = rx_buffered->tag;
 		pe_entry.context = rx_buffered->context;
@@ -1329,7 +1501,7 @@ ssize_t sock_rx_claim_recv(struct sock_rx_ctx *rx_ctx, void *context,
 			sock_pe_report_rx_completion(&pe_entry);
 		}
 
-		dlist_remove(&rx_buffered->entry);
+		sock_rx_dequeue_entry(rx_buffered);
 		sock_rx_release_entry(rx_buffered);
 	} else {
 		ret = -FI_ENOMSG;
@@ -1339,99 +1511,246 @@ ssize_t sock_rx_claim_recv(struct sock_rx_ctx *rx_ctx, void *context,
 	return ret;
 }
 
+/*
+ * Deliver a complete unexpected message to the receive it matched, which
+ * the caller has marked busy.  Returns 1 if the receive is a multi-recv
+ * buffer that can take further messages.  Called with rx_ctx->lock held.
+ */
+static int sock_pe_consume_buffered_rx(struct sock_rx_ctx *rx_ctx,
+				       struct sock_rx_entry *rx_buffered,
+				       struct sock_rx_entry *rx_posted)
+{
+	struct sock_pe_entry pe_entry;
+	size_t i, rem, offset, len, used;
+	int multi_recv;
+
+	sock_rx_dequeue_entry(rx_buffered);
+	multi_recv = (rx_posted->flags & FI_MULTI_RECV) ? 1 : 0;
+
+	if (rx_buffered->is_rndv) {
+		rx_buffered->rndv_posted = rx_posted;
+		rx_ctx->rndv_pending++;
+		dlist_insert_tail(&rx_buffered->entry, &rx_ctx->rx_rndv_list);
+		sock_pe_start_rndv(rx_ctx, rx_buffered);
+		return multi_recv && !rx_posted->is_busy &&
+			!rx_posted->is_exhausted;
+	}
+
+	SOCK_LOG_DBG("Consuming buffered entry: %p, ctx: %p\n",
+		      rx_buffered, rx_ctx);
+	SOCK_LOG_DBG("Consuming posted entry: %p, ctx: %p\n",
+		      rx_posted, rx_ctx);
+
+	memset(&pe_entry, 0, sizeof(pe_entry));
+	offset = 0;
+	rem = rx_buffered->iov[0].iov.len;
+	used = rx_posted->used;
+	for (i = 0; i < rx_posted->rx_op.dest_iov_len && rem > 0; i++) {
+		if (used >= rx_posted->iov[i].iov.len) {
+			used -= rx_posted->iov[i].iov.len;
+			continue;
+		}
+
+		len = MIN(rx_posted->iov[i].iov.len - used, rem);
+		if (!pe_entry.buf)
+			pe_entry.buf = rx_posted->iov[i].iov.addr + used;
+		memcpy((char *) (uintptr_t) rx_posted->iov[i].iov.addr + used,
+		       (char *) (uintptr_t) rx_buffered->iov[0].iov.addr + offset, len);
+		offset += len;
+		rem -= len;
+		used = 0;
+	}
+	rx_posted->used += offset;
+
+	pe_entry.data_len = rx_buffered->used;
+	pe_entry.done_len = offset;
+	pe_entry.addr = rx_buffered->addr;
+	pe_entry.data = rx_buffered->data;
+	pe_entry.tag = rx_buffered->tag;
+	pe_entry.context = (uint64_t)rx_posted->context;
+	pe_entry.pe.rx.rx_iov[0].iov.addr = rx_posted->iov[0].iov.addr;
+	pe_entry.type = SOCK_PE_RX;
+	pe_entry.comp = rx_buffered->comp;
+	pe_entry.flags = rx_posted->flags;
+	pe_entry.flags |= (FI_MSG | FI_RECV);
+	if (rx_buffered->is_tagged)
+		pe_entry.flags |= FI_TAGGED;
+	pe_entry.flags &= ~FI_MULTI_RECV;
+
+	if (multi_recv) {
+		if (sock_rx_multi_recv_done(rx_ctx, rx_posted))
+			pe_entry.flags |= FI_MULTI_RECV;
+	} else {
+		sock_rx_dequeue_entry(rx_posted);
+	}
+
+	if (rem) {
+		SOCK_LOG_DBG("Not enough space in posted recv buffer\n");
+		sock_pe_report_rx_error(&pe_entry, rem);
+	} else {
+		sock_pe_report_rx_completion(&pe_entry);
+	}
+
+	sock_rx_release_entry(rx_buffered);
+
+	if (!multi_recv || (pe_entry.flags & FI_MULTI_RECV)) {
+		sock_rx_release_entry(rx_posted);
+		rx_ctx->num_left++;
+		return 0;
+	}
+	rx_posted->is_busy = 0;
+	return !rx_posted->is_exhausted;
+}
+
+/* a buffered message just became complete; look for its receive */
+static void sock_pe_match_buffered_rx(struct sock_rx_ctx *rx_ctx,
+				      struct sock_rx_entry *rx_buffered)
+{
+	struct sock_rx_entry *rx_posted;
+
+	rx_posted = sock_rx_get_entry(rx_ctx, rx_buffered->addr,
+				      rx_buffered->tag, rx_buffered->is_tagged);
+	if (rx_posted)
+		sock_pe_consume_buffered_rx(rx_ctx, rx_buffered, rx_posted);
+}
+
+/*
+ * Arrivals look for a posted receive before they are buffered, so only
+ * receives posted since the last pass, and multi-recv buffers that were
+ * busy, can match a buffered message.  Each takes the oldest message it
+ * matches.  Called with rx_ctx->lock held.
+ */
 static int sock_pe_progress_buffered_rx(struct sock_rx_ctx *rx_ctx)
 {
 	struct dlist_entry *entry;
-	struct sock_pe_entry pe_entry;
 	struct sock_rx_entry *rx_buffered, *rx_posted;
-	size_t i, rem = 0, offset, len, used_len, dst_offset;
 
-	if (dlist_empty(&rx_ctx->rx_entry_list) ||
-	    dlist_empty(&rx_ctx->rx_buffered_list))
+	for (entry = rx_ctx->rx_rndv_list.next;
+	     entry != &rx_ctx->rx_rndv_list;) {
+		rx_buffered = container_of(entry, struct sock_rx_entry, entry);
+		entry = entry->next;
+		sock_pe_start_rndv(rx_ctx, rx_buffered);
+	}
+
+	if (rx_ctx->rx_match_seq == rx_ctx->rx_seq)
+		return 0;
+
+	if (dlist_empty(&rx_ctx->rx_buffered_list)) {
+		rx_ctx->rx_match_seq = rx_ctx->rx_seq;
 		return 0;
+	}
 
-	for (entry = rx_ctx->rx_buffered_list.next;
-	     entry != &rx_ctx->rx_buffered_list;) {
+	for (entry = rx_ctx->rx_entry_list.prev;
+	     entry != &rx_ctx->rx_entry_list; entry = entry->prev) {
+		rx_posted = container_of(entry, struct sock_rx_entry, entry);
+		if (rx_posted->seq < rx_ctx->rx_match_seq)
+			break;
+	}
 
-		rx_buffered = container_of(entry, struct sock_rx_entry, entry);
+	for (entry = entry->next; entry != &rx_ctx->rx_entry_list;) {
+		rx_posted = container_of(entry, struct sock_rx_entry, entry);
 		entry = entry->next;
 
-		if (!rx_buffered->is_complete || rx_buffered->is_claimed)
-			continue;
+		do {
+			if (rx_posted->is_busy)
+				break;
 
-		rx_posted = sock_rx_get_entry(rx_ctx, rx_buffered->addr,
-						rx_buffered->tag,
-						rx_buffered->is_tagged);
-		if (!rx_posted)
-			continue;
+			rx_buffered = sock_rx_get_buffered_entry(rx_ctx,
+						rx_posted->addr, rx_posted->tag,
+						rx_posted->ignore,
+						rx_posted->is_tagged);
+			if (!rx_buffered)
+				break;
 
-		SOCK_LOG_DBG("Consuming buffered entry: %p, ctx: %p\n",
-			      rx_buffered, rx_ctx);
-		SOCK_LOG_DBG("Consuming posted entry: %p, ctx: %p\n",
-			      rx_posted, rx_ctx);
+			rx_posted->is_busy = 1;
+		} while (sock_pe_consume_buffered_rx(rx_ctx, rx_buffered,
+						     rx_posted));
+	}
+	rx_ctx->rx_match_seq = rx_ctx->rx_seq;
+	return 0;
+}
 
-		offset = 0;
-		rem = rx_buffered->iov[0].iov.len;
-		rx_ctx->buffered_len -= rem;
-		used_len = rx_posted->used;
-		pe_entry.data_len = 0;
-		pe_entry.buf = 0L;
-		for (i = 0; i < rx_posted->rx_op.dest_iov_len && rem > 0; i++) {
-			if (used_len >= rx_posted->rx_op.dest_iov_len) {
-				used_len -= rx_posted->rx_op.dest_iov_len;
-				continue;
-			}
+/*
+ * A send above the rendezvous threshold only announces its length.  It
+ * is queued like an unexpected message without a payload, and the data
+ * is pulled once a receive matches it.
+ */
+static int sock_pe_process_rx_rts(struct sock_pe *pe,
+				  struct sock_rx_ctx *rx_ctx,
+				  struct sock_pe_entry *pe_entry, uint64_t len)
+{
+	struct sock_rx_entry *rx_entry;
+	struct sock_tx_ctx *tx_ctx;
 
-			dst_offset = used_len;
-			len = MIN(rx_posted->iov[i].iov.len, rem);
-			pe_entry.buf = rx_posted->iov[i].iov.addr + dst_offset;
-			memcpy((char *) (uintptr_t) rx_posted->iov[i].iov.addr + dst_offset,
-			       (char *) (uintptr_t) rx_buffered->iov[0].iov.addr + offset, len);
-			offset += len;
-			rem -= len;
-			dst_offset = used_len = 0;
-			rx_posted->used += len;
-			pe_entry.data_len = rx_buffered->used;
-		}
+	if (sock_pe_recv_field(pe_entry, &pe_entry->data_len,
+			       sizeof(pe_entry->data_len), len))
+		return 0;
 
-		pe_entry.done_len = offset;
-		pe_entry.data = rx_buffered->data;
-		pe_entry.tag = rx_buffered->tag;
-		pe_entry.context = (uint64_t)rx_posted->context;
-		pe_entry.pe.rx.rx_iov[0].iov.addr = rx_posted->iov[0].iov.addr;
-		pe_entry.type = SOCK_PE_RX;
-		pe_entry.comp = rx_buffered->comp;
-		pe_entry.flags = rx_posted->flags;
-		pe_entry.flags |= (FI_MSG | FI_RECV);
-		if (rx_buffered->is_tagged)
-			pe_entry.flags |= FI_TAGGED;
-		pe_entry.flags &= ~FI_MULTI_RECV;
+	fastlock_acquire(&rx_ctx->lock);
+	sock_pe_progress_buffered_rx(rx_ctx);
+	rx_entry = sock_rx_new_buffered_entry(rx_ctx, 0);
+	if (!rx_entry) {
+		fastlock_release(&rx_ctx->lock);
+		return -FI_ENOMEM;
+	}
 
-		if (rx_posted->flags & FI_MULTI_RECV) {
-			if (sock_rx_avail_len(rx_posted) < rx_ctx->min_multi_recv) {
-				pe_entry.flags |= FI_MULTI_RECV;
-				dlist_remove(&rx_posted->entry);
-			}
-		} else {
-			dlist_remove(&rx_posted->entry);
-		}
+	rx_entry->addr = pe_entry->addr;
+	rx_entry->tag = pe_entry->tag;
+	rx_entry->data = pe_entry->data;
+	rx_entry->ignore = 0;
+	rx_entry->comp = pe_entry->comp;
+	if (pe_entry->msg_hdr.flags & FI_REMOTE_CQ_DATA)
+		rx_entry->flags |= FI_REMOTE_CQ_DATA;
+	if (pe_entry->msg_hdr.op_type == SOCK_OP_TSEND)
+		rx_entry->is_tagged = 1;
 
-		if (rem) {
-			SOCK_LOG_DBG("Not enough space in posted recv buffer\n");
-			sock_pe_report_rx_error(&pe_entry, rem);
-		} else {
-			sock_pe_report_rx_completion(&pe_entry);
-		}
+	rx_entry->is_rndv = 1;
+	rx_entry->rndv_id = pe_entry->msg_hdr.pe_entry_id;
+	rx_entry->rndv_len = pe_entry->data_len;
+	rx_entry->rndv_conn = pe_entry->conn;
+	rx_entry->rndv_ep = pe_entry->ep;
+	rx_entry->is_busy = 0;
+	rx_entry->is_complete = 1;
 
-		dlist_remove(&rx_buffered->entry);
-		sock_rx_release_entry(rx_buffered);
+	/* the matching receive fails and the sender is told right away */
+	tx_ctx = sock_pe_rndv_tx_ctx(pe_entry->ep);
+	if (!tx_ctx || !tx_ctx->enabled)
+		rx_entry->rndv_err = FI_EOPNOTSUPP;
 
-		if ((!(rx_posted->flags & FI_MULTI_RECV) ||
-		     (pe_entry.flags & FI_MULTI_RECV))) {
-			sock_rx_release_entry(rx_posted);
-			rx_ctx->num_left++;
-		}
+	sock_rx_enqueue_buffered_entry(rx_ctx, rx_entry);
+	sock_pe_match_buffered_rx(rx_ctx, rx_entry);
+	fastlock_release(&rx_ctx->lock);
+
+	if (!tx_ctx || !tx_ctx->enabled) {
+		SOCK_LOG_ERROR("No TX context to pull rendezvous data\n");
+		sock_pe_send_response(pe, rx_ctx, pe_entry, 0,
+				      SOCK_OP_READ_ERROR, FI_EOPNOTSUPP);
+		return 0;
 	}
+	pe_entry->is_complete = 1;
+	return 0;
+}
+
+/*
+ * An unexpected message that does not fit under the buffered receive
+ * limit is discarded rather than left on the conn, where it would hold
+ * up everything queued behind it.  The ack goes out only once the
+ * payload is off the wire.
+ */
+static int sock_pe_drop_rx_send(struct sock_pe *pe,
+				struct sock_rx_ctx *rx_ctx,
+				struct sock_pe_entry *pe_entry)
+{
+	if (pe_entry->rem) {
+		pe_entry->rem -= sock_comm_discard(pe_entry->conn, pe_entry->rem);
+		if (pe_entry->rem)
+			return 0;
+	}
+
+	pe_entry->is_complete = 1;
+	if (pe_entry->msg_hdr.flags & FI_TRANSMIT_COMPLETE)
+		sock_pe_send_response(pe, rx_ctx, pe_entry, 0,
+				      SOCK_OP_SEND_COMPLETE, 0);
 	return 0;
 }
 
@@ -1442,6 +1761,7 @@ static int sock_pe_process_rx_send(struct sock_pe *pe,
 	ssize_t i, ret = 0;
 	struct sock_rx_entry *rx_entry;
 	uint64_t len, rem, offset, data_len, done_data, used;
+	int buffered;
 
 	offset = 0;
 	len = sizeof(struct sock_msg_hdr);
@@ -1460,6 +1780,12 @@ static int sock_pe_process_rx_send(struct sock_pe *pe,
 		len += SOCK_CQ_DATA_SIZE;
 	}
 
+	if (pe_entry->msg_hdr.flags & SOCK_RNDV)
+		return sock_pe_process_rx_rts(pe, rx_ctx, pe_entry, len);
+
+	if (pe_entry->pe.rx.dropped)
+		return sock_pe_drop_rx_send(pe, rx_ctx, pe_entry);
+
 	data_len = pe_entry->msg_hdr.msg_len - len;
 	if (pe_entry->done_len == len && !pe_entry->pe.rx.rx_entry) {
 		fastlock_acquire(&rx_ctx->lock);
@@ -1470,6 +1796,22 @@ static int sock_pe_process_rx_send(struct sock_pe *pe,
 		SOCK_LOG_DBG("Consuming posted entry: %p\n", rx_entry);
 
 		if (!rx_entry) {
+			if (!sock_rx_can_buffer(rx_ctx, data_len)) {
+				fastlock_release(&rx_ctx->lock);
+				SOCK_LOG_ERROR("Buffered recv limit reached, dropping %" PRIu64 " bytes\n",
+					       data_len);
+				pe_entry->flags = FI_MSG | FI_RECV;
+				if (pe_entry->msg_hdr.op_type == SOCK_OP_TSEND)
+					pe_entry->flags |= FI_TAGGED;
+				if (pe_entry->msg_hdr.flags & FI_REMOTE_CQ_DATA)
+					pe_entry->flags |= FI_REMOTE_CQ_DATA;
+				pe_entry->data_len = data_len;
+				sock_pe_report_rx_error(pe_entry, data_len);
+				pe_entry->pe.rx.dropped = 1;
+				pe_entry->rem = data_len;
+				return sock_pe_drop_rx_send(pe, rx_ctx, pe_entry);
+			}
+
 			SOCK_LOG_DBG("%p: No matching recv, buffering recv (len = %llu)\n",
 				      pe_entry, (long long unsigned int)data_len);
 
@@ -1490,6 +1832,7 @@ static int sock_pe_process_rx_send(struct sock_pe *pe,
 
 			if (pe_entry->msg_hdr.op_type == SOCK_OP_TSEND)
 				rx_entry->is_tagged = 1;
+			sock_rx_enqueue_buffered_entry(rx_ctx, rx_entry);
 		}
 		fastlock_release(&rx_ctx->lock);
 		pe_entry->context = rx_entry->context;
@@ -1530,6 +1873,7 @@ static int sock_pe_process_rx_send(struct sock_pe *pe,
 
 	pe_entry->is_complete = 1;
 	rx_entry->is_complete = 1;
+	buffered = rx_entry->is_buffered;
 
 	pe_entry->flags = rx_entry->flags;
 	if (pe_entry->msg_hdr.op_type == SOCK_OP_TSEND)
@@ -1541,16 +1885,20 @@ static int sock_pe_process_rx_send(struct sock_pe *pe,
 	pe_entry->flags &= ~FI_MULTI_RECV;
 
 	fastlock_acquire(&rx_ctx->lock);
-	if (rx_entry->flags & FI_MULTI_RECV) {
-		if (sock_rx_avail_len(rx_entry) < rx_ctx->min_multi_recv) {
-			pe_entry->flags |= FI_MULTI_RECV;
-			dlist_remove(&rx_entry->entry);
-		}
+	if (buffered) {
+		/* receives posted meanwhile take older messages first */
+		sock_pe_progress_buffered_rx(rx_ctx);
+		rx_entry->is_busy = 0;
+		sock_pe_match_buffered_rx(rx_ctx, rx_entry);
 	} else {
-		if (!rx_entry->is_buffered)
-			dlist_remove(&rx_entry->entry);
+		if (rx_entry->flags & FI_MULTI_RECV) {
+			if (sock_rx_multi_recv_done(rx_ctx, rx_entry))
+				pe_entry->flags |= FI_MULTI_RECV;
+		} else {
+			sock_rx_dequeue_entry(rx_entry);
+		}
+		rx_entry->is_busy = 0;
 	}
-	rx_entry->is_busy = 0;
 	fastlock_release(&rx_ctx->lock);
 
 	/* report error, if any */
@@ -1561,7 +1909,7 @@ static int sock_pe_process_rx_send(struct sock_pe *pe,
 		pe_entry->rem = pe_entry->total_len - pe_entry->done_len;
 		goto out;
 	} else {
-		if (!rx_entry->is_buffered)
+		if (!buffered)
 			sock_pe_report_rx_completion(pe_entry);
 	}
 
@@ -1571,7 +1919,7 @@ out:
 				      SOCK_OP_SEND_COMPLETE, 0);
 	}
 
-	if (!rx_entry->is_buffered &&
+	if (!buffered &&
 	    (!(rx_entry->flags & FI_MULTI_RECV) ||
 	     (pe_entry->flags & FI_MULTI_RECV))) {
 		fastlock_acquire(&rx_ctx->lock);
@@ -1606,6 +1954,9 @@ static int sock_pe_process_recv(struct sock_pe *pe, struct sock_rx_ctx *rx_ctx,
 	case SOCK_OP_READ:
 		ret = sock_pe_process_rx_read(pe, rx_ctx, pe_entry);
 		break;
+	case SOCK_OP_RNDV_READ:
+		ret = sock_pe_process_rx_rndv_read(pe, rx_ctx, pe_entry);
+		break;
 	case SOCK_OP_ATOMIC:
 		ret = sock_pe_process_rx_atomic(pe, rx_ctx, pe_entry);
 		break;
@@ -1626,6 +1977,10 @@ static int sock_pe_process_recv(struct sock_pe *pe, struct sock_rx_ctx *rx_ctx,
 	case SOCK_OP_ATOMIC_ERROR:
 		ret = sock_pe_handle_error(pe, pe_entry);
 		break;
+	case SOCK_OP_CONN_CLOSE:
+	case SOCK_OP_CONN_CLOSE_NACK:
+		ret = sock_pe_handle_conn_close(pe, pe_entry);
+		break;
 	default:
 		ret = -FI_ENOSYS;
 		SOCK_LOG_ERROR("Operation not supported\n");
@@ -1711,23 +2066,22 @@ static int sock_pe_progress_tx_atomic(struct sock_pe *pe,
 {
 	int datatype_sz;
 	union sock_iov iov[SOCK_EP_MAX_IOV_LIMIT];
-	ssize_t len, i, entry_len;
+	struct sock_pe_iov v;
+	ssize_t i, entry_len;
 
 	if (pe_entry->pe.tx.send_done)
 		return 0;
 
-	len = sizeof(struct sock_msg_hdr);
+	sock_pe_iov_init(&v);
+	sock_pe_iov_add(pe_entry, &v, &pe_entry->msg_hdr,
+			sizeof(struct sock_msg_hdr));
+
 	entry_len = sizeof(struct sock_atomic_req) - sizeof(struct sock_msg_hdr);
-	if (sock_pe_send_field(pe_entry, &pe_entry->pe.tx.tx_op, entry_len, len))
-		return 0;
-	len += entry_len;
+	sock_pe_iov_add(pe_entry, &v, &pe_entry->pe.tx.tx_op, entry_len);
 
-	if (pe_entry->flags & FI_REMOTE_CQ_DATA) {
-		if (sock_pe_send_field(pe_entry, &pe_entry->data,
-				       SOCK_CQ_DATA_SIZE, len))
-			return 0;
-		len += SOCK_CQ_DATA_SIZE;
-	}
+	if (pe_entry->flags & FI_REMOTE_CQ_DATA)
+		sock_pe_iov_add(pe_entry, &v, &pe_entry->data,
+				SOCK_CQ_DATA_SIZE);
 
 	/* dest iocs */
 	entry_len = sizeof(union sock_iov) * pe_entry->pe.tx.tx_op.dest_iov_len;
@@ -1736,44 +2090,37 @@ static int sock_pe_progress_tx_atomic(struct sock_pe *pe,
 		iov[i].ioc.count = pe_entry->pe.tx.tx_iov[i].dst.ioc.count;
 		iov[i].ioc.key = pe_entry->pe.tx.tx_iov[i].dst.ioc.key;
 	}
-
-	if (sock_pe_send_field(pe_entry, &iov[0], entry_len, len))
-		return 0;
-	len += entry_len;
+	sock_pe_iov_add(pe_entry, &v, &iov[0], entry_len);
 
 	/* cmp data */
 	datatype_sz = fi_datatype_size(pe_entry->pe.tx.tx_op.atomic.datatype);
 	for (i = 0; i < pe_entry->pe.tx.tx_op.atomic.cmp_iov_len; i++) {
-		if (sock_pe_send_field(pe_entry,
-				       (void *) (uintptr_t) pe_entry->pe.tx.tx_iov[i].cmp.ioc.addr,
-				       pe_entry->pe.tx.tx_iov[i].cmp.ioc.count *
-				       datatype_sz, len))
-			return 0;
-		len += (pe_entry->pe.tx.tx_iov[i].cmp.ioc.count * datatype_sz);
+		sock_pe_iov_add(pe_entry, &v,
+			(void *) (uintptr_t) pe_entry->pe.tx.tx_iov[i].cmp.ioc.addr,
+			pe_entry->pe.tx.tx_iov[i].cmp.ioc.count * datatype_sz);
 	}
 
 	/* data */
 	if (pe_entry->flags & FI_INJECT) {
-		if (sock_pe_send_field(pe_entry,
-				       &pe_entry->pe.tx.inject[0],
-				       pe_entry->pe.tx.tx_op.src_iov_len, len))
-			return 0;
-		len += pe_entry->pe.tx.tx_op.src_iov_len;
-	} else {
+		sock_pe_iov_add(pe_entry, &v, &pe_entry->scratch->inject[0],
+				pe_entry->pe.tx.tx_op.src_iov_len);
+	} else if (pe_entry->pe.tx.tx_op.atomic.op != FI_ATOMIC_READ) {
 		for (i = 0; i < pe_entry->pe.tx.tx_op.src_iov_len; i++) {
-			if (pe_entry->pe.tx.tx_op.atomic.op != FI_ATOMIC_READ) {
-				if (sock_pe_send_field(pe_entry,
-				    (void *) (uintptr_t) pe_entry->pe.tx.tx_iov[i].src.ioc.addr,
-				    pe_entry->pe.tx.tx_iov[i].src.ioc.count *
-				    datatype_sz, len))
-					return 0;
-			} else {
-				pe_entry->done_len += pe_entry->pe.tx.tx_iov[i].src.ioc.count * datatype_sz;
-			}
-			len += (pe_entry->pe.tx.tx_iov[i].src.ioc.count * datatype_sz);
+			sock_pe_iov_add(pe_entry, &v,
+				(void *) (uintptr_t) pe_entry->pe.tx.tx_iov[i].src.ioc.addr,
+				pe_entry->pe.tx.tx_iov[i].src.ioc.count * datatype_sz);
 		}
 	}
 
+	if (sock_pe_send_iov(pe_entry, &v))
+		return 0;
+
+	/* source data of an atomic read is accounted for but never sent */
+	if (pe_entry->done_len < pe_entry->total_len &&
+	    !(pe_entry->flags & FI_INJECT) &&
+	    pe_entry->pe.tx.tx_op.atomic.op == FI_ATOMIC_READ)
+		pe_entry->done_len = pe_entry->total_len;
+
 	sock_comm_flush(pe_entry->conn);
 	if (!sock_comm_tx_done(pe_entry->conn))
 		return 0;
@@ -1798,18 +2145,19 @@ static int sock_pe_progress_tx_write(struct sock_pe *pe,
 				     struct sock_conn *conn)
 {
 	union sock_iov dest_iov[SOCK_EP_MAX_IOV_LIMIT];
-	ssize_t len, i, dest_iov_len;
+	struct sock_pe_iov v;
+	ssize_t i, dest_iov_len;
 
 	if (pe_entry->pe.tx.send_done)
 		return 0;
 
-	len = sizeof(struct sock_msg_hdr);
-	if (pe_entry->flags & FI_REMOTE_CQ_DATA) {
-		if (sock_pe_send_field(pe_entry, &pe_entry->data,
-				       SOCK_CQ_DATA_SIZE, len))
-			return 0;
-		len += SOCK_CQ_DATA_SIZE;
-	}
+	sock_pe_iov_init(&v);
+	sock_pe_iov_add(pe_entry, &v, &pe_entry->msg_hdr,
+			sizeof(struct sock_msg_hdr));
+
+	if (pe_entry->flags & FI_REMOTE_CQ_DATA)
+		sock_pe_iov_add(pe_entry, &v, &pe_entry->data,
+				SOCK_CQ_DATA_SIZE);
 
 	/* dest iovs */
 	dest_iov_len = sizeof(union sock_iov) * pe_entry->pe.tx.tx_op.dest_iov_len;
@@ -1818,30 +2166,26 @@ static int sock_pe_progress_tx_write(struct sock_pe *pe,
 		dest_iov[i].iov.len = pe_entry->pe.tx.tx_iov[i].dst.iov.len;
 		dest_iov[i].iov.key = pe_entry->pe.tx.tx_iov[i].dst.iov.key;
 	}
-	if (sock_pe_send_field(pe_entry, &dest_iov[0], dest_iov_len, len))
-		return 0;
-	len += dest_iov_len;
+	sock_pe_iov_add(pe_entry, &v, &dest_iov[0], dest_iov_len);
 
 	/* data */
 	if (pe_entry->flags & FI_INJECT) {
-		if (sock_pe_send_field(pe_entry, &pe_entry->pe.tx.inject[0],
-				       pe_entry->pe.tx.tx_op.src_iov_len, len))
-			return 0;
-		len += pe_entry->pe.tx.tx_op.src_iov_len;
+		sock_pe_iov_add(pe_entry, &v, &pe_entry->scratch->inject[0],
+				pe_entry->pe.tx.tx_op.src_iov_len);
 		pe_entry->data_len = pe_entry->pe.tx.tx_op.src_iov_len;
 	} else {
 		pe_entry->data_len = 0;
 		for (i = 0; i < pe_entry->pe.tx.tx_op.src_iov_len; i++) {
-			if (sock_pe_send_field(
-				    pe_entry,
-				    (void *) (uintptr_t) pe_entry->pe.tx.tx_iov[i].src.iov.addr,
-				    pe_entry->pe.tx.tx_iov[i].src.iov.len, len))
-				return 0;
-			len += pe_entry->pe.tx.tx_iov[i].src.iov.len;
+			sock_pe_iov_add(pe_entry, &v,
+				(void *) (uintptr_t) pe_entry->pe.tx.tx_iov[i].src.iov.addr,
+				pe_entry->pe.tx.tx_iov[i].src.iov.len);
 			pe_entry->data_len += pe_entry->pe.tx.tx_iov[i].src.iov.len;
 		}
 	}
 
+	if (sock_pe_send_iov(pe_entry, &v))
+		return 0;
+
 	sock_comm_flush(pe_entry->conn);
 	if (!sock_comm_tx_done(pe_entry->conn))
 		return 0;
@@ -1861,12 +2205,16 @@ static int sock_pe_progress_tx_read(struct sock_pe *pe,
 				    struct sock_conn *conn)
 {
 	union sock_iov src_iov[SOCK_EP_MAX_IOV_LIMIT];
-	ssize_t len, i, src_iov_len;
+	union sock_iov dst_iov[SOCK_EP_MAX_IOV_LIMIT];
+	struct sock_pe_iov v;
+	ssize_t i, src_iov_len, dst_iov_len;
 
 	if (pe_entry->pe.tx.send_done)
 		return 0;
 
-	len = sizeof(struct sock_msg_hdr);
+	sock_pe_iov_init(&v);
+	sock_pe_iov_add(pe_entry, &v, &pe_entry->msg_hdr,
+			sizeof(struct sock_msg_hdr));
 
 	/* src iovs */
 	src_iov_len = sizeof(union sock_iov) * pe_entry->pe.tx.tx_op.src_iov_len;
@@ -1877,10 +2225,19 @@ static int sock_pe_progress_tx_read(struct sock_pe *pe,
 		src_iov[i].iov.key = pe_entry->pe.tx.tx_iov[i].src.iov.key;
 		pe_entry->data_len += pe_entry->pe.tx.tx_iov[i].src.iov.len;
 	}
+	sock_pe_iov_add(pe_entry, &v, &src_iov[0], src_iov_len);
+
+	/* dst iovs, for the responder to write into directly */
+	if (pe_entry->pe.tx.cma) {
+		dst_iov_len = sizeof(union sock_iov) *
+			pe_entry->pe.tx.tx_op.dest_iov_len;
+		for (i = 0; i < pe_entry->pe.tx.tx_op.dest_iov_len; i++)
+			dst_iov[i] = pe_entry->pe.tx.tx_iov[i].dst;
+		sock_pe_iov_add(pe_entry, &v, &dst_iov[0], dst_iov_len);
+	}
 
-	if (sock_pe_send_field(pe_entry, &src_iov[0], src_iov_len, len))
+	if (sock_pe_send_iov(pe_entry, &v))
 		return 0;
-	len += src_iov_len;
 
 	sock_comm_flush(pe_entry->conn);
 	if (!sock_comm_tx_done(pe_entry->conn))
@@ -1901,43 +2258,44 @@ static int sock_pe_progress_tx_send(struct sock_pe *pe,
 				    struct sock_pe_entry *pe_entry,
 				    struct sock_conn *conn)
 {
-	size_t len, i;
+	size_t i;
+	struct sock_pe_iov v;
+
 	if (pe_entry->pe.tx.send_done)
 		return 0;
 
-	len = sizeof(struct sock_msg_hdr);
-	if (pe_entry->pe.tx.tx_op.op == SOCK_OP_TSEND) {
-		if (sock_pe_send_field(pe_entry, &pe_entry->tag,
-				       SOCK_TAG_SIZE, len))
-			return 0;
-		len += SOCK_TAG_SIZE;
-	}
-
-	if (pe_entry->flags & FI_REMOTE_CQ_DATA) {
-		if (sock_pe_send_field(pe_entry, &pe_entry->data,
-				       SOCK_CQ_DATA_SIZE, len))
-			return 0;
-		len += SOCK_CQ_DATA_SIZE;
-	}
+	sock_pe_iov_init(&v);
+	sock_pe_iov_add(pe_entry, &v, &pe_entry->msg_hdr,
+			sizeof(struct sock_msg_hdr));
 
-	if (pe_entry->flags & FI_INJECT) {
-		if (sock_pe_send_field(pe_entry, pe_entry->pe.tx.inject,
-				       pe_entry->pe.tx.tx_op.src_iov_len, len))
-			return 0;
-		len += pe_entry->pe.tx.tx_op.src_iov_len;
+	if (pe_entry->pe.tx.tx_op.op == SOCK_OP_TSEND)
+		sock_pe_iov_add(pe_entry, &v, &pe_entry->tag, SOCK_TAG_SIZE);
+
+	if (pe_entry->flags & FI_REMOTE_CQ_DATA)
+		sock_pe_iov_add(pe_entry, &v, &pe_entry->data,
+				SOCK_CQ_DATA_SIZE);
+
+	if (pe_entry->pe.tx.rndv) {
+		/* the receiver pulls the payload once it has a buffer */
+		sock_pe_iov_add(pe_entry, &v, &pe_entry->data_len,
+				sizeof(pe_entry->data_len));
+	} else if (pe_entry->flags & FI_INJECT) {
+		sock_pe_iov_add(pe_entry, &v, pe_entry->scratch->inject,
+				pe_entry->pe.tx.tx_op.src_iov_len);
 		pe_entry->data_len = pe_entry->pe.tx.tx_op.src_iov_len;
 	} else {
 		pe_entry->data_len = 0;
 		for (i = 0; i < pe_entry->pe.tx.tx_op.src_iov_len; i++) {
-			if (sock_pe_send_field(pe_entry,
-				    (void *) (uintptr_t) pe_entry->pe.tx.tx_iov[i].src.iov.addr,
-				    pe_entry->pe.tx.tx_iov[i].src.iov.len, len))
-				return 0;
-			len += pe_entry->pe.tx.tx_iov[i].src.iov.len;
+			sock_pe_iov_add(pe_entry, &v,
+				(void *) (uintptr_t) pe_entry->pe.tx.tx_iov[i].src.iov.addr,
+				pe_entry->pe.tx.tx_iov[i].src.iov.len);
 			pe_entry->data_len += pe_entry->pe.tx.tx_iov[i].src.iov.len;
 		}
 	}
 
+	if (sock_pe_send_iov(pe_entry, &v))
+		return 0;
+
 	sock_comm_flush(pe_entry->conn);
 	if (!sock_comm_tx_done(pe_entry->conn))
 		return 0;
@@ -1952,6 +2310,11 @@ static int sock_pe_progress_tx_send(struct sock_pe *pe,
 		pe_entry->conn->tx_pe_entry = NULL;
 		SOCK_LOG_DBG("Send complete\n");
 
+		if (pe_entry->pe.tx.rndv) {
+			pe_entry->pe.tx.rndv_wait = 1;
+			return 0;
+		}
+
 		if (pe_entry->flags & FI_INJECT_COMPLETE) {
 			sock_pe_report_tx_completion(pe_entry);
 			pe_entry->is_complete = 1;
@@ -1982,19 +2345,32 @@ static int sock_pe_progress_tx_entry(struct sock_pe *pe,
 		conn->tx_pe_entry = pe_entry;
 	}
 
+	if (conn->state != SOCK_CONN_STATE_CONNECTED) {
+		ret = sock_conn_progress(&pe->cmap, conn);
+		if (ret == -FI_EAGAIN) {
+			/* a closing connection must be able to go idle */
+			if (conn->state == SOCK_CONN_STATE_CLOSING)
+				conn->tx_pe_entry = NULL;
+			return 0;
+		}
+		if (ret) {
+			sock_pe_report_tx_error(pe_entry, -ret);
+			pe_entry->is_complete = 1;
+			return 0;
+		}
+	}
+
+	if (!pe_entry->pe.tx.conn_ref) {
+		pe_entry->pe.tx.conn_ref = 1;
+		sock_pe_conn_get(conn);
+	}
+
 	if ((pe_entry->flags & FI_FENCE) &&
 	    (tx_ctx->pe_entry_list.next != &pe_entry->ctx_entry)) {
 		SOCK_LOG_DBG("Waiting for FI_FENCE\n");
 		return 0;
 	}
 
-	if (!pe_entry->pe.tx.header_sent) {
-		if (sock_pe_send_field(pe_entry, &pe_entry->msg_hdr,
-				       sizeof(struct sock_msg_hdr), 0))
-			return 0;
-		pe_entry->pe.tx.header_sent = 1;
-	}
-
 	switch (pe_entry->msg_hdr.op_type) {
 	case SOCK_OP_SEND:
 	case SOCK_OP_TSEND:
@@ -2004,6 +2380,7 @@ static int sock_pe_progress_tx_entry(struct sock_pe *pe,
 		ret = sock_pe_progress_tx_write(pe, pe_entry, conn);
 		break;
 	case SOCK_OP_READ:
+	case SOCK_OP_RNDV_READ:
 		ret = sock_pe_progress_tx_read(pe, pe_entry, conn);
 		break;
 	case SOCK_OP_ATOMIC:
@@ -2024,7 +2401,7 @@ static int sock_pe_progress_rx_pe_entry(struct sock_pe *pe,
 {
 	int ret;
 
-	if (!rbused(&pe_entry->conn->inbuf) && pe_entry->conn->disconnected)
+	if (!sock_comm_data_avail(pe_entry->conn) && pe_entry->conn->disconnected)
 		return 0;
 
 	if (pe_entry->pe.rx.pending_send) {
@@ -2059,6 +2436,273 @@ out:
 	return 0;
 }
 
+/*
+ * Datagram endpoints bypass the per-peer connection machinery: frames
+ * are self-contained, so a queued send is parked in a batch slot and
+ * completed as soon as the kernel takes it, and a received frame is
+ * matched and copied out in one pass.
+ */
+static void sock_pe_report_dgram_tx(struct sock_dgram_slot *slot)
+{
+	struct sock_pe_entry pe_entry;
+
+	pe_entry.comp = slot->comp;
+	pe_entry.addr = slot->addr;
+	pe_entry.context = slot->context;
+	pe_entry.buf = slot->buf;
+	pe_entry.data_len = slot->data_len;
+	pe_entry.data = slot->data;
+	pe_entry.tag = slot->tag;
+	pe_entry.flags = slot->flags | FI_MSG | FI_SEND;
+	if (slot->msg_hdr.op_type == SOCK_OP_TSEND)
+		pe_entry.flags |= FI_TAGGED;
+	pe_entry.msg_hdr.flags = pe_entry.flags;
+	sock_pe_report_tx_completion(&pe_entry);
+}
+
+static int sock_pe_new_tx_dgram(struct sock_tx_ctx *tx_ctx,
+				struct sock_dgram_slot *slot)
+{
+	size_t i;
+	struct sock_op op;
+	struct sock_ep *ep;
+	struct sock_conn *conn;
+	struct sock_tx_cmd cmd;
+	uint64_t msg_len;
+
+	if (!sock_tx_ctx_read_start(tx_ctx, &cmd))
+		return -FI_EAGAIN;
+
+	sock_tx_ctx_read_op_send(&cmd, &op, &slot->flags, &slot->context,
+				 &slot->addr, &slot->buf, &ep, &conn);
+	msg_len = sizeof(slot->msg_hdr);
+
+	if (op.op == SOCK_OP_TSEND) {
+		sock_tx_ctx_read(&cmd, &slot->tag, sizeof(slot->tag));
+		msg_len += SOCK_TAG_SIZE;
+	}
+
+	if (slot->flags & FI_REMOTE_CQ_DATA) {
+		sock_tx_ctx_read(&cmd, &slot->data, sizeof(slot->data));
+		msg_len += SOCK_CQ_DATA_SIZE;
+	}
+
+	if (slot->flags & FI_INJECT) {
+		sock_tx_ctx_read(&cmd, slot->inject, op.src_iov_len);
+		slot->data_len = op.src_iov_len;
+		slot->iov_cnt = 0;
+	} else {
+		slot->data_len = 0;
+		for (i = 0; i < op.src_iov_len; i++) {
+			sock_tx_ctx_read(&cmd, &slot->iov[i], sizeof(slot->iov[i]));
+			slot->data_len += slot->iov[i].iov.len;
+		}
+		slot->iov_cnt = op.src_iov_len;
+	}
+	sock_tx_ctx_read_done(&cmd);
+
+	slot->comp = (ep && tx_ctx->fclass == FI_CLASS_STX_CTX) ?
+		     &ep->comp : &tx_ctx->comp;
+	if (sock_av_get_sockaddr(tx_ctx->av, slot->addr, &slot->sin))
+		memset(&slot->sin, 0, sizeof(slot->sin));
+
+	memset(&slot->msg_hdr, 0, sizeof(slot->msg_hdr));
+	slot->msg_hdr.version = SOCK_WIRE_PROTO_VERSION;
+	slot->msg_hdr.op_type = op.op;
+	slot->msg_hdr.rx_id = (uint16_t) SOCK_GET_RX_ID(slot->addr,
+						tx_ctx->av->rx_ctx_bits);
+	slot->msg_hdr.flags = htonll(slot->flags);
+	slot->msg_hdr.msg_len = htonll(msg_len + slot->data_len);
+	return 0;
+}
+
+static int sock_pe_progress_tx_dgram(struct sock_pe *pe,
+				     struct sock_tx_ctx *tx_ctx)
+{
+	int i, ret = 0;
+	struct sock_dgram *dgram = tx_ctx->dgram;
+
+	fastlock_acquire(&dgram->tx_lock);
+	do {
+		while (dgram->tx_cnt < SOCK_DGRAM_BATCH &&
+		       !sock_pe_new_tx_dgram(tx_ctx, &dgram->tx[
+				(dgram->tx_head + dgram->tx_cnt) % SOCK_DGRAM_BATCH]))
+			dgram->tx_cnt++;
+
+		if (!dgram->tx_cnt)
+			break;
+
+		ret = sock_dgram_send_batch(dgram);
+		for (i = 0; i < ret; i++) {
+			sock_pe_report_dgram_tx(&dgram->tx[dgram->tx_head]);
+			dgram->tx_head = (dgram->tx_head + 1) % SOCK_DGRAM_BATCH;
+			dgram->tx_cnt--;
+		}
+	} while (ret > 0);
+	fastlock_release(&dgram->tx_lock);
+	return 0;
+}
+
+static struct sock_rx_ctx *sock_pe_dgram_rx_ctx(struct sock_ep *ep,
+						uint8_t rx_id)
+{
+	if (ep->fclass != FI_CLASS_SEP)
+		return ep->rx_ctx;
+	return (rx_id < ep->ep_attr.rx_ctx_cnt) ? ep->rx_array[rx_id] : NULL;
+}
+
+static void sock_pe_process_rx_dgram(struct sock_ep *ep, char *buf,
+				     size_t len, struct sockaddr_in *sin)
+{
+	struct sock_pe_entry pe_entry;
+	struct sock_rx_entry *rx_entry;
+	struct sock_rx_ctx *rx_ctx;
+	struct sock_msg_hdr msg_hdr;
+	size_t i, off, rem, used, copy_len;
+
+	if (len < sizeof(msg_hdr))
+		return;
+
+	memcpy(&msg_hdr, buf, sizeof(msg_hdr));
+	msg_hdr.flags = ntohll(msg_hdr.flags);
+	msg_hdr.msg_len = ntohll(msg_hdr.msg_len);
+	if (msg_hdr.version != SOCK_WIRE_PROTO_VERSION ||
+	    msg_hdr.msg_len != len ||
+	    (msg_hdr.op_type != SOCK_OP_SEND &&
+	     msg_hdr.op_type != SOCK_OP_TSEND)) {
+		SOCK_LOG_DBG("Dropping invalid datagram\n");
+		return;
+	}
+
+	rx_ctx = sock_pe_dgram_rx_ctx(ep, msg_hdr.rx_id);
+	if (!rx_ctx || !rx_ctx->enabled)
+		return;
+
+	off = sizeof(msg_hdr);
+	pe_entry.tag = 0;
+	pe_entry.data = 0;
+	if (msg_hdr.op_type == SOCK_OP_TSEND) {
+		if (off + SOCK_TAG_SIZE > len)
+			return;
+		memcpy(&pe_entry.tag, buf + off, SOCK_TAG_SIZE);
+		off += SOCK_TAG_SIZE;
+	}
+
+	if (msg_hdr.flags & FI_REMOTE_CQ_DATA) {
+		if (off + SOCK_CQ_DATA_SIZE > len)
+			return;
+		memcpy(&pe_entry.data, buf + off, SOCK_CQ_DATA_SIZE);
+		off += SOCK_CQ_DATA_SIZE;
+	}
+
+	pe_entry.addr = ep->av ? _sock_av_lookup(ep->av, (struct sockaddr *) sin) :
+				 FI_ADDR_NOTAVAIL;
+	pe_entry.comp = (rx_ctx->ctx.fid.fclass == FI_CLASS_SRX_CTX) ?
+			&ep->comp : &rx_ctx->comp;
+	pe_entry.data_len = len - off;
+	buf += off;
+
+	fastlock_acquire(&rx_ctx->lock);
+	sock_pe_progress_buffered_rx(rx_ctx);
+
+	rx_entry = sock_rx_get_entry(rx_ctx, pe_entry.addr, pe_entry.tag,
+				     msg_hdr.op_type == SOCK_OP_TSEND ? 1 : 0);
+	if (!rx_entry) {
+		if (!sock_rx_can_buffer(rx_ctx, pe_entry.data_len)) {
+			SOCK_LOG_DBG("Dropping unexpected datagram\n");
+			goto out;
+		}
+
+		rx_entry = sock_rx_new_buffered_entry(rx_ctx, pe_entry.data_len);
+		if (!rx_entry)
+			goto out;
+
+		memcpy((char *) (uintptr_t) rx_entry->iov[0].iov.addr, buf,
+		       pe_entry.data_len);
+		rx_entry->used = pe_entry.data_len;
+		rx_entry->addr = pe_entry.addr;
+		rx_entry->tag = pe_entry.tag;
+		rx_entry->data = pe_entry.data;
+		rx_entry->ignore = 0;
+		rx_entry->comp = pe_entry.comp;
+		if (msg_hdr.flags & FI_REMOTE_CQ_DATA)
+			rx_entry->flags |= FI_REMOTE_CQ_DATA;
+		if (msg_hdr.op_type == SOCK_OP_TSEND)
+			rx_entry->is_tagged = 1;
+		rx_entry->is_busy = 0;
+		rx_entry->is_complete = 1;
+		sock_rx_enqueue_buffered_entry(rx_ctx, rx_entry);
+		goto out;
+	}
+
+	rem = pe_entry.data_len;
+	used = rx_entry->used;
+	pe_entry.buf = 0;
+	for (i = 0; rem > 0 && i < rx_entry->rx_op.dest_iov_len; i++) {
+		if (used >= rx_entry->iov[i].iov.len) {
+			used -= rx_entry->iov[i].iov.len;
+			continue;
+		}
+
+		copy_len = MIN(rx_entry->iov[i].iov.len - used, rem);
+		memcpy((char *) (uintptr_t) rx_entry->iov[i].iov.addr + used,
+		       buf, copy_len);
+		if (!pe_entry.buf)
+			pe_entry.buf = rx_entry->iov[i].iov.addr + used;
+		buf += copy_len;
+		rem -= copy_len;
+		rx_entry->used += copy_len;
+		used = 0;
+	}
+
+	pe_entry.context = rx_entry->context;
+	pe_entry.flags = rx_entry->flags | FI_MSG | FI_RECV;
+	if (msg_hdr.op_type == SOCK_OP_TSEND)
+		pe_entry.flags |= FI_TAGGED;
+	if (msg_hdr.flags & FI_REMOTE_CQ_DATA)
+		pe_entry.flags |= FI_REMOTE_CQ_DATA;
+	pe_entry.flags &= ~FI_MULTI_RECV;
+
+	if (rx_entry->flags & FI_MULTI_RECV) {
+		if (sock_rx_multi_recv_done(rx_ctx, rx_entry))
+			pe_entry.flags |= FI_MULTI_RECV;
+	} else {
+		sock_rx_dequeue_entry(rx_entry);
+	}
+	rx_entry->is_busy = 0;
+
+	if (rem) {
+		SOCK_LOG_DBG("Not enough space in posted recv buffer\n");
+		sock_pe_report_rx_error(&pe_entry, rem);
+	} else {
+		sock_pe_report_rx_completion(&pe_entry);
+	}
+
+	if (!(rx_entry->flags & FI_MULTI_RECV) ||
+	    (pe_entry.flags & FI_MULTI_RECV)) {
+		sock_rx_release_entry(rx_entry);
+		rx_ctx->num_left++;
+	}
+out:
+	fastlock_release(&rx_ctx->lock);
+}
+
+static int sock_pe_progress_rx_dgram(struct sock_ep *ep)
+{
+	int i, ret;
+	struct sock_dgram *dgram = ep->dgram;
+
+	do {
+		ret = sock_dgram_recv_batch(dgram);
+		for (i = 0; i < ret; i++) {
+			sock_pe_process_rx_dgram(ep,
+					dgram->rx_buf + i * SOCK_DGRAM_BUF_SZ,
+					dgram->rx_len[i], &dgram->rx_addr[i]);
+		}
+	} while (ret == SOCK_DGRAM_BATCH);
+	return ret < 0 ? ret : 0;
+}
+
 static int sock_pe_new_rx_entry(struct sock_pe *pe, struct sock_rx_ctx *rx_ctx,
 				struct sock_ep *ep, struct sock_conn *conn)
 {
@@ -2075,14 +2719,18 @@ static int sock_pe_new_rx_entry(struct sock_pe *pe, struct sock_rx_ctx *rx_ctx,
 
 	pe_entry->conn = conn;
 	pe_entry->type = SOCK_PE_RX;
+	sock_pe_conn_get(conn);
 	pe_entry->ep = ep;
 	pe_entry->is_complete = 0;
 	pe_entry->done_len = 0;
 
 	if (ep->ep_type == FI_EP_MSG || !ep->av)
 		pe_entry->addr = FI_ADDR_NOTAVAIL;
-	else
+	else if (conn->ep->av == ep->av)
 		pe_entry->addr = conn->av_index;
+	else
+		pe_entry->addr = _sock_av_lookup(ep->av,
+					(struct sockaddr *) &conn->addr);
 
 	if (rx_ctx->ctx.fid.fclass == FI_CLASS_SRX_CTX)
 		pe_entry->comp = &ep->comp;
@@ -2090,7 +2738,7 @@ static int sock_pe_new_rx_entry(struct sock_pe *pe, struct sock_rx_ctx *rx_ctx,
 		pe_entry->comp = &rx_ctx->comp;
 
 	SOCK_LOG_DBG("New RX on PE entry %p (%ld)\n",
-		      pe_entry, PE_INDEX(pe, pe_entry));
+		      pe_entry, pe_entry->id);
 
 	SOCK_LOG_DBG("Inserting rx_entry to PE entry %p, conn: %p\n",
 		      pe_entry, pe_entry->conn);
@@ -2106,6 +2754,10 @@ static int sock_pe_new_tx_entry(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx)
 	struct sock_msg_hdr *msg_hdr;
 	struct sock_pe_entry *pe_entry;
 	struct sock_ep *ep;
+	struct sock_tx_cmd cmd;
+
+	if (!sock_tx_ctx_read_start(tx_ctx, &cmd))
+		return 0;
 
 	pe_entry = sock_pe_acquire_entry(pe);
 	if (!pe_entry) {
@@ -2129,16 +2781,16 @@ static int sock_pe_new_tx_entry(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx)
 	msg_hdr = &pe_entry->msg_hdr;
 	msg_hdr->msg_len = sizeof(*msg_hdr);
 
-	msg_hdr->pe_entry_id = PE_INDEX(pe, pe_entry);
+	msg_hdr->pe_entry_id = pe_entry->id;
 	SOCK_LOG_DBG("New TX on PE entry %p (%d)\n",
 		      pe_entry, msg_hdr->pe_entry_id);
 
-	sock_tx_ctx_read_op_send(tx_ctx, &pe_entry->pe.tx.tx_op,
+	sock_tx_ctx_read_op_send(&cmd, &pe_entry->pe.tx.tx_op,
 			&pe_entry->flags, &pe_entry->context, &pe_entry->addr,
 			&pe_entry->buf, &ep, &pe_entry->conn);
 
 	if (pe_entry->pe.tx.tx_op.op == SOCK_OP_TSEND) {
-		rbfdread(&tx_ctx->rbfd, &pe_entry->tag, sizeof(pe_entry->tag));
+		sock_tx_ctx_read(&cmd, &pe_entry->tag, sizeof(pe_entry->tag));
 		msg_hdr->msg_len += sizeof(pe_entry->tag);
 	}
 
@@ -2148,7 +2800,7 @@ static int sock_pe_new_tx_entry(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx)
 		pe_entry->comp = &tx_ctx->comp;
 
 	if (pe_entry->flags & FI_REMOTE_CQ_DATA) {
-		rbfdread(&tx_ctx->rbfd, &pe_entry->data, sizeof(pe_entry->data));
+		sock_tx_ctx_read(&cmd, &pe_entry->data, sizeof(pe_entry->data));
 		msg_hdr->msg_len += sizeof(pe_entry->data);
 	}
 
@@ -2157,58 +2809,77 @@ static int sock_pe_new_tx_entry(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx)
 	case SOCK_OP_SEND:
 	case SOCK_OP_TSEND:
 		if (pe_entry->flags & FI_INJECT) {
-			rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.inject[0],
+			sock_tx_ctx_read(&cmd, &pe_entry->scratch->inject[0],
 				 pe_entry->pe.tx.tx_op.src_iov_len);
 			msg_hdr->msg_len += pe_entry->pe.tx.tx_op.src_iov_len;
 		} else {
+			pe_entry->data_len = 0;
 			for (i = 0; i < pe_entry->pe.tx.tx_op.src_iov_len; i++) {
-				rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.tx_iov[i].src,
+				sock_tx_ctx_read(&cmd, &pe_entry->pe.tx.tx_iov[i].src,
 					 sizeof(pe_entry->pe.tx.tx_iov[i].src));
-				msg_hdr->msg_len += pe_entry->pe.tx.tx_iov[i].src.iov.len;
+				pe_entry->data_len += pe_entry->pe.tx.tx_iov[i].src.iov.len;
+			}
+
+			if (sock_rndv_threshold &&
+			    pe_entry->data_len >= sock_rndv_threshold) {
+				pe_entry->pe.tx.rndv = 1;
+				msg_hdr->msg_len += sizeof(pe_entry->data_len);
+			} else {
+				msg_hdr->msg_len += pe_entry->data_len;
 			}
 		}
 		break;
 	case SOCK_OP_WRITE:
 		if (pe_entry->flags & FI_INJECT) {
-			rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.inject[0],
+			sock_tx_ctx_read(&cmd, &pe_entry->scratch->inject[0],
 				 pe_entry->pe.tx.tx_op.src_iov_len);
 			msg_hdr->msg_len += pe_entry->pe.tx.tx_op.src_iov_len;
 		} else {
 			for (i = 0; i < pe_entry->pe.tx.tx_op.src_iov_len; i++) {
-				rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.tx_iov[i].src,
+				sock_tx_ctx_read(&cmd, &pe_entry->pe.tx.tx_iov[i].src,
 					 sizeof(pe_entry->pe.tx.tx_iov[i].src));
 				msg_hdr->msg_len += pe_entry->pe.tx.tx_iov[i].src.iov.len;
 			}
 		}
 
 		for (i = 0; i < pe_entry->pe.tx.tx_op.dest_iov_len; i++) {
-			rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.tx_iov[i].dst,
+			sock_tx_ctx_read(&cmd, &pe_entry->pe.tx.tx_iov[i].dst,
 				 sizeof(pe_entry->pe.tx.tx_iov[i].dst));
 		}
 		msg_hdr->msg_len += sizeof(union sock_iov) * i;
 		break;
 	case SOCK_OP_READ:
+	case SOCK_OP_RNDV_READ:
 		for (i = 0; i < pe_entry->pe.tx.tx_op.src_iov_len; i++) {
-			rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.tx_iov[i].src,
+			sock_tx_ctx_read(&cmd, &pe_entry->pe.tx.tx_iov[i].src,
 				 sizeof(pe_entry->pe.tx.tx_iov[i].src));
 		}
 		msg_hdr->msg_len += sizeof(union sock_iov) * i;
 
+		pe_entry->data_len = 0;
 		for (i = 0;  i < pe_entry->pe.tx.tx_op.dest_iov_len; i++) {
-			rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.tx_iov[i].dst,
+			sock_tx_ctx_read(&cmd, &pe_entry->pe.tx.tx_iov[i].dst,
 				 sizeof(pe_entry->pe.tx.tx_iov[i].dst));
+			pe_entry->data_len += pe_entry->pe.tx.tx_iov[i].dst.iov.len;
+		}
+
+		if (pe_entry->conn && pe_entry->conn->shm &&
+		    pe_entry->conn->shm->cma && sock_cma_threshold &&
+		    pe_entry->data_len >= sock_cma_threshold) {
+			pe_entry->pe.tx.cma = 1;
+			msg_hdr->msg_len += sizeof(union sock_iov) * i;
 		}
 		break;
 	case SOCK_OP_ATOMIC:
 		msg_hdr->msg_len += sizeof(struct sock_op);
 		datatype_sz = fi_datatype_size(pe_entry->pe.tx.tx_op.atomic.datatype);
 		if (pe_entry->flags & FI_INJECT) {
-			rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.inject[0],
+			sock_tx_ctx_read(&cmd, &pe_entry->scratch->inject[0],
 				 pe_entry->pe.tx.tx_op.src_iov_len);
 			msg_hdr->msg_len += pe_entry->pe.tx.tx_op.src_iov_len;
 		} else {
 			for (i = 0; i < pe_entry->pe.tx.tx_op.src_iov_len; i++) {
-				rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.tx_iov[i].src,
+				sock_tx_ctx_read(&cmd, &pe_entry->pe.tx.tx_iov[i].src,
 					 sizeof(pe_entry->pe.tx.tx_iov[i].src));
 				msg_hdr->msg_len += datatype_sz *
 					pe_entry->pe.tx.tx_iov[i].src.ioc.count;
@@ -2216,18 +2887,18 @@ static int sock_pe_new_tx_entry(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx)
 		}
 
 		for (i = 0; i < pe_entry->pe.tx.tx_op.dest_iov_len; i++) {
-			rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.tx_iov[i].dst,
+			sock_tx_ctx_read(&cmd, &pe_entry->pe.tx.tx_iov[i].dst,
 				 sizeof(pe_entry->pe.tx.tx_iov[i].dst));
 		}
 		msg_hdr->msg_len += sizeof(union sock_iov) * i;
 
 		for (i = 0; i < pe_entry->pe.tx.tx_op.atomic.res_iov_len; i++) {
-			rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.tx_iov[i].res,
+			sock_tx_ctx_read(&cmd, &pe_entry->pe.tx.tx_iov[i].res,
 				 sizeof(pe_entry->pe.tx.tx_iov[i].res));
 		}
 
 		for (i = 0; i < pe_entry->pe.tx.tx_op.atomic.cmp_iov_len; i++) {
-			rbfdread(&tx_ctx->rbfd, &pe_entry->pe.tx.tx_iov[i].cmp,
+			sock_tx_ctx_read(&cmd, &pe_entry->pe.tx.tx_iov[i].cmp,
 				 sizeof(pe_entry->pe.tx.tx_iov[i].cmp));
 			msg_hdr->msg_len += datatype_sz *
 				pe_entry->pe.tx.tx_iov[i].cmp.ioc.count;
@@ -2235,8 +2906,10 @@ static int sock_pe_new_tx_entry(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx)
 		break;
 	default:
 		SOCK_LOG_ERROR("Invalid operation type\n");
+		sock_tx_ctx_read_done(&cmd);
 		return -FI_EINVAL;
 	}
+	sock_tx_ctx_read_done(&cmd);
 
 	SOCK_LOG_DBG("Inserting TX-entry to PE entry %p, conn: %p\n",
 		      pe_entry, pe_entry->conn);
@@ -2254,7 +2927,12 @@ static int sock_pe_new_tx_entry(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx)
 		pe_entry->flags &= ~FI_TRANSMIT_COMPLETE;
 
 	msg_hdr->dest_iov_len = pe_entry->pe.tx.tx_op.dest_iov_len;
-	msg_hdr->flags = htonll(pe_entry->flags);
+	msg_hdr->flags = pe_entry->flags;
+	if (pe_entry->pe.tx.rndv)
+		msg_hdr->flags |= SOCK_RNDV;
+	if (pe_entry->pe.tx.cma)
+		msg_hdr->flags |= SOCK_CMA;
+	msg_hdr->flags = htonll(msg_hdr->flags);
 	pe_entry->total_len = msg_hdr->msg_len;
 	msg_hdr->msg_len = htonll(msg_hdr->msg_len);
 	msg_hdr->pe_entry_id = htons(msg_hdr->pe_entry_id);
@@ -2273,7 +2951,11 @@ void sock_pe_signal(struct sock_pe *pe)
 void sock_pe_add_tx_ctx(struct sock_pe *pe, struct sock_tx_ctx *ctx)
 {
 	pthread_mutex_lock(&pe->list_lock);
+	ctx->pe = pe;
 	dlistfd_insert_tail(&ctx->pe_entry, &pe->tx_list);
+	if (fi_epoll_add(pe->epoll_set, ctx->ring.signal.fd[FI_READ_FD],
+			 FI_EPOLL_IN, NULL))
+		SOCK_LOG_ERROR("failed to add TX ctx to PE poll set\n");
 	sock_pe_signal(pe);
 	pthread_mutex_unlock(&pe->list_lock);
 	SOCK_LOG_DBG("TX ctx added to PE\n");
@@ -2282,6 +2964,7 @@ void sock_pe_add_tx_ctx(struct sock_pe *pe, struct sock_tx_ctx *ctx)
 void sock_pe_add_rx_ctx(struct sock_pe *pe, struct sock_rx_ctx *ctx)
 {
 	pthread_mutex_lock(&pe->list_lock);
+	ctx->pe = pe;
 	dlistfd_insert_tail(&ctx->pe_entry, &pe->rx_list);
 	sock_pe_signal(pe);
 	pthread_mutex_unlock(&pe->list_lock);
@@ -2290,90 +2973,146 @@ void sock_pe_add_rx_ctx(struct sock_pe *pe, struct sock_rx_ctx *ctx)
 
 void sock_pe_remove_tx_ctx(struct sock_tx_ctx *tx_ctx)
 {
-	pthread_mutex_lock(&tx_ctx->domain->pe->list_lock);
+	if (!tx_ctx->pe)
+		return;
+
+	pthread_mutex_lock(&tx_ctx->pe->list_lock);
 	dlist_remove(&tx_ctx->pe_entry);
-	pthread_mutex_unlock(&tx_ctx->domain->pe->list_lock);
+	fi_epoll_del(tx_ctx->pe->epoll_set, tx_ctx->ring.signal.fd[FI_READ_FD]);
+	pthread_mutex_unlock(&tx_ctx->pe->list_lock);
 }
 
 void sock_pe_remove_rx_ctx(struct sock_rx_ctx *rx_ctx)
 {
-	pthread_mutex_lock(&rx_ctx->domain->pe->list_lock);
+	if (!rx_ctx->pe)
+		return;
+
+	pthread_mutex_lock(&rx_ctx->pe->list_lock);
 	dlist_remove(&rx_ctx->pe_entry);
-	pthread_mutex_unlock(&rx_ctx->domain->pe->list_lock);
+	pthread_mutex_unlock(&rx_ctx->pe->list_lock);
+}
+
+static void sock_pe_conn_set_ready(struct sock_pe *pe, struct sock_ep *ep,
+				   struct sock_conn *conn)
+{
+	if (conn->rx_ready)
+		return;
+
+	conn->rx_ready = 1;
+	dlist_insert_tail(&conn->ready_entry, &ep->ready_list);
+	pe->num_ready++;
+}
+
+static void sock_pe_conn_clear_ready(struct sock_pe *pe, struct sock_conn *conn)
+{
+	conn->rx_ready = 0;
+	dlist_remove(&conn->ready_entry);
+	pe->num_ready--;
 }
 
 static int sock_pe_progress_rx_ep(struct sock_pe *pe, struct sock_ep *ep,
 					struct sock_rx_ctx *rx_ctx)
 {
-	int ret = 0, data_avail = 0;
+	int i, n, num_fds, ret = 0;
+	ssize_t avail;
 	struct dlist_entry *entry;
 	struct sock_conn *conn;
-	fd_set rfds;
-	int max_fd = 0, nfds = 0;
-	struct timeval tv;
-	FD_ZERO(&rfds);
+	struct sock_conn_map *map;
+	void *ctxs[SOCK_EPOLL_WAIT_SZ];
 
+	map = &ep->pe->cmap;
 	fastlock_acquire(&ep->lock);
 
-	for (entry = ep->conn_list.next;
-	     entry != &ep->conn_list; entry = entry->next) {
-		conn = container_of(entry, struct sock_conn, ep_entry);
+	if (ep->dgram) {
+		ret = sock_pe_progress_rx_dgram(ep);
+		if (ret < 0)
+			goto out;
+	}
+
+	/* connections are edge-triggered: harvest every pending event */
+	do {
+		num_fds = fi_epoll_wait(ep->conn_epoll, ctxs,
+					SOCK_EPOLL_WAIT_SZ, 0);
+		if (num_fds < 0) {
+			SOCK_LOG_ERROR("failed to poll connections\n");
+			ret = num_fds;
+			goto out;
+		}
+
+		for (i = 0; i < num_fds; i++) {
+			conn = sock_conn_map_lookup_key(map,
+						(uint16_t) (uintptr_t) ctxs[i]);
+			if (conn)
+				sock_pe_conn_set_ready(pe, ep, conn);
+		}
+	} while (num_fds == SOCK_EPOLL_WAIT_SZ);
+
+	for (entry = ep->ready_list.next; entry != &ep->ready_list;) {
+		conn = container_of(entry, struct sock_conn, ready_entry);
+		entry = entry->next;
+
 		if (rbused(&conn->outbuf))
 			sock_comm_flush(conn);
 
 		if (conn->rx_pe_entry)
 			continue;
 
-		data_avail = 0;
-		if (rbused(&conn->inbuf) > 0) {
-			data_avail = 1;
-		} else {
-			FD_SET(conn->sock_fd, &rfds);
-			nfds++;
-			max_fd = MAX(conn->sock_fd, max_fd);
-			data_avail = sock_comm_data_avail(conn);
+		if (!sock_comm_data_pending(conn)) {
+			sock_pe_conn_clear_ready(pe, conn);
+			if (conn->disconnected) {
+				fi_epoll_del(ep->conn_epoll, conn->sock_fd);
+				fi_epoll_del(pe->epoll_set, conn->sock_fd);
+				sock_conn_event(map, conn, SOCK_CONN_EOF);
+			}
+			continue;
 		}
 
-		if (data_avail && !dlist_empty(&pe->free_list)) {
+		/* drain complete messages already read ahead into the inbuf */
+		for (n = 0; n < SOCK_COMM_RX_BATCH && sock_pe_avail_entries(pe);
+		     n++) {
+			avail = sock_comm_data_avail(conn);
 			ret = sock_pe_new_rx_entry(pe, rx_ctx, ep, conn);
 			if (ret < 0)
 				goto out;
-		}
-	}
 
-	if (nfds == 0)
-		goto out;
-
-	tv.tv_sec = 0;
-	tv.tv_usec = 0;
-	ret = select(max_fd + 1, &rfds, NULL, NULL, &tv);
-	if (ret < 0) {
-		SOCK_LOG_ERROR("Error in select\n");
-		goto out;
-	}
-
-	if (ret == 0)
-		goto out;
-
-	for (entry = ep->conn_list.next;
-	     entry != &ep->conn_list; entry = entry->next) {
-		conn = container_of(entry, struct sock_conn, ep_entry);
-		if (conn->rx_pe_entry)
-			continue;
-
-		if (FD_ISSET(conn->sock_fd, &rfds)) {
-			if (!dlist_empty(&pe->free_list)) {
-				/* new RX PE entry */
-				ret = sock_pe_new_rx_entry(pe, rx_ctx, ep, conn);
-				if (ret < 0)
-					goto out;
-			}
+			if (conn->rx_pe_entry ||
+			    sock_comm_data_avail(conn) == avail ||
+			    sock_comm_data_avail(conn) < sizeof(struct sock_msg_hdr))
+				break;
 		}
 	}
 
 	ret = 0;
 out:
 	fastlock_release(&ep->lock);
+	sock_conn_map_evict(map);
+	return ret;
+}
+
+/*
+ * Rendezvous pulls ride on the receiving endpoint's TX context, which an
+ * application in manual progress mode may never drive on its own.
+ */
+static int sock_pe_progress_rndv_pulls(struct sock_pe *pe,
+				       struct sock_rx_ctx *rx_ctx)
+{
+	struct sock_tx_ctx *tx_ctx;
+	struct dlist_entry *entry;
+	struct sock_ep *ep;
+	int ret = 0;
+
+	if (rx_ctx->ctx.fid.fclass != FI_CLASS_SRX_CTX) {
+		tx_ctx = sock_pe_rndv_tx_ctx(rx_ctx->ep);
+		return tx_ctx ? sock_pe_progress_tx_ctx(pe, tx_ctx) : 0;
+	}
+
+	for (entry = rx_ctx->ep_list.next;
+	     entry != &rx_ctx->ep_list && !ret; entry = entry->next) {
+		ep = container_of(entry, struct sock_ep, rx_ctx_entry);
+		tx_ctx = sock_pe_rndv_tx_ctx(ep);
+		if (tx_ctx)
+			ret = sock_pe_progress_tx_ctx(pe, tx_ctx);
+	}
 	return ret;
 }
 
@@ -2420,6 +3159,10 @@ out:
 	if (ret < 0)
 		SOCK_LOG_ERROR("failed to progress RX ctx\n");
 	fastlock_release(&pe->lock);
+
+	if (!ret && rx_ctx->rndv_active &&
+	    rx_ctx->domain->progress_mode == FI_PROGRESS_MANUAL)
+		ret = sock_pe_progress_rndv_pulls(pe, rx_ctx);
 	return ret;
 }
 
@@ -2458,11 +3201,13 @@ int sock_pe_progress_tx_ctx(struct sock_pe *pe, struct sock_tx_ctx *tx_ctx)
 	if (fastlock_acquire(&pe->lock))
 		return 0;
 
+	sock_conn_map_progress(&pe->cmap);
+
 	fastlock_acquire(&tx_ctx->rlock);
-	if (!rbfdempty(&tx_ctx->rbfd) &&
-	    pe->num_free_entries > SOCK_PE_MIN_ENTRIES) {
+	if (tx_ctx->dgram)
+		ret = sock_pe_progress_tx_dgram(pe, tx_ctx);
+	else if (sock_pe_avail_entries(pe) > SOCK_PE_MIN_ENTRIES)
 		ret = sock_pe_new_tx_entry(pe, tx_ctx);
-	}
 	fastlock_release(&tx_ctx->rlock);
 	if (ret < 0)
 		goto out;
@@ -2492,20 +3237,27 @@ out:
 	return ret;
 }
 
-static void sock_pe_poll(struct sock_pe *pe)
+/* wake up now and then to trim comm buffers and close idle connections */
+static int sock_pe_wait_timeout(struct sock_pe *pe)
+{
+	if (!pe->cmap.open_cnt)
+		return -1;
+	return sock_conn_idle_timeout ?
+		MIN(sock_conn_idle_timeout, SOCK_COMM_TRIM_INTERVAL) :
+		SOCK_COMM_TRIM_INTERVAL;
+}
+
+static int sock_pe_idle(struct sock_pe *pe)
 {
-	char tmp;
-	fd_set rfds;
-	int i, max_fds = 0;
 	struct dlist_entry *entry;
 	struct sock_tx_ctx *tx_ctx;
 	struct sock_rx_ctx *rx_ctx;
-	struct sock_conn_map *map;
-	struct sock_conn *conn;
 
-	FD_ZERO(&rfds);
 	if (dlistfd_empty(&pe->tx_list) && dlistfd_empty(&pe->rx_list))
-		goto do_wait;
+		return 1;
+
+	if (pe->num_ready || pe->cmap.connect_cnt)
+		return 0;
 
 	pthread_mutex_lock(&pe->list_lock);
 	if (!dlistfd_empty(&pe->tx_list)) {
@@ -2513,13 +3265,12 @@ static void sock_pe_poll(struct sock_pe *pe)
 		     entry != &pe->tx_list.list; entry = entry->next) {
 			tx_ctx = container_of(entry, struct sock_tx_ctx,
 						pe_entry);
-			if (!rbfdempty(&tx_ctx->rbfd) ||
-			    !dlist_empty(&tx_ctx->pe_entry_list)) {
+			if (!sock_tx_ctx_empty(tx_ctx) ||
+			    !dlist_empty(&tx_ctx->pe_entry_list) ||
+			    (tx_ctx->dgram && tx_ctx->dgram->tx_cnt)) {
 				pthread_mutex_unlock(&pe->list_lock);
-				return;
+				return 0;
 			}
-			FD_SET(tx_ctx->rbfd.fd[RB_READ_FD], &rfds);
-			max_fds = MAX(tx_ctx->rbfd.fd[RB_READ_FD], max_fds);
 		}
 	}
 
@@ -2529,61 +3280,97 @@ static void sock_pe_poll(struct sock_pe *pe)
 			rx_ctx = container_of(entry, struct sock_rx_ctx,
 						pe_entry);
 			if (!dlist_empty(&rx_ctx->rx_buffered_list) ||
+			    !dlist_empty(&rx_ctx->rx_rndv_list) ||
 			    !dlist_empty(&rx_ctx->pe_entry_list)) {
 				pthread_mutex_unlock(&pe->list_lock);
-				return;
+				return 0;
 			}
 		}
 	}
 	pthread_mutex_unlock(&pe->list_lock);
+	return 1;
+}
 
-	map = &pe->domain->r_cmap;
-	fastlock_acquire(&map->lock);
-	for (i = 0; i < map->used; i++) {
-		conn = &map->table[i];
-		if (rbused(&conn->outbuf) || rbused(&conn->inbuf)) {
-			sock_comm_flush(conn);
-			fastlock_release(&map->lock);
-			return;
-		}
+/* charge the time since the last call to one of the PE states */
+static uint64_t sock_pe_account(struct sock_pe *pe, uint64_t *counter)
+{
+	uint64_t now;
 
-		if (!conn->disconnected) {
-			FD_SET(conn->sock_fd, &rfds);
-			max_fds = MAX(conn->sock_fd, max_fds);
-		}
-	}
-	fastlock_release(&map->lock);
+	now = fi_gettime_us();
+	if (now > pe->stats_time)
+		*counter += now - pe->stats_time;
+	pe->stats_time = now;
+	return now;
+}
 
-do_wait:
-	if (!pe->waittime) {
-		pe->waittime = fi_gettime_ms();
+static void sock_pe_backoff(struct sock_pe *pe, uint64_t usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+	sock_pe_account(pe, &pe->stats.backoff);
+}
+
+/*
+ * Once the PE goes idle, spin for the domain's busy-poll budget, then
+ * sleep between idle polls for exponentially longer periods up to its
+ * backoff limit, then block until one of the PE's file descriptors is
+ * signaled. Any work found starts the next idle period from scratch.
+ * Spinning yields so that other progress threads sharing the CPU run.
+ */
+static void sock_pe_poll(struct sock_pe *pe)
+{
+	char tmp;
+	uint64_t now;
+	struct sock_domain *dom = pe->domain;
+	void *ctxs[SOCK_EPOLL_WAIT_SZ];
+
+	if (!sock_pe_idle(pe)) {
+		pe->idle_since = 0;
+		pe->backoff = 0;
+		sock_pe_account(pe, &pe->stats.busy);
 		return;
 	}
 
-	if (fi_gettime_ms() - pe->waittime < sock_pe_waittime)
+	now = sock_pe_account(pe, &pe->stats.spin);
+	if (!pe->idle_since) {
+		pe->idle_since = now;
 		return;
+	}
 
-	pe->waittime = 0;
-	FD_SET(pe->signal_fds[SOCK_SIGNAL_RD_FD], &rfds);
-	max_fds = MAX(pe->signal_fds[SOCK_SIGNAL_RD_FD], max_fds);
+	if (now - pe->idle_since < (uint64_t) dom->pe_spin_budget) {
+		sched_yield();
+		return;
+	}
 
-	if (select(max_fds + 1, &rfds, NULL, NULL, NULL) < 0) {
-		SOCK_LOG_ERROR("select failed\n");
+	if (pe->backoff < (uint64_t) dom->pe_backoff_max) {
+		pe->backoff = MIN(MAX(pe->backoff * 2, 1),
+				  (uint64_t) dom->pe_backoff_max);
+		sock_pe_backoff(pe, pe->backoff);
 		return;
 	}
 
-	if (FD_ISSET(pe->signal_fds[SOCK_SIGNAL_RD_FD], &rfds))
-		while (read(pe->signal_fds[SOCK_SIGNAL_RD_FD], &tmp, 1) == 1) {
-		}
+	pe->idle_since = 0;
+	pe->backoff = 0;
+	pe->stats.num_blocks++;
+	if (fi_epoll_wait(pe->epoll_set, ctxs, SOCK_EPOLL_WAIT_SZ,
+			  sock_pe_wait_timeout(pe)) < 0)
+		SOCK_LOG_ERROR("poll failed\n");
+	sock_pe_account(pe, &pe->stats.blocked);
+
+	while (read(pe->signal_fds[SOCK_SIGNAL_RD_FD], &tmp, 1) == 1) {
+	}
 }
 
 #ifndef __APPLE__
-static void sock_thread_set_affinity(char *s)
+static void sock_thread_set_affinity(char *s, int index, int count)
 {
 	char *saveptra = NULL, *saveptrb = NULL, *saveptrc = NULL;
 	char *a, *b, *c;
-	int j, first, last, stride;
-	cpu_set_t mycpuset;
+	int j, first, last, stride, cpu;
+	cpu_set_t mycpuset, pecpuset;
 	pthread_t mythread;
 
 	mythread = pthread_self();
@@ -2614,19 +3401,41 @@ static void sock_thread_set_affinity(char *s)
 		a =  strtok_r(NULL, ",", &saveptra);
 	}
 
+	/* with several progress threads, give each its own processor */
+	if (count > 1 && CPU_COUNT(&mycpuset) > 0) {
+		index %= CPU_COUNT(&mycpuset);
+		CPU_ZERO(&pecpuset);
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &mycpuset) && index-- == 0) {
+				CPU_SET(cpu, &pecpuset);
+				break;
+			}
+		}
+		mycpuset = pecpuset;
+	}
+
 	j = pthread_setaffinity_np(mythread, sizeof(cpu_set_t), &mycpuset);
 	if (j != 0)
 		SOCK_LOG_ERROR("pthread_setaffinity_np failed\n");
 }
 #endif
 
-static void sock_pe_set_affinity(void)
+static void sock_pe_set_affinity(struct sock_pe *pe)
 {
+#ifndef __APPLE__
+	char *str;
+#endif
+
 	if (sock_pe_affinity_str == NULL)
 		return;
 
 #ifndef __APPLE__
-	sock_thread_set_affinity(sock_pe_affinity_str);
+	/* strtok_r() modifies the string and every thread parses it */
+	str = strdup(sock_pe_affinity_str);
+	if (!str)
+		return;
+	sock_thread_set_affinity(str, pe->index, pe->domain->num_pe);
+	free(str);
 #else
 	SOCK_LOG_ERROR("*** FI_SOCKETS_PE_AFFINITY is not supported on OS X\n");
 #endif
@@ -2641,7 +3450,8 @@ static void *sock_pe_progress_thread(void *data)
 	struct sock_pe *pe = (struct sock_pe *)data;
 
 	SOCK_LOG_DBG("Progress thread started\n");
-	sock_pe_set_affinity();
+	sock_pe_set_affinity(pe);
+	pe->stats_time = fi_gettime_us();
 	while (*((volatile int *)&pe->do_progress)) {
 		if (pe->domain->progress_mode == FI_PROGRESS_AUTO)
 			sock_pe_poll(pe);
@@ -2681,25 +3491,43 @@ static void *sock_pe_progress_thread(void *data)
 	return NULL;
 }
 
-static void sock_pe_init_table(struct sock_pe *pe)
+static void sock_pe_free_table(struct sock_pe *pe)
 {
 	int i;
 
-	memset(&pe->pe_table, 0,
-	       sizeof(struct sock_pe_entry) * SOCK_PE_MAX_ENTRIES);
+	for (i = 0; i < pe->num_entries / SOCK_PE_SLAB_ENTRIES; i++) {
+		free(pe->pe_slab[i]);
+		free(pe->scratch_slab[i]);
+	}
+	free(pe->pe_slab);
+	free(pe->scratch_slab);
+}
+
+static int sock_pe_init_table(struct sock_pe *pe)
+{
+	int max_slabs;
 
 	dlist_init(&pe->free_list);
 	dlist_init(&pe->busy_list);
 
-	for (i = 0; i < SOCK_PE_MAX_ENTRIES; i++) {
-		dlist_insert_head(&pe->pe_table[i].entry, &pe->free_list);
+	max_slabs = (sock_pe_max_entries + SOCK_PE_SLAB_ENTRIES - 1) /
+		    SOCK_PE_SLAB_ENTRIES;
+	max_slabs = MAX(1, MIN(max_slabs,
+			       SOCK_PE_MAX_ENTRIES / SOCK_PE_SLAB_ENTRIES));
+	pe->max_entries = max_slabs * SOCK_PE_SLAB_ENTRIES;
+
+	pe->pe_slab = calloc(max_slabs, sizeof(*pe->pe_slab));
+	pe->scratch_slab = calloc(max_slabs, sizeof(*pe->scratch_slab));
+	if (!pe->pe_slab || !pe->scratch_slab || sock_pe_grow_table(pe)) {
+		sock_pe_free_table(pe);
+		return -FI_ENOMEM;
 	}
 
-	pe->num_free_entries = SOCK_PE_MAX_ENTRIES;
 	SOCK_LOG_DBG("PE table init: OK\n");
+	return 0;
 }
 
-struct sock_pe *sock_pe_init(struct sock_domain *domain)
+struct sock_pe *sock_pe_init(struct sock_domain *domain, int index)
 {
 	struct sock_pe *pe;
 
@@ -2707,32 +3535,56 @@ struct sock_pe *sock_pe_init(struct sock_domain *domain)
 	if (!pe)
 		return NULL;
 
-	sock_pe_init_table(pe);
+	if (sock_pe_init_table(pe)) {
+		free(pe);
+		return NULL;
+	}
+
 	dlistfd_head_init(&pe->tx_list);
 	dlistfd_head_init(&pe->rx_list);
 	fastlock_init(&pe->lock);
 	pthread_mutex_init(&pe->list_lock, NULL);
 	pe->domain = domain;
+	pe->index = index;
+
+	if (sock_conn_map_init(&pe->cmap, sock_cm_def_map_sz))
+		goto err0;
+	pe->cmap.domain = domain;
+	fastlock_init(&pe->cmap.lock);
+
+	if (fi_epoll_create(&pe->epoll_set))
+		goto err1;
 
 	if (domain->progress_mode == FI_PROGRESS_AUTO) {
 		if (socketpair(AF_UNIX, SOCK_STREAM, 0, pe->signal_fds) < 0) {
-			goto err1;
+			goto err2;
 		}
 		fd_set_nonblock(pe->signal_fds[SOCK_SIGNAL_RD_FD]);
+		if (fi_epoll_add(pe->epoll_set,
+				 pe->signal_fds[SOCK_SIGNAL_RD_FD],
+				 FI_EPOLL_IN, NULL))
+			goto err3;
+
 		pe->do_progress = 1;
 		if (pthread_create(&pe->progress_thread, NULL,
 				   sock_pe_progress_thread, (void *)pe)) {
 			SOCK_LOG_ERROR("Couldn't create progress thread\n");
-			goto err2;
+			goto err3;
 		}
 	}
 	SOCK_LOG_DBG("PE init: OK\n");
 	return pe;
 
-err2:
+err3:
 	close(pe->signal_fds[0]);
 	close(pe->signal_fds[1]);
+err2:
+	fi_epoll_close(pe->epoll_set);
 err1:
+	sock_conn_map_destroy(&pe->cmap);
+	fastlock_destroy(&pe->cmap.lock);
+err0:
+	sock_pe_free_table(pe);
 	fastlock_destroy(&pe->lock);
 	dlistfd_head_free(&pe->tx_list);
 	dlistfd_head_free(&pe->rx_list);
@@ -2740,6 +3592,23 @@ err1:
 	return NULL;
 }
 
+static void sock_pe_report(struct sock_pe *pe)
+{
+	struct fi_sockets_pe_stats *stats = &pe->stats;
+	uint64_t total;
+
+	total = stats->busy + stats->spin + stats->backoff + stats->blocked;
+	if (!total)
+		return;
+
+	FI_INFO(&sock_prov, FI_LOG_DOMAIN,
+		"domain %p progress thread %d: %.1f%% busy, %.1f%% spinning, "
+		"%.1f%% backing off, %.1f%% blocked (%" PRIu64 " blocks)\n",
+		pe->domain, pe->index, 100.0 * stats->busy / total,
+		100.0 * stats->spin / total, 100.0 * stats->backoff / total,
+		100.0 * stats->blocked / total, stats->num_blocks);
+}
+
 void sock_pe_finalize(struct sock_pe *pe)
 {
 	if (pe->domain->progress_mode == FI_PROGRESS_AUTO) {
@@ -2748,8 +3617,14 @@ void sock_pe_finalize(struct sock_pe *pe)
 		pthread_join(pe->progress_thread, NULL);
 		close(pe->signal_fds[0]);
 		close(pe->signal_fds[1]);
+		sock_pe_report(pe);
 	}
 
+	fi_epoll_close(pe->epoll_set);
+	if (pe->cmap.size)
+		sock_conn_map_destroy(&pe->cmap);
+	fastlock_destroy(&pe->cmap.lock);
+	sock_pe_free_table(pe);
 	fastlock_destroy(&pe->lock);
 	pthread_mutex_destroy(&pe->list_lock);
 	dlistfd_head_free(&pe->tx_list);
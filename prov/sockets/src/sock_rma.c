@@ -67,6 +67,7 @@ ssize_t sock_ep_rma_readmsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 	union sock_iov tx_iov;
 	struct sock_conn *conn;
 	struct sock_tx_ctx *tx_ctx;
+	struct sock_tx_cmd cmd;
 	uint64_t total_len, src_len, dst_len;
 	struct sock_ep *sock_ep;
 
@@ -127,18 +128,16 @@ ssize_t sock_ep_rma_readmsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 		(msg->iov_count * sizeof(union sock_iov)) +
 		(msg->rma_iov_count * sizeof(union sock_iov));
 
-	sock_tx_ctx_start(tx_ctx);
-	if (rbfdavail(&tx_ctx->rbfd) < total_len) {
-		ret = -FI_EAGAIN;
-		goto err;
-	}
+	ret = sock_tx_ctx_start(tx_ctx, &cmd, total_len);
+	if (ret)
+		return ret;
 
 	memset(&tx_op, 0, sizeof(struct sock_op));
 	tx_op.op = SOCK_OP_READ;
 	tx_op.src_iov_len = msg->rma_iov_count;
 	tx_op.dest_iov_len = msg->iov_count;
 
-	sock_tx_ctx_write_op_send(tx_ctx, &tx_op, flags,
+	sock_tx_ctx_write_op_send(&cmd, &tx_op, flags,
 			(uintptr_t) msg->context, msg->addr,
 			(uintptr_t) msg->msg_iov[0].iov_base,
 			sock_ep, conn);
@@ -148,7 +147,7 @@ ssize_t sock_ep_rma_readmsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 		tx_iov.iov.addr = msg->rma_iov[i].addr;
 		tx_iov.iov.key = msg->rma_iov[i].key;
 		tx_iov.iov.len = msg->rma_iov[i].len;
-		sock_tx_ctx_write(tx_ctx, &tx_iov, sizeof(tx_iov));
+		sock_tx_ctx_write(&cmd, &tx_iov, sizeof(tx_iov));
 		src_len += tx_iov.iov.len;
 	}
 
@@ -156,7 +155,7 @@ ssize_t sock_ep_rma_readmsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 	for (i = 0; i < msg->iov_count; i++) {
 		tx_iov.iov.addr = (uintptr_t) msg->msg_iov[i].iov_base;
 		tx_iov.iov.len = msg->msg_iov[i].iov_len;
-		sock_tx_ctx_write(tx_ctx, &tx_iov, sizeof(tx_iov));
+		sock_tx_ctx_write(&cmd, &tx_iov, sizeof(tx_iov));
 		dst_len += tx_iov.iov.len;
 	}
 
@@ -168,11 +167,11 @@ ssize_t sock_ep_rma_readmsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 	}
 #endif
 
-	sock_tx_ctx_commit(tx_ctx);
+	sock_tx_ctx_commit(&cmd);
 	return 0;
 
 err:
-	sock_tx_ctx_abort(tx_ctx);
+	sock_tx_ctx_abort(&cmd);
 	return ret;
 }
 
@@ -240,6 +239,7 @@ ssize_t sock_ep_rma_writemsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 	union sock_iov tx_iov;
 	struct sock_conn *conn;
 	struct sock_tx_ctx *tx_ctx;
+	struct sock_tx_cmd cmd;
 	uint64_t total_len, src_len, dst_len;
 	struct sock_ep *sock_ep;
 
@@ -317,23 +317,24 @@ ssize_t sock_ep_rma_writemsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 	total_len += (sizeof(struct sock_op_send) +
 		      (msg->rma_iov_count * sizeof(union sock_iov)));
 
-	sock_tx_ctx_start(tx_ctx);
-	if (rbfdavail(&tx_ctx->rbfd) < total_len) {
-		ret = -FI_EAGAIN;
-		goto err;
-	}
+	if (flags & FI_REMOTE_CQ_DATA)
+		total_len += sizeof(uint64_t);
+
+	ret = sock_tx_ctx_start(tx_ctx, &cmd, total_len);
+	if (ret)
+		return ret;
 
-	sock_tx_ctx_write_op_send(tx_ctx, &tx_op, flags,
+	sock_tx_ctx_write_op_send(&cmd, &tx_op, flags,
 			(uintptr_t) msg->context, msg->addr,
 			(uintptr_t) msg->msg_iov[0].iov_base, sock_ep, conn);
 
 	if (flags & FI_REMOTE_CQ_DATA)
-		sock_tx_ctx_write(tx_ctx, &msg->data, sizeof(msg->data));
+		sock_tx_ctx_write(&cmd, &msg->data, sizeof(msg->data));
 
 	src_len = 0;
 	if (flags & FI_INJECT) {
 		for (i = 0; i < msg->iov_count; i++) {
-			sock_tx_ctx_write(tx_ctx, msg->msg_iov[i].iov_base,
+			sock_tx_ctx_write(&cmd, msg->msg_iov[i].iov_base,
 					  msg->msg_iov[i].iov_len);
 			src_len += msg->msg_iov[i].iov_len;
 		}
@@ -341,7 +342,7 @@ ssize_t sock_ep_rma_writemsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 		for (i = 0; i < msg->iov_count; i++) {
 			tx_iov.iov.addr = (uintptr_t) msg->msg_iov[i].iov_base;
 			tx_iov.iov.len = msg->msg_iov[i].iov_len;
-			sock_tx_ctx_write(tx_ctx, &tx_iov, sizeof(tx_iov));
+			sock_tx_ctx_write(&cmd, &tx_iov, sizeof(tx_iov));
 			src_len += tx_iov.iov.len;
 		}
 	}
@@ -351,7 +352,7 @@ ssize_t sock_ep_rma_writemsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 		tx_iov.iov.addr = msg->rma_iov[i].addr;
 		tx_iov.iov.key = msg->rma_iov[i].key;
 		tx_iov.iov.len = msg->rma_iov[i].len;
-		sock_tx_ctx_write(tx_ctx, &tx_iov, sizeof(tx_iov));
+		sock_tx_ctx_write(&cmd, &tx_iov, sizeof(tx_iov));
 		dst_len += tx_iov.iov.len;
 	}
 
@@ -363,11 +364,11 @@ ssize_t sock_ep_rma_writemsg(struct fid_ep *ep, const struct fi_msg_rma *msg,
 	}
 #endif
 
-	sock_tx_ctx_commit(tx_ctx);
+	sock_tx_ctx_commit(&cmd);
 	return 0;
 
 err:
-	sock_tx_ctx_abort(tx_ctx);
+	sock_tx_ctx_abort(&cmd);
 	return ret;
 }
 
@@ -81,15 +81,78 @@ struct sock_rx_entry *sock_rx_new_entry(struct sock_rx_ctx *rx_ctx)
 	rx_entry->is_tagged = 0;
 	SOCK_LOG_DBG("New rx_entry: %p, ctx: %p\n", rx_entry, rx_ctx);
 	dlist_init(&rx_entry->entry);
+	dlist_init(&rx_entry->match_entry);
 	rx_ctx->num_left--;
 	return rx_entry;
 }
 
+static inline size_t sock_rx_buf_class_len(int buf_class)
+{
+	return (size_t) 1 << (buf_class + SOCK_RX_BUF_MIN_SHIFT);
+}
+
+static int sock_rx_buf_class(size_t len)
+{
+	int buf_class = 0;
+
+	while (sock_rx_buf_class_len(buf_class) < len) {
+		if (++buf_class == SOCK_RX_BUF_CLASSES)
+			return -1;
+	}
+	return buf_class;
+}
+
+static int sock_rx_grow_buf_pool(struct sock_rx_ctx *rx_ctx, int buf_class)
+{
+	struct sock_rx_buf_pool *pool = &rx_ctx->buf_pool[buf_class];
+	struct slist_entry *slab;
+	size_t i, obj_size, count;
+	char *buf;
+
+	obj_size = sizeof(struct sock_rx_entry) + sock_rx_buf_class_len(buf_class);
+	count = MAX(SOCK_RX_BUF_SLAB_SZ / obj_size, 1);
+
+	slab = malloc(sizeof(*slab) + count * obj_size);
+	if (!slab)
+		return -FI_ENOMEM;
+
+	slist_insert_tail(slab, &rx_ctx->buf_slab_list);
+	rx_ctx->buf_slab_len += count * sock_rx_buf_class_len(buf_class);
+
+	buf = (char *) (slab + 1);
+	for (i = 0; i < count; i++, buf += obj_size)
+		slist_insert_tail(&((struct sock_rx_entry *) buf)->pool_entry,
+				  &pool->free_list);
+	pool->num_free += count;
+	return 0;
+}
+
+void sock_rx_free_buf_pool(struct sock_rx_ctx *rx_ctx)
+{
+	while (!slist_empty(&rx_ctx->buf_slab_list))
+		free(slist_remove_head(&rx_ctx->buf_slab_list));
+	rx_ctx->buf_slab_len = 0;
+}
+
 void sock_rx_release_entry(struct sock_rx_entry *rx_entry)
 {
 	struct sock_rx_ctx *rx_ctx;
+	struct sock_rx_buf_pool *pool;
+
 	SOCK_LOG_DBG("Releasing rx_entry: %p\n", rx_entry);
-	if (rx_entry->is_pool_entry) {
+	if (rx_entry->is_buffered) {
+		rx_ctx = rx_entry->rx_ctx;
+		rx_ctx->buffered_len -= rx_entry->total_len;
+		rx_ctx->buffered_cnt--;
+		if (rx_entry->buf_class) {
+			pool = &rx_ctx->buf_pool[rx_entry->buf_class - 1];
+			slist_insert_head(&rx_entry->pool_entry, &pool->free_list);
+			pool->num_free++;
+			pool->num_used--;
+			return;
+		}
+		free(rx_entry);
+	} else if (rx_entry->is_pool_entry) {
 		rx_ctx = rx_entry->rx_ctx;
 		memset(rx_entry, 0, sizeof(*rx_entry));
 		rx_entry->rx_ctx =  rx_ctx;
@@ -100,21 +163,50 @@ void sock_rx_release_entry(struct sock_rx_entry *rx_entry)
 	}
 }
 
+/*
+ * A limit of 0 means the application left buffering to the provider.  One
+ * message is always accepted so that a send larger than the limit can
+ * still be delivered; callers drop what does not fit.
+ */
+int sock_rx_can_buffer(struct sock_rx_ctx *rx_ctx, size_t len)
+{
+	size_t limit;
+
+	limit = rx_ctx->attr.total_buffered_recv ?
+		rx_ctx->attr.total_buffered_recv : SOCK_EP_MAX_BUFF_RECV;
+	return !rx_ctx->buffered_len || rx_ctx->buffered_len + len <= limit;
+}
+
 struct sock_rx_entry *sock_rx_new_buffered_entry(struct sock_rx_ctx *rx_ctx,
 						 size_t len)
 {
 	struct sock_rx_entry *rx_entry;
+	struct sock_rx_buf_pool *pool;
+	int buf_class;
 
-	if (rx_ctx->buffered_len + len >= rx_ctx->attr.total_buffered_recv)
-		SOCK_LOG_ERROR("Exceeded buffered recv limit\n");
+	buf_class = sock_rx_buf_class(len);
+	if (buf_class >= 0) {
+		pool = &rx_ctx->buf_pool[buf_class];
+		if (slist_empty(&pool->free_list) &&
+		    sock_rx_grow_buf_pool(rx_ctx, buf_class))
+			return NULL;
 
-	rx_entry = calloc(1, sizeof(*rx_entry) + len);
-	if (!rx_entry)
-		return NULL;
+		rx_entry = container_of(slist_remove_head(&pool->free_list),
+					struct sock_rx_entry, pool_entry);
+		pool->num_free--;
+		pool->num_used++;
+		memset(rx_entry, 0, sizeof(*rx_entry));
+		rx_entry->buf_class = buf_class + 1;
+	} else {
+		rx_entry = calloc(1, sizeof(*rx_entry) + len);
+		if (!rx_entry)
+			return NULL;
+	}
 
 	SOCK_LOG_DBG("New buffered entry:%p len: %lu, ctx: %p\n",
 		       rx_entry, len, rx_ctx);
 
+	rx_entry->rx_ctx = rx_ctx;
 	rx_entry->is_busy = 1;
 	rx_entry->is_buffered = 1;
 	rx_entry->rx_op.dest_iov_len = 1;
@@ -123,58 +215,252 @@ struct sock_rx_entry *sock_rx_new_buffered_entry(struct sock_rx_ctx *rx_ctx,
 	rx_entry->total_len = len;
 
 	rx_ctx->buffered_len += len;
-	dlist_insert_tail(&rx_entry->entry, &rx_ctx->rx_buffered_list);
+	rx_ctx->buffered_cnt++;
+	dlist_init(&rx_entry->entry);
+	dlist_init(&rx_entry->match_entry);
 	rx_entry->is_busy = 1;
 	rx_entry->is_tagged = 0;
 
 	return rx_entry;
 }
 
+void sock_rx_buffered_stats(struct sock_rx_ctx *rx_ctx,
+			    struct fi_sockets_buffered_recv_stats *stats)
+{
+	int i;
+
+	fastlock_acquire(&rx_ctx->lock);
+	stats->limit = rx_ctx->attr.total_buffered_recv ?
+		rx_ctx->attr.total_buffered_recv : SOCK_EP_MAX_BUFF_RECV;
+	stats->used = rx_ctx->buffered_len;
+	stats->entries = rx_ctx->buffered_cnt;
+	stats->pooled = rx_ctx->buf_slab_len;
+	stats->cached = 0;
+	for (i = 0; i < SOCK_RX_BUF_CLASSES; i++)
+		stats->cached += rx_ctx->buf_pool[i].num_free *
+				 sock_rx_buf_class_len(i);
+	fastlock_release(&rx_ctx->lock);
+}
+
 inline size_t sock_rx_avail_len(struct sock_rx_entry *rx_entry)
 {
 	return rx_entry->total_len - rx_entry->used;
 }
 
-struct sock_rx_entry *sock_rx_get_entry(struct sock_rx_ctx *rx_ctx,
-					uint64_t addr, uint64_t tag,
-					uint8_t is_tagged)
+/*
+ * Posted receives stay on rx_entry_list in post order.  Those with an
+ * exact tag (and every untagged receive) are also hashed on tag and
+ * source; tagged receives with ignore bits, and directed receives whose
+ * source cannot be resolved, go on the wildcard list.  A lookup takes the
+ * oldest candidate from the source bucket, the any-source bucket and the
+ * wildcard list, preserving the matching order of a linear scan.
+ */
+#define SOCK_RX_ANY_SRC (~0ULL)
+
+static inline uint64_t sock_rx_src_key(struct sock_rx_ctx *rx_ctx,
+				       fi_addr_t addr)
 {
-	struct dlist_entry *entry;
-	struct sock_rx_entry *rx_entry;
+	if (addr == FI_ADDR_UNSPEC)
+		return SOCK_RX_ANY_SRC;
+	return rx_ctx->av ? sock_av_addr_key(rx_ctx->av, addr) : addr;
+}
 
-	for (entry = rx_ctx->rx_entry_list.next;
-	     entry != &rx_ctx->rx_entry_list; entry = entry->next) {
+static inline struct dlist_entry *sock_rx_bucket(struct sock_rx_ctx *rx_ctx,
+						 struct dlist_entry *hash_table,
+						 uint8_t is_tagged,
+						 uint64_t tag, uint64_t src_key)
+{
+	uint64_t hash;
 
-		rx_entry = container_of(entry, struct sock_rx_entry, entry);
-		if (rx_entry->is_busy || (is_tagged != rx_entry->is_tagged))
-			continue;
+	hash = (tag ^ (src_key * 0x9E3779B97F4A7C15ULL) ^ is_tagged) *
+		0x9E3779B97F4A7C15ULL;
+	return &hash_table[(hash >> 32) & rx_ctx->rx_match_mask];
+}
 
-		if (((rx_entry->tag & ~rx_entry->ignore) == (tag & ~rx_entry->ignore)) &&
-		    (rx_entry->addr == FI_ADDR_UNSPEC || addr == FI_ADDR_UNSPEC ||
-		     rx_entry->addr == addr ||
-		     (rx_ctx->av &&
-		      !sock_av_compare_addr(rx_ctx->av, addr, rx_entry->addr)))) {
-			rx_entry->is_busy = 1;
+static int sock_rx_init_hash(struct sock_rx_ctx *rx_ctx,
+			     struct dlist_entry **hash_table)
+{
+	size_t i, size = SOCK_RX_HASH_MIN_SZ;
+
+	while (size < rx_ctx->attr.size && size < SOCK_RX_HASH_MAX_SZ)
+		size <<= 1;
+
+	*hash_table = calloc(size, sizeof(**hash_table));
+	if (!*hash_table)
+		return -FI_ENOMEM;
+
+	for (i = 0; i < size; i++)
+		dlist_init(&(*hash_table)[i]);
+	rx_ctx->rx_match_mask = size - 1;
+	return 0;
+}
+
+void sock_rx_enqueue_entry(struct sock_rx_ctx *rx_ctx,
+			   struct sock_rx_entry *rx_entry)
+{
+	uint64_t tag;
+
+	rx_entry->seq = rx_ctx->rx_seq++;
+	rx_entry->src_key = sock_rx_src_key(rx_ctx, rx_entry->addr);
+	dlist_insert_tail(&rx_entry->entry, &rx_ctx->rx_entry_list);
+
+	if ((rx_entry->is_tagged && rx_entry->ignore) || !rx_entry->src_key ||
+	    (!rx_ctx->rx_match_hash &&
+	     sock_rx_init_hash(rx_ctx, &rx_ctx->rx_match_hash))) {
+		dlist_insert_tail(&rx_entry->match_entry, &rx_ctx->rx_wild_list);
+		return;
+	}
+
+	tag = rx_entry->is_tagged ? rx_entry->tag : 0;
+	dlist_insert_tail(&rx_entry->match_entry,
+			  sock_rx_bucket(rx_ctx, rx_ctx->rx_match_hash,
+					 rx_entry->is_tagged, tag,
+					 rx_entry->src_key));
+}
+
+void sock_rx_dequeue_entry(struct sock_rx_entry *rx_entry)
+{
+	dlist_remove(&rx_entry->entry);
+	dlist_remove(&rx_entry->match_entry);
+	dlist_init(&rx_entry->match_entry);
+}
+
+static inline int sock_rx_match(struct sock_rx_ctx *rx_ctx,
+				struct sock_rx_entry *rx_entry,
+				uint64_t addr, uint64_t tag, uint8_t is_tagged)
+{
+	return (!rx_entry->is_busy && is_tagged == rx_entry->is_tagged &&
+		((rx_entry->tag & ~rx_entry->ignore) == (tag & ~rx_entry->ignore)) &&
+		(rx_entry->addr == FI_ADDR_UNSPEC || addr == FI_ADDR_UNSPEC ||
+		 rx_entry->addr == addr ||
+		 (rx_ctx->av &&
+		  !sock_av_compare_addr(rx_ctx->av, addr, rx_entry->addr))));
+}
+
+static struct sock_rx_entry *sock_rx_scan_bucket(struct sock_rx_ctx *rx_ctx,
+						 uint8_t is_tagged,
+						 uint64_t tag, uint64_t src_key)
+{
+	struct dlist_entry *head, *entry;
+	struct sock_rx_entry *rx_entry;
+
+	head = sock_rx_bucket(rx_ctx, rx_ctx->rx_match_hash, is_tagged, tag,
+			      src_key);
+	for (entry = head->next; entry != head; entry = entry->next) {
+		rx_entry = container_of(entry, struct sock_rx_entry, match_entry);
+		if (!rx_entry->is_busy && rx_entry->is_tagged == is_tagged &&
+		    rx_entry->src_key == src_key &&
+		    (!is_tagged || rx_entry->tag == tag))
 			return rx_entry;
-		}
 	}
 	return NULL;
 }
 
-struct sock_rx_entry *sock_rx_get_buffered_entry(struct sock_rx_ctx *rx_ctx,
-						uint64_t addr, uint64_t tag,
-						uint64_t ignore,
-						uint8_t is_tagged)
+static struct sock_rx_entry *sock_rx_scan_list(struct sock_rx_ctx *rx_ctx,
+					       struct dlist_entry *head,
+					       uint64_t addr, uint64_t tag,
+					       uint8_t is_tagged)
 {
 	struct dlist_entry *entry;
 	struct sock_rx_entry *rx_entry;
 
-	for (entry = rx_ctx->rx_buffered_list.next;
-	     entry != &rx_ctx->rx_buffered_list; entry = entry->next) {
+	for (entry = head->next; entry != head; entry = entry->next) {
+		rx_entry = (head == &rx_ctx->rx_entry_list) ?
+			container_of(entry, struct sock_rx_entry, entry) :
+			container_of(entry, struct sock_rx_entry, match_entry);
+		if (sock_rx_match(rx_ctx, rx_entry, addr, tag, is_tagged))
+			return rx_entry;
+	}
+	return NULL;
+}
+
+struct sock_rx_entry *sock_rx_get_entry(struct sock_rx_ctx *rx_ctx,
+					uint64_t addr, uint64_t tag,
+					uint8_t is_tagged)
+{
+	struct sock_rx_entry *rx_entry, *any_entry;
+	uint64_t src_key;
+
+	src_key = sock_rx_src_key(rx_ctx, addr);
+	if (!rx_ctx->rx_match_hash || src_key == SOCK_RX_ANY_SRC || !src_key) {
+		rx_entry = sock_rx_scan_list(rx_ctx, &rx_ctx->rx_entry_list,
+					     addr, tag, is_tagged);
+		goto out;
+	}
 
-		rx_entry = container_of(entry, struct sock_rx_entry, entry);
-		if (rx_entry->is_busy || (is_tagged != rx_entry->is_tagged) ||
-		    rx_entry->is_claimed)
+	if (!is_tagged)
+		tag = 0;
+
+	rx_entry = sock_rx_scan_bucket(rx_ctx, is_tagged, tag, src_key);
+	any_entry = sock_rx_scan_bucket(rx_ctx, is_tagged, tag,
+					SOCK_RX_ANY_SRC);
+	if (any_entry && (!rx_entry || any_entry->seq < rx_entry->seq))
+		rx_entry = any_entry;
+
+	any_entry = sock_rx_scan_list(rx_ctx, &rx_ctx->rx_wild_list,
+				      addr, tag, is_tagged);
+	if (any_entry && (!rx_entry || any_entry->seq < rx_entry->seq))
+		rx_entry = any_entry;
+out:
+	if (rx_entry)
+		rx_entry->is_busy = 1;
+	return rx_entry;
+}
+
+/*
+ * Unexpected messages stay on rx_buffered_list in arrival order.  They are
+ * also hashed on tag alone, since most receives take any source; the
+ * source is checked within the bucket.  Lookups with ignore bits scan the
+ * list, as do all lookups if the table could not be allocated while the
+ * list was empty.
+ */
+void sock_rx_enqueue_buffered_entry(struct sock_rx_ctx *rx_ctx,
+				    struct sock_rx_entry *rx_entry)
+{
+	uint64_t tag;
+	int hashed;
+
+	hashed = rx_ctx->rx_buffered_hash ||
+		 (dlist_empty(&rx_ctx->rx_buffered_list) &&
+		  !sock_rx_init_hash(rx_ctx, &rx_ctx->rx_buffered_hash));
+	dlist_insert_tail(&rx_entry->entry, &rx_ctx->rx_buffered_list);
+	if (!hashed)
+		return;
+
+	tag = rx_entry->is_tagged ? rx_entry->tag : 0;
+	dlist_insert_tail(&rx_entry->match_entry,
+			  sock_rx_bucket(rx_ctx, rx_ctx->rx_buffered_hash,
+					 rx_entry->is_tagged, tag,
+					 SOCK_RX_ANY_SRC));
+}
+
+static struct sock_rx_entry *sock_rx_scan_buffered(struct sock_rx_ctx *rx_ctx,
+						   uint64_t addr, uint64_t tag,
+						   uint64_t ignore,
+						   uint8_t is_tagged,
+						   uint8_t is_claimed,
+						   uintptr_t context)
+{
+	struct dlist_entry *head, *entry;
+	struct sock_rx_entry *rx_entry;
+	int hashed;
+
+	hashed = rx_ctx->rx_buffered_hash && (!is_tagged || !ignore);
+	head = hashed ? sock_rx_bucket(rx_ctx, rx_ctx->rx_buffered_hash,
+				       is_tagged, is_tagged ? tag : 0,
+				       SOCK_RX_ANY_SRC) :
+		&rx_ctx->rx_buffered_list;
+
+	for (entry = head->next; entry != head; entry = entry->next) {
+		rx_entry = hashed ?
+			container_of(entry, struct sock_rx_entry, match_entry) :
+			container_of(entry, struct sock_rx_entry, entry);
+		if (is_tagged != rx_entry->is_tagged ||
+		    is_claimed != rx_entry->is_claimed)
+			continue;
+
+		if (is_claimed ? rx_entry->context != context :
+		    rx_entry->is_busy || !rx_entry->is_complete)
 			continue;
 
 		if (((rx_entry->tag & ~ignore) == (tag & ~ignore)) &&
@@ -187,3 +473,20 @@ struct sock_rx_entry *sock_rx_get_buffered_entry(struct sock_rx_ctx *rx_ctx,
 	}
 	return NULL;
 }
+
+struct sock_rx_entry *sock_rx_get_buffered_entry(struct sock_rx_ctx *rx_ctx,
+						uint64_t addr, uint64_t tag,
+						uint64_t ignore,
+						uint8_t is_tagged)
+{
+	return sock_rx_scan_buffered(rx_ctx, addr, tag, ignore, is_tagged, 0, 0);
+}
+
+struct sock_rx_entry *sock_rx_get_claimed_entry(struct sock_rx_ctx *rx_ctx,
+						void *context, uint64_t tag,
+						uint64_t ignore,
+						uint8_t is_tagged)
+{
+	return sock_rx_scan_buffered(rx_ctx, FI_ADDR_UNSPEC, tag, ignore,
+				     is_tagged, 1, (uintptr_t) context);
+}
@@ -0,0 +1,399 @@
+/*
+ * Copyright (c) 2015 Intel Corporation, Inc.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#if HAVE_CONFIG_H
+#  include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "sock.h"
+#include "sock_util.h"
+
+#define SOCK_LOG_DBG(...) _SOCK_LOG_DBG(FI_LOG_EP_DATA, __VA_ARGS__)
+#define SOCK_LOG_ERROR(...) _SOCK_LOG_ERROR(FI_LOG_EP_DATA, __VA_ARGS__)
+
+/*
+ * Same-host connections keep their TCP socket for setup, teardown and
+ * wakeups, but move their byte stream into a pair of shared memory rings.
+ * The connecting side creates the segment and owns the first ring as its
+ * transmit ring; the accepting side maps the same segment by name.
+ */
+#define SOCK_SHM_SEG_SZ (2 * sizeof(struct sock_shm_ring))
+#define SOCK_SHM_RING_MASK (SOCK_SHM_RING_SZ - 1)
+
+int sock_shm_is_local(int sock_fd)
+{
+	struct sockaddr_in local, peer;
+	socklen_t len;
+
+	len = sizeof(local);
+	if (getsockname(sock_fd, (struct sockaddr *) &local, &len))
+		return 0;
+
+	len = sizeof(peer);
+	if (getpeername(sock_fd, (struct sockaddr *) &peer, &len))
+		return 0;
+
+	return local.sin_family == AF_INET &&
+		local.sin_addr.s_addr == peer.sin_addr.s_addr;
+}
+
+/*
+ * An address match alone does not make a peer local: containers with
+ * their own pid namespace, or another host behind the same address, must
+ * not be handed our pid.  The pid namespace inode and the kernel boot id
+ * are exchanged in the handshake and have to match ours.
+ */
+int sock_shm_host_id(struct sock_host_id *id)
+{
+	struct stat st;
+	ssize_t len;
+	int fd;
+
+	memset(id, 0, sizeof(*id));
+	if (stat("/proc/self/ns/pid", &st))
+		return -errno;
+	id->pid_ns = st.st_ino;
+
+	fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	len = read(fd, id->boot_id, sizeof(id->boot_id) - 1);
+	close(fd);
+	if (len <= 0)
+		return -FI_EINVAL;
+	id->boot_id[strcspn(id->boot_id, "\n")] = '\0';
+	return 0;
+}
+
+int sock_shm_same_host(const struct sock_host_id *id)
+{
+	struct sock_host_id self;
+
+	return !sock_shm_host_id(&self) && id->pid_ns &&
+		!memcmp(&self, id, sizeof(self));
+}
+
+static int sock_shm_map(struct sock_shm **shm, int fd, int creator)
+{
+	struct sock_shm *_shm;
+	struct sock_shm_ring *rings;
+
+	_shm = calloc(1, sizeof(*_shm));
+	if (!_shm)
+		return -FI_ENOMEM;
+
+	rings = mmap(NULL, SOCK_SHM_SEG_SZ, PROT_READ | PROT_WRITE,
+		     MAP_SHARED, fd, 0);
+	if (rings == MAP_FAILED) {
+		SOCK_LOG_ERROR("mmap failed: %s\n", strerror(errno));
+		free(_shm);
+		return -FI_ENOMEM;
+	}
+
+	_shm->base = rings;
+	_shm->tx = creator ? &rings[0] : &rings[1];
+	_shm->rx = creator ? &rings[1] : &rings[0];
+	*shm = _shm;
+	return 0;
+}
+
+int sock_shm_create(struct sock_shm **shm, int sock_fd, char *name)
+{
+#ifdef HAVE_ATOMICS
+	struct sockaddr_in local, peer;
+	struct sock_shm_ring *ring;
+	socklen_t len;
+	int fd, ret, i;
+
+	len = sizeof(local);
+	if (getsockname(sock_fd, (struct sockaddr *) &local, &len))
+		return -errno;
+	len = sizeof(peer);
+	if (getpeername(sock_fd, (struct sockaddr *) &peer, &len))
+		return -errno;
+
+	snprintf(name, SOCK_SHM_NAME_LEN, "/fi_sock_%d_%u_%u", getpid(),
+		 ntohs(local.sin_port), ntohs(peer.sin_port));
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		SOCK_LOG_DBG("shm_open %s failed: %s\n", name, strerror(errno));
+		return -errno;
+	}
+
+	if (ftruncate(fd, SOCK_SHM_SEG_SZ)) {
+		ret = -errno;
+		goto err;
+	}
+
+	ret = sock_shm_map(shm, fd, 1);
+	if (ret)
+		goto err;
+	close(fd);
+
+	for (i = 0; i < 2; i++) {
+		ring = (struct sock_shm_ring *) (*shm)->base + i;
+		sock_seq_init(&ring->head, 0);
+		sock_seq_init(&ring->tail, 0);
+		sock_seq_init(&ring->armed, 1);
+	}
+	SOCK_LOG_DBG("Created shm segment %s\n", name);
+	return 0;
+err:
+	close(fd);
+	shm_unlink(name);
+	return ret;
+#else
+	return -FI_ENOSYS;
+#endif
+}
+
+int sock_shm_attach(struct sock_shm **shm, const char *name)
+{
+	struct stat st;
+	int fd, ret;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) {
+		SOCK_LOG_DBG("shm_open %s failed: %s\n", name, strerror(errno));
+		return -errno;
+	}
+
+	if (fstat(fd, &st) || st.st_size != SOCK_SHM_SEG_SZ) {
+		SOCK_LOG_ERROR("Invalid shm segment %s\n", name);
+		close(fd);
+		return -FI_EINVAL;
+	}
+
+	ret = sock_shm_map(shm, fd, 0);
+	close(fd);
+	return ret;
+}
+
+void sock_shm_free(struct sock_shm *shm)
+{
+	if (!shm)
+		return;
+	munmap(shm->base, SOCK_SHM_SEG_SZ);
+	free(shm);
+}
+
+static void sock_shm_copy_in(struct sock_shm_ring *ring, size_t pos,
+			     const void *buf, size_t len)
+{
+	size_t off, first;
+
+	off = pos & SOCK_SHM_RING_MASK;
+	first = MIN(len, SOCK_SHM_RING_SZ - off);
+	memcpy(ring->data + off, buf, first);
+	memcpy(ring->data, (const char *) buf + first, len - first);
+}
+
+static void sock_shm_copy_out(struct sock_shm_ring *ring, size_t pos,
+			      void *buf, size_t len)
+{
+	size_t off, first;
+
+	off = pos & SOCK_SHM_RING_MASK;
+	first = MIN(len, SOCK_SHM_RING_SZ - off);
+	memcpy(buf, ring->data + off, first);
+	memcpy((char *) buf + first, ring->data, len - first);
+}
+
+ssize_t sock_shm_sendv(struct sock_conn *conn, const struct iovec *iov,
+		       int iov_cnt, size_t len)
+{
+	struct sock_shm_ring *ring = conn->shm->tx;
+	size_t head, avail, copy, done = 0;
+	char c = 0;
+	int i;
+
+	head = sock_seq_load(&ring->head);
+	avail = SOCK_SHM_RING_SZ - (head - sock_seq_load(&ring->tail));
+	avail = MIN(avail, len);
+
+	for (i = 0; i < iov_cnt && done < avail; i++) {
+		copy = MIN(iov[i].iov_len, avail - done);
+		sock_shm_copy_in(ring, head + done, iov[i].iov_base, copy);
+		done += copy;
+	}
+
+	if (!done)
+		return 0;
+
+	sock_seq_store(&ring->head, head + done);
+	sock_fence();
+	if (sock_seq_load(&ring->armed) && sock_seq_xchg(&ring->armed, 0)) {
+		if (send(conn->sock_fd, &c, sizeof(c), MSG_NOSIGNAL) != sizeof(c))
+			SOCK_LOG_DBG("doorbell %s\n", strerror(errno));
+	}
+	SOCK_LOG_DBG("wrote to shm: %lu\n", done);
+	return done;
+}
+
+size_t sock_shm_tx_avail(struct sock_conn *conn)
+{
+	struct sock_shm_ring *ring = conn->shm->tx;
+
+	return SOCK_SHM_RING_SZ - (sock_seq_load(&ring->head) -
+				   sock_seq_load(&ring->tail));
+}
+
+ssize_t sock_shm_data_avail(struct sock_conn *conn)
+{
+	struct sock_shm_ring *ring = conn->shm->rx;
+
+	return sock_seq_load(&ring->head) - sock_seq_load(&ring->tail);
+}
+
+ssize_t sock_shm_recv(struct sock_conn *conn, void *buf, size_t len)
+{
+	struct sock_shm_ring *ring = conn->shm->rx;
+	size_t tail;
+
+	tail = sock_seq_load(&ring->tail);
+	len = MIN(len, sock_seq_load(&ring->head) - tail);
+	if (!len)
+		return 0;
+
+	sock_shm_copy_out(ring, tail, buf, len);
+	sock_seq_store(&ring->tail, tail + len);
+	SOCK_LOG_DBG("read from shm: %lu\n", len);
+	return len;
+}
+
+ssize_t sock_shm_peek(struct sock_conn *conn, void *buf, size_t len)
+{
+	struct sock_shm_ring *ring = conn->shm->rx;
+
+	if (sock_shm_data_avail(conn) < len)
+		return 0;
+
+	sock_shm_copy_out(ring, sock_seq_load(&ring->tail), buf, len);
+	return len;
+}
+
+ssize_t sock_shm_discard(struct sock_conn *conn, size_t len)
+{
+	struct sock_shm_ring *ring = conn->shm->rx;
+
+	len = MIN(len, sock_shm_data_avail(conn));
+	sock_seq_store(&ring->tail, sock_seq_load(&ring->tail) + len);
+	return len;
+}
+
+/*
+ * An empty ring re-arms the doorbell before the connection leaves the
+ * ready list.  The ring is checked once more afterwards so that a writer
+ * which missed the armed flag cannot strand its data.
+ */
+int sock_shm_data_pending(struct sock_conn *conn)
+{
+	char buf[64];
+	ssize_t ret;
+
+	if (sock_shm_data_avail(conn))
+		return 1;
+
+	do {
+		ret = recv(conn->sock_fd, buf, sizeof(buf), MSG_DONTWAIT);
+	} while (ret > 0);
+
+	if (ret == 0)
+		conn->disconnected = 1;
+
+	sock_seq_store(&conn->shm->rx->armed, 1);
+	sock_fence();
+	return sock_shm_data_avail(conn) > 0;
+}
+
+/*
+ * Copy straight into the peer's buffers with cross memory attach.  Any
+ * failure, e.g. a peer that cannot be traced under Yama ptrace
+ * restrictions, turns CMA off for the connection, and the caller falls
+ * back to sending the data over the connection.
+ */
+int sock_shm_cma_write(struct sock_conn *conn, const union sock_iov *local,
+		       size_t local_cnt, const union sock_iov *remote,
+		       size_t remote_cnt)
+{
+#ifdef HAVE_PROCESS_VM_WRITEV
+	struct iovec liov[SOCK_EP_MAX_IOV_LIMIT], riov[SOCK_EP_MAX_IOV_LIMIT];
+	size_t i, len = 0, rlen = 0;
+	ssize_t ret;
+
+	if (!conn->shm || !conn->shm->cma ||
+	    local_cnt > SOCK_EP_MAX_IOV_LIMIT ||
+	    remote_cnt > SOCK_EP_MAX_IOV_LIMIT)
+		return -FI_ENOSYS;
+
+	for (i = 0; i < local_cnt; i++) {
+		liov[i].iov_base = (void *) (uintptr_t) local[i].iov.addr;
+		liov[i].iov_len = local[i].iov.len;
+		len += local[i].iov.len;
+	}
+
+	for (i = 0; i < remote_cnt; i++) {
+		riov[i].iov_base = (void *) (uintptr_t) remote[i].iov.addr;
+		riov[i].iov_len = remote[i].iov.len;
+		rlen += remote[i].iov.len;
+	}
+
+	if (len != rlen)
+		return -FI_EINVAL;
+
+	ret = process_vm_writev(conn->shm->peer_pid, liov, local_cnt,
+				riov, remote_cnt, 0);
+	if (ret == len)
+		return 0;
+
+	SOCK_LOG_DBG("CMA unavailable: %s\n",
+		     ret < 0 ? strerror(errno) : "short write");
+	conn->shm->cma = 0;
+	return ret < 0 ? -errno : -FI_EIO;
+#else
+	return -FI_ENOSYS;
+#endif
+}
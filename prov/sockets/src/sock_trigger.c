@@ -81,9 +81,10 @@ ssize_t sock_queue_rma_op(struct fid_ep *ep, const struct fi_msg_rma *msg,
 	trigger->ep = ep;
 	trigger->flags = flags;
 
-	fastlock_acquire(&cntr->trigger_lock);
-	dlist_insert_tail(&trigger->entry, &cntr->trigger_list);
-	fastlock_release(&cntr->trigger_lock);
+	if (sock_cntr_queue_trigger(cntr, trigger)) {
+		free(trigger);
+		return -FI_ENOMEM;
+	}
 	return 0;
 }
 
@@ -112,17 +113,18 @@ ssize_t sock_queue_msg_op(struct fid_ep *ep, const struct fi_msg *msg,
 	trigger->threshold = threshold->threshold;
 
 	memcpy(&trigger->op.msg.msg, msg, sizeof(*msg));
-	trigger->op.msg.msg.msg_iov = &trigger->op.msg.msg.msg_iov[0];
-	memcpy((void *) &trigger->op.msg.msg.msg_iov[0], &msg->msg_iov[0],
+	trigger->op.msg.msg.msg_iov = &trigger->op.msg.msg_iov[0];
+	memcpy(&trigger->op.msg.msg_iov[0], &msg->msg_iov[0],
 	       msg->iov_count * sizeof(struct iovec));
 
 	trigger->op_type = op_type;
 	trigger->ep = ep;
 	trigger->flags = flags;
 
-	fastlock_acquire(&cntr->trigger_lock);
-	dlist_insert_tail(&trigger->entry, &cntr->trigger_list);
-	fastlock_release(&cntr->trigger_lock);
+	if (sock_cntr_queue_trigger(cntr, trigger)) {
+		free(trigger);
+		return -FI_ENOMEM;
+	}
 	return 0;
 }
 
@@ -151,17 +153,18 @@ ssize_t sock_queue_tmsg_op(struct fid_ep *ep, const struct fi_msg_tagged *msg,
 	trigger->threshold = threshold->threshold;
 
 	memcpy(&trigger->op.tmsg.msg, msg, sizeof(*msg));
-	trigger->op.tmsg.msg.msg_iov = &trigger->op.tmsg.msg.msg_iov[0];
-	memcpy((void *) &trigger->op.tmsg.msg.msg_iov[0], &msg->msg_iov[0],
+	trigger->op.tmsg.msg.msg_iov = &trigger->op.tmsg.msg_iov[0];
+	memcpy(&trigger->op.tmsg.msg_iov[0], &msg->msg_iov[0],
 	       msg->iov_count * sizeof(struct iovec));
 
 	trigger->op_type = op_type;
 	trigger->ep = ep;
 	trigger->flags = flags;
 
-	fastlock_acquire(&cntr->trigger_lock);
-	dlist_insert_tail(&trigger->entry, &cntr->trigger_list);
-	fastlock_release(&cntr->trigger_lock);
+	if (sock_cntr_queue_trigger(cntr, trigger)) {
+		free(trigger);
+		return -FI_ENOMEM;
+	}
 	return 0;
 }
 
@@ -197,7 +200,7 @@ ssize_t sock_queue_atomic_op(struct fid_ep *ep, const struct fi_msg_atomic *msg,
 	memcpy(&trigger->op.atomic.msg_iov[0], &msg->msg_iov[0],
 	       msg->iov_count * sizeof(struct fi_ioc));
 	memcpy(&trigger->op.atomic.rma_iov[0], &msg->rma_iov[0],
-	       msg->iov_count * sizeof(struct fi_rma_ioc));
+	       msg->rma_iov_count * sizeof(struct fi_rma_ioc));
 
 	if (comparev) {
 		memcpy(&trigger->op.atomic.comparev[0], &comparev[0],
@@ -213,8 +216,9 @@ ssize_t sock_queue_atomic_op(struct fid_ep *ep, const struct fi_msg_atomic *msg,
 	trigger->ep = ep;
 	trigger->flags = flags;
 
-	fastlock_acquire(&cntr->trigger_lock);
-	dlist_insert_tail(&trigger->entry, &cntr->trigger_list);
-	fastlock_release(&cntr->trigger_lock);
+	if (sock_cntr_queue_trigger(cntr, trigger)) {
+		free(trigger);
+		return -FI_ENOMEM;
+	}
 	return 0;
 }
@@ -42,12 +42,26 @@ extern const char sock_dom_name[];
 extern const char sock_prov_name[];
 extern struct fi_provider sock_prov;
 extern int sock_pe_waittime;
+extern int sock_pe_profile;
+extern int sock_pe_spin_budget;
+extern int sock_pe_backoff_max;
 extern int sock_conn_retry;
 extern int sock_cm_def_map_sz;
 extern int sock_av_def_sz;
 extern int sock_cq_def_sz;
 extern int sock_eq_def_sz;
 extern char *sock_pe_affinity_str;
+extern int sock_pe_threads;
+extern int sock_pe_max_entries;
+extern int sock_mr_cache_size;
+extern int sock_rndv_threshold;
+extern int sock_shm_enable;
+extern int sock_cma_threshold;
+extern int sock_dgram_udp;
+extern int sock_av_preconnect;
+extern int sock_conn_inflight;
+extern int sock_conn_cache_size;
+extern int sock_conn_idle_timeout;
 #if ENABLE_DEBUG
 extern int sock_dgram_drop_rate;
 #endif
@@ -36,7 +36,6 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 
 #include "sock.h"
 #include "sock_util.h"
@@ -106,70 +105,77 @@ static int sock_wait_init(struct sock_wait *wait, enum fi_wait_obj type)
 	return 0;
 }
 
+static void sock_wait_reset(struct sock_wait *wait)
+{
+	char buf[64];
+
+	atomic_set(&wait->signaled, 0);
+	while (read(wait->wobj.fd[WAIT_READ_FD], buf, sizeof(buf)) > 0)
+		;
+}
+
 static int sock_wait_wait(struct fid_wait *wait_fid, int timeout)
 {
-	int err = 0;
-	struct sock_cq *cq;
-	struct sock_cntr *cntr;
-	struct timeval now;
 	struct sock_wait *wait;
-	double start_ms = 0.0, end_ms = 0.0;
-	struct dlist_entry *p, *head;
-	struct sock_fid_list *list_item;
+	uint64_t end_ms = 0, now;
+	int ret, poll_timeout;
 
 	wait = container_of(wait_fid, struct sock_wait, wait_fid);
-	if (timeout > 0) {
-		gettimeofday(&now, NULL);
-		start_ms = (double)now.tv_sec * 1000.0 +
-			(double)now.tv_usec / 1000.0;
-	}
+	if (timeout > 0)
+		end_ms = fi_gettime_ms() + timeout;
+
+	while (1) {
+		sock_poll_set_progress(&wait->pset);
 
-	head = &wait->fid_list;
-	for (p = head->next; p != head; p = p->next) {
-		list_item = container_of(p, struct sock_fid_list, entry);
-		switch (list_item->fid->fclass) {
-		case FI_CLASS_CQ:
-			cq = container_of(list_item->fid,
-					  struct sock_cq, cq_fid);
-			sock_cq_progress(cq);
-			if (rbused(&cq->cqerr_rb))
-				return 1;
+		switch (wait->type) {
+		case FI_WAIT_FD:
+			sock_wait_reset(wait);
+			if (sock_poll_set_ready(&wait->pset, NULL, 1))
+				return 0;
 			break;
 
-		case FI_CLASS_CNTR:
-			cntr = container_of(list_item->fid,
-					    struct sock_cntr, cntr_fid);
-			sock_cntr_progress(cntr);
+		case FI_WAIT_MUTEX_COND:
+			pthread_mutex_lock(&wait->wobj.mutex_cond.mutex);
+			if (sock_poll_set_ready(&wait->pset, NULL, 1)) {
+				pthread_mutex_unlock(&wait->wobj.mutex_cond.mutex);
+				return 0;
+			}
 			break;
+
+		default:
+			SOCK_LOG_ERROR("Invalid wait object type\n");
+			return -FI_EINVAL;
 		}
-	}
-	if (timeout > 0) {
-		gettimeofday(&now, NULL);
-		end_ms = (double)now.tv_sec * 1000.0 +
-			(double)now.tv_usec / 1000.0;
-		timeout -=  (end_ms - start_ms);
-		timeout = timeout < 0 ? 0 : timeout;
-	}
 
-	switch (wait->type) {
-	case FI_WAIT_FD:
-		err = fi_poll_fd(wait->wobj.fd[WAIT_READ_FD], timeout);
-		if (err > 0)
-			err = 0;
-		else if (err == 0)
-			err = -FI_ETIMEDOUT;
-		break;
+		poll_timeout = timeout;
+		if (timeout > 0) {
+			now = fi_gettime_ms();
+			poll_timeout = now >= end_ms ? 0 : end_ms - now;
+		}
 
-	case FI_WAIT_MUTEX_COND:
-		err = fi_wait_cond(&wait->wobj.mutex_cond.cond,
-				   &wait->wobj.mutex_cond.mutex, timeout);
-		break;
+		/* manual progress members need to be driven from here */
+		if (wait->pset.num_manual &&
+		    (poll_timeout < 0 || poll_timeout > SOCK_WAIT_PROGRESS_MS))
+			poll_timeout = SOCK_WAIT_PROGRESS_MS;
+
+		if (wait->type == FI_WAIT_FD) {
+			ret = fi_poll_fd(wait->wobj.fd[WAIT_READ_FD],
+					 poll_timeout);
+		} else {
+			ret = poll_timeout ?
+				fi_wait_cond(&wait->wobj.mutex_cond.cond,
+					     &wait->wobj.mutex_cond.mutex,
+					     poll_timeout) : 0;
+			pthread_mutex_unlock(&wait->wobj.mutex_cond.mutex);
+		}
 
-	default:
-		SOCK_LOG_ERROR("Invalid wait object type\n");
-		return -FI_EINVAL;
+		if (ret < 0)
+			return ret;
+
+		if (timeout >= 0 && fi_gettime_ms() >= end_ms)
+			return sock_poll_set_ready(&wait->pset, NULL, 1) ?
+				0 : -FI_ETIMEDOUT;
 	}
-	return err;
 }
 
 void sock_wait_signal(struct fid_wait *wait_fid)
@@ -182,13 +188,19 @@ void sock_wait_signal(struct fid_wait *wait_fid)
 
 	switch (wait->type) {
 	case FI_WAIT_FD:
+		/* one byte is enough until the waiter drains the fd */
+		if (atomic_get(&wait->signaled) ||
+		    atomic_inc(&wait->signaled) != 1)
+			break;
 		ret = write(wait->wobj.fd[WAIT_WRITE_FD], &c, 1);
 		if (ret != 1)
 			SOCK_LOG_ERROR("failed to signal\n");
 		break;
 
 	case FI_WAIT_MUTEX_COND:
-		pthread_cond_signal(&wait->wobj.mutex_cond.cond);
+		pthread_mutex_lock(&wait->wobj.mutex_cond.mutex);
+		pthread_cond_broadcast(&wait->wobj.mutex_cond.cond);
+		pthread_mutex_unlock(&wait->wobj.mutex_cond.mutex);
 		break;
 	default:
 		SOCK_LOG_ERROR("Invalid wait object type\n");
@@ -220,18 +232,10 @@ static int sock_wait_control(struct fid *fid, int command, void *arg)
 
 int sock_wait_close(fid_t fid)
 {
-	struct sock_fid_list *list_item;
-	struct dlist_entry *p, *head;
 	struct sock_wait *wait;
 
 	wait = container_of(fid, struct sock_wait, wait_fid.fid);
-	head = &wait->fid_list;
-
-	for (p = head->next; p != head;) {
-		list_item = container_of(p, struct sock_fid_list, entry);
-		p = p->next;
-		free(list_item);
-	}
+	sock_poll_set_fini(&wait->pset);
 
 	if (wait->type == FI_WAIT_FD) {
 		close(wait->wobj.fd[WAIT_READ_FD]);
@@ -302,7 +306,8 @@ int sock_wait_open(struct fid_fabric *fabric, struct fi_wait_attr *attr,
 	wait->fab = fab;
 	wait->type = wait_obj_type;
 	atomic_inc(&fab->ref);
-	dlist_init(&wait->fid_list);
+	sock_poll_set_init(&wait->pset);
+	atomic_initialize(&wait->signaled, 0);
 
 	*waitset = &wait->wait_fid;
 	return 0;